@@ -10,8 +10,10 @@
 
 #include <string>
 #include "soa.hpp"
+#include "instrumentation.hpp"
 #include <algorithm>
 #include "marketdataservice.hpp"
+#include "sequenceid.hpp"
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
 
@@ -19,6 +21,8 @@ enum Market { BROKERTEC, ESPEED, CME };
 
 /**
  * An execution order that can be placed on an exchange.
+ * The order IDs are compact, only turned into text when the order is printed or encoded,
+ * so that an order is copied along the execution path without any string.
  * Type T is the product type.
  */
 template<typename T>
@@ -28,11 +32,14 @@ class ExecutionOrder
 public:
 
   // ctor for an order
-  ExecutionOrder(const T &_product, PricingSide _side, string _orderId, 
+  ExecutionOrder(const T &_product, PricingSide _side, SequenceId _orderId, 
 	  OrderType _orderType, double _price, double _visibleQuantity, 
-	  double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+	  double _hiddenQuantity, SequenceId _parentOrderId, bool _isChildOrder);
   ExecutionOrder() = default;
 
+  // ctor for a product not executed yet
+  explicit ExecutionOrder(const T &_product);
+
   // Get the product
   const T& GetProduct() const;
 
@@ -40,7 +47,7 @@ public:
   PricingSide GetPricingSide() const;
 
   // Get the order ID
-  const string& GetOrderId() const;
+  SequenceId GetOrderId() const;
 
   // Get the order type on this order
   OrderType GetOrderType() const;
@@ -54,32 +61,39 @@ public:
   // Get the hidden quantity
   long GetHiddenQuantity() const;
 
-  // Get the parent order ID
-  const string& GetParentOrderId() const;
+  // Get the parent order ID, no ID for an order without a parent
+  SequenceId GetParentOrderId() const;
 
   // Is child order?
   bool IsChildOrder() const;
 
   // Print
-  string print();
+  string print() const;
+
+  // Write the order as a binary journal record, return the record length
+  size_t Encode(long long _timestamp, char* _buffer) const;
+
+  // Read an order back from a binary journal record
+  static ExecutionOrder<T> Decode(const char* _buffer);
 
 private:
-  T product;
+  const T* product = nullptr; // owned by the product registry
   PricingSide side;
-  string orderId;
+  SequenceId orderId;
   OrderType orderType;
   double price;
   double visibleQuantity;
   double hiddenQuantity;
-  string parentOrderId;
+  SequenceId parentOrderId;
   bool isChildOrder;
 
+  COPY_COUNTED(ExecutionOrder<T>)
 };
 
 
 template<typename T>
-ExecutionOrder<T>::ExecutionOrder(const T& _product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
-	product(_product)
+ExecutionOrder<T>::ExecutionOrder(const T& _product, PricingSide _side, SequenceId _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, SequenceId _parentOrderId, bool _isChildOrder) :
+	product(&_product)
 {
 	side = _side;
 	orderId = _orderId;
@@ -91,10 +105,16 @@ ExecutionOrder<T>::ExecutionOrder(const T& _product, PricingSide _side, string _
 	isChildOrder = _isChildOrder;
 }
 
+template<typename T>
+ExecutionOrder<T>::ExecutionOrder(const T& _product) :
+	ExecutionOrder(_product, BID, SequenceId(), MARKET, 0, 0, 0, SequenceId(), false)
+{
+}
+
 template<typename T>
 const T& ExecutionOrder<T>::GetProduct() const
 {
-	return product;
+	return *product;
 }
 
 template<typename T>
@@ -104,7 +124,7 @@ PricingSide ExecutionOrder<T>::GetPricingSide() const
 }
 
 template<typename T>
-const string& ExecutionOrder<T>::GetOrderId() const
+SequenceId ExecutionOrder<T>::GetOrderId() const
 {
 	return orderId;
 }
@@ -134,7 +154,7 @@ long ExecutionOrder<T>::GetHiddenQuantity() const
 }
 
 template<typename T>
-const string& ExecutionOrder<T>::GetParentOrderId() const
+SequenceId ExecutionOrder<T>::GetParentOrderId() const
 {
 	return parentOrderId;
 }
@@ -146,10 +166,10 @@ bool ExecutionOrder<T>::IsChildOrder() const
 }
 
 template<typename T>
-string ExecutionOrder<T>::print()
+string ExecutionOrder<T>::print() const
 {
 	stringstream output;
-	output << "CUSIP: " << product.GetProductId() << ", ";
+	output << "CUSIP: " << product->GetProductId() << ", ";
 
 	string orderSide;
 	if (side == BID) orderSide = "bid";
@@ -174,6 +194,35 @@ string ExecutionOrder<T>::print()
 	return output.str();
 }
 
+template<typename T>
+size_t ExecutionOrder<T>::Encode(long long _timestamp, char* _buffer) const
+{
+	ExecutionRecord record;
+	SetJournalHeader(record.header, EXECUTION_RECORD, sizeof(record), product->GetProductIndex(), _timestamp);
+	record.side = static_cast<uint8_t>(side);
+	record.orderType = static_cast<uint8_t>(orderType);
+	record.isChildOrder = isChildOrder;
+	record.reserved = 0;
+	record.price = static_cast<int32_t>(ToTicks(price));
+	record.visibleQuantity = static_cast<int64_t>(visibleQuantity);
+	record.hiddenQuantity = static_cast<int64_t>(hiddenQuantity);
+	char id[SEQUENCE_ID_MAX_LENGTH];
+	SetJournalId(record.orderId, string_view(id, orderId.Format(id)));
+	SetJournalId(record.parentOrderId, string_view(id, parentOrderId.Format(id)));
+	return PutJournalRecord(record, _buffer);
+}
+
+template<typename T>
+ExecutionOrder<T> ExecutionOrder<T>::Decode(const char* _buffer)
+{
+	ExecutionRecord record = GetJournalRecord<ExecutionRecord>(_buffer);
+	const T& product = ProductRegistry<T>::GetInstance().Get(static_cast<size_t>(record.header.productIndex));
+	return ExecutionOrder<T>(product, static_cast<PricingSide>(record.side), SequenceId::Parse(GetJournalId(record.orderId)),
+		static_cast<OrderType>(record.orderType), ToPrice(record.price),
+		static_cast<double>(record.visibleQuantity), static_cast<double>(record.hiddenQuantity),
+		SequenceId::Parse(GetJournalId(record.parentOrderId)), record.isChildOrder != 0);
+}
+
 
 template<typename T>
 class MarketDataListener;
@@ -184,7 +233,7 @@ class MarketDataListener;
  * Type T is the product type.
  */
 template<typename T>
-class AlgoExecutionService : public Service<string,ExecutionOrder <T> >
+class AlgoExecutionService : public Service<string_view, ExecutionOrder <T> >
 {
 
 public:
@@ -196,10 +245,10 @@ public:
 	~AlgoExecutionService();
 
 	// Get data on our service given a key
-	ExecutionOrder<T>& GetData(string _key);
+	ExecutionOrder<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(ExecutionOrder<T>& _data);
+	void OnMessage(ExecutionOrder<T>&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<ExecutionOrder<T>>* _listener);
@@ -210,26 +259,33 @@ public:
 	// Get the listener of the service
 	MarketDataListener<T>* GetListener();
 
-	// Execute an order on a market
-	void AlgoExecuteOrder(OrderStacks<T>& _orderBook);
+	// Execute an order on a market, return the stored order or nullptr if the spread is too wide
+	const ExecutionOrder<T>* AlgoExecuteOrder(const OrderStacks<T>& _orderBook);
+
+	// Number the orders of a shard from 0, so that the services of a sharded system do not share IDs
+	void SetOrderIdShard(uint32_t _shard);
+
+	// Save the side of the next order of each product and the ID of the next order to a checkpoint
+	void SaveCheckpoint(ostream& _checkpoint) const;
+
+	// Restore the sides and the ID of the next order of a checkpoint
+	void RestoreCheckpoint(istream& _checkpoint);
 
 private:
-	unordered_map<string, ExecutionOrder<T>> algoExecutions;
+	ProductStore<ExecutionOrder<T>> algoExecutions;
 	vector<ServiceListener<ExecutionOrder<T>>*> listeners;
 	MarketDataListener<T>* listener;
-	bool isBuy; // help to decide whether buy or sell  
-	int numID; // help to generate unique ID for trades
+	vector<char> sellsNext; // by product index, whether the next order of the product sells rather than buys
+	SequenceIdGenerator orderIds; // help to generate unique ID for trades
 };
 
 
 template<typename T>
 AlgoExecutionService<T>::AlgoExecutionService()
 {
-	algoExecutions = unordered_map<string, ExecutionOrder<T>>();
+	algoExecutions = ProductStore<ExecutionOrder<T>>();
 	listeners = vector<ServiceListener<ExecutionOrder<T>>*>();
 	listener = new MarketDataListener<T>(this);
-	isBuy = true;
-	numID = 0;
 }
 
 template<typename T>
@@ -238,18 +294,19 @@ AlgoExecutionService<T>::~AlgoExecutionService() {
 }
 
 template<typename T>
-ExecutionOrder<T>& AlgoExecutionService<T>::GetData(string _key)
+ExecutionOrder<T>& AlgoExecutionService<T>::GetData(string_view _key)
 {
-	return algoExecutions[_key];
+	return algoExecutions.Get(_key);
 }
 
 template<typename T>
-void AlgoExecutionService<T>::OnMessage(ExecutionOrder<T>& _data)
+void AlgoExecutionService<T>::OnMessage(ExecutionOrder<T>&& _data)
 {
-	algoExecutions[_data.GetProduct().GetProductId()] = _data;
+	INSTRUMENT_HOP("AlgoExecutionService::OnMessage");
+	const ExecutionOrder<T>& algoExecution = algoExecutions.Put(move(_data));
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(algoExecution); });
 }
 
 template<typename T>
@@ -271,15 +328,14 @@ MarketDataListener<T>* AlgoExecutionService<T>::GetListener()
 }
 
 template<typename T>
-void AlgoExecutionService<T>::AlgoExecuteOrder(OrderStacks<T>& orderBook)
+const ExecutionOrder<T>* AlgoExecutionService<T>::AlgoExecuteOrder(const OrderStacks<T>& orderBook)
 {
-	T product = orderBook.GetProduct();
-	string productId = product.GetProductId();
-	string orderId = to_string(numID);
+	INSTRUMENT_HOP("AlgoExecutionService::AlgoExecuteOrder");
+	const T& product = orderBook.GetProduct();
 
-	BidOffer bidOffer = orderBook.GetBestBidOffer();
-	Order bestBid = bidOffer.GetBidOrder();
-	Order bestOffer = bidOffer.GetOfferOrder();
+	const BidOffer& bidOffer = orderBook.GetBestBidOffer();
+	const Order& bestBid = bidOffer.GetBidOrder();
+	const Order& bestOffer = bidOffer.GetOfferOrder();
 	double bidPrice = bestBid.GetPrice();
 	long bidQuantity = bestBid.GetQuantity();
 	double offerPrice = bestOffer.GetPrice();
@@ -289,19 +345,54 @@ void AlgoExecutionService<T>::AlgoExecuteOrder(OrderStacks<T>& orderBook)
 	{ 
 		// We all use Market orders
 		// We are crossing the spread, so BID will get offer price.
-		if (isBuy) {
-			ExecutionOrder<T> algoExecution(product, BID, orderId, MARKET, offerPrice, offerQuantity, 0, "NA", false);
-			this->OnMessage(algoExecution);
+		// the next order ID is only taken for an order
+		SequenceId orderId = orderIds.Next();
+		size_t index = product.GetProductIndex();
+		if (index >= sellsNext.size()) sellsNext.resize(index + 1, false);
+		if (!sellsNext[index]) {
+			ExecutionOrder<T> algoExecution(product, BID, orderId, MARKET, offerPrice, offerQuantity, 0, SequenceId(), false);
+			this->OnMessage(move(algoExecution));
 		}
 		else {
-			ExecutionOrder<T> algoExecution(product, OFFER, orderId, MARKET, bidPrice, bidQuantity, 0, "NA", false);
-			this->OnMessage(algoExecution);
+			ExecutionOrder<T> algoExecution(product, OFFER, orderId, MARKET, bidPrice, bidQuantity, 0, SequenceId(), false);
+			this->OnMessage(move(algoExecution));
 		}
 
-		isBuy = !isBuy; // alternate the direction of order
-		numID++; // change the next order ID
+		// alternate the direction of the orders of each product, so that the orders of a product
+		// are the same whichever other products share the service, as in a sharded system
+		sellsNext[index] = !sellsNext[index];
 
+		return &algoExecutions[index];
 	}
+	return nullptr;
+}
+
+
+template<typename T>
+void AlgoExecutionService<T>::SetOrderIdShard(uint32_t _shard)
+{
+	orderIds.Reset(_shard, 0);
+}
+
+template<typename T>
+void AlgoExecutionService<T>::SaveCheckpoint(ostream& _checkpoint) const
+{
+	WriteCheckpointValue(_checkpoint, static_cast<uint64_t>(sellsNext.size()));
+	_checkpoint.write(sellsNext.data(), sellsNext.size());
+	WriteCheckpointValue(_checkpoint, orderIds.Peek().GetValue());
+}
+
+template<typename T>
+void AlgoExecutionService<T>::RestoreCheckpoint(istream& _checkpoint)
+{
+	uint64_t products = 0;
+	uint64_t nextId = 0;
+	ReadCheckpointValue(_checkpoint, products);
+	sellsNext.assign(products, false);
+	_checkpoint.read(sellsNext.data(), sellsNext.size());
+	ReadCheckpointValue(_checkpoint, nextId);
+	SequenceId next = SequenceId::FromValue(nextId);
+	orderIds.Reset(next.GetShard(), next.GetSequence());
 }
 
 
@@ -323,13 +414,13 @@ public:
 	MarketDataListener(AlgoExecutionService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(OrderStacks<T>& _data);
+	void ProcessAdd(const OrderStacks<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(OrderStacks<T>& _data);
+	void ProcessRemove(const OrderStacks<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(OrderStacks<T>& _data);
+	void ProcessUpdate(const OrderStacks<T>& _data);
 
 };
 
@@ -340,15 +431,58 @@ MarketDataListener<T>::MarketDataListener(AlgoExecutionService<T>* _service)
 }
 
 template<typename T>
-void MarketDataListener<T>::ProcessAdd(OrderStacks<T>& _data)
+void MarketDataListener<T>::ProcessAdd(const OrderStacks<T>& _data)
 {
 	service->AlgoExecuteOrder(_data);
 }
 
 template<typename T>
-void MarketDataListener<T>::ProcessRemove(OrderStacks<T>& _data) {}
+void MarketDataListener<T>::ProcessRemove(const OrderStacks<T>& _data) {}
 
 template<typename T>
-void MarketDataListener<T>::ProcessUpdate(OrderStacks<T>& _data) {}
+void MarketDataListener<T>::ProcessUpdate(const OrderStacks<T>& _data)
+{
+	// level-by-level updates change the top of the book as well
+	service->AlgoExecuteOrder(_data);
+}
+
+
+/**
+* Stage of a Pipeline running the algo on the order books, wired at compile time in place of MarketDataListener.
+* Type T is the product type.
+*/
+template<typename T>
+class AlgoExecutionStage
+{
+
+private:
+
+	AlgoExecutionService<T>* service;
+
+public:
+
+	typedef OrderStacks<T> InputType;
+
+	// Ctor
+	AlgoExecutionStage(AlgoExecutionService<T>* _service);
+
+	// Run the algo on a book, passing on the order it executes
+	template<typename Next>
+	void Process(const OrderStacks<T>& _data, Next& _next);
+
+};
+
+template<typename T>
+AlgoExecutionStage<T>::AlgoExecutionStage(AlgoExecutionService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+template<typename Next>
+void AlgoExecutionStage<T>::Process(const OrderStacks<T>& _data, Next& _next)
+{
+	if (const ExecutionOrder<T>* algoExecution = service->AlgoExecuteOrder(_data)) _next(*algoExecution);
+}
 
 #endif
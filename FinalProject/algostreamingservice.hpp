@@ -10,6 +10,7 @@
 #define ALGO_STREAMING_SERVICE_HPP
 
 #include "soa.hpp"
+#include "instrumentation.hpp"
 #include "pricingservice.hpp"
 
 
@@ -39,7 +40,7 @@ public:
   long GetHiddenQuantity() const;
 
   // Print the stream
-  string print();
+  string print() const;
 
 private:
   double price;
@@ -78,7 +79,7 @@ PricingSide PriceStreamOrder::GetSide() const
 	return side;
 }
 
-string PriceStreamOrder::print()
+string PriceStreamOrder::print() const
 {
 	stringstream output;
 
@@ -110,6 +111,9 @@ public:
 	PriceStream() = default;
 	~PriceStream() {};
 
+	// ctor for a product not streamed yet
+	explicit PriceStream(const T& _product);
+
 	// Get the product
 	const T& GetProduct() const;
 
@@ -120,10 +124,16 @@ public:
 	const PriceStreamOrder& GetOfferOrder() const;
 
 	// Print PriceStream
-	string print();
+	string print() const;
+
+	// Write the stream as a binary journal record, return the record length
+	size_t Encode(long long _timestamp, char* _buffer) const;
+
+	// Read a stream back from a binary journal record
+	static PriceStream<T> Decode(const char* _buffer);
 
 private:
-	T product;
+	const T* product = nullptr; // owned by the product registry
 	// PriceStream has two members representing the bid and offer.
 	PriceStreamOrder bidOrder;
 	PriceStreamOrder offerOrder;
@@ -132,14 +142,20 @@ private:
 
 template<typename T>
 PriceStream<T>::PriceStream(const T& _product, const PriceStreamOrder& _bidOrder, const PriceStreamOrder& _offerOrder) :
-	product(_product), bidOrder(_bidOrder), offerOrder(_offerOrder)
+	product(&_product), bidOrder(_bidOrder), offerOrder(_offerOrder)
+{
+}
+
+template<typename T>
+PriceStream<T>::PriceStream(const T& _product) :
+	PriceStream(_product, PriceStreamOrder(0, 0, 0, BID), PriceStreamOrder(0, 0, 0, OFFER))
 {
 }
 
 template<typename T>
 const T& PriceStream<T>::GetProduct() const
 {
-	return product;
+	return *product;
 }
 
 template<typename T>
@@ -155,16 +171,40 @@ const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const
 }
 
 template<typename T>
-string PriceStream<T>::print()
+string PriceStream<T>::print() const
 {
 	stringstream output;
-	output << "CUSIP: " << product.GetProductId() << ", ";
+	output << "CUSIP: " << product->GetProductId() << ", ";
 	output << bidOrder.print() << ",";
 	output << offerOrder.print() << ",";
 
 	return output.str();
 }
 
+template<typename T>
+size_t PriceStream<T>::Encode(long long _timestamp, char* _buffer) const
+{
+	StreamingRecord record;
+	SetJournalHeader(record.header, STREAMING_RECORD, sizeof(record), product->GetProductIndex(), _timestamp);
+	record.bidPrice = static_cast<int32_t>(ToTicks(bidOrder.GetPrice()));
+	record.bidVisibleQuantity = static_cast<int32_t>(bidOrder.GetVisibleQuantity());
+	record.bidHiddenQuantity = static_cast<int32_t>(bidOrder.GetHiddenQuantity());
+	record.offerPrice = static_cast<int32_t>(ToTicks(offerOrder.GetPrice()));
+	record.offerVisibleQuantity = static_cast<int32_t>(offerOrder.GetVisibleQuantity());
+	record.offerHiddenQuantity = static_cast<int32_t>(offerOrder.GetHiddenQuantity());
+	return PutJournalRecord(record, _buffer);
+}
+
+template<typename T>
+PriceStream<T> PriceStream<T>::Decode(const char* _buffer)
+{
+	StreamingRecord record = GetJournalRecord<StreamingRecord>(_buffer);
+	const T& product = ProductRegistry<T>::GetInstance().Get(static_cast<size_t>(record.header.productIndex));
+	PriceStreamOrder bid(ToPrice(record.bidPrice), record.bidVisibleQuantity, record.bidHiddenQuantity, BID);
+	PriceStreamOrder offer(ToPrice(record.offerPrice), record.offerVisibleQuantity, record.offerHiddenQuantity, OFFER);
+	return PriceStream<T>(product, bid, offer);
+}
+
 
 template<typename T>
 class PricingListener;
@@ -175,7 +215,7 @@ class PricingListener;
  * Type T is the product type.
  */
 template<typename T>
-class AlgoStreamingService : public Service<string,PriceStream <T> >
+class AlgoStreamingService : public Service<string_view, PriceStream <T> >
 {
 
 public:
@@ -187,10 +227,10 @@ public:
   ~AlgoStreamingService();
 
   // Get data on our service given a key
-  PriceStream<T>& GetData(string _key);
+  PriceStream<T>& GetData(string_view _key);
 
   // The callback that a Connector should invoke for any new or updated data
-  void OnMessage(PriceStream<T>& _data);
+  void OnMessage(PriceStream<T>&& _data);
 
   // Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
   void AddListener(ServiceListener<PriceStream<T>>* _listener);
@@ -201,11 +241,11 @@ public:
   // Get the listener of the service
   ServiceListener<Price<T>>* GetListener();
 
-  // send the bid/offer prices to the BondStreamingService
-  void PublishPrice(Price<T>& _price);
+  // send the bid/offer prices to the BondStreamingService, return the stored stream
+  const PriceStream<T>& PublishPrice(const Price<T>& _price);
 
 private:
-	unordered_map<string, PriceStream<T>> algoStreams;
+	ProductStore<PriceStream<T>> algoStreams;
 	vector<ServiceListener<PriceStream<T>>*> listeners;
 	PricingListener<T>* listener;
 	bool isFirst; // alternate visible sizes
@@ -215,7 +255,7 @@ private:
 template<typename T>
 AlgoStreamingService<T>::AlgoStreamingService()
 {
-	algoStreams = unordered_map<string, PriceStream<T>>();
+	algoStreams = ProductStore<PriceStream<T>>();
 	listeners = vector<ServiceListener<PriceStream<T>>*>();
 	listener = new PricingListener<T>(this);
 	isFirst = false;
@@ -227,18 +267,19 @@ AlgoStreamingService<T>::~AlgoStreamingService() {
 }
 
 template<typename T>
-PriceStream<T>& AlgoStreamingService<T>::GetData(string _key)
+PriceStream<T>& AlgoStreamingService<T>::GetData(string_view _key)
 {
-	return algoStreams[_key];
+	return algoStreams.Get(_key);
 }
 
 template<typename T>
-void AlgoStreamingService<T>::OnMessage(PriceStream<T>& _data)
+void AlgoStreamingService<T>::OnMessage(PriceStream<T>&& _data)
 {
-	algoStreams[_data.GetProduct().GetProductId()] = _data;
+	INSTRUMENT_HOP("AlgoStreamingService::OnMessage");
+	const PriceStream<T>& algoStream = algoStreams.Put(move(_data));
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(algoStream); });
 }
 
 template<typename T>
@@ -260,10 +301,10 @@ ServiceListener<Price<T>>* AlgoStreamingService<T>::GetListener()
 }
 
 template<typename T>
-void AlgoStreamingService<T>::PublishPrice(Price<T>& price)
+const PriceStream<T>& AlgoStreamingService<T>::PublishPrice(const Price<T>& price)
 {
-	T product = price.GetProduct();
-	string productId = product.GetProductId();
+	INSTRUMENT_HOP("AlgoStreamingService::PublishPrice");
+	const T& product = price.GetProduct();
 
 	
 	double bidPrice = price.GetMid() - price.GetBidOfferSpread() / 2.0;
@@ -277,7 +318,8 @@ void AlgoStreamingService<T>::PublishPrice(Price<T>& price)
 	PriceStream<T> algoStream(product, bidStreamOrder, offerStreamOrder);
 
 	// update event and pass to all the listeners
-	this->OnMessage(algoStream);
+	this->OnMessage(move(algoStream));
+	return algoStreams[product.GetProductIndex()];
 }
 
 
@@ -300,13 +342,13 @@ public:
 	~PricingListener() {};
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(Price<T>& _data);
+	void ProcessAdd(const Price<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(Price<T>& _data);
+	void ProcessRemove(const Price<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(Price<T>& _data);
+	void ProcessUpdate(const Price<T>& _data);
 
 };
 
@@ -317,15 +359,54 @@ PricingListener<T>::PricingListener(AlgoStreamingService<T>* _service)
 }
 
 template<typename T>
-void PricingListener<T>::ProcessAdd(Price<T>& _data)
+void PricingListener<T>::ProcessAdd(const Price<T>& _data)
 {
 	service->PublishPrice(_data);
 }
 
 template<typename T>
-void PricingListener<T>::ProcessRemove(Price<T>& _data) {}
+void PricingListener<T>::ProcessRemove(const Price<T>& _data) {}
+
+template<typename T>
+void PricingListener<T>::ProcessUpdate(const Price<T>& _data) {}
+
+
+/**
+* Stage of a Pipeline running the algo on the prices, wired at compile time in place of PricingListener.
+* Type T is the product type.
+*/
+template<typename T>
+class AlgoStreamingStage
+{
+
+private:
+
+	AlgoStreamingService<T>* service;
+
+public:
+
+	typedef Price<T> InputType;
+
+	// Ctor
+	AlgoStreamingStage(AlgoStreamingService<T>* _service);
+
+	// Make a stream from a price, passing on the stream
+	template<typename Next>
+	void Process(const Price<T>& _data, Next& _next);
+
+};
+
+template<typename T>
+AlgoStreamingStage<T>::AlgoStreamingStage(AlgoStreamingService<T>* _service)
+{
+	service = _service;
+}
 
 template<typename T>
-void PricingListener<T>::ProcessUpdate(Price<T>& _data) {}
+template<typename Next>
+void AlgoStreamingStage<T>::Process(const Price<T>& _data, Next& _next)
+{
+	_next(service->PublishPrice(_data));
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+/**
+ * asynclistener.hpp
+ * Defines the adapter running a ServiceListener on its own thread behind a
+ * single-producer/single-consumer ring buffer.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef ASYNC_LISTENER_HPP
+#define ASYNC_LISTENER_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "soa.hpp"
+#include "instrumentation.hpp"
+
+using namespace std;
+
+// What to do when the ring of an asynchronous listener is full
+// BLOCK: wait for the listener thread to make room
+// DROP: discard the event
+// CONFLATE: keep only the latest event of each product until there is room
+enum BackPressurePolicy { BLOCK, DROP, CONFLATE };
+
+// Kind of listener callback carried by an event
+enum ListenerEventType { ADD_EVENT, REMOVE_EVENT, UPDATE_EVENT };
+
+/**
+ * Event waiting in the ring of an asynchronous listener.
+ * Type V is the data type of the listener.
+ */
+template<typename V>
+struct ListenerEvent
+{
+	ListenerEventType type = ADD_EVENT;
+	V data;
+#ifdef INSTRUMENT_PIPELINE
+	Timestamp origin = 0; // of the producer thread, restored on the listener thread
+#endif
+};
+
+/**
+ * Listener forwarding the callbacks it receives to another listener on a thread of its own.
+ * Events are copied into a ring of pre-allocated slots by the thread calling the
+ * callbacks, which must be a single thread, and delivered in order by the listener thread.
+ * With the CONFLATE policy, events that do not fit are parked per product on the
+ * producer side and delivered with the next callback that finds room, or on Flush().
+ * The wrapped listener is not owned.
+ * Type V is the data type of the listener, it gives its product through GetProduct().
+ */
+template<typename V>
+class AsyncListener : public ServiceListener<V>
+{
+
+public:
+
+	// ctor starting the listener thread, the capacity is rounded up to a power of two
+	AsyncListener(ServiceListener<V>* _listener, BackPressurePolicy _policy = BLOCK, size_t _capacity = 1 << 14);
+
+	// dtor delivering every pending event and stopping the listener thread
+	~AsyncListener();
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(const V& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(const V& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(const V& _data);
+
+	// Wait until every event received so far has been delivered, called from the producer thread
+	void Flush();
+
+	// Get the number of events delivered to the wrapped listener
+	unsigned long long GetDeliveredCount() const;
+
+	// Get the number of events discarded with the DROP policy
+	unsigned long long GetDroppedCount() const;
+
+	// Get the number of events replaced by a later event of the same product with the CONFLATE policy
+	unsigned long long GetConflatedCount() const;
+
+	// Get the number of times the producer had to wait with the BLOCK policy
+	unsigned long long GetBlockedCount() const;
+
+private:
+
+	AsyncListener(const AsyncListener&) = delete;
+	AsyncListener& operator=(const AsyncListener&) = delete;
+
+	// Accept an event from the producer according to the policy
+	void Enqueue(ListenerEventType _type, const V& _data);
+
+	// Copy an event into the ring, false if it is full
+	bool TryPush(ListenerEventType _type, const V& _data);
+
+	// Move the parked events into the ring while there is room, return false if some are left
+	bool PushConflated();
+
+	// Loop of the listener thread
+	void Run();
+
+	ServiceListener<V>* listener;
+	BackPressurePolicy policy;
+	vector<ListenerEvent<V>> ring;
+	size_t mask;
+
+	// written by the producer only
+	alignas(64) atomic<size_t> head;
+	size_t cachedTail;
+	vector<ListenerEvent<V>> conflated; // parked events by product index
+	vector<char> isConflated;
+	size_t conflatedCount; // number of parked events
+	unsigned long long droppedEvents;
+	unsigned long long conflatedEvents;
+	unsigned long long blockedEvents;
+
+	// written by the listener thread only
+	alignas(64) atomic<size_t> tail;
+
+	atomic<bool> stopping;
+	thread worker;
+
+};
+
+template<typename V>
+AsyncListener<V>::AsyncListener(ServiceListener<V>* _listener, BackPressurePolicy _policy, size_t _capacity)
+{
+	size_t capacity = 2;
+	while (capacity < _capacity) capacity <<= 1;
+
+	listener = _listener;
+	policy = _policy;
+	ring = vector<ListenerEvent<V>>(capacity);
+	mask = capacity - 1;
+	head = 0;
+	cachedTail = 0;
+	conflatedCount = 0;
+	droppedEvents = 0;
+	conflatedEvents = 0;
+	blockedEvents = 0;
+	tail = 0;
+	stopping = false;
+	worker = thread(&AsyncListener<V>::Run, this);
+}
+
+template<typename V>
+AsyncListener<V>::~AsyncListener()
+{
+	Flush();
+	stopping = true;
+	worker.join();
+}
+
+template<typename V>
+void AsyncListener<V>::ProcessAdd(const V& _data)
+{
+	Enqueue(ADD_EVENT, _data);
+}
+
+template<typename V>
+void AsyncListener<V>::ProcessRemove(const V& _data)
+{
+	Enqueue(REMOVE_EVENT, _data);
+}
+
+template<typename V>
+void AsyncListener<V>::ProcessUpdate(const V& _data)
+{
+	Enqueue(UPDATE_EVENT, _data);
+}
+
+template<typename V>
+void AsyncListener<V>::Flush()
+{
+	while (!PushConflated()) this_thread::yield();
+	while (tail.load(memory_order_acquire) != head.load(memory_order_relaxed)) this_thread::yield();
+}
+
+template<typename V>
+unsigned long long AsyncListener<V>::GetDeliveredCount() const
+{
+	return tail.load(memory_order_acquire);
+}
+
+template<typename V>
+unsigned long long AsyncListener<V>::GetDroppedCount() const
+{
+	return droppedEvents;
+}
+
+template<typename V>
+unsigned long long AsyncListener<V>::GetConflatedCount() const
+{
+	return conflatedEvents;
+}
+
+template<typename V>
+unsigned long long AsyncListener<V>::GetBlockedCount() const
+{
+	return blockedEvents;
+}
+
+template<typename V>
+void AsyncListener<V>::Enqueue(ListenerEventType _type, const V& _data)
+{
+	if (policy == CONFLATE)
+	{
+		// older parked events go first, then this one
+		if (PushConflated() && TryPush(_type, _data)) return;
+
+		size_t index = _data.GetProduct().GetProductIndex();
+		if (index >= conflated.size())
+		{
+			conflated.resize(index + 1);
+			isConflated.resize(index + 1, false);
+		}
+		if (isConflated[index]) conflatedEvents++;
+		else conflatedCount++;
+		conflated[index].type = _type;
+		conflated[index].data = _data;
+		isConflated[index] = true;
+		return;
+	}
+
+	if (TryPush(_type, _data)) return;
+
+	if (policy == DROP)
+	{
+		droppedEvents++;
+		return;
+	}
+
+	blockedEvents++;
+	while (!TryPush(_type, _data)) this_thread::yield();
+}
+
+template<typename V>
+bool AsyncListener<V>::TryPush(ListenerEventType _type, const V& _data)
+{
+	size_t position = head.load(memory_order_relaxed);
+	if (position - cachedTail > mask)
+	{
+		// only read the consumer index when the ring looks full
+		cachedTail = tail.load(memory_order_acquire);
+		if (position - cachedTail > mask) return false;
+	}
+
+	ListenerEvent<V>& event = ring[position & mask];
+	event.type = _type;
+	event.data = _data;
+	INSTRUMENT_SAVE_ORIGIN(event.origin); // a parked event takes the origin of the event pushing it
+	head.store(position + 1, memory_order_release);
+	return true;
+}
+
+template<typename V>
+bool AsyncListener<V>::PushConflated()
+{
+	if (conflatedCount == 0) return true;
+
+	for (size_t i = 0; i < conflated.size(); i++)
+	{
+		if (!isConflated[i]) continue;
+		if (!TryPush(conflated[i].type, conflated[i].data)) return false;
+		isConflated[i] = false;
+		conflatedCount--;
+	}
+	return true;
+}
+
+template<typename V>
+void AsyncListener<V>::Run()
+{
+	int idle = 0;
+	while (true)
+	{
+		size_t position = tail.load(memory_order_relaxed);
+		if (position == head.load(memory_order_acquire))
+		{
+			if (stopping.load(memory_order_acquire) && position == head.load(memory_order_acquire)) return;
+
+			// spin briefly, then give the core away
+			if (++idle < 64) continue;
+			if (idle < 128) this_thread::yield();
+			else this_thread::sleep_for(chrono::microseconds(50));
+			continue;
+		}
+		idle = 0;
+
+		ListenerEvent<V>& event = ring[position & mask];
+		INSTRUMENT_RESTORE_ORIGIN(event.origin);
+		switch (event.type) {
+		case ADD_EVENT: listener->ProcessAdd(event.data); break;
+		case REMOVE_EVENT: listener->ProcessRemove(event.data); break;
+		case UPDATE_EVENT: listener->ProcessUpdate(event.data); break;
+		}
+		tail.store(position + 1, memory_order_release);
+	}
+}
+
+#endif
@@ -0,0 +1,930 @@
+/*
+*Benchmarking the trading system components
+*build with -DCOUNT_COPIES to count the copies of the data types on the market data to risk path
+*run as "benchmark [filter] [--repetitions N] [--output file]" from the folder of the input files:
+*the groups whose name contains the filter are run N times and the median of each measure
+*is written to the output file, benchmark_results.csv by default, to compare across commits;
+*the Scaling and Sharding groups replay generated feeds of more products and are only run when named
+*@author: Chaofan Shen
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <new>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <filesystem>
+#include <queue>
+#include <random>
+#include "soa.hpp"
+#include "products.hpp"
+#include "pricingservice.hpp"
+#include "tradebookingservice.hpp"
+#include "inquiryservice.hpp"
+#include "marketdataservice.hpp"
+#include "algostreamingservice.hpp"
+#include "algoexecutionservice.hpp"
+#include "bondexecutionservice.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "bondanalytics.hpp"
+#include "pipeline.hpp"
+#include "tradingsystem.hpp"
+#include "feedgenerator.hpp"
+#include "shardedtradingsystem.hpp"
+#include "sorting.hpp"
+#include "daryheap.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+
+// Number of heap allocations made by the program, counted by the replaced operator new
+atomic<unsigned long long> allocationCount(0);
+
+void* operator new(size_t _size)
+{
+	allocationCount.fetch_add(1, memory_order_relaxed);
+	if (void* memory = malloc(_size > 0 ? _size : 1)) return memory;
+	throw bad_alloc();
+}
+
+void operator delete(void* _memory) noexcept
+{
+	free(_memory);
+}
+
+void operator delete(void* _memory, size_t) noexcept
+{
+	free(_memory);
+}
+
+// Reference implementations of the price conversions before the tick codec
+double LegacyGetNormalPrice(string price)
+{
+	string fp, sp, tp;
+	auto pos_dot = price.find("-");
+	fp = price.substr(0, pos_dot);
+	sp = price.substr(pos_dot + 1, 2);
+	tp = price.substr(pos_dot + 3, 1);
+	if (tp == "+") tp = "4";
+
+	return stod(fp) + stod(sp) / 32.0 + stod(tp) / 256.0;
+}
+
+string LegacyGetQuotePrice(double price)
+{
+	int fp = floor(price);
+	int tp = floor((price - fp) * 256.0);
+	int sp = floor(tp / 8.0);
+	tp = tp % 8;
+
+	string tmp_sp = to_string(sp), tmp_tp = to_string(tp);
+	if (sp < 10) tmp_sp = "0" + tmp_sp;
+	if (tp == 4) tmp_tp = "+";
+	return to_string(fp) + "-" + tmp_sp + tmp_tp;
+}
+
+// Time of each run of a measure over its items
+struct BenchmarkResult
+{
+	string name;
+	long items;
+	vector<double> seconds;
+};
+
+// Results by measure, in the order they are first measured
+vector<BenchmarkResult> benchmarkResults;
+
+// Print the rate of a measure and record it
+void Report(const string& name, long items, double seconds)
+{
+	cout << name << ": " << items << " items in " << seconds << " s, "
+		<< static_cast<long>(items / seconds) << " items/s" << endl;
+
+	auto found = find_if(benchmarkResults.begin(), benchmarkResults.end(), [&](const BenchmarkResult& r) { return r.name == name; });
+	if (found == benchmarkResults.end())
+	{
+		benchmarkResults.push_back(BenchmarkResult{ name, items, {} });
+		found = benchmarkResults.end() - 1;
+	}
+	found->seconds.push_back(seconds);
+}
+
+// Write the median of the runs of each measure as CSV, one line per measure in a fixed order
+void WriteResults(ostream& output)
+{
+	output << "benchmark,items,runs,median_seconds,items_per_second" << endl;
+	for (BenchmarkResult& result : benchmarkResults)
+	{
+		vector<double> seconds = result.seconds;
+		sort(seconds.begin(), seconds.end());
+		size_t middle = seconds.size() / 2;
+		double median = seconds.size() % 2 == 1 ? seconds[middle] : (seconds[middle - 1] + seconds[middle]) / 2;
+
+		// the names are quoted, some have commas
+		output << "\"" << result.name << "\"," << result.items << "," << seconds.size() << "," << median << ","
+			<< static_cast<long>(result.items / median) << endl;
+	}
+}
+
+// Time a body run over a number of items and print the rate
+template<typename F>
+void Measure(const string& name, long items, F body)
+{
+	auto start = chrono::steady_clock::now();
+	body();
+	auto stop = chrono::steady_clock::now();
+
+	Report(name, items, chrono::duration<double>(stop - start).count());
+}
+
+// Read a whole file, so that the benchmarks of its parsers do not time the disk
+string ReadFile(const string& fileName)
+{
+	ifstream file(fileName);
+	return string((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+}
+
+// Count the lines of a text
+long CountLines(const string& text)
+{
+	return static_cast<long>(count(text.begin(), text.end(), '\n'));
+}
+
+// Compare the tick codec to the legacy conversions over every price
+// of the prices.txt range (99 to 101 and the 1/128 to 1/64 spreads)
+void BenchmarkPriceCodec()
+{
+	vector<string> quotes;
+	vector<double> prices;
+	for (PriceTicks t = 99 * TICKS_PER_POINT; t <= 101 * TICKS_PER_POINT; t++)
+	{
+		quotes.push_back(FormatTicks(t));
+		prices.push_back(ToPrice(t));
+	}
+	for (PriceTicks t = 2; t <= 4; t++)
+	{
+		quotes.push_back(FormatTicks(t));
+		prices.push_back(ToPrice(t));
+	}
+
+	// both implementations must agree on every price
+	long mismatches = 0;
+	for (size_t i = 0; i < quotes.size(); i++)
+	{
+		if (LegacyGetNormalPrice(quotes[i]) != GetNormalPrice(quotes[i])) mismatches++;
+		if (LegacyGetQuotePrice(prices[i]) != GetQuotePrice(prices[i])) mismatches++;
+	}
+	cout << "Price codec: " << quotes.size() << " prices, " << mismatches << " mismatches" << endl;
+
+	const int rounds = 2000;
+	long items = rounds * static_cast<long>(quotes.size());
+	double sum = 0;
+	size_t length = 0;
+
+	Measure("LegacyGetNormalPrice", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& q : quotes) sum += LegacyGetNormalPrice(q);
+	});
+	Measure("GetNormalPrice", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& q : quotes) sum += GetNormalPrice(q);
+	});
+	Measure("LegacyGetQuotePrice", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto p : prices) length += LegacyGetQuotePrice(p).size();
+	});
+	Measure("GetQuotePrice", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto p : prices) length += GetQuotePrice(p).size();
+	});
+	Measure("FormatTicks (buffer)", items, [&]() {
+		char buffer[MAX_FRACTIONAL_LENGTH];
+		for (int r = 0; r < rounds; r++)
+			for (auto p : prices) length += FormatTicks(ToTicks(p), buffer) - buffer;
+	});
+
+	// keep the results alive
+	cout << "(checksum " << sum << ", " << length << ")" << endl;
+}
+
+// Look up the products by CUSIP, as each connector does for each line
+void BenchmarkProductLookup()
+{
+	const ProductRegistry<Bond>& registry = GetBondRegistry();
+	vector<string> cusips;
+	for (size_t i = 0; i < registry.Size(); i++) cusips.push_back(registry.Get(i).GetProductId());
+
+	const long rounds = 1000000;
+	size_t total = 0;
+	Measure("GetProductType", rounds * static_cast<long>(cusips.size()), [&]() {
+		for (long r = 0; r < rounds; r++)
+			for (auto& cusip : cusips) total += GetProductType(cusip).GetProductIndex();
+	});
+
+	// keep the results alive
+	cout << "(checksum " << total << ")" << endl;
+}
+
+// Replay a file held in memory into a connector of a service without listeners, timing its line parser
+template<typename S>
+void BenchmarkConnectorSubscribe(const string& name, const string& fileName)
+{
+	string text = ReadFile(fileName);
+	S service;
+
+	istringstream data(text);
+	Measure(name, CountLines(text), [&]() { service.GetConnector()->Subscribe(data); });
+}
+
+// Compare the fixed-depth aggregated book to the vector-based aggregation
+void BenchmarkAggregateMarketData(const string& fileName)
+{
+	marketDataService<Bond> marketdataservice;
+	ifstream marketdata(fileName);
+	marketdataservice.GetConnector()->Subscribe(marketdata);
+
+	const int rounds = 200000;
+	const auto& registry = GetBondRegistry();
+	long items = rounds * static_cast<long>(registry.Size());
+	long total = 0;
+
+	Measure("marketDataService::GetBestBidOffer", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (size_t i = 0; i < registry.Size(); i++)
+				total += marketdataservice.GetBestBidOffer(registry.Get(i).GetProductId()).GetBidOrder().GetQuantity();
+	});
+	Measure("marketDataService::AggregateMarketData", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (size_t i = 0; i < registry.Size(); i++)
+				total += marketdataservice.AggregateMarketData(registry.Get(i).GetProductId()).GetBidStack().size();
+	});
+	Measure("marketDataService::GetAggregatedBook", items, [&]() {
+		AggregatedBook<BOOK_DEPTH> book;
+		for (int r = 0; r < rounds; r++)
+			for (size_t i = 0; i < registry.Size(); i++)
+			{
+				marketdataservice.GetAggregatedBook(registry.Get(i).GetProductId(), book);
+				total += book.GetDepth(BID) + book.GetSpread() + book.GetTotalQuantity(OFFER);
+			}
+	});
+
+	// keep the results alive
+	cout << "(checksum " << total << ")" << endl;
+}
+
+// Compare the timestamp facility to the boost local time stamping it replaces
+void BenchmarkTimestamps()
+{
+	const long rounds = 1000000;
+	size_t length = 0;
+
+	Measure("microsec_clock::local_time + to_simple_string", rounds, [&]() {
+		for (long r = 0; r < rounds; r++)
+			length += boost::posix_time::to_simple_string(boost::posix_time::microsec_clock::local_time()).size();
+	});
+	Measure("GetTimestamp", rounds, [&]() {
+		for (long r = 0; r < rounds; r++) length += GetTimestamp() & 1;
+	});
+	Measure("GetTimestamp + FormatTimestamp (buffer)", rounds, [&]() {
+		char stamp[MAX_TIMESTAMP_LENGTH];
+		for (long r = 0; r < rounds; r++) length += FormatTimestamp(GetTimestamp(), stamp) - stamp;
+	});
+
+	// keep the results alive
+	cout << "(checksum " << length << ", sample " << FormatTimestamp(GetTimestamp()) << ")" << endl;
+}
+
+// Compare the cost and size of a persisted record in text and in the binary journal
+template<typename V>
+void BenchmarkPersistRecord(const string& name, V data)
+{
+	const long rounds = 1000000;
+	size_t textBytes = 0, binaryBytes = 0;
+
+	Measure(name + " text", rounds, [&]() {
+		char stamp[MAX_TIMESTAMP_LENGTH];
+		for (long r = 0; r < rounds; r++)
+		{
+			string line(stamp, FormatTimestamp(GetTimestamp(), stamp));
+			textBytes += (line + ", " + data.print() + "\n").size();
+		}
+	});
+	Measure(name + " binary", rounds, [&]() {
+		char record[JOURNAL_MAX_RECORD];
+		for (long r = 0; r < rounds; r++)
+		{
+			binaryBytes += data.Encode(ToEpochNanoseconds(GetTimestamp()), record);
+		}
+	});
+	cout << name << ": " << textBytes / rounds << " bytes as text, " << binaryBytes / rounds << " bytes as binary" << endl;
+}
+
+// Count the heap allocations per message of a connector and its service over a whole file.
+// The file is read once beforehand, so that the books and stores are already built and
+// only the steady state is counted, and the fixed cost of a Subscribe() call, such as its
+// read buffer, is measured on an empty input and reported apart.
+template<typename S>
+void BenchmarkConnectorAllocations(const string& name, const string& fileName)
+{
+	S service;
+	string text = ReadFile(fileName);
+	long lines = CountLines(text);
+
+	istringstream warmup(text);
+	service.GetConnector()->Subscribe(warmup);
+
+	istringstream empty;
+	unsigned long long before = allocationCount.load();
+	service.GetConnector()->Subscribe(empty);
+	unsigned long long fixed = allocationCount.load() - before;
+
+	istringstream data(text);
+	before = allocationCount.load();
+	service.GetConnector()->Subscribe(data);
+	unsigned long long allocations = allocationCount.load() - before - fixed;
+
+	cout << name << ": " << allocations << " allocations over " << lines << " lines, "
+		<< (lines > 0 ? allocations * 1000000.0 / lines : 0) << " per 1M messages, plus "
+		<< fixed << " per Subscribe()" << endl;
+}
+
+// Book trades cycling through the products and books into positions risked by a risk service,
+// one trade at a time and in batches notifying once for each product
+void BenchmarkPositions()
+{
+	const ProductRegistry<Bond>& registry = GetBondRegistry();
+	const char* books[] = { "TRSY1", "TRSY2", "TRSY3" };
+	vector<Trade<Bond>> trades;
+	for (int i = 0; i < 70000; i++)
+	{
+		trades.push_back(Trade<Bond>(registry.Get(static_cast<size_t>(i % registry.Size())), "TRADE-" + to_string(i), 99.0,
+			books[(i / 7) % 3], 1000000 * (i % 5 + 1), (i % 2 == 0) ? BUY : SELL));
+	}
+
+	const int rounds = 10;
+	const size_t batch = 64;
+	long items = rounds * static_cast<long>(trades.size());
+
+	PositionService<Bond> positionService;
+	RiskService<Bond> riskService;
+	positionService.AddListener(riskService.GetListener());
+	Measure("PositionService::AddTrade", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& trade : trades) positionService.AddTrade(trade);
+	});
+
+	PositionService<Bond> batchPositionService;
+	RiskService<Bond> batchRiskService;
+	batchPositionService.AddListener(batchRiskService.GetListener());
+	Measure("PositionService::AddTrades (64 per batch)", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (size_t i = 0; i < trades.size(); i += batch)
+				batchPositionService.AddTrades(&trades[i], min(batch, trades.size() - i));
+	});
+
+	// both must end with the same positions
+	long mismatches = 0;
+	for (size_t i = 0; i < registry.Size(); i++)
+	{
+		const string& productId = registry.Get(i).GetProductId();
+		if (positionService.GetData(productId).print() != batchPositionService.GetData(productId).print()) mismatches++;
+	}
+	cout << "AddTrades: " << mismatches << " mismatches with AddTrade" << endl;
+
+	// the positions of the trades, risked again on their own
+	vector<Position<Bond>> positions;
+	PositionService<Bond> replayPositionService;
+	for (auto& trade : trades) positions.push_back(replayPositionService.AddTrade(trade));
+	RiskService<Bond> replayRiskService;
+	double pv01 = 0;
+	Measure("RiskService::AddPosition", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& position : positions) pv01 += replayRiskService.AddPosition(position).GetPV01();
+	});
+
+	// keep the results alive
+	cout << "(checksum " << pv01 << ")" << endl;
+}
+
+// Replay prices.txt and marketdata.txt through the listener graph of main, on this thread,
+// the output files being sent to the null device so that the disk is not timed.
+// The historical services still format every record on their threads, which are waited for.
+void BenchmarkTradingSystem(const string& pricesFile, const string& marketDataFile)
+{
+	string prices = ReadFile(pricesFile);
+	string marketData = ReadFile(marketDataFile);
+
+	BufferedFileWriter::SetRedirection(NULL_DEVICE);
+	{
+		TradingSystem tradingSystem;
+		tradingSystem.AddListeners();
+
+		istringstream pricesData(prices);
+		Measure("TradingSystem prices.txt", CountLines(prices), [&]() {
+			tradingSystem.pricingservice.GetConnector()->Subscribe(pricesData);
+			tradingSystem.Flush();
+		});
+		istringstream marketDataData(marketData);
+		Measure("TradingSystem marketdata.txt", CountLines(marketData), [&]() {
+			tradingSystem.marketdataservice.GetConnector()->Subscribe(marketDataData);
+			tradingSystem.Flush();
+		});
+	}
+	BufferedFileWriter::SetRedirection("");
+}
+
+// Universes swept by the Scaling group, by number of products and of updates of each product
+const size_t SCALING_PRODUCTS[] = { 7, 70, 700 };
+const long SCALING_UPDATES[] = { 100, 1000 };
+
+// Register the bonds of the largest universe of the Scaling group, the smaller ones being its
+// first bonds. The sectors and the risk analytics are set up from the registry when first used,
+// so this is done before any group is run
+void RegisterScalingBonds()
+{
+	FeedGenerator generator(*max_element(begin(SCALING_PRODUCTS), end(SCALING_PRODUCTS)), 0);
+	stringstream products;
+	generator.WriteProducts(products);
+	LoadBondReference(GetBondRegistry(), products);
+}
+
+// Replay generated prices and market data of growing universes through the trading system,
+// as BenchmarkTradingSystem() does for the shipped files, to see how the rates scale with the
+// number of products. The feeds are generated in memory and go through the products in turn.
+void BenchmarkScaling()
+{
+	BufferedFileWriter::SetRedirection(NULL_DEVICE);
+	for (size_t products : SCALING_PRODUCTS)
+	{
+		for (long updates : SCALING_UPDATES)
+		{
+			FeedGenerator generator(products, updates);
+			string universe = "Scaling " + to_string(products) + " products x " + to_string(updates) + " updates";
+
+			TradingSystem tradingSystem;
+			tradingSystem.AddListeners();
+
+			stringstream prices;
+			generator.WritePrices(prices);
+			Measure(universe + " prices", static_cast<long>(products) * updates, [&]() {
+				tradingSystem.pricingservice.GetConnector()->Subscribe(prices);
+				tradingSystem.Flush();
+			});
+
+			stringstream marketData;
+			generator.WriteMarketData(marketData);
+			Measure(universe + " marketdata", static_cast<long>(products) * updates * 2 * FEED_BOOK_LEVELS, [&]() {
+				tradingSystem.marketdataservice.GetConnector()->Subscribe(marketData);
+				tradingSystem.Flush();
+			});
+		}
+	}
+	BufferedFileWriter::SetRedirection("");
+}
+
+// Numbers of shards swept by the Sharding group
+const int SHARDING_SHARDS[] = { 1, 2, 4, 8 };
+
+// Run generated feeds of the largest universe of the Scaling group through the sharded trading
+// system, each number of shards on files written to a temporary folder, to see how the rate
+// grows with the workers: it can only grow as far as the machine has cores
+void BenchmarkSharding()
+{
+	size_t products = *max_element(begin(SCALING_PRODUCTS), end(SCALING_PRODUCTS));
+	long updates = 100;
+	string folder = (filesystem::temp_directory_path() / "tradingsystem_sharding").string();
+	filesystem::create_directories(folder);
+	FeedGenerator(products, updates).Generate(folder, false);
+
+	long lines = static_cast<long>(products) * (updates * (1 + 2 * FEED_BOOK_LEVELS) + FEED_TRADES_PER_PRODUCT
+		+ FEED_INQUIRIES_PER_PRODUCT);
+	cout << "(" << thread::hardware_concurrency() << " cores)" << endl;
+	BufferedFileWriter::SetRedirection(NULL_DEVICE);
+	for (int shards : SHARDING_SHARDS)
+	{
+		ShardedTradingSystem tradingSystem(shards);
+		tradingSystem.AddListeners();
+		tradingSystem.AddFeed("prices", folder + "/prices.txt", &TradingSystem::pricingservice);
+		tradingSystem.AddFeed("trades", folder + "/trades.txt", &TradingSystem::tradeBookingService);
+		tradingSystem.AddFeed("inquiries", folder + "/inquiries.txt", &TradingSystem::inquiryService, 1);
+		tradingSystem.AddFeed("market data", folder + "/marketdata.txt", &TradingSystem::marketdataservice, 0, 10);
+		Measure("Sharding " + to_string(products) + " products " + to_string(shards) + " shards", lines, [&]() {
+			tradingSystem.Run();
+			tradingSystem.Flush();
+		});
+	}
+	BufferedFileWriter::SetRedirection("");
+	filesystem::remove_all(folder);
+}
+
+// Book trades while a reader thread copies the position snapshots, checking each copy
+// is consistent, its aggregate position being the sum of its books
+void BenchmarkSnapshots()
+{
+	const ProductRegistry<Bond>& registry = GetBondRegistry();
+	const string books[] = { "TRSY1", "TRSY2", "TRSY3" };
+	vector<Trade<Bond>> trades;
+	for (int i = 0; i < 70000; i++)
+	{
+		trades.push_back(Trade<Bond>(registry.Get(static_cast<size_t>(i % registry.Size())), "TRADE-" + to_string(i), 99.0,
+			books[(i / 7) % 3], 1000000 * (i % 5 + 1), (i % 2 == 0) ? BUY : SELL));
+	}
+
+	const int rounds = 10;
+	long items = rounds * static_cast<long>(trades.size());
+
+	PositionService<Bond> positionService;
+	Measure("PositionService::AddTrade with no reader", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& trade : trades) positionService.AddTrade(trade);
+	});
+
+	atomic<bool> writing(true);
+	long reads = 0;
+	long inconsistent = 0;
+	thread reader([&]() {
+		Position<Bond> snapshot;
+		while (writing.load(memory_order_relaxed))
+		{
+			for (size_t i = 0; i < registry.Size(); i++)
+			{
+				if (!positionService.GetSnapshot(registry.Get(i).GetProductId(), snapshot)) continue;
+				reads++;
+				long sum = snapshot.GetPosition(books[0]) + snapshot.GetPosition(books[1]) + snapshot.GetPosition(books[2]);
+				if (sum != snapshot.GetAggregatePosition()) inconsistent++;
+			}
+		}
+	});
+	auto start = chrono::steady_clock::now();
+	Measure("PositionService::AddTrade with a snapshot reader", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& trade : trades) positionService.AddTrade(trade);
+	});
+	writing = false;
+	reader.join();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "PositionService::GetSnapshot: " << reads << " reads in " << seconds << " s, "
+		<< static_cast<long>(reads / seconds) << " reads/s, " << inconsistent << " inconsistent" << endl;
+}
+
+// Compare the batch kernel of the bond analytics with a scalar loop valuing the bonds
+// cash flow by cash flow, repricing a few hundred bonds on every tick
+void BenchmarkInquiries()
+{
+	const ProductRegistry<Bond>& registry = GetBondRegistry();
+	vector<Inquiry<Bond>> inquiries;
+	for (int i = 0; i < 70000; i++)
+	{
+		inquiries.push_back(Inquiry<Bond>("INQUIRY" + to_string(i), registry.Get(static_cast<size_t>(i % registry.Size())),
+			(i % 2 == 0) ? BUY : SELL, 1000000 * (i % 5 + 1), 100.0, RECEIVED));
+	}
+
+	// quoted on the mids of one price per product
+	MidPriceQuoter<Bond> quoter;
+	for (size_t i = 0; i < registry.Size(); i++) quoter.ProcessAdd(Price<Bond>(registry.Get(i), 99.5 + i / 8.0, 1.0 / 128));
+
+	long items = static_cast<long>(inquiries.size());
+	InquiryService<Bond> singleService;
+	singleService.SetQuoter(&quoter);
+	vector<Inquiry<Bond>> single = inquiries;
+	Measure("InquiryService::OnMessage one at a time", items, [&]() {
+		for (auto& inquiry : single) singleService.OnMessage(move(inquiry));
+	});
+
+	InquiryService<Bond> burstService;
+	burstService.SetQuoter(&quoter);
+	vector<Inquiry<Bond>> bursts = inquiries;
+	Measure("InquiryService::OnMessages in bursts of 64", items, [&]() {
+		for (size_t i = 0; i < bursts.size(); i += INQUIRY_BATCH_SIZE)
+			burstService.OnMessages(bursts.data() + i, min(INQUIRY_BATCH_SIZE, bursts.size() - i));
+	});
+	burstService.PrintReport(cout);
+}
+
+void BenchmarkBondAnalytics()
+{
+	const ProductRegistry<Bond>& registry = GetBondRegistry();
+	vector<Bond> bonds;
+	for (int i = 0; i < 100; i++)
+		for (size_t j = 0; j < registry.Size(); j++) bonds.push_back(registry.Get(j));
+
+	const int ticks = 2000;
+	long items = ticks * static_cast<long>(bonds.size());
+	auto priceOf = [](int _tick, size_t _bond) { return 99.0 + ((_tick * 7 + _bond) % 64) / 32.0; };
+
+	BondAnalytics analytics(bonds);
+	double batchSum = 0;
+	Measure("BondAnalytics::Compute (" + to_string(bonds.size()) + " bonds per tick)", items, [&]() {
+		for (int t = 0; t < ticks; t++)
+		{
+			for (size_t i = 0; i < bonds.size(); i++) analytics.SetPrice(i, priceOf(t, i));
+			analytics.Compute();
+			batchSum += analytics.GetPV01(t % bonds.size());
+		}
+	});
+
+	double scalarSum = 0;
+	vector<BondRisk> risks(bonds.size());
+	Measure("ComputeBondRisk scalar loop (" + to_string(bonds.size()) + " bonds per tick)", items, [&]() {
+		for (int t = 0; t < ticks; t++)
+		{
+			for (size_t i = 0; i < bonds.size(); i++) risks[i] = ComputeBondRisk(bonds[i], priceOf(t, i));
+			scalarSum += risks[t % bonds.size()].pv01;
+		}
+	});
+
+	// both must end with the same risk
+	double maxDifference = 0;
+	for (size_t i = 0; i < bonds.size(); i++)
+		maxDifference = max(maxDifference, fabs(analytics.GetPV01(i) - risks[i].pv01));
+	cout << "BondAnalytics: largest PV01 difference " << maxDifference << " with the scalar loop, checksums "
+		<< batchSum << " and " << scalarSum << endl;
+}
+
+// Compare the introsort and its parallel mode with std::sort, the d-ary heaps with
+// std::priority_queue, and the top-N query of the heap with partial_sort_copy
+void BenchmarkSorting()
+{
+	const size_t count = 1000000;
+	mt19937_64 generator(42);
+	uniform_real_distribution<double> distribution(99.0, 101.0);
+	vector<double> values(count);
+	for (double& value : values) value = distribution(generator);
+
+	// each sort starts again from the same values, the copy is not timed
+	vector<double> sorted;
+	auto timeSort = [&](const string& name, auto sortRange) {
+		sorted = values;
+		Measure(name, static_cast<long>(count), [&]() { sortRange(sorted.begin(), sorted.end()); });
+		if (!is_sorted(sorted.begin(), sorted.end())) cout << name << ": not sorted" << endl;
+	};
+	timeSort("std::sort (1M doubles)", [](auto _first, auto _last) { sort(_first, _last); });
+	timeSort("IntroSort (1M doubles)", [](auto _first, auto _last) { IntroSort(_first, _last); });
+	timeSort("ParallelSort (1M doubles, " + to_string(max(1u, thread::hardware_concurrency())) + " threads)",
+		[](auto _first, auto _last) { ParallelSort(_first, _last, less<double>()); });
+
+	// the order books of the feeds, five levels a side in reverse order of price
+	const int books = 200000;
+	vector<Order> bids, offers;
+	for (int k = FEED_BOOK_LEVELS; k > 0; k--)
+	{
+		bids.push_back(Order(99.0 + k / 256.0, 1000000L * k, BID));
+		offers.push_back(Order(101.0 - k / 256.0, 1000000L * k, OFFER));
+	}
+	const Bond& bond = GetBondRegistry().Get(0);
+	double best = 0;
+	Measure("OrderStacks sorted construction (5 levels a side)", books, [&]() {
+		for (int b = 0; b < books; b++) best += OrderStacks<Bond>(bond, bids, offers).GetBestBidOffer().GetBidOrder().GetPrice();
+	});
+
+	// push every value then pop them all
+	long heapItems = 2 * static_cast<long>(count);
+	double sum = 0;
+	Measure("std::priority_queue push and pop (1M doubles)", heapItems, [&]() {
+		priority_queue<double> heap;
+		for (double value : values) heap.push(value);
+		for (; !heap.empty(); heap.pop()) sum += heap.top();
+	});
+	auto timeHeap = [&](const string& name, auto heap) {
+		heap.Reserve(count);
+		Measure(name, heapItems, [&]() {
+			for (double value : values) heap.Push(value);
+			for (; !heap.Empty(); heap.Pop()) sum += heap.Top();
+		});
+	};
+	timeHeap("DaryHeap<2> push and pop (1M doubles)", DaryHeap<double, 2>());
+	timeHeap("DaryHeap<4> push and pop (1M doubles)", DaryHeap<double, 4>());
+	timeHeap("DaryHeap<8> push and pop (1M doubles)", DaryHeap<double, 8>());
+
+	// the deadlines of timers pushed back as they are rescheduled, the earliest on top
+	const size_t timers = 10000;
+	DaryHeap<double, 4, greater<double>> deadlines;
+	vector<size_t> handles;
+	for (size_t i = 0; i < timers; i++) handles.push_back(deadlines.Push(values[i]));
+	Measure("DaryHeap<4>::Update of 10000 timers", static_cast<long>(count), [&]() {
+		for (size_t i = 0; i < count; i++) deadlines.Update(handles[i % timers], values[i] + i / 1000.0);
+	});
+	sum += deadlines.Top();
+
+	// the ten largest values, as for the largest positions or the widest spreads
+	const size_t n = 10;
+	vector<double> top;
+	Measure("GetTopN (10 of 1M doubles)", static_cast<long>(count), [&]() {
+		top = GetTopN(values.begin(), values.end(), n, less<double>());
+	});
+	vector<double> reference(n);
+	Measure("partial_sort_copy (10 of 1M doubles)", static_cast<long>(count), [&]() {
+		partial_sort_copy(values.begin(), values.end(), reference.begin(), reference.end(), greater<double>());
+	});
+	cout << "GetTopN: " << (top == reference ? "same" : "different") << " values as partial_sort_copy (checksum "
+		<< sum + best << ")" << endl;
+}
+
+// Listener keeping a copy of every book the market data service publishes
+class OrderBookRecorder : public ServiceListener<OrderStacks<Bond>>
+{
+
+public:
+
+	vector<OrderStacks<Bond>> books;
+
+	void ProcessAdd(const OrderStacks<Bond>& _data) { books.push_back(_data); }
+	void ProcessRemove(const OrderStacks<Bond>& _data) {}
+	void ProcessUpdate(const OrderStacks<Bond>& _data) {}
+
+};
+
+// Compare passing the books down to the risk service through the listeners added at run time
+// and through a Pipeline wired at compile time, without any other listener on the way
+void BenchmarkDispatch(const string& fileName)
+{
+	marketDataService<Bond> marketdataservice;
+	OrderBookRecorder recorder;
+	marketdataservice.AddListener(&recorder);
+	ifstream marketdata(fileName);
+	marketdataservice.GetConnector()->Subscribe(marketdata);
+
+	const int rounds = 10;
+	long items = rounds * static_cast<long>(recorder.books.size());
+
+	AlgoExecutionService<Bond> algoExecutionService;
+	ExecutionService<Bond> executionService;
+	TradeBookingService<Bond> tradeBookingService;
+	PositionService<Bond> positionService;
+	RiskService<Bond> riskService;
+	algoExecutionService.AddListener(executionService.GetListener());
+	executionService.AddListener(tradeBookingService.GetListener());
+	tradeBookingService.AddListener(positionService.GetListener());
+	positionService.AddListener(riskService.GetListener());
+	ServiceListener<OrderStacks<Bond>>* listener = algoExecutionService.GetListener();
+	Measure("Book to risk, listeners", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& book : recorder.books) listener->ProcessAdd(book);
+	});
+
+	AlgoExecutionService<Bond> staticAlgoExecutionService;
+	ExecutionService<Bond> staticExecutionService;
+	TradeBookingService<Bond> staticTradeBookingService;
+	PositionService<Bond> staticPositionService;
+	RiskService<Bond> staticRiskService;
+	Pipeline pipeline{ AlgoExecutionStage<Bond>(&staticAlgoExecutionService), ExecutionStage<Bond>(&staticExecutionService),
+		TradeBookingStage<Bond>(&staticTradeBookingService), PositionStage<Bond>(&staticPositionService),
+		RiskStage<Bond>(&staticRiskService) };
+	Measure("Book to risk, pipeline", items, [&]() {
+		for (int r = 0; r < rounds; r++)
+			for (auto& book : recorder.books) pipeline.Push(book);
+	});
+
+	// both wirings must reach the same positions and risk
+	long mismatches = 0;
+	for (auto& book : recorder.books)
+	{
+		const string& productId = book.GetProduct().GetProductId();
+		if (positionService.GetData(productId).print() != staticPositionService.GetData(productId).print()) mismatches++;
+		if (riskService.GetData(productId).print() != staticRiskService.GetData(productId).print()) mismatches++;
+	}
+	cout << "Book to risk: " << mismatches << " mismatches between the listeners and the pipeline" << endl;
+}
+
+#ifdef COUNT_COPIES
+
+// Print the copies of a data type per event and start counting again
+template<typename V>
+void PrintCopies(const string& name, long events)
+{
+	unsigned long long copies = CopyCounter<V>::GetCopyCount();
+	cout << "  " << name << ": " << copies << " copies, " << static_cast<double>(copies) / events << " per update" << endl;
+	CopyCounter<V>::ResetCopyCount();
+}
+
+// Count the copies of each data type per market data update, through the algo execution,
+// execution, trade booking and position services down to the risk service
+void BenchmarkMarketDataToRiskCopies(const string& fileName)
+{
+	marketDataService<Bond> marketdataservice;
+	AlgoExecutionService<Bond> algoExecutionService;
+	ExecutionService<Bond> executionService;
+	TradeBookingService<Bond> tradeBookingService;
+	PositionService<Bond> positionService;
+	RiskService<Bond> riskService;
+	marketdataservice.AddListener(algoExecutionService.GetListener());
+	algoExecutionService.AddListener(executionService.GetListener());
+	executionService.AddListener(tradeBookingService.GetListener());
+	tradeBookingService.AddListener(positionService.GetListener());
+	positionService.AddListener(riskService.GetListener());
+
+	// count from a clean start, after the products are registered
+	GetBondRegistry();
+	CopyCounter<Bond>::ResetCopyCount();
+	CopyCounter<Order>::ResetCopyCount();
+	CopyCounter<BidOffer>::ResetCopyCount();
+	CopyCounter<OrderStacks<Bond>>::ResetCopyCount();
+	CopyCounter<ExecutionOrder<Bond>>::ResetCopyCount();
+	CopyCounter<Trade<Bond>>::ResetCopyCount();
+	CopyCounter<Position<Bond>>::ResetCopyCount();
+	CopyCounter<PV01<Bond>>::ResetCopyCount();
+
+	ifstream marketdata(fileName);
+	marketdataservice.GetConnector()->Subscribe(marketdata);
+
+	ifstream count(fileName);
+	long updates = 0;
+	string line;
+	while (getline(count, line)) updates++;
+	updates /= 10;
+
+	cout << "Copies on the market data to risk path over " << updates << " updates:" << endl;
+	PrintCopies<Bond>("Bond", updates);
+	PrintCopies<Order>("Order", updates);
+	PrintCopies<BidOffer>("BidOffer", updates);
+	PrintCopies<OrderStacks<Bond>>("OrderStacks", updates);
+	PrintCopies<ExecutionOrder<Bond>>("ExecutionOrder", updates);
+	PrintCopies<Trade<Bond>>("Trade", updates);
+	PrintCopies<Position<Bond>>("Position", updates);
+	PrintCopies<PV01<Bond>>("PV01", updates);
+}
+
+#endif
+
+int main(int argc, char* argv[])
+{
+	string filter;
+	int repetitions = 1;
+	string outputFile = "benchmark_results.csv";
+	for (int i = 1; i < argc; i++)
+	{
+		string argument = argv[i];
+		if (argument == "--repetitions" && i + 1 < argc) repetitions = max(1, atoi(argv[++i]));
+		else if (argument == "--output" && i + 1 < argc) outputFile = argv[++i];
+		else filter = argument;
+	}
+
+	// the groups of measures, in the order they are run
+	const Bond& bond = GetProductType("91282CFX4");
+	vector<pair<string, function<void()>>> groups = {
+		{ "PriceCodec", []() { BenchmarkPriceCodec(); } },
+		{ "ProductLookup", []() { BenchmarkProductLookup(); } },
+		{ "ConnectorSubscribe", []() {
+			BenchmarkConnectorSubscribe<pricingService<Bond>>("pricingConnector::Subscribe", "prices.txt");
+			BenchmarkConnectorSubscribe<TradeBookingService<Bond>>("TradeBookingConnector::Subscribe", "trades.txt");
+			BenchmarkConnectorSubscribe<InquiryService<Bond>>("InquiryConnector::Subscribe", "inquiries.txt");
+			BenchmarkConnectorSubscribe<marketDataService<Bond>>("marketDataConnector::Subscribe", "marketdata.txt"); } },
+		{ "AggregateMarketData", []() { BenchmarkAggregateMarketData("marketdata.txt"); } },
+		{ "Timestamps", []() { BenchmarkTimestamps(); } },
+		{ "PersistRecord", [&]() {
+			BenchmarkPersistRecord("PriceStream", PriceStream<Bond>(bond,
+				PriceStreamOrder(99.99609375, 1000000, 2000000, BID), PriceStreamOrder(100.00390625, 1000000, 2000000, OFFER)));
+			BenchmarkPersistRecord("ExecutionOrder", ExecutionOrder<Bond>(bond, BID, SequenceId(1234), MARKET, 99.99609375,
+				10000000, 0, SequenceId(), false)); } },
+		{ "ConnectorAllocations", []() {
+			BenchmarkConnectorAllocations<pricingService<Bond>>("pricingConnector allocations", "prices.txt");
+			BenchmarkConnectorAllocations<TradeBookingService<Bond>>("TradeBookingConnector allocations", "trades.txt");
+			BenchmarkConnectorAllocations<InquiryService<Bond>>("InquiryConnector allocations", "inquiries.txt");
+			BenchmarkConnectorAllocations<marketDataService<Bond>>("marketDataConnector allocations", "marketdata.txt"); } },
+		{ "Dispatch", []() { BenchmarkDispatch("marketdata.txt"); } },
+		{ "Positions", []() { BenchmarkPositions(); } },
+		{ "Snapshots", []() { BenchmarkSnapshots(); } },
+		{ "Inquiries", []() { BenchmarkInquiries(); } },
+		{ "BondAnalytics", []() { BenchmarkBondAnalytics(); } },
+		{ "Sorting", []() { BenchmarkSorting(); } },
+		{ "TradingSystem", []() { BenchmarkTradingSystem("prices.txt", "marketdata.txt"); } },
+#ifdef COUNT_COPIES
+		{ "MarketDataToRiskCopies", []() { BenchmarkMarketDataToRiskCopies("marketdata.txt"); } },
+#endif
+	};
+
+	// the groups run only when the filter names them, as they register more bonds
+	vector<pair<string, function<void()>>> namedGroups = {
+		{ "Scaling", []() { BenchmarkScaling(); } },
+		{ "Sharding", []() { BenchmarkSharding(); } },
+	};
+	bool isNamed = any_of(namedGroups.begin(), namedGroups.end(), [&](const auto& group) {
+		return !filter.empty() && group.first.find(filter) != string::npos; });
+	if (isNamed) RegisterScalingBonds();
+
+	cout << "Start benchmarking trading system." << endl;
+	for (int r = 0; r < repetitions; r++)
+	{
+		for (auto& group : groups)
+		{
+			if (group.first.find(filter) == string::npos) continue;
+			group.second();
+		}
+		for (auto& group : namedGroups)
+		{
+			if (filter.empty() || group.first.find(filter) == string::npos) continue;
+			group.second();
+		}
+	}
+
+	ofstream output(outputFile);
+	WriteResults(output);
+	cout << benchmarkResults.size() << " measures written to " << outputFile << endl;
+	return 0;
+}
@@ -0,0 +1,277 @@
+/**
+ * bondanalytics.hpp
+ * Defines the bond analytics computing yield, duration and PV01 from price.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef BOND_ANALYTICS_HPP
+#define BOND_ANALYTICS_HPP
+
+#include <cmath>
+#include <vector>
+#include "products.hpp"
+#include "productregistry.hpp"
+
+using namespace std;
+
+// Settlement date the bonds are valued for, the prices of the feeds are of this date
+const date ANALYTICS_SETTLEMENT_DATE(2022, Dec, 23);
+
+// Number of Newton steps solving a yield, enough from the yield of the last price
+const int YIELD_NEWTON_STEPS = 6;
+
+// Change of yield of a PV01, one basis point
+const double BASIS_POINT = 0.0001;
+
+/**
+ * Coupons left of a semiannual bond on a settlement date.
+ */
+struct BondSchedule
+{
+	int coupons; // coupons left, the last one paid with the principal
+	double fraction; // fraction of the coupon period to the next coupon
+	double couponPayment; // each coupon on 100 face value
+	double accrued; // accrued interest on 100 face value
+};
+
+/**
+ * Yield and risk of a bond on 100 face value.
+ */
+struct BondRisk
+{
+	double yield; // semiannual yield to maturity
+	double modifiedDuration;
+	double pv01; // change of the dirty price for one basis point of yield
+};
+
+// Get the coupons left of a bond on a settlement date, coupon dates stepping back from the maturity
+BondSchedule GetBondSchedule(const Bond& _bond, const date& _settlement);
+
+// Compute the yield and risk of a bond from its clean price, cash flow by cash flow
+BondRisk ComputeBondRisk(const Bond& _bond, double _price, const date& _settlement = ANALYTICS_SETTLEMENT_DATE);
+
+/**
+ * Analytics of all the registered bonds, held as a structure of arrays, one array per
+ * field indexed by product index.
+ * The price of a bond on its yield is summed in closed form, the cashflows being a
+ * geometric series, so a bond takes the same few steps whatever its maturity and
+ * Compute() is one loop over the arrays without branches, which the compiler can
+ * turn into SIMD code (build with -O3 -ffast-math for the vector exp and log).
+ * Each yield is solved from the yield of the last price, so a change of price
+ * converges in a fixed number of Newton steps.
+ */
+class BondAnalytics
+{
+
+public:
+
+	// ctor for the analytics of the bonds of a registry, at par until they are priced
+	BondAnalytics(const ProductRegistry<Bond>& _bonds, const date& _settlement = ANALYTICS_SETTLEMENT_DATE);
+
+	// ctor for the analytics of a list of bonds, indexed by their position in the list
+	BondAnalytics(const vector<Bond>& _bonds, const date& _settlement = ANALYTICS_SETTLEMENT_DATE);
+
+	// Set the clean price of the bond of a product index
+	void SetPrice(size_t _index, double _price);
+
+	// Get the clean price of the bond of a product index
+	double GetPrice(size_t _index) const;
+
+	// Compute the yield, duration and PV01 of all the bonds from their prices
+	void Compute();
+
+	// Compute the yield, duration and PV01 of the bonds of product index _begin up to _end
+	void Compute(size_t _begin, size_t _end);
+
+	// Get the yield of the bond of a product index
+	double GetYield(size_t _index) const;
+
+	// Get the modified duration of the bond of a product index
+	double GetModifiedDuration(size_t _index) const;
+
+	// Get the PV01 of the bond of a product index
+	double GetPV01(size_t _index) const;
+
+	// Get the number of bonds
+	size_t Size() const;
+
+private:
+
+	// Price a bond and the derivative of its price on a yield, on 100 face value
+	static void PriceOnYield(double _coupon, double _periods, double _fraction, double _yield, double& _price, double& _slope);
+
+	// Add a bond at par
+	void Add(const Bond& _bond, const date& _settlement);
+
+	vector<double> coupons; // coupon payment per period
+	vector<double> periods; // coupons left
+	vector<double> fractions; // of the period to the next coupon
+	vector<double> accrued;
+	vector<double> prices; // clean
+	vector<double> yields;
+	vector<double> durations;
+	vector<double> pv01s;
+
+};
+
+BondSchedule GetBondSchedule(const Bond& _bond, const date& _settlement)
+{
+	date next = _bond.GetMaturityDate();
+	int coupons = 1;
+	while (next - months(6) > _settlement)
+	{
+		next = next - months(6);
+		coupons++;
+	}
+	date previous = next - months(6);
+
+	BondSchedule schedule;
+	schedule.coupons = coupons;
+	schedule.fraction = double((next - _settlement).days()) / double((next - previous).days());
+	schedule.couponPayment = 100.0 * _bond.GetCoupon() / 2;
+	schedule.accrued = schedule.couponPayment * (1 - schedule.fraction);
+	return schedule;
+}
+
+BondRisk ComputeBondRisk(const Bond& _bond, double _price, const date& _settlement)
+{
+	BondSchedule schedule = GetBondSchedule(_bond, _settlement);
+	double dirty = _price + schedule.accrued;
+
+	double yield = _bond.GetCoupon();
+	double price = 0;
+	double slope = 0;
+	for (int step = 0; step < 50; step++)
+	{
+		// price and its derivative on the yield, discounting each cash flow
+		price = 0;
+		slope = 0;
+		double base = 1 + yield / 2;
+		for (int k = 1; k <= schedule.coupons; k++)
+		{
+			double t = schedule.fraction + k - 1;
+			double cashflow = schedule.couponPayment + (k == schedule.coupons ? 100.0 : 0.0);
+			double discounted = cashflow / pow(base, t);
+			price += discounted;
+			slope -= discounted * t / base / 2;
+		}
+
+		double change = (price - dirty) / slope;
+		yield -= change;
+		if (fabs(change) < 1e-12) break;
+	}
+
+	BondRisk risk;
+	risk.yield = yield;
+	risk.modifiedDuration = -slope / price;
+	risk.pv01 = -slope * BASIS_POINT;
+	return risk;
+}
+
+BondAnalytics::BondAnalytics(const ProductRegistry<Bond>& _bonds, const date& _settlement)
+{
+	for (size_t i = 0; i < _bonds.Size(); i++) Add(_bonds.Get(i), _settlement);
+	Compute();
+}
+
+BondAnalytics::BondAnalytics(const vector<Bond>& _bonds, const date& _settlement)
+{
+	for (const Bond& bond : _bonds) Add(bond, _settlement);
+	Compute();
+}
+
+void BondAnalytics::Add(const Bond& _bond, const date& _settlement)
+{
+	BondSchedule schedule = GetBondSchedule(_bond, _settlement);
+	coupons.push_back(schedule.couponPayment);
+	periods.push_back(schedule.coupons);
+	fractions.push_back(schedule.fraction);
+	accrued.push_back(schedule.accrued);
+	prices.push_back(100);
+	yields.push_back(_bond.GetCoupon());
+	durations.push_back(0);
+	pv01s.push_back(0);
+}
+
+void BondAnalytics::SetPrice(size_t _index, double _price)
+{
+	prices[_index] = _price;
+}
+
+double BondAnalytics::GetPrice(size_t _index) const
+{
+	return prices[_index];
+}
+
+void BondAnalytics::Compute()
+{
+	Compute(0, prices.size());
+}
+
+void BondAnalytics::Compute(size_t _begin, size_t _end)
+{
+	const double* __restrict c = coupons.data();
+	const double* __restrict n = periods.data();
+	const double* __restrict f = fractions.data();
+	const double* __restrict a = accrued.data();
+	const double* __restrict p = prices.data();
+	double* __restrict y = yields.data();
+	double* __restrict d = durations.data();
+	double* __restrict r = pv01s.data();
+
+	// each step runs over all the bonds, so that the inner loop has no branches
+	for (int step = 0; step < YIELD_NEWTON_STEPS; step++)
+	{
+		for (size_t i = _begin; i < _end; i++)
+		{
+			double price, slope;
+			PriceOnYield(c[i], n[i], f[i], y[i], price, slope);
+			y[i] -= (price - p[i] - a[i]) / slope;
+		}
+	}
+	for (size_t i = _begin; i < _end; i++)
+	{
+		double price, slope;
+		PriceOnYield(c[i], n[i], f[i], y[i], price, slope);
+		d[i] = -slope / price;
+		r[i] = -slope * BASIS_POINT;
+	}
+}
+
+inline void BondAnalytics::PriceOnYield(double _coupon, double _periods, double _fraction, double _yield, double& _price, double& _slope)
+{
+	// with v = 1 / (1 + y / 2), the dirty price is
+	// v^f * (c * (1 - v^n) / (1 - v) + 100 * v^(n - 1))
+	double v = 1 / (1 + _yield / 2);
+	double logV = log(v);
+	double vf = exp(_fraction * logV);
+	double vn = exp(_periods * logV);
+	double annuity = (1 - vn) / (1 - v);
+	double annuitySlope = (annuity - _periods * vn / v) / (1 - v);
+	double rest = _coupon * annuity + 100 * vn / v;
+	double restSlope = _coupon * annuitySlope + 100 * (_periods - 1) * vn / (v * v);
+	_price = vf * rest;
+	_slope = -(_fraction * _price / v + vf * restSlope) * v * v / 2;
+}
+
+double BondAnalytics::GetYield(size_t _index) const
+{
+	return yields[_index];
+}
+
+double BondAnalytics::GetModifiedDuration(size_t _index) const
+{
+	return durations[_index];
+}
+
+double BondAnalytics::GetPV01(size_t _index) const
+{
+	return pv01s[_index];
+}
+
+size_t BondAnalytics::Size() const
+{
+	return prices.size();
+}
+
+#endif
@@ -8,10 +8,14 @@
 #define EXECUTION_SERVICE_HPP
 
 #include "soa.hpp"
+#include "instrumentation.hpp"
 #include "algoexecutionservice.hpp"
+#include "wireprotocol.hpp"
 
 template<typename T>
 class AlgoExecutionListener;
+template<typename T>
+class ExecutionConnector;
 
 /**
 * Service for executing orders in the Market.
@@ -19,7 +23,7 @@ class AlgoExecutionListener;
 * Type T is the product type.
 */
 template<typename T>
-class ExecutionService : public Service<string, ExecutionOrder<T>>
+class ExecutionService : public Service<string_view, ExecutionOrder<T>>
 {
 
 public:
@@ -31,10 +35,10 @@ public:
 	~ExecutionService();
 
 	// Get data on our service given a key
-	ExecutionOrder<T>& GetData(string _key);
+	ExecutionOrder<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(ExecutionOrder<T>& _data);
+	void OnMessage(ExecutionOrder<T>&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<ExecutionOrder<T>>* _listener);
@@ -45,41 +49,48 @@ public:
 	// Get the listener of the service
 	AlgoExecutionListener<T>* GetListener();
 
-	// Execute an order in the market
-	void ExecuteOrder(ExecutionOrder<T>& _executionOrder);
+	// Get the connector of the service
+	ExecutionConnector<T>* GetConnector();
+
+	// Execute an order in the market, return the stored order
+	const ExecutionOrder<T>& ExecuteOrder(const ExecutionOrder<T>& _executionOrder);
 
 private:
-	unordered_map<string, ExecutionOrder<T>> executionOrders;
+	ProductStore<ExecutionOrder<T>> executionOrders;
 	vector<ServiceListener<ExecutionOrder<T>>*> listeners;
 	AlgoExecutionListener<T>* listener;
+	ExecutionConnector<T>* connector;
 };
 
 template<typename T>
 ExecutionService<T>::ExecutionService()
 {
-	executionOrders = unordered_map<string, ExecutionOrder<T>>();
+	executionOrders = ProductStore<ExecutionOrder<T>>();
 	listeners = vector<ServiceListener<ExecutionOrder<T>>*>();
 	listener = new AlgoExecutionListener<T>(this);
+	connector = new ExecutionConnector<T>(this);
 }
 
 template<typename T>
 ExecutionService<T>::~ExecutionService() {
 	delete listener;
+	delete connector;
 }
 
 template<typename T>
-ExecutionOrder<T>& ExecutionService<T>::GetData(string _key)
+ExecutionOrder<T>& ExecutionService<T>::GetData(string_view _key)
 {
-	return executionOrders[_key];
+	return executionOrders.Get(_key);
 }
 
 template<typename T>
-void ExecutionService<T>::OnMessage(ExecutionOrder<T>& _data)
+void ExecutionService<T>::OnMessage(ExecutionOrder<T>&& _data)
 {
-	executionOrders[_data.GetProduct().GetProductId()] = _data;
+	INSTRUMENT_HOP("ExecutionService::OnMessage");
+	const ExecutionOrder<T>& executionOrder = executionOrders.Put(move(_data));
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(executionOrder); });
 }
 
 template<typename T>
@@ -101,11 +112,82 @@ AlgoExecutionListener<T>* ExecutionService<T>::GetListener()
 }
 
 template<typename T>
-void ExecutionService<T>::ExecuteOrder(ExecutionOrder<T>& _executionOrder)
+ExecutionConnector<T>* ExecutionService<T>::GetConnector()
 {
-	this->OnMessage(_executionOrder);
+	return connector;
+}
+
+template<typename T>
+const ExecutionOrder<T>& ExecutionService<T>::ExecuteOrder(const ExecutionOrder<T>& _executionOrder)
+{
+	INSTRUMENT_HOP("ExecutionService::ExecuteOrder");
+	this->OnMessage(ExecutionOrder<T>(_executionOrder));
+	connector->Publish(_executionOrder);
+	return executionOrders[_executionOrder.GetProduct().GetProductIndex()];
 }
 
+/**
+* ExecutionConnector publishing executions as text lines, or wire messages, over a socket to a listener process.
+* Publish-only connector, it publishes nothing until it is connected.
+* Type T is the product type.
+*/
+template<typename T>
+class ExecutionConnector : public Connector<ExecutionOrder<T>>
+{
+
+private:
+
+	ExecutionService<T>* service;
+	SocketPublisher publisher;
+	WireEncoder encoder;
+	char message[WIRE_MAX_MESSAGE];
+
+public:
+
+	// Ctor
+	ExecutionConnector(ExecutionService<T>* _service);
+
+	// Connect to the listener process, sending text lines or wire messages, false if it cannot be reached
+	bool Connect(const string& _host, int _port, FrameFormat _format = TEXT_FRAME, int _retries = 10);
+
+	// Publish data to the Connector
+	void Publish(const ExecutionOrder<T>& _data);
+
+	// Subscribe data from the Connector
+	void Subscribe(istream& _data);
+
+};
+
+template<typename T>
+ExecutionConnector<T>::ExecutionConnector(ExecutionService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+bool ExecutionConnector<T>::Connect(const string& _host, int _port, FrameFormat _format, int _retries)
+{
+	publisher.SetFormat(_format);
+	if (!publisher.Connect(_host, _port, _retries)) return false;
+
+	// the listener checks the products behind the indices of the messages first
+	if (_format == BINARY_FRAME) publisher.PublishMessage(message, encoder.EncodeRegistry(message));
+	return true;
+}
+
+template<typename T>
+void ExecutionConnector<T>::Publish(const ExecutionOrder<T>& _data)
+{
+	if (!publisher.IsConnected()) return;
+
+	if (publisher.GetFormat() == BINARY_FRAME) publisher.PublishMessage(message, encoder.EncodeRecord(WIRE_EXECUTION, _data, message));
+	else publisher.PublishLine(_data.print());
+}
+
+template<typename T>
+void ExecutionConnector<T>::Subscribe(istream& _data) {}
+
+
 /**
 * Execution Service Listener subscribing data from AlgoExecutionService.
 * Type T is the product type.
@@ -124,13 +206,13 @@ public:
 	AlgoExecutionListener(ExecutionService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(ExecutionOrder<T>& _data);
+	void ProcessAdd(const ExecutionOrder<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(ExecutionOrder<T>& _data);
+	void ProcessRemove(const ExecutionOrder<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(ExecutionOrder<T>& _data);
+	void ProcessUpdate(const ExecutionOrder<T>& _data);
 
 };
 
@@ -141,15 +223,54 @@ AlgoExecutionListener<T>::AlgoExecutionListener(ExecutionService<T>* _service)
 }
 
 template<typename T>
-void AlgoExecutionListener<T>::ProcessAdd(ExecutionOrder<T>& _data)
+void AlgoExecutionListener<T>::ProcessAdd(const ExecutionOrder<T>& _data)
 {
 	service->ExecuteOrder(_data);
 }
 
 template<typename T>
-void AlgoExecutionListener<T>::ProcessRemove(ExecutionOrder<T>& _data) {}
+void AlgoExecutionListener<T>::ProcessRemove(const ExecutionOrder<T>& _data) {}
+
+template<typename T>
+void AlgoExecutionListener<T>::ProcessUpdate(const ExecutionOrder<T>& _data) {}
 
+
+/**
+* Stage of a Pipeline executing the algo orders, wired at compile time in place of AlgoExecutionListener.
+* Type T is the product type.
+*/
 template<typename T>
-void AlgoExecutionListener<T>::ProcessUpdate(ExecutionOrder<T>& _data) {}
+class ExecutionStage
+{
+
+private:
+
+	ExecutionService<T>* service;
+
+public:
+
+	typedef ExecutionOrder<T> InputType;
+
+	// Ctor
+	ExecutionStage(ExecutionService<T>* _service);
+
+	// Execute an order, passing on the executed order
+	template<typename Next>
+	void Process(const ExecutionOrder<T>& _data, Next& _next);
+
+};
+
+template<typename T>
+ExecutionStage<T>::ExecutionStage(ExecutionService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+template<typename Next>
+void ExecutionStage<T>::Process(const ExecutionOrder<T>& _data, Next& _next)
+{
+	_next(service->ExecuteOrder(_data));
+}
 
 #endif
@@ -9,11 +9,15 @@
 #define STREAMING_SERVICE_HPP
 
 #include "soa.hpp"
+#include "instrumentation.hpp"
 #include "algostreamingservice.hpp"
+#include "wireprotocol.hpp"
 
 
 template<typename T>
 class AlgoStreamingListener;
+template<typename T>
+class StreamingConnector;
 
 /**
 * Streaming service to publish two-way prices.
@@ -22,14 +26,15 @@ class AlgoStreamingListener;
 */
 
 template<typename T>
-class StreamingService : public Service<string, PriceStream<T>>
+class StreamingService : public Service<string_view, PriceStream<T>>
 {
 
 private:
 
-	unordered_map<string, PriceStream<T>> priceStreams;
+	ProductStore<PriceStream<T>> priceStreams;
 	vector<ServiceListener<PriceStream<T>>*> listeners;
 	AlgoStreamingListener<T>* listener;
+	StreamingConnector<T>* connector;
 
 public:
 
@@ -40,10 +45,10 @@ public:
 	~StreamingService();
 
 	// Get data on our service given a key
-	PriceStream<T>& GetData(string _key);
+	PriceStream<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(PriceStream<T>& _data);
+	void OnMessage(PriceStream<T>&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<PriceStream<T>>* _listener);
@@ -54,37 +59,43 @@ public:
 	// Get the listener of the service
 	AlgoStreamingListener<T>* GetListener();
 
-	// Publish two-way prices
-	void PublishPrice(PriceStream<T>& _priceStream);
+	// Get the connector of the service
+	StreamingConnector<T>* GetConnector();
+
+	// Publish two-way prices, return the stored stream
+	const PriceStream<T>& PublishPrice(const PriceStream<T>& _priceStream);
 
 };
 
 template<typename T>
 StreamingService<T>::StreamingService()
 {
-	priceStreams = unordered_map<string, PriceStream<T>>();
+	priceStreams = ProductStore<PriceStream<T>>();
 	listeners = vector<ServiceListener<PriceStream<T>>*>();
 	listener = new AlgoStreamingListener<T>(this);
+	connector = new StreamingConnector<T>(this);
 }
 
 template<typename T>
 StreamingService<T>::~StreamingService() {
 	delete listener;
+	delete connector;
 }
 
 template<typename T>
-PriceStream<T>& StreamingService<T>::GetData(string _key)
+PriceStream<T>& StreamingService<T>::GetData(string_view _key)
 {
-	return priceStreams[_key];
+	return priceStreams.Get(_key);
 }
 
 template<typename T>
-void StreamingService<T>::OnMessage(PriceStream<T>& _data)
+void StreamingService<T>::OnMessage(PriceStream<T>&& _data)
 {
-	priceStreams[_data.GetProduct().GetProductId()] = _data;
+	INSTRUMENT_HOP("StreamingService::OnMessage");
+	const PriceStream<T>& priceStream = priceStreams.Put(move(_data));
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(priceStream); });
 }
 
 template<typename T>
@@ -106,11 +117,81 @@ AlgoStreamingListener<T>* StreamingService<T>::GetListener()
 }
 
 template<typename T>
-void StreamingService<T>::PublishPrice(PriceStream<T>& _priceStream)
+StreamingConnector<T>* StreamingService<T>::GetConnector()
+{
+	return connector;
+}
+
+template<typename T>
+const PriceStream<T>& StreamingService<T>::PublishPrice(const PriceStream<T>& _priceStream)
+{
+	INSTRUMENT_HOP("StreamingService::PublishPrice");
+	this->OnMessage(PriceStream<T>(_priceStream));
+	connector->Publish(_priceStream);
+	return priceStreams[_priceStream.GetProduct().GetProductIndex()];
+}
+
+/**
+* StreamingConnector publishing price streams as text lines, or wire messages, over a socket to a listener process.
+* Publish-only connector, it publishes nothing until it is connected.
+* Type T is the product type.
+*/
+template<typename T>
+class StreamingConnector : public Connector<PriceStream<T>>
+{
+
+private:
+
+	StreamingService<T>* service;
+	SocketPublisher publisher;
+	WireEncoder encoder;
+	char message[WIRE_MAX_MESSAGE];
+
+public:
+
+	// Ctor
+	StreamingConnector(StreamingService<T>* _service);
+
+	// Connect to the listener process, sending text lines or wire messages, false if it cannot be reached
+	bool Connect(const string& _host, int _port, FrameFormat _format = TEXT_FRAME, int _retries = 10);
+
+	// Publish data to the Connector
+	void Publish(const PriceStream<T>& _data);
+
+	// Subscribe data from the Connector
+	void Subscribe(istream& _data);
+
+};
+
+template<typename T>
+StreamingConnector<T>::StreamingConnector(StreamingService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+bool StreamingConnector<T>::Connect(const string& _host, int _port, FrameFormat _format, int _retries)
+{
+	publisher.SetFormat(_format);
+	if (!publisher.Connect(_host, _port, _retries)) return false;
+
+	// the listener checks the products behind the indices of the messages first
+	if (_format == BINARY_FRAME) publisher.PublishMessage(message, encoder.EncodeRegistry(message));
+	return true;
+}
+
+template<typename T>
+void StreamingConnector<T>::Publish(const PriceStream<T>& _data)
 {
-	this->OnMessage(_priceStream);
+	if (!publisher.IsConnected()) return;
+
+	if (publisher.GetFormat() == BINARY_FRAME) publisher.PublishMessage(message, encoder.EncodeRecord(WIRE_STREAM, _data, message));
+	else publisher.PublishLine(_data.print());
 }
 
+template<typename T>
+void StreamingConnector<T>::Subscribe(istream& _data) {}
+
 
 /**
 * Streaming Service Listener subscribing data from Algo Streaming Service
@@ -130,13 +211,13 @@ public:
 	AlgoStreamingListener(StreamingService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(PriceStream<T>& _data);
+	void ProcessAdd(const PriceStream<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(PriceStream<T>& _data);
+	void ProcessRemove(const PriceStream<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(PriceStream<T>& _data);
+	void ProcessUpdate(const PriceStream<T>& _data);
 
 };
 
@@ -147,16 +228,55 @@ AlgoStreamingListener<T>::AlgoStreamingListener(StreamingService<T>* _service)
 }
 
 template<typename T>
-void AlgoStreamingListener<T>::ProcessAdd(PriceStream<T>& _data)
+void AlgoStreamingListener<T>::ProcessAdd(const PriceStream<T>& _data)
 {
 	service->PublishPrice(_data);
 }
 
 template<typename T>
-void AlgoStreamingListener<T>::ProcessRemove(PriceStream<T>& _data) {}
+void AlgoStreamingListener<T>::ProcessRemove(const PriceStream<T>& _data) {}
+
+template<typename T>
+void AlgoStreamingListener<T>::ProcessUpdate(const PriceStream<T>& _data) {}
 
+
+/**
+* Stage of a Pipeline publishing the algo streams, wired at compile time in place of AlgoStreamingListener.
+* Type T is the product type.
+*/
 template<typename T>
-void AlgoStreamingListener<T>::ProcessUpdate(PriceStream<T>& _data) {}
+class StreamingStage
+{
+
+private:
+
+	StreamingService<T>* service;
+
+public:
+
+	typedef PriceStream<T> InputType;
+
+	// Ctor
+	StreamingStage(StreamingService<T>* _service);
+
+	// Publish a stream, passing on the published stream
+	template<typename Next>
+	void Process(const PriceStream<T>& _data, Next& _next);
+
+};
+
+template<typename T>
+StreamingStage<T>::StreamingStage(StreamingService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+template<typename Next>
+void StreamingStage<T>::Process(const PriceStream<T>& _data, Next& _next)
+{
+	_next(service->PublishPrice(_data));
+}
 
 
 #endif
@@ -0,0 +1,102 @@
+/**
+ * bookregistry.hpp
+ * Defines the registry interning the books the trades are booked in.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef BOOK_REGISTRY_HPP
+#define BOOK_REGISTRY_HPP
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+using namespace std;
+
+// Number of books a position can be kept in
+const int MAX_BOOKS = 32;
+
+/**
+ * Registry giving each book a dense id (0, 1, 2, ...) in the order it is first seen,
+ * so that positions keep their books in a fixed array indexed by the id.
+ * There are a few books, so they are found by a scan of their names, which does not
+ * lock; only interning a new book does.
+ */
+class BookRegistry
+{
+
+public:
+
+	// Get the registry
+	static BookRegistry& GetInstance();
+
+	// Get the id of a book, adding the book if it is new, throw out_of_range past MAX_BOOKS books
+	int Intern(string_view _book);
+
+	// Find the id of a book, -1 if it is not registered
+	int Find(string_view _book) const;
+
+	// Get the name of a book id
+	const string& GetName(int _bookId) const;
+
+	// Get the number of registered books
+	int Size() const;
+
+private:
+
+	BookRegistry() = default;
+	BookRegistry(const BookRegistry&) = delete;
+	BookRegistry& operator=(const BookRegistry&) = delete;
+
+	array<string, MAX_BOOKS> names; // a name is never changed once counted
+	atomic<int> count{ 0 };
+	mutex lock; // serializes adding the books
+
+};
+
+BookRegistry& BookRegistry::GetInstance()
+{
+	static BookRegistry registry;
+	return registry;
+}
+
+int BookRegistry::Intern(string_view _book)
+{
+	int bookId = Find(_book);
+	if (bookId >= 0) return bookId;
+
+	lock_guard<mutex> guard(lock);
+	bookId = Find(_book);
+	if (bookId >= 0) return bookId;
+
+	int size = count.load(memory_order_relaxed);
+	if (size == MAX_BOOKS) throw out_of_range("Too many books: " + string(_book));
+	names[size] = string(_book);
+	count.store(size + 1, memory_order_release);
+	return size;
+}
+
+int BookRegistry::Find(string_view _book) const
+{
+	int size = count.load(memory_order_acquire);
+	for (int i = 0; i < size; i++)
+	{
+		if (names[i] == _book) return i;
+	}
+	return -1;
+}
+
+const string& BookRegistry::GetName(int _bookId) const
+{
+	return names[_bookId];
+}
+
+int BookRegistry::Size() const
+{
+	return count.load(memory_order_acquire);
+}
+
+#endif
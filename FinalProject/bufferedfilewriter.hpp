@@ -0,0 +1,288 @@
+/**
+ * bufferedfilewriter.hpp
+ * Defines the persistent, double-buffered output file writer used by the
+ * publish-only connectors.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef BUFFERED_FILE_WRITER_HPP
+#define BUFFERED_FILE_WRITER_HPP
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// File discarding what is written to it, the output of the trading system of the benchmarks and checks
+#ifdef _WIN32
+const char* const NULL_DEVICE = "NUL";
+#else
+const char* const NULL_DEVICE = "/dev/null";
+#endif
+
+/**
+ * Append-only writer keeping its file open for the whole run.
+ * Callers copy their bytes into a front buffer. A dedicated I/O thread swaps it with
+ * a back buffer and writes the back buffer out when the front buffer reaches the size
+ * threshold or when the flush interval elapses, whichever comes first.
+ *
+ * Delivery guarantees:
+ * - Write() returns once the bytes are copied into the front buffer. It only waits
+ *   when both buffers are full, that is when the disk cannot keep up.
+ * - Bytes are handed to the operating system at most one flush interval after they
+ *   were written, and in the order of the Write() calls.
+ * - Flush() and the destructor return after every byte written before them has been
+ *   handed to the operating system. Shared writers are destroyed at program exit, so
+ *   a normal exit loses nothing. A crash loses at most the last flush interval.
+ * - With sync on, every write-out is followed by fsync, so data that has been flushed
+ *   also survives an operating system crash. This costs one disk round trip per
+ *   flush, but only the I/O thread pays it.
+ *
+ * Cost of Write(): the copy is made under the writer's mutex, which is shared by every
+ * thread appending to the file, such as the shards, since one buffer is what keeps the
+ * order of their writes. The I/O thread only holds it to swap the buffers, never during
+ * the disk write, so the lock is uncontended unless two producers append at once. The
+ * I/O thread is woken once per half buffer, not on every write.
+ */
+class BufferedFileWriter
+{
+
+public:
+
+	// ctor opening a file for appending, in binary mode for binary data
+	BufferedFileWriter(const string& _fileName, size_t _bufferSize = 1 << 20,
+		chrono::milliseconds _flushInterval = chrono::milliseconds(100), bool _sync = false, bool _binary = false);
+
+	// dtor flushing everything and closing the file
+	~BufferedFileWriter();
+
+	// Get the writer shared by everyone appending to a file, opened on first use
+	static BufferedFileWriter& GetWriter(const string& _fileName, bool _binary = false);
+
+	// Send the output of every writer, already opened or not, to one file, such as NULL_DEVICE, or to their own files if empty
+	static void SetRedirection(const string& _fileName);
+
+	// Append bytes to the file
+	void Write(string_view _data);
+
+	// Wait until everything written so far has been handed to the operating system
+	void Flush();
+
+	// Turn fsync after each write-out on or off
+	void SetSync(bool _sync);
+
+private:
+
+	BufferedFileWriter(const BufferedFileWriter&) = delete;
+	BufferedFileWriter& operator=(const BufferedFileWriter&) = delete;
+
+	// Loop of the I/O thread
+	void Run();
+
+	// Send what is written from now on to another file, after flushing what was written before to the current one
+	void Redirect(const string& _fileName);
+
+	// Get the file the writers are redirected to, empty if none
+	static string& GetRedirection();
+
+	// Get the writers opened by GetWriter, by file name, and their lock
+	static map<string, unique_ptr<BufferedFileWriter>>& GetWriters();
+	static mutex& GetWritersLock();
+
+	FILE* file; // only used by the I/O thread once constructed
+	string target; // file to write to
+	bool binary;
+	bool reopen; // target changed, the I/O thread reopens before its next write-out
+	vector<char> front; // filled by the callers
+	vector<char> back; // written out by the I/O thread
+	size_t bufferSize;
+	chrono::milliseconds flushInterval;
+	bool sync;
+
+	mutex lock;
+	condition_variable writerWakeUp;
+	condition_variable callerWakeUp;
+	unsigned long long appended; // bytes copied into the buffers
+	unsigned long long written; // bytes handed to the operating system
+	bool flushRequested;
+	bool stopping;
+	thread writer;
+
+};
+
+BufferedFileWriter::BufferedFileWriter(const string& _fileName, size_t _bufferSize,
+	chrono::milliseconds _flushInterval, bool _sync, bool _binary)
+{
+	file = fopen(_fileName.c_str(), _binary ? "ab" : "a");
+	target = _fileName;
+	binary = _binary;
+	reopen = false;
+	bufferSize = _bufferSize;
+	flushInterval = _flushInterval;
+	sync = _sync;
+	front.reserve(bufferSize);
+	back.reserve(bufferSize);
+	appended = 0;
+	written = 0;
+	flushRequested = false;
+	stopping = false;
+	writer = thread(&BufferedFileWriter::Run, this);
+}
+
+BufferedFileWriter::~BufferedFileWriter()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	writerWakeUp.notify_one();
+	writer.join();
+	if (file != nullptr) fclose(file);
+}
+
+BufferedFileWriter& BufferedFileWriter::GetWriter(const string& _fileName, bool _binary)
+{
+	lock_guard<mutex> guard(GetWritersLock());
+	unique_ptr<BufferedFileWriter>& writer = GetWriters()[_fileName];
+	if (!writer)
+	{
+		const string& redirection = GetRedirection();
+		writer.reset(new BufferedFileWriter(redirection.empty() ? _fileName : redirection,
+			1 << 20, chrono::milliseconds(100), false, _binary));
+	}
+	return *writer;
+}
+
+void BufferedFileWriter::SetRedirection(const string& _fileName)
+{
+	lock_guard<mutex> guard(GetWritersLock());
+	GetRedirection() = _fileName;
+	for (auto& writer : GetWriters())
+	{
+		writer.second->Redirect(_fileName.empty() ? writer.first : _fileName);
+	}
+}
+
+void BufferedFileWriter::Redirect(const string& _fileName)
+{
+	Flush();
+	lock_guard<mutex> guard(lock);
+	if (_fileName == target) return;
+	target = _fileName;
+	reopen = true;
+}
+
+string& BufferedFileWriter::GetRedirection()
+{
+	static string redirection;
+	return redirection;
+}
+
+map<string, unique_ptr<BufferedFileWriter>>& BufferedFileWriter::GetWriters()
+{
+	static map<string, unique_ptr<BufferedFileWriter>> writers;
+	return writers;
+}
+
+mutex& BufferedFileWriter::GetWritersLock()
+{
+	static mutex writersLock;
+	return writersLock;
+}
+
+void BufferedFileWriter::Write(string_view _data)
+{
+	unique_lock<mutex> guard(lock);
+
+	// both buffers full, wait for the I/O thread to take the front one
+	if (!front.empty() && front.size() + _data.size() > bufferSize)
+	{
+		writerWakeUp.notify_one();
+		callerWakeUp.wait(guard, [&]() { return front.empty() || front.size() + _data.size() <= bufferSize; });
+	}
+
+	// wake the I/O thread when the front buffer crosses half full, not again until it is taken
+	size_t before = front.size();
+	front.insert(front.end(), _data.begin(), _data.end());
+	appended += _data.size();
+	if (before < bufferSize / 2 && front.size() >= bufferSize / 2) writerWakeUp.notify_one();
+}
+
+void BufferedFileWriter::Flush()
+{
+	unique_lock<mutex> guard(lock);
+	unsigned long long target = appended;
+	flushRequested = true;
+	writerWakeUp.notify_one();
+	callerWakeUp.wait(guard, [&]() { return written >= target; });
+}
+
+void BufferedFileWriter::SetSync(bool _sync)
+{
+	lock_guard<mutex> guard(lock);
+	sync = _sync;
+}
+
+void BufferedFileWriter::Run()
+{
+	unique_lock<mutex> guard(lock);
+	while (true)
+	{
+		writerWakeUp.wait_for(guard, flushInterval, [&]() {
+			return stopping || flushRequested || front.size() >= bufferSize / 2;
+		});
+
+		bool isLast = stopping;
+		flushRequested = false;
+		if (!front.empty())
+		{
+			// take the filled buffer and let the callers continue into the empty one
+			front.swap(back);
+			bool doSync = sync;
+			string reopenTarget;
+			if (reopen) reopenTarget = target;
+			reopen = false;
+			guard.unlock();
+			callerWakeUp.notify_all();
+
+			if (!reopenTarget.empty())
+			{
+				if (file != nullptr) fclose(file);
+				file = fopen(reopenTarget.c_str(), binary ? "ab" : "a");
+			}
+			if (file != nullptr)
+			{
+				fwrite(back.data(), 1, back.size(), file);
+				fflush(file);
+#ifdef _WIN32
+				if (doSync) _commit(_fileno(file));
+#else
+				if (doSync) fsync(fileno(file));
+#endif
+			}
+
+			size_t count = back.size();
+			back.clear();
+			guard.lock();
+			written += count;
+		}
+		callerWakeUp.notify_all();
+
+		if (isLast && front.empty()) return;
+	}
+}
+
+#endif
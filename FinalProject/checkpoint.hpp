@@ -0,0 +1,75 @@
+/**
+ * checkpoint.hpp
+ * Defines the layout of the checkpoint files of the replay engine and the
+ * helpers the services save their state into them with.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include "journal.hpp"
+
+using namespace std;
+
+/*
+	A checkpoint file is a CheckpointHeader with the offset in each input file of the
+	next line to read, followed by the state of the services, each one writing its
+	part with SaveCheckpoint() and reading it back in the same order with
+	RestoreCheckpoint(). Fixed-size values are written in the layout of the machine,
+	and the positions and the risk as journal records, so that a checkpoint is only
+	read back by the same build.
+*/
+
+// Start of every checkpoint file, the last characters being the version of the layout
+const char CHECKPOINT_MAGIC[8] = { 'T', 'S', 'C', 'H', 'K', 'P', '0', '3' };
+
+// Largest number of input files of a checkpoint
+const int CHECKPOINT_MAX_FEEDS = 8;
+
+#pragma pack(push, 1)
+
+// Header of a checkpoint file
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t feedCount;
+	uint32_t reserved;
+	int64_t recordedTime; // of the replay, in microseconds, the lines before it having been read
+	uint64_t offsets[CHECKPOINT_MAX_FEEDS]; // of the next line of each input file
+	uint64_t lines[CHECKPOINT_MAX_FEEDS]; // read from each input file
+};
+
+#pragma pack(pop)
+
+// Write a fixed-size value to a checkpoint
+template<typename V>
+void WriteCheckpointValue(ostream& _checkpoint, const V& _value)
+{
+	static_assert(is_trivially_copyable<V>::value, "only fixed-size values are written as they are");
+	_checkpoint.write(reinterpret_cast<const char*>(&_value), sizeof(V));
+}
+
+// Read a fixed-size value from a checkpoint, return false at its end
+template<typename V>
+bool ReadCheckpointValue(istream& _checkpoint, V& _value)
+{
+	static_assert(is_trivially_copyable<V>::value, "only fixed-size values are read as they are");
+	return static_cast<bool>(_checkpoint.read(reinterpret_cast<char*>(&_value), sizeof(V)));
+}
+
+// Write a data type to a checkpoint as its journal record
+template<typename V>
+void WriteCheckpointRecord(ostream& _checkpoint, const V& _data)
+{
+	char record[JOURNAL_MAX_RECORD];
+	size_t length = _data.Encode(0, record);
+	_checkpoint.write(record, length);
+}
+
+#endif
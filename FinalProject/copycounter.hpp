@@ -0,0 +1,90 @@
+/**
+ * copycounter.hpp
+ * Defines the copy counters of the data types, compiled in when COUNT_COPIES is
+ * defined, to see how often an event is copied on its way through the services.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef COPY_COUNTER_HPP
+#define COPY_COUNTER_HPP
+
+#include <atomic>
+
+using namespace std;
+
+#ifdef COUNT_COPIES
+
+/**
+ * Counter of the copies of a data type, held as a member of the type so that the
+ * implicit copies of the type are counted and its moves are not.
+ * Type V is the data type counted.
+ */
+template<typename V>
+class CopyCounter
+{
+
+public:
+
+	// ctor
+	CopyCounter() = default;
+
+	// copy ctor counting a copy
+	CopyCounter(const CopyCounter&);
+
+	// move ctor
+	CopyCounter(CopyCounter&&) noexcept = default;
+
+	// copy assignment counting a copy
+	CopyCounter& operator=(const CopyCounter&);
+
+	// move assignment
+	CopyCounter& operator=(CopyCounter&&) noexcept = default;
+
+	// Get the number of copies of the type since the last reset
+	static unsigned long long GetCopyCount();
+
+	// Start counting from zero
+	static void ResetCopyCount();
+
+private:
+
+	inline static atomic<unsigned long long> copies{ 0 };
+
+};
+
+template<typename V>
+CopyCounter<V>::CopyCounter(const CopyCounter&)
+{
+	copies.fetch_add(1, memory_order_relaxed);
+}
+
+template<typename V>
+CopyCounter<V>& CopyCounter<V>::operator=(const CopyCounter&)
+{
+	copies.fetch_add(1, memory_order_relaxed);
+	return *this;
+}
+
+template<typename V>
+unsigned long long CopyCounter<V>::GetCopyCount()
+{
+	return copies.load(memory_order_relaxed);
+}
+
+template<typename V>
+void CopyCounter<V>::ResetCopyCount()
+{
+	copies.store(0, memory_order_relaxed);
+}
+
+// Member counting the copies of the enclosing data type V
+#define COPY_COUNTED(V) CopyCounter<V> copyCounter;
+
+#else
+
+// Nothing is counted, the data types keep their layout
+#define COPY_COUNTED(V)
+
+#endif
+
+#endif
@@ -0,0 +1,319 @@
+/**
+ * daryheap.hpp
+ * Defines the d-ary heap with handles behind the top-N queries of the services,
+ * such as the largest positions or the widest spreads.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef DARY_HEAP_HPP
+#define DARY_HEAP_HPP
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <string>
+#include <stdexcept>
+
+using namespace std;
+
+// Slot of a handle whose value has left the heap
+const size_t HEAP_NO_SLOT = static_cast<size_t>(-1);
+
+/**
+ * Heap of values in an array where each node has D children, the top being the largest
+ * value for the comparison, as for priority_queue.
+ * A wider node halves the depth of a binary heap for D = 4, so a push moves up fewer
+ * levels and the children compared on the way down share a cache line.
+ * Each value pushed gets a handle it keeps until it is popped or erased, which Update()
+ * moves up or down the heap when its priority changes, the decrease-key of timers.
+ * Unlike the class of Maxheap.cpp, the values are stored and compared in the heap itself.
+ * Type T is the value type, D the number of children of a node.
+ */
+template<typename T, int D = 4, typename Compare = less<T>>
+class DaryHeap
+{
+
+public:
+
+	// ctor for an empty heap
+	DaryHeap(Compare _comp = Compare());
+
+	// Push a value, return its handle
+	size_t Push(const T& _value);
+
+	// Get the top value
+	const T& Top() const;
+
+	// Get the handle of the top value
+	size_t TopHandle() const;
+
+	// Pop the top value
+	void Pop();
+
+	// Change the value of a handle, moving it up or down the heap
+	void Update(size_t _handle, const T& _value);
+
+	// Remove the value of a handle
+	void Erase(size_t _handle);
+
+	// Check whether a handle still has a value in the heap
+	bool Contains(size_t _handle) const;
+
+	// Get the value of a handle
+	const T& Get(size_t _handle) const;
+
+	// Get the number of values
+	size_t Size() const;
+
+	// Check whether there is no value
+	bool Empty() const;
+
+	// Remove every value and handle
+	void Clear();
+
+	// Reserve the room for a number of values
+	void Reserve(size_t _size);
+
+	// Check that no value is above its parent and that every handle finds its value, for the self checks
+	bool IsValid() const;
+
+private:
+
+	// Value in a slot of the heap array and its handle
+	struct Entry
+	{
+		T value;
+		size_t handle;
+	};
+
+	// Move the entry of a slot up while it is above its parent, return its final slot
+	size_t SiftUp(size_t _slot);
+
+	// Move the entry of a slot down while a child is above it
+	void SiftDown(size_t _slot);
+
+	// Remove the entry of a slot, filling it with the last one
+	void RemoveSlot(size_t _slot);
+
+	// Place an entry in a slot and record the slot of its handle
+	void Place(size_t _slot, Entry&& _entry);
+
+	Compare comp;
+	vector<Entry> entries; // the heap array
+	vector<size_t> slots; // by handle
+	vector<size_t> freeHandles; // of the values that left the heap, given again to the next values
+
+};
+
+template<typename T, int D, typename Compare>
+DaryHeap<T, D, Compare>::DaryHeap(Compare _comp) :
+	comp(_comp)
+{
+	static_assert(D >= 2, "a heap node has at least two children");
+}
+
+template<typename T, int D, typename Compare>
+size_t DaryHeap<T, D, Compare>::Push(const T& _value)
+{
+	size_t handle;
+	if (freeHandles.empty())
+	{
+		handle = slots.size();
+		slots.push_back(HEAP_NO_SLOT);
+	}
+	else
+	{
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+
+	entries.push_back(Entry{ _value, handle });
+	slots[handle] = entries.size() - 1;
+	SiftUp(entries.size() - 1);
+	return handle;
+}
+
+template<typename T, int D, typename Compare>
+const T& DaryHeap<T, D, Compare>::Top() const
+{
+	if (entries.empty()) throw out_of_range("The heap is empty");
+	return entries.front().value;
+}
+
+template<typename T, int D, typename Compare>
+size_t DaryHeap<T, D, Compare>::TopHandle() const
+{
+	if (entries.empty()) throw out_of_range("The heap is empty");
+	return entries.front().handle;
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::Pop()
+{
+	if (entries.empty()) throw out_of_range("The heap is empty");
+	RemoveSlot(0);
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::Update(size_t _handle, const T& _value)
+{
+	if (!Contains(_handle)) throw out_of_range("The handle " + to_string(_handle) + " is not in the heap");
+	size_t slot = slots[_handle];
+	entries[slot].value = _value;
+	if (SiftUp(slot) == slot) SiftDown(slot);
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::Erase(size_t _handle)
+{
+	if (!Contains(_handle)) throw out_of_range("The handle " + to_string(_handle) + " is not in the heap");
+	RemoveSlot(slots[_handle]);
+}
+
+template<typename T, int D, typename Compare>
+bool DaryHeap<T, D, Compare>::Contains(size_t _handle) const
+{
+	return _handle < slots.size() && slots[_handle] != HEAP_NO_SLOT;
+}
+
+template<typename T, int D, typename Compare>
+const T& DaryHeap<T, D, Compare>::Get(size_t _handle) const
+{
+	if (!Contains(_handle)) throw out_of_range("The handle " + to_string(_handle) + " is not in the heap");
+	return entries[slots[_handle]].value;
+}
+
+template<typename T, int D, typename Compare>
+size_t DaryHeap<T, D, Compare>::Size() const
+{
+	return entries.size();
+}
+
+template<typename T, int D, typename Compare>
+bool DaryHeap<T, D, Compare>::Empty() const
+{
+	return entries.empty();
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::Clear()
+{
+	entries.clear();
+	slots.clear();
+	freeHandles.clear();
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::Reserve(size_t _size)
+{
+	entries.reserve(_size);
+	slots.reserve(_size);
+}
+
+template<typename T, int D, typename Compare>
+bool DaryHeap<T, D, Compare>::IsValid() const
+{
+	size_t handles = 0;
+	for (size_t slot = 0; slot < entries.size(); slot++)
+	{
+		if (slot > 0 && comp(entries[(slot - 1) / D].value, entries[slot].value)) return false;
+		if (entries[slot].handle >= slots.size() || slots[entries[slot].handle] != slot) return false;
+	}
+	for (size_t slot : slots) handles += (slot != HEAP_NO_SLOT);
+	return handles == entries.size() && handles + freeHandles.size() == slots.size();
+}
+
+template<typename T, int D, typename Compare>
+size_t DaryHeap<T, D, Compare>::SiftUp(size_t _slot)
+{
+	// the entry is held aside and the parents moved down into the hole
+	Entry entry = move(entries[_slot]);
+	while (_slot > 0)
+	{
+		size_t parent = (_slot - 1) / D;
+		if (!comp(entries[parent].value, entry.value)) break;
+		Place(_slot, move(entries[parent]));
+		_slot = parent;
+	}
+	Place(_slot, move(entry));
+	return _slot;
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::SiftDown(size_t _slot)
+{
+	Entry entry = move(entries[_slot]);
+	size_t size = entries.size();
+	while (true)
+	{
+		size_t first = D * _slot + 1;
+		if (first >= size) break;
+
+		// the largest of the children, which are next to each other in the array
+		size_t last = min(first + D, size);
+		size_t largest = first;
+		for (size_t child = first + 1; child < last; child++)
+		{
+			if (comp(entries[largest].value, entries[child].value)) largest = child;
+		}
+		if (!comp(entry.value, entries[largest].value)) break;
+		Place(_slot, move(entries[largest]));
+		_slot = largest;
+	}
+	Place(_slot, move(entry));
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::RemoveSlot(size_t _slot)
+{
+	size_t handle = entries[_slot].handle;
+	slots[handle] = HEAP_NO_SLOT;
+	freeHandles.push_back(handle);
+
+	size_t last = entries.size() - 1;
+	if (_slot != last)
+	{
+		Place(_slot, move(entries[last]));
+		entries.pop_back();
+		if (SiftUp(_slot) == _slot) SiftDown(_slot);
+	}
+	else entries.pop_back();
+}
+
+template<typename T, int D, typename Compare>
+void DaryHeap<T, D, Compare>::Place(size_t _slot, Entry&& _entry)
+{
+	slots[_entry.handle] = _slot;
+	entries[_slot] = move(_entry);
+}
+
+/*
+	Top-N queries
+*/
+
+// Get the n largest values of a range for a comparison, the largest first,
+// keeping the n largest so far in a heap whose top is the smallest of them
+template<typename InputIt, typename Compare>
+vector<typename iterator_traits<InputIt>::value_type> GetTopN(InputIt _first, InputIt _last, size_t _n, Compare _comp)
+{
+	typedef typename iterator_traits<InputIt>::value_type V;
+	auto inverse = [_comp](const V& _a, const V& _b) { return _comp(_b, _a); };
+	DaryHeap<V, 4, decltype(inverse)> smallest(inverse);
+	smallest.Reserve(_n);
+
+	for (; _first != _last && _n > 0; ++_first)
+	{
+		if (smallest.Size() < _n) smallest.Push(*_first);
+		else if (_comp(smallest.Top(), *_first)) smallest.Update(smallest.TopHandle(), *_first);
+	}
+
+	vector<V> top;
+	top.reserve(smallest.Size());
+	for (; !smallest.Empty(); smallest.Pop()) top.push_back(smallest.Top());
+	reverse(top.begin(), top.end());
+	return top;
+}
+
+#endif
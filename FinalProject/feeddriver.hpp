@@ -0,0 +1,187 @@
+/**
+ * feeddriver.hpp
+ * Defines the driver subscribing the input files of the trading system,
+ * each on a thread of its own.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef FEED_DRIVER_HPP
+#define FEED_DRIVER_HPP
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include "soa.hpp"
+#include "wireprotocol.hpp"
+
+using namespace std;
+
+/**
+ * One input, a file or a socket, and the connector subscribing it.
+ */
+struct Feed
+{
+	string name;
+	string fileName; // empty for a socket feed
+	string host;
+	int port = 0;
+	shared_ptr<SocketStream> socket;
+	shared_ptr<WireReader> wire; // only for a socket feed of binary frames
+	function<void(istream&)> subscribe;
+	long lines = 0;
+	double seconds = 0;
+};
+
+/**
+ * Driver running the Subscribe() of every feed, concurrently by default.
+ * Feeds flowing into the same service must be sequenced by that service.
+ * The lines of each file are counted before timing so that the throughput only
+ * covers the connector and the services behind it. Socket feeds are connected before
+ * timing and count the lines, or wire messages, of the frames they receive. Feeds of binary
+ * frames also report the gaps in their sequence numbers.
+ */
+class FeedDriver
+{
+
+public:
+
+	// Add a feed read from a file by a connector
+	template<typename V>
+	void AddFeed(const string& _name, const string& _fileName, Connector<V>* _connector);
+
+	// Add a feed read from a publisher socket by a connector, as text lines or as wire messages
+	// through its SubscribeWire(), return the stream it will read
+	template<typename C>
+	const SocketStream& AddSocketFeed(const string& _name, const string& _host, int _port, C* _connector,
+		FrameFormat _format = TEXT_FRAME);
+
+	// Subscribe every feed, each on its own thread or one after another, and wait for them
+	void Run(bool _concurrent = true);
+
+	// Print the throughput of each feed and the wall time of the last run
+	void PrintReport(ostream& _output) const;
+
+	// Get the wall time of the last run in seconds
+	double GetWallSeconds() const;
+
+private:
+
+	// Subscribe one feed and time it
+	static void RunFeed(Feed& _feed);
+
+	vector<Feed> feeds;
+	double wallSeconds = 0;
+
+};
+
+template<typename V>
+void FeedDriver::AddFeed(const string& _name, const string& _fileName, Connector<V>* _connector)
+{
+	Feed feed;
+	feed.name = _name;
+	feed.fileName = _fileName;
+	feed.subscribe = [_connector](istream& _data) { _connector->Subscribe(_data); };
+	feeds.push_back(feed);
+}
+
+template<typename C>
+const SocketStream& FeedDriver::AddSocketFeed(const string& _name, const string& _host, int _port, C* _connector,
+	FrameFormat _format)
+{
+	Feed feed;
+	feed.name = _name;
+	feed.host = _host;
+	feed.port = _port;
+	feed.socket = make_shared<SocketStream>();
+	if (_format == BINARY_FRAME)
+	{
+		feed.wire = make_shared<WireReader>(feed.socket->GetBuffer());
+		WireReader* reader = feed.wire.get();
+		feed.subscribe = [_connector, reader](istream& _data) { _connector->SubscribeWire(*reader); };
+	}
+	else
+	{
+		feed.subscribe = [_connector](istream& _data) { _connector->Subscribe(_data); };
+	}
+	feeds.push_back(feed);
+	return *feed.socket;
+}
+
+void FeedDriver::Run(bool _concurrent)
+{
+	for (auto& feed : feeds)
+	{
+		feed.lines = 0;
+		feed.seconds = 0;
+		if (feed.socket)
+		{
+			if (!feed.socket->Connect(feed.host, feed.port))
+				cout << "Cannot connect the " << feed.name << " feed to " << feed.host << ":" << feed.port << endl;
+			continue;
+		}
+
+		ifstream count(feed.fileName);
+		string line;
+		while (getline(count, line)) feed.lines++;
+	}
+
+	auto start = chrono::steady_clock::now();
+	if (_concurrent)
+	{
+		vector<thread> threads;
+		for (auto& feed : feeds) threads.push_back(thread(&FeedDriver::RunFeed, ref(feed)));
+		for (auto& t : threads) t.join();
+	}
+	else
+	{
+		for (auto& feed : feeds) RunFeed(feed);
+	}
+	auto stop = chrono::steady_clock::now();
+	wallSeconds = chrono::duration<double>(stop - start).count();
+}
+
+void FeedDriver::RunFeed(Feed& _feed)
+{
+	auto start = chrono::steady_clock::now();
+	if (_feed.socket)
+	{
+		_feed.subscribe(*_feed.socket);
+		_feed.lines = static_cast<long>(_feed.wire ? _feed.wire->GetMessageCount() : _feed.socket->GetBuffer().GetLineCount());
+	}
+	else
+	{
+		ifstream data(_feed.fileName);
+		_feed.subscribe(data);
+	}
+	auto stop = chrono::steady_clock::now();
+	_feed.seconds = chrono::duration<double>(stop - start).count();
+}
+
+void FeedDriver::PrintReport(ostream& _output) const
+{
+	for (auto& feed : feeds)
+	{
+		_output << feed.name << ": " << feed.lines << (feed.wire ? " messages in " : " lines in ") << feed.seconds << " s, "
+			<< static_cast<long>(feed.seconds > 0 ? feed.lines / feed.seconds : 0) << (feed.wire ? " messages/s" : " lines/s");
+		if (feed.wire)
+		{
+			if (feed.wire->IsRejected()) _output << ", rejected for other products than products.txt";
+			const WireSequence& sequence = feed.wire->GetSequence();
+			_output << ", " << sequence.GetGapCount() << " sequence gaps, " << sequence.GetMissedCount() << " missed";
+		}
+		_output << endl;
+	}
+	_output << "All feeds: " << wallSeconds << " s wall time" << endl;
+}
+
+double FeedDriver::GetWallSeconds() const
+{
+	return wallSeconds;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+*Generating the input files of the trading system for any number of products
+*usage: feedgenerator [products] [updates per product] [folder] [binary|text] [interval]
+*writes products.txt, prices.txt, marketdata.txt, trades.txt and inquiries.txt into the folder,
+*generated by default, with binary the wire messages of each feed into prices.wire and so on,
+*and given an interval in microseconds between the updates the timestamped feeds into
+*prices.timed.txt and so on; the trading system and feedpublisher are then run from that folder
+*@author: Chaofan Shen
+*/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <filesystem>
+#include "soa.hpp"
+#include "feedgenerator.hpp"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+	size_t products = argc > 1 ? stoul(argv[1]) : 7;
+	long updates = argc > 2 ? stol(argv[2]) : 10000;
+	string folder = argc > 3 ? argv[3] : "generated";
+	bool binary = argc > 4 && string(argv[4]) == "binary";
+	long long interval = argc > 5 ? stoll(argv[5]) : 0;
+
+	try
+	{
+		FeedGenerator generator(products, updates);
+		filesystem::create_directories(folder);
+
+		// the wire messages are encoded against the products of the folder
+		SetBondReferenceFile(folder + "/products.txt");
+
+		auto start = chrono::steady_clock::now();
+		generator.Generate(folder, binary, interval);
+		auto stop = chrono::steady_clock::now();
+
+		cout << "Generated " << products << " products with " << updates << " updates each in " << folder
+			<< (binary ? " (text and wire)" : "") << (interval > 0 ? " with timestamps" : "") << ", " << chrono::duration<double>(stop - start).count() << " s" << endl;
+	}
+	catch (const exception& e)
+	{
+		cout << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,310 @@
+/**
+ * feedgenerator.hpp
+ * Defines the generator of synthetic input files for any number of products and
+ * of updates of each, following the patterns of the shipped files, to test the
+ * trading system beyond the seven Treasuries.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef FEED_GENERATOR_HPP
+#define FEED_GENERATOR_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "soa.hpp"
+#include "bondanalytics.hpp"
+#include "snapshotstore.hpp"
+#include "wireprotocol.hpp"
+#include "boost/date_time/gregorian/gregorian.hpp"
+
+using namespace std;
+using namespace boost::gregorian;
+
+// Most products of a generated universe, the capacity of the snapshot stores
+const size_t FEED_MAX_PRODUCTS = SNAPSHOT_CHUNK_SIZE * SNAPSHOT_MAX_CHUNKS;
+
+// Trades and inquiries of each product, as in the shipped files
+const int FEED_TRADES_PER_PRODUCT = 10;
+const int FEED_INQUIRIES_PER_PRODUCT = 10;
+
+// Levels of each side of a generated order book
+const int FEED_BOOK_LEVELS = 5;
+
+/**
+ * Generator of the products.txt reference data and of the prices, market data, trades
+ * and inquiries feeds of a universe of bonds.
+ * The first seven bonds are the Treasuries, the next ones copies of them with a CUSIP
+ * of their own and a maturity a week later for each round of seven, in the same sectors.
+ * The feeds follow the specification of the shipped files: the mids oscillate between
+ * 99 and 101 by the smallest tick, the price spread alternates between 1/128 and 1/64,
+ * the top of book spread widens from 1/128 to 1/32 and back by 1/128 with each level one
+ * tick wider, the trades and inquiries alternate between BUY and SELL with quantities
+ * cycling from 1000000 to 5000000. The prices and order books go through the products
+ * in turn, one update of each at a time, so that the whole universe is in play.
+ */
+class FeedGenerator
+{
+
+public:
+
+	// ctor for a number of products and of price and order book updates of each
+	FeedGenerator(size_t _products, long _updates);
+
+	// Get the generated bonds
+	const vector<Bond>& GetBonds() const;
+
+	// Get the number of price and order book updates of each product
+	long GetUpdates() const;
+
+	// Write the reference data of the bonds, in the format read by LoadBondReference()
+	void WriteProducts(ostream& _output) const;
+
+	// Write the prices feed: CUSIP,mid,spread
+	// Given an interval in microseconds between the updates, each line starts with the time it is recorded at,
+	// for the replay engine, the trades and inquiries being spread evenly over the same time
+	void WritePrices(ostream& _output, long long _interval = 0) const;
+
+	// Write the market data feed, each order book as its lines: CUSIP,price,quantity,BID or OFFER
+	void WriteMarketData(ostream& _output, long long _interval = 0) const;
+
+	// Write the trades feed: CUSIP,trade id,price,book,quantity,BUY or SELL
+	void WriteTrades(ostream& _output, long long _interval = 0) const;
+
+	// Write the inquiries feed: inquiry id,CUSIP,BUY or SELL,quantity,price,RECEIVED
+	void WriteInquiries(ostream& _output, long long _interval = 0) const;
+
+	// Write products.txt and the four feeds into a folder, and their wire messages into
+	// prices.wire and so on if asked, which registers the bonds in the order of products.txt,
+	// and given an interval between the updates the timestamped feeds into prices.timed.txt and so on
+	void Generate(const string& _folder, bool _binary, long long _interval = 0) const;
+
+private:
+
+	// Get the mid of an update, in ticks, going up from 99 to 101 and back down
+	static PriceTicks GetMidTicks(long _update);
+
+	// Get the recorded time of a round out of a number of rounds spread over the updates
+	long long GetRoundTime(long long _interval, int _round, int _rounds) const;
+
+	// Encode the lines of a feed file as wire messages of a type, written one after the other
+	static void EncodeFeed(const string& _fileName, const string& _wireFileName, WireMessageType _type);
+
+	vector<Bond> bonds;
+	vector<string> sectors;
+	long updates;
+
+};
+
+FeedGenerator::FeedGenerator(size_t _products, long _updates)
+{
+	if (_products == 0 || _products > FEED_MAX_PRODUCTS)
+		throw out_of_range("The number of products must be between 1 and " + to_string(FEED_MAX_PRODUCTS));
+	updates = _updates;
+
+	// the Treasuries are the templates of the universe
+	vector<Bond> treasuries;
+	vector<string> treasurySectors;
+	istringstream defaults(DEFAULT_BOND_REFERENCE);
+	LineReader reader(defaults);
+	string_view line;
+	string sector;
+	while (reader.Next(line))
+	{
+		treasuries.push_back(ParseBondReference(line, sector));
+		treasurySectors.push_back(sector);
+	}
+
+	for (size_t i = 0; i < _products; i++)
+	{
+		const Bond& treasury = treasuries[i % treasuries.size()];
+		size_t round = i / treasuries.size();
+		if (round == 0) bonds.push_back(treasury);
+		else
+		{
+			ostringstream cusip;
+			cusip << "SYN" << setw(6) << setfill('0') << i;
+			bonds.push_back(Bond(cusip.str(), CUSIP, treasury.GetTicker(), treasury.GetCoupon(),
+				treasury.GetMaturityDate() + days(7 * static_cast<long>(round))));
+		}
+		sectors.push_back(treasurySectors[i % treasurySectors.size()]);
+	}
+}
+
+const vector<Bond>& FeedGenerator::GetBonds() const
+{
+	return bonds;
+}
+
+long FeedGenerator::GetUpdates() const
+{
+	return updates;
+}
+
+void FeedGenerator::WriteProducts(ostream& _output) const
+{
+	BondAnalytics analytics(bonds);
+	for (size_t i = 0; i < bonds.size(); i++)
+	{
+		const Bond& bond = bonds[i];
+		_output << bond.GetProductId() << "," << bond.GetTicker() << "," << fixed << setprecision(5) << bond.GetCoupon()
+			<< "," << to_iso_extended_string(bond.GetMaturityDate()).replace(4, 1, "/").replace(7, 1, "/") << ","
+			<< sectors[i] << "," << analytics.GetPV01(i) << "\n";
+	}
+}
+
+PriceTicks FeedGenerator::GetMidTicks(long _update)
+{
+	// 512 ticks up from 99 to 101, then 512 down
+	const long halfCycle = 2 * TICKS_PER_POINT;
+	long step = _update % (2 * halfCycle);
+	return 99 * TICKS_PER_POINT + (step <= halfCycle ? step : 2 * halfCycle - step);
+}
+
+long long FeedGenerator::GetRoundTime(long long _interval, int _round, int _rounds) const
+{
+	return _interval * updates * _round / _rounds;
+}
+
+void FeedGenerator::WritePrices(ostream& _output, long long _interval) const
+{
+	string line;
+	for (long j = 0; j < updates; j++)
+	{
+		// the spread alternates between 1/128 and 1/64
+		string time = _interval > 0 ? to_string(j * _interval) + "," : "";
+		string mid = FormatTicks(GetMidTicks(j));
+		string spread = FormatTicks(j % 2 == 0 ? 2 : 4);
+		for (const Bond& bond : bonds)
+		{
+			line.assign(time);
+			line += bond.GetProductId();
+			line += ",";
+			line += mid;
+			line += ",";
+			line += spread;
+			line += "\n";
+			_output << line;
+		}
+	}
+}
+
+void FeedGenerator::WriteMarketData(ostream& _output, long long _interval) const
+{
+	// the top of book spread in ticks, 1/128 widening to 1/32 and back
+	const PriceTicks spreads[] = { 2, 4, 6, 8, 6, 4 };
+	vector<string> levels(2 * FEED_BOOK_LEVELS);
+	for (long j = 0; j < updates; j++)
+	{
+		PriceTicks mid = GetMidTicks(j);
+		PriceTicks half = spreads[j % 6] / 2;
+		for (int k = 0; k < FEED_BOOK_LEVELS; k++)
+		{
+			string quantity = to_string((k + 1) * 10000000L);
+			levels[2 * k] = "," + FormatTicks(mid - half - k) + "," + quantity + ",BID\n";
+			levels[2 * k + 1] = "," + FormatTicks(mid + half + k) + "," + quantity + ",OFFER\n";
+		}
+
+		string time = _interval > 0 ? to_string(j * _interval) + "," : "";
+		for (const Bond& bond : bonds)
+			for (const string& level : levels) _output << time << bond.GetProductId() << level;
+	}
+}
+
+void FeedGenerator::WriteTrades(ostream& _output, long long _interval) const
+{
+	const string books[] = { "TRSY1", "TRSY2", "TRSY3" };
+	long tradeId = 0;
+	for (int j = 0; j < FEED_TRADES_PER_PRODUCT; j++)
+	{
+		// BUY at 99 and SELL at 100
+		bool isBuy = j % 2 == 0;
+		string time = _interval > 0 ? to_string(GetRoundTime(_interval, j, FEED_TRADES_PER_PRODUCT)) + "," : "";
+		for (const Bond& bond : bonds)
+		{
+			_output << time << bond.GetProductId() << ",TRADE-" << tradeId << "," << (isBuy ? "99-000" : "100-000") << ","
+				<< books[tradeId % 3] << "," << (j % 5 + 1) * 1000000L << "," << (isBuy ? "BUY" : "SELL") << "\n";
+			tradeId++;
+		}
+	}
+}
+
+void FeedGenerator::WriteInquiries(ostream& _output, long long _interval) const
+{
+	long inquiryId = 0;
+	for (int j = 0; j < FEED_INQUIRIES_PER_PRODUCT; j++)
+	{
+		bool isBuy = j % 2 == 0;
+		string time = _interval > 0 ? to_string(GetRoundTime(_interval, j, FEED_INQUIRIES_PER_PRODUCT)) + "," : "";
+		for (const Bond& bond : bonds)
+		{
+			_output << time << "INQUIRY" << inquiryId << "," << bond.GetProductId() << "," << (isBuy ? "BUY" : "SELL") << ","
+				<< (j % 5 + 1) * 1000000L << "," << (isBuy ? "99-000" : "100-000") << ",RECEIVED\n";
+			inquiryId++;
+		}
+	}
+}
+
+void FeedGenerator::Generate(const string& _folder, bool _binary, long long _interval) const
+{
+	const string prefix = _folder.empty() ? "" : _folder + "/";
+	{
+		ofstream products(prefix + "products.txt");
+		WriteProducts(products);
+		ofstream prices(prefix + "prices.txt");
+		WritePrices(prices);
+		ofstream marketData(prefix + "marketdata.txt");
+		WriteMarketData(marketData);
+		ofstream trades(prefix + "trades.txt");
+		WriteTrades(trades);
+		ofstream inquiries(prefix + "inquiries.txt");
+		WriteInquiries(inquiries);
+	}
+	if (_interval > 0)
+	{
+		ofstream prices(prefix + "prices.timed.txt");
+		WritePrices(prices, _interval);
+		ofstream marketData(prefix + "marketdata.timed.txt");
+		WriteMarketData(marketData, _interval);
+		ofstream trades(prefix + "trades.timed.txt");
+		WriteTrades(trades, _interval);
+		ofstream inquiries(prefix + "inquiries.timed.txt");
+		WriteInquiries(inquiries, _interval);
+	}
+	if (!_binary) return;
+
+	// the messages carry the product index, so the bonds must be registered in the order of products.txt
+	ifstream products(prefix + "products.txt");
+	ProductRegistry<Bond>& registry = LoadBondReference(GetBondRegistry(), products);
+	for (size_t i = 0; i < bonds.size(); i++)
+	{
+		if (registry.GetIndex(bonds[i].GetProductId()) != i)
+			throw logic_error("Other bonds are registered, cannot encode the feeds of " + prefix + "products.txt");
+	}
+
+	EncodeFeed(prefix + "prices.txt", prefix + "prices.wire", WIRE_PRICE);
+	EncodeFeed(prefix + "marketdata.txt", prefix + "marketdata.wire", WIRE_BOOK_SNAPSHOT);
+	EncodeFeed(prefix + "trades.txt", prefix + "trades.wire", WIRE_TRADE);
+	EncodeFeed(prefix + "inquiries.txt", prefix + "inquiries.wire", WIRE_INQUIRY);
+}
+
+void FeedGenerator::EncodeFeed(const string& _fileName, const string& _wireFileName, WireMessageType _type)
+{
+	ifstream data(_fileName);
+	ofstream output(_wireFileName, ios::binary);
+	LineReader reader(data);
+	WireEncoder encoder;
+	char message[WIRE_MAX_MESSAGE];
+	string_view line;
+	while (reader.Next(line))
+	{
+		size_t length = encoder.EncodeLine(_type, line, message);
+		if (length > 0) output.write(message, length);
+	}
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+*Listening to the executions and streams the trading system publishes, run as a separate process
+*usage: feedlistener [quiet], prints every execution and stream unless quiet
+*Text lines and wire messages are both understood, the sequence of wire messages is checked
+*@author: Chaofan Shen
+*/
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <string_view>
+#include "soa.hpp"
+#include "algoexecutionservice.hpp"
+#include "algostreamingservice.hpp"
+#include "wireprotocol.hpp"
+
+using namespace std;
+
+mutex outputLock;
+
+// Print what the trading system publishes on a port until it disconnects
+void ListenFeed(const string& _name, int _port, bool _quiet)
+{
+	int listener = ListenSocket(_port);
+	if (listener < 0)
+	{
+		lock_guard<mutex> guard(outputLock);
+		cout << "Cannot listen on port " << _port << " for " << _name << endl;
+		return;
+	}
+
+	int client = AcceptSocket(listener);
+	CloseSocket(listener);
+	if (client < 0) return;
+
+	SocketStreamBuf buffer;
+	buffer.Attach(client);
+
+	FrameHeader header;
+	const char* payload;
+	WireSequence sequence;
+	bool registryChecked = false;
+	bool rejected = false;
+	long lines = 0;
+	long long totalLatency = 0;
+	while (!rejected && buffer.NextFrame(header, payload))
+	{
+		long long latency = buffer.GetFrameReceiveTime() - buffer.GetFrameSendTime();
+		unique_lock<mutex> guard(outputLock, defer_lock);
+		if (!_quiet) guard.lock();
+
+		if (header.format == BINARY_FRAME)
+		{
+			const char* end = payload + header.length;
+			while (const WireHeader* message = NextWireMessage(payload, end))
+			{
+				// the products are known by their index, which only means the same product with the same registry
+				if (!registryChecked)
+				{
+					registryChecked = true;
+					rejected = !MatchesWireRegistry(*message);
+					if (rejected) break;
+					continue;
+				}
+				lines++;
+				totalLatency += latency;
+				sequence.Check(message->sequence);
+				if (_quiet) continue;
+
+				if (message->type == WIRE_EXECUTION)
+					cout << _name << ": " << ExecutionOrder<Bond>::Decode(GetWirePayload(*message)).print() << "\n";
+				else if (message->type == WIRE_STREAM)
+					cout << _name << ": " << PriceStream<Bond>::Decode(GetWirePayload(*message)).print() << "\n";
+			}
+			continue;
+		}
+
+		string_view text(payload, header.length);
+		while (!text.empty())
+		{
+			size_t eol = text.find('\n');
+			string_view line = text.substr(0, eol);
+			text.remove_prefix(eol == string_view::npos ? text.size() : eol + 1);
+			lines++;
+			totalLatency += latency;
+			if (!_quiet) cout << _name << ": " << line << "\n";
+		}
+	}
+
+	lock_guard<mutex> guard(outputLock);
+	if (rejected) cout << _name << ": rejected, the trading system has other products than products.txt" << endl;
+	cout << _name << ": " << lines << " received in " << buffer.GetFrameCount() << " frames, average wire latency "
+		<< (lines > 0 ? totalLatency / lines / 1000.0 : 0) << " us, " << sequence.GetGapCount() << " sequence gaps" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	bool quiet = argc > 1 && string(argv[1]) == "quiet";
+	GetBondRegistry();
+
+	cout << "Listening to executions on port " << EXECUTIONS_PORT << " and streams on port " << STREAMING_PORT << "." << endl;
+	thread executions(ListenFeed, "executions", EXECUTIONS_PORT, quiet);
+	thread streams(ListenFeed, "streams", STREAMING_PORT, quiet);
+
+	executions.join();
+	streams.join();
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+*Publishing the input files of the trading system over sockets, run as a separate process
+*usage: feedpublisher [lines per frame] [binary], then start the trading system with: test socket [host] [binary]
+*binary publishes wire messages, each line being parsed once here instead of by the trading system,
+*or read as they are from prices.wire and so on when feedgenerator has written them
+*@author: Chaofan Shen
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include "soa.hpp"
+#include "linereader.hpp"
+#include "wireprotocol.hpp"
+
+using namespace std;
+
+mutex outputLock;
+
+// Publish the wire messages of a file written by feedgenerator, return the number of messages
+long PublishWireFile(ifstream& _data, SocketPublisher& _publisher)
+{
+	vector<char> buffer(1 << 20);
+	size_t size = 0;
+	long messages = 0;
+	while (_publisher.IsConnected())
+	{
+		_data.read(buffer.data() + size, buffer.size() - size);
+		size += static_cast<size_t>(_data.gcount());
+		if (size == 0) break;
+
+		const char* position = buffer.data();
+		const char* end = buffer.data() + size;
+		while (const WireHeader* message = NextWireMessage(position, end))
+		{
+			_publisher.PublishMessage(reinterpret_cast<const char*>(message), message->length);
+			messages++;
+		}
+
+		// keep a message cut by the end of the block for the next block
+		size = end - position;
+		memmove(buffer.data(), position, size);
+		if (!_data) break;
+	}
+	return messages;
+}
+
+// Serve one file to the first client connecting to its port, as lines or encoded as wire messages of a type
+void PublishFeed(const string& _fileName, int _port, int _linesPerFrame, FrameFormat _format, WireMessageType _type)
+{
+	int listener = ListenSocket(_port);
+	if (listener < 0)
+	{
+		lock_guard<mutex> guard(outputLock);
+		cout << "Cannot listen on port " << _port << " for " << _fileName << endl;
+		return;
+	}
+
+	int client = AcceptSocket(listener);
+	CloseSocket(listener);
+	if (client < 0) return;
+
+	SocketPublisher publisher(_linesPerFrame, _format);
+	publisher.Attach(client);
+	WireEncoder encoder;
+	char message[WIRE_MAX_MESSAGE];
+	if (_format == BINARY_FRAME) publisher.PublishMessage(message, encoder.EncodeRegistry(message));
+
+	// the messages of the wire file go on the socket as they are
+	ifstream wireData(_fileName.substr(0, _fileName.rfind('.')) + ".wire", ios::binary);
+	if (_format == BINARY_FRAME && wireData)
+	{
+		auto start = chrono::steady_clock::now();
+		long messages = PublishWireFile(wireData, publisher);
+		publisher.Flush();
+		unsigned long long frames = publisher.GetFrameCount();
+		publisher.Close();
+		auto stop = chrono::steady_clock::now();
+
+		lock_guard<mutex> guard(outputLock);
+		cout << _fileName << ": " << messages << " messages from the wire file in " << frames << " frames, "
+			<< chrono::duration<double>(stop - start).count() << " s" << endl;
+		return;
+	}
+
+	ifstream data(_fileName);
+	LineReader reader(data);
+	string_view line;
+	long lines = 0;
+	auto start = chrono::steady_clock::now();
+	while (reader.Next(line) && publisher.IsConnected())
+	{
+		lines++;
+		if (_format == TEXT_FRAME)
+		{
+			publisher.PublishLine(line);
+			continue;
+		}
+
+		size_t length = encoder.EncodeLine(_type, line, message);
+		if (length > 0) publisher.PublishMessage(message, length);
+	}
+	publisher.Flush();
+	unsigned long long frames = publisher.GetFrameCount();
+	publisher.Close();
+	auto stop = chrono::steady_clock::now();
+
+	lock_guard<mutex> guard(outputLock);
+	cout << _fileName << ": " << lines << " lines";
+	if (_format == BINARY_FRAME) cout << " as " << encoder.GetSequence() << " messages";
+	cout << " in " << frames << " frames, " << chrono::duration<double>(stop - start).count() << " s" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int linesPerFrame = argc > 1 ? stoi(argv[1]) : 64;
+	FrameFormat format = (argc > 2 && string(argv[2]) == "binary") ? BINARY_FRAME : TEXT_FRAME;
+	GetBondRegistry();
+
+	cout << "Publishing prices, trades, inquiries and market data on ports "
+		<< PRICES_PORT << "-" << MARKET_DATA_PORT << "." << endl;
+	thread prices(PublishFeed, "prices.txt", PRICES_PORT, linesPerFrame, format, WIRE_PRICE);
+	thread trades(PublishFeed, "trades.txt", TRADES_PORT, linesPerFrame, format, WIRE_TRADE);
+	thread inquiries(PublishFeed, "inquiries.txt", INQUIRIES_PORT, linesPerFrame, format, WIRE_INQUIRY);
+	thread marketdata(PublishFeed, "marketdata.txt", MARKET_DATA_PORT, linesPerFrame, format, WIRE_BOOK_SNAPSHOT);
+
+	prices.join();
+	trades.join();
+	inquiries.join();
+	marketdata.join();
+	return 0;
+}
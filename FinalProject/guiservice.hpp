@@ -6,9 +6,17 @@
 #ifndef GUI_SERVICE_HPP
 #define GUI_SERVICE_HPP
 
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <sstream>
+#include <array>
+#include <atomic>
+#include <stdexcept>
 #include "soa.hpp"
+#include "instrumentation.hpp"
 #include "pricingservice.hpp"
-#include "boost/date_time/posix_time/posix_time.hpp"
+#include "bufferedfilewriter.hpp"
 
 using namespace std;
 
@@ -17,26 +25,50 @@ class GUIConnector;
 template<typename T>
 class GUIPricingListener;
 
+// Number of slots allocated at once by the GUI throttle
+const size_t GUI_CHUNK_SIZE = 64;
+
+// Number of chunks of the GUI throttle, which has slots for this many times GUI_CHUNK_SIZE products
+const size_t GUI_MAX_CHUNKS = 64;
+
+/**
+* Latest price of one product waiting for the next GUI tick.
+* Type T is the product type.
+*/
+template<typename T>
+struct GUISlot
+{
+	mutex lock;
+	Price<T> price;
+	bool updated = false;
+};
+
 /**
 * Service for outputing GUI with a certain throttle.
+* Prices are conflated per product: the pricing thread only overwrites the slot of
+* the product, and a timer thread publishes the products updated since the last tick
+* once per throttle interval, until the cap on the number of updates is reached.
+* The slots are allocated in chunks as the products are first priced and never move,
+* so the timer thread runs through them while the pricing thread adds more.
+* Whatever is pending is published once more when the service is destroyed.
 * Keyed on product identifier.
 * Type T is the product type.
 */
 template<typename T>
-class GUIService : Service<string, Price<T>>
+class GUIService : Service<string_view, Price<T>>
 {
 
 public:
 
 	// Constructor and destructor
-	GUIService();
+	GUIService(chrono::milliseconds _throttle = chrono::milliseconds(300), int _maxUpdates = 100);
 	~GUIService();
 
 	// Get data on our service given a key
-	Price<T>& GetData(string _key);
+	Price<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(Price<T>& _data);
+	void OnMessage(Price<T>&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<Price<T>>* _listener);
@@ -51,49 +83,85 @@ public:
 	GUIPricingListener<T>* GetListener();
 
 	// listens to streaming prices that should be throettled
-	void ThroettleStreamingPrices(Price<T>& _price);
+	void ThroettleStreamingPrices(const Price<T>& _price);
+
+	// Get the number of updates published so far
+	int GetUpdateCount() const;
 
 
 private:
 
-	unordered_map<string, Price<T>> guis;
+	// Loop of the timer thread
+	void Run();
+
+	// Publish the products updated since the last tick, return false once the cap is reached
+	bool PublishUpdates();
+
+	// Get the slot of a product index, allocating its chunk if needed, throw out_of_range past the capacity
+	GUISlot<T>& GetSlot(size_t _index);
+
+	struct SlotChunk
+	{
+		GUISlot<T> slots[GUI_CHUNK_SIZE];
+	};
+
+	ProductStore<Price<T>> guis;
 	vector<ServiceListener<Price<T>>*> listeners;
 	GUIConnector<T>* connector;
 	GUIPricingListener<T>* listener;
-	boost::posix_time::ptime lastTime;
-	boost::posix_time::time_duration throttle;
+	array<atomic<SlotChunk*>, GUI_MAX_CHUNKS> chunks{};
+	chrono::milliseconds throttle;
+	int maxUpdates;
+	atomic<int> updateCount; // written by the timer thread only, read by GetUpdateCount from any thread
+
+	mutex timerLock;
+	condition_variable timerWakeUp;
+	bool stopping;
+	thread timer;
 };
 
 template<typename T>
-GUIService<T>::GUIService()
+GUIService<T>::GUIService(chrono::milliseconds _throttle, int _maxUpdates)
 {
-	guis = unordered_map<string, Price<T>>();
+	guis = ProductStore<Price<T>>();
 	listeners = vector<ServiceListener<Price<T>>*>();
 	connector = new GUIConnector<T>(this);
 	listener = new GUIPricingListener<T>(this);
-	lastTime = boost::posix_time::microsec_clock::local_time();
-	throttle = boost::posix_time::millisec(300);
+	throttle = _throttle;
+	maxUpdates = _maxUpdates;
+	updateCount.store(0, memory_order_relaxed);
+	stopping = false;
+	timer = thread(&GUIService<T>::Run, this);
 }
 
 template<typename T>
 GUIService<T>::~GUIService() {
+	{
+		lock_guard<mutex> guard(timerLock);
+		stopping = true;
+	}
+	timerWakeUp.notify_one();
+	timer.join();
+
 	delete connector;
 	delete listener;
+	for (auto& chunk : chunks) delete chunk.load(memory_order_relaxed);
 }
 
 template<typename T>
-Price<T>& GUIService<T>::GetData(string _key)
+Price<T>& GUIService<T>::GetData(string_view _key)
 {
-	return guis[_key];
+	return guis.Get(_key);
 }
 
 template<typename T>
-void GUIService<T>::OnMessage(Price<T>& _data)
+void GUIService<T>::OnMessage(Price<T>&& _data)
 {
-	guis[_data.GetProduct().GetProductId()] = _data;
+	INSTRUMENT_HOP("GUIService::OnMessage");
+	const Price<T>& gui = guis.Put(move(_data));
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(gui); });
 }
 
 template<typename T>
@@ -121,17 +189,89 @@ GUIPricingListener<T>* GUIService<T>::GetListener()
 }
 
 template<typename T>
-void GUIService<T>::ThroettleStreamingPrices(Price<T>& _price) {
+void GUIService<T>::ThroettleStreamingPrices(const Price<T>& _price) {
+
+	// only keep the latest price of the product, the timer thread publishes it
+	GUISlot<T>& slot = GetSlot(_price.GetProduct().GetProductIndex());
+	lock_guard<mutex> guard(slot.lock);
+	slot.price = _price;
+	slot.updated = true;
+}
+
+template<typename T>
+int GUIService<T>::GetUpdateCount() const
+{
+	return updateCount.load(memory_order_relaxed);
+}
 
-	// calculate the time duration between two price updates
-	boost::posix_time::ptime curTime = boost::posix_time::microsec_clock::local_time();
-	auto time_duration = curTime - lastTime;
+template<typename T>
+void GUIService<T>::Run()
+{
+	unique_lock<mutex> guard(timerLock);
+	auto nextTick = chrono::steady_clock::now() + throttle;
+	while (!stopping)
+	{
+		if (timerWakeUp.wait_until(guard, nextTick, [&]() { return stopping; })) break;
+		nextTick += throttle;
+
+		guard.unlock();
+		bool open = PublishUpdates();
+		guard.lock();
+		if (!open) return;
+	}
 
-	if (time_duration > throttle) {
-		connector->PublishGUI(curTime, _price); // since we have timestamp, we add a new publish()
-		this->OnMessage(_price);
-		lastTime = curTime;
+	// publish what the last interval has left
+	guard.unlock();
+	PublishUpdates();
+}
+
+template<typename T>
+bool GUIService<T>::PublishUpdates()
+{
+	Timestamp curTime = GetTimestamp();
+	for (size_t i = 0; i < GUI_MAX_CHUNKS * GUI_CHUNK_SIZE; i++)
+	{
+		if (updateCount.load(memory_order_relaxed) >= maxUpdates) return false;
+
+		// the chunks not allocated yet have no product priced
+		SlotChunk* chunk = chunks[i / GUI_CHUNK_SIZE].load(memory_order_acquire);
+		if (chunk == nullptr)
+		{
+			i += GUI_CHUNK_SIZE - 1;
+			continue;
+		}
+		GUISlot<T>& slot = chunk->slots[i % GUI_CHUNK_SIZE];
+
+		Price<T> price;
+		{
+			lock_guard<mutex> guard(slot.lock);
+			if (!slot.updated) continue;
+			price = slot.price;
+			slot.updated = false;
+		}
+
+		connector->PublishGUI(curTime, price); // since we have timestamp, we add a new publish()
+		this->OnMessage(move(price));
+		updateCount.store(updateCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	}
+	return updateCount.load(memory_order_relaxed) < maxUpdates;
+}
+
+template<typename T>
+GUISlot<T>& GUIService<T>::GetSlot(size_t _index)
+{
+	size_t index = _index / GUI_CHUNK_SIZE;
+	if (index >= GUI_MAX_CHUNKS) throw out_of_range("Too many products for the GUI: " + to_string(_index));
+
+	SlotChunk* chunk = chunks[index].load(memory_order_acquire);
+	if (chunk == nullptr)
+	{
+		// the pricing threads of a GUI may race to allocate a chunk, the loser frees its own
+		SlotChunk* allocated = new SlotChunk();
+		if (chunks[index].compare_exchange_strong(chunk, allocated, memory_order_acq_rel)) chunk = allocated;
+		else delete allocated;
 	}
+	return chunk->slots[_index % GUI_CHUNK_SIZE];
 }
 
 /**
@@ -152,13 +292,13 @@ public:
 	GUIPricingListener(GUIService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(Price<T>& _data);
+	void ProcessAdd(const Price<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(Price<T>& _data);
+	void ProcessRemove(const Price<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(Price<T>& _data);
+	void ProcessUpdate(const Price<T>& _data);
 
 };
 
@@ -170,20 +310,21 @@ GUIPricingListener<T>::GUIPricingListener(GUIService<T>* _service)
 
 
 template<typename T>
-void GUIPricingListener<T>::ProcessAdd(Price<T>& _data)
+void GUIPricingListener<T>::ProcessAdd(const Price<T>& _data)
 {
 	service->ThroettleStreamingPrices(_data);
 }
 
 template<typename T>
-void GUIPricingListener<T>::ProcessRemove(Price<T>& _data) {}
+void GUIPricingListener<T>::ProcessRemove(const Price<T>& _data) {}
 
 template<typename T>
-void GUIPricingListener<T>::ProcessUpdate(Price<T>& _data) {}
+void GUIPricingListener<T>::ProcessUpdate(const Price<T>& _data) {}
 
 
 /**
 * GUI Connector publishing data to gui.txt.
+* The file stays open for the whole run and is written through a buffered writer.
 * Publish-only connector
 * Type T is the product type.
 */
@@ -194,6 +335,7 @@ class GUIConnector : public Connector<Price<T>>
 private:
 
 	GUIService<T>* service;
+	BufferedFileWriter* writer;
 
 public:
 
@@ -201,13 +343,13 @@ public:
 	GUIConnector(GUIService<T>* _service);
 
 	// Publish data to the Connector
-	void Publish(Price<T>& _data);
+	void Publish(const Price<T>& _data);
 
 	// Subscribe data from the Connector
-	void Subscribe(ifstream& _data);
+	void Subscribe(istream& _data);
 
 	// new Publish function since we have timestamp now
-	void PublishGUI(boost::posix_time::ptime time, Price<T> _data);
+	void PublishGUI(Timestamp time, const Price<T>& _data);
 
 };
 
@@ -215,26 +357,26 @@ template<typename T>
 GUIConnector<T>::GUIConnector(GUIService<T>* _service)
 {
 	service = _service;
+	writer = &BufferedFileWriter::GetWriter("gui.txt");
 }
 
 
 template<typename T>
-void GUIConnector<T>::Publish(Price<T>& _data){}
+void GUIConnector<T>::Publish(const Price<T>& _data){}
 
 template<typename T>
-void GUIConnector<T>::Subscribe(ifstream& _data) {}
+void GUIConnector<T>::Subscribe(istream& _data) {}
 
 template<typename T>
-void GUIConnector<T>::PublishGUI(boost::posix_time::ptime time, Price<T> _data)
+void GUIConnector<T>::PublishGUI(Timestamp time, const Price<T>& _data)
 {
 	string productId = _data.GetProduct().GetProductId();
 	double midPrice = _data.GetMid();
 	double spread = _data.GetBidOfferSpread();
 
-	ofstream GUIOutput;
-	GUIOutput.open("gui.txt", ios::app);
-	GUIOutput << time << ", " << "CUSIP: " << productId << ", " << midPrice << ", " << spread << endl;
-	GUIOutput.close();
+	stringstream GUIOutput;
+	GUIOutput << FormatTimestamp(time) << ", " << "CUSIP: " << productId << ", " << midPrice << ", " << spread << "\n";
+	writer->Write(GUIOutput.str());
 }
 
 
@@ -11,7 +11,8 @@
 #define HISTORICAL_DATA_SERVICE_HPP
 
 #include "soa.hpp"
-#include "boost/date_time/posix_time/posix_time.hpp"
+#include "instrumentation.hpp"
+#include "bufferedfilewriter.hpp"
 
 using namespace std;
 
@@ -22,26 +23,32 @@ class ToHistoricalDataListener;
 
 enum PersistType { POSITION, RISK, EXECUTION, STREAMING, INQUIRY };
 
+// Format of the persisted data, the binary journal is turned back into text by journaldecoder
+enum PersistFormat { TEXT, BINARY };
+
+// Get the output file of a persist data type
+string GetPersistFileName(PersistType type, PersistFormat format = TEXT);
+
 /**
  * Service for processing and persisting historical data to a persistent store.
  * Keyed on some persistent key.
  * Type T is the data type to persist.
  */
 template<typename T>
-class HistoricalDataService : Service<string, T>
+class HistoricalDataService : Service<string_view, T>
 {
 
 public:
 
 	// Constructor and destructor
-	HistoricalDataService(PersistType _type);
+	HistoricalDataService(PersistType _type, PersistFormat _format = TEXT);
 	~HistoricalDataService();
 
 	// Get data on our service given a key
-	T& GetData(string _key);
+	T& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(T& _data);
+	void OnMessage(T&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<T>* _listener);
@@ -58,27 +65,32 @@ public:
 	// Get the service type that historical data comes from
 	PersistType GetPersistType() const;
 
+	// Get the format data is persisted in
+	PersistFormat GetPersistFormat() const;
+
 	// Persist data to a store
-	void PersistData(string _persistKey, T& _data);
+	void PersistData(string_view _persistKey, const T& _data);
 
 private:
 
-	unordered_map<string, T> historicalDatas;
+	ProductStore<T> historicalDatas;
 	vector<ServiceListener<T>*> listeners;
 	HistoricalDataConnector<T>* connector;
 	ToHistoricalDataListener<T>* listener;
 	PersistType type;
+	PersistFormat format;
 
 };
 
 template<typename T>
-HistoricalDataService<T>::HistoricalDataService(PersistType _type)
+HistoricalDataService<T>::HistoricalDataService(PersistType _type, PersistFormat _format)
 {
-	historicalDatas = unordered_map<string, T>();
+	type = _type;
+	format = _format;
+	historicalDatas = ProductStore<T>();
 	listeners = vector<ServiceListener<T>*>();
 	connector = new HistoricalDataConnector<T>(this);
 	listener = new ToHistoricalDataListener<T>(this);
-	type = _type;
 }
 
 template<typename T>
@@ -88,17 +100,19 @@ HistoricalDataService<T>::~HistoricalDataService() {
 }
 
 template<typename T>
-T& HistoricalDataService<T>::GetData(string _key)
+T& HistoricalDataService<T>::GetData(string_view _key)
 {
-	return historicalDatas[_key];
+	return historicalDatas.Get(_key);
 }
 
 template<typename T>
-void HistoricalDataService<T>::OnMessage(T& _data)
+void HistoricalDataService<T>::OnMessage(T&& _data)
 { 
 	// No need to update to its listeners 
-	historicalDatas[_data.GetProduct().GetProductId()] = _data;
-	connector->Publish(_data);
+	connector->Publish(historicalDatas.Put(move(_data)));
+
+	// a data type is persisted to one file
+	INSTRUMENT_SINK(GetPersistFileName(type, format));
 }
 
 template<typename T>
@@ -132,15 +146,39 @@ PersistType HistoricalDataService<T>::GetPersistType() const
 }
 
 template<typename T>
-void HistoricalDataService<T>::PersistData(string _persistKey, T& _data)
+PersistFormat HistoricalDataService<T>::GetPersistFormat() const
 {
-	this->OnMessage(_data);
+	return format;
+}
+
+template<typename T>
+void HistoricalDataService<T>::PersistData(string_view _persistKey, const T& _data)
+{
+	this->OnMessage(T(_data));
 }
 
 
 
+// Get the output file of a persist data type
+string GetPersistFileName(PersistType type, PersistFormat format)
+{
+	string extension = format == BINARY ? ".bin" : ".txt";
+	switch (type) {
+	case POSITION: return "positions" + extension;
+	case RISK: return "risk" + extension;
+	case EXECUTION: return "executions" + extension;
+	case STREAMING: return "streaming" + extension;
+	case INQUIRY: return "allinquiries" + extension;
+	default: return "";
+	}
+}
+
+
 /**
-* Historical Data Connector publishing data to output .txt files
+* Historical Data Connector publishing data to output .txt files, or to .bin
+* journals of fixed-layout records (see journal.hpp) in BINARY format.
+* The file stays open for the whole run and is written through a buffered writer
+* shared by every connector of the same persist type.
 * Type T is the data type to persist.
 */
 template<typename T>
@@ -150,6 +188,8 @@ class HistoricalDataConnector : public Connector<T>
 private:
 
 	HistoricalDataService<T>* service;
+	BufferedFileWriter* writer;
+	PersistFormat format;
 
 public:
 
@@ -157,10 +197,10 @@ public:
 	HistoricalDataConnector(HistoricalDataService<T>* _service);
 
 	// Publish data to the Connector
-	void Publish(T& _data);
+	void Publish(const T& _data);
 
 	// Subscribe data from the Connector
-	void Subscribe(ifstream& _data);
+	void Subscribe(istream& _data);
 
 };
 
@@ -168,32 +208,35 @@ template<typename T>
 HistoricalDataConnector<T>::HistoricalDataConnector(HistoricalDataService<T>* _service)
 {
 	service = _service;
+	format = service->GetPersistFormat();
+	writer = &BufferedFileWriter::GetWriter(GetPersistFileName(service->GetPersistType(), format), format == BINARY);
 }
 
 template<typename T>
-void HistoricalDataConnector<T>::Publish(T& _data)
+void HistoricalDataConnector<T>::Publish(const T& _data)
 {
-	// Output different files according to persist data type
-	PersistType type = service->GetPersistType();
-	ofstream file;
-	string fileName;
-
-	if (type == POSITION) fileName = "positions.txt";
-	if (type == RISK) fileName = "risk.txt";
-	if (type == EXECUTION) fileName = "executions.txt";
-	if (type == STREAMING) fileName = "streaming.txt";
-	if (type == INQUIRY) fileName = "allinquiries.txt";
-	file.open(fileName, ios::app);
+	Timestamp timestamp = GetTimestamp();
+	if (format == BINARY)
+	{
+		// call back Encode() for each persist data type, timestamped in nanoseconds
+		char record[JOURNAL_MAX_RECORD];
+		size_t length = _data.Encode(ToEpochNanoseconds(timestamp), record);
+		writer->Write(string_view(record, length));
+		return;
+	}
 
 	// call back print() for each persist data type
 	// also output the timestamp
-	boost::posix_time::ptime curTime = boost::posix_time::microsec_clock::local_time();
-	file << curTime << ", " << _data.print() << endl;
-	file.close();
+	char stamp[MAX_TIMESTAMP_LENGTH];
+	string line(stamp, FormatTimestamp(timestamp, stamp));
+	line += ", ";
+	line += _data.print();
+	line += "\n";
+	writer->Write(line);
 }
 
 template<typename T>
-void HistoricalDataConnector<T>::Subscribe(ifstream& _data) {}
+void HistoricalDataConnector<T>::Subscribe(istream& _data) {}
 
 
 /**
@@ -214,13 +257,13 @@ public:
 	ToHistoricalDataListener(HistoricalDataService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(T& _data);
+	void ProcessAdd(const T& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(T& _data);
+	void ProcessRemove(const T& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(T& _data);
+	void ProcessUpdate(const T& _data);
 
 };
 
@@ -231,16 +274,16 @@ ToHistoricalDataListener<T>::ToHistoricalDataListener(HistoricalDataService<T>*
 }
 
 template<typename T>
-void ToHistoricalDataListener<T>::ProcessAdd(T& _data)
+void ToHistoricalDataListener<T>::ProcessAdd(const T& _data)
 {
 	service->PersistData("", _data);
 }
 
 template<typename T>
-void ToHistoricalDataListener<T>::ProcessRemove(T& _data) {}
+void ToHistoricalDataListener<T>::ProcessRemove(const T& _data) {}
 
 template<typename T>
-void ToHistoricalDataListener<T>::ProcessUpdate(T& _data) {}
+void ToHistoricalDataListener<T>::ProcessUpdate(const T& _data) {}
 
 
 #endif
\ No newline at end of file
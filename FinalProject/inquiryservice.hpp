@@ -9,12 +9,35 @@
 #define INQUIRY_SERVICE_HPP
 
 #include <algorithm>
+#include <cmath>
+#include <map>
 #include "soa.hpp"
+#include "instrumentation.hpp"
+#include "linereader.hpp"
+#include "wireprotocol.hpp"
+#include "timestamp.hpp"
+#include "snapshotstore.hpp"
+#include "latencyhistogram.hpp"
 #include "tradebookingservice.hpp"
+#include "pricingservice.hpp"
 
 // Various inqyury states
 enum InquiryState { RECEIVED, QUOTED, DONE, REJECTED, CUSTOMER_REJECTED };
 
+// Get the name of an inquiry state
+const char* GetInquiryStateName(InquiryState _state)
+{
+	switch (_state)
+	{
+	case RECEIVED: return "RECEIVED";
+	case QUOTED: return "QUOTED";
+	case DONE: return "DONE";
+	case REJECTED: return "REJECTED";
+	case CUSTOMER_REJECTED: return "CUSTOMER_REJECTED";
+	}
+	return "";
+}
+
 /**
  * Inquiry object modeling a customer inquiry from a client.
  * Type T is the product type.
@@ -27,6 +50,9 @@ public:
   // ctor for an inquiry
 	Inquiry() = default;
 	Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state);
+
+  // ctor for a product without inquiries yet
+	explicit Inquiry(const T &_product);
   
 
   // Get the inquiry ID
@@ -54,11 +80,17 @@ public:
   void SetState(InquiryState _state);
 
   // Print inquiry
-  string print();
+  string print() const;
+
+  // Write the inquiry as a binary journal record, return the record length
+  size_t Encode(long long _timestamp, char* _buffer) const;
+
+  // Read an inquiry back from a binary journal record
+  static Inquiry<T> Decode(const char* _buffer);
 
 private:
   string inquiryId;
-  T product;
+  const T* product = nullptr; // owned by the product registry
   Side side;
   long quantity;
   double price;
@@ -69,7 +101,7 @@ private:
 
 template<typename T>
 Inquiry<T>::Inquiry(string _inquiryId, const T& _product, Side _side, long _quantity, double _price, InquiryState _state) :
-	product(_product)
+	product(&_product)
 {
 	inquiryId = _inquiryId;
 	side = _side;
@@ -78,6 +110,12 @@ Inquiry<T>::Inquiry(string _inquiryId, const T& _product, Side _side, long _quan
 	state = _state;
 }
 
+template<typename T>
+Inquiry<T>::Inquiry(const T& _product) :
+	Inquiry("", _product, BUY, 0, 0, RECEIVED)
+{
+}
+
 template<typename T>
 const string& Inquiry<T>::GetInquiryId() const
 {
@@ -87,7 +125,7 @@ const string& Inquiry<T>::GetInquiryId() const
 template<typename T>
 const T& Inquiry<T>::GetProduct() const
 {
-	return product;
+	return *product;
 }
 
 template<typename T>
@@ -118,6 +156,7 @@ template<typename T>
 double Inquiry<T>::SetPrice(double _price)
 {
 	price = _price;
+	return price;
 }
 
 template<typename T>
@@ -127,7 +166,7 @@ void Inquiry<T>::SetState(InquiryState _state)
 }
 
 template<typename T>
-string Inquiry<T>::print()
+string Inquiry<T>::print() const
 {
 	stringstream output;
 	output << "Inquiry ID: " << inquiryId << ", ";
@@ -139,27 +178,174 @@ string Inquiry<T>::print()
 	output << "Price: " << GetQuotePrice(price) << ", ";
 	output << "Quantity: " << to_string(quantity) << ", ";
 
-	string tmps;
-	if (state == RECEIVED) tmps = "RECEIVED";
-	if (state == QUOTED) tmps = "QUOTED";
-	if (state == DONE) tmps = "DONE";
-	if (state == REJECTED) tmps = "REJECTED";
-	if (state == CUSTOMER_REJECTED) tmps = "CUSTOMER_REJECTED";
-	output << "State: " << tmps;
+	output << "State: " << GetInquiryStateName(state);
 
 	return output.str();
 }
 
+template<typename T>
+size_t Inquiry<T>::Encode(long long _timestamp, char* _buffer) const
+{
+	InquiryRecord record;
+	SetJournalHeader(record.header, INQUIRY_RECORD, sizeof(record), product->GetProductIndex(), _timestamp);
+	record.side = static_cast<uint8_t>(side);
+	record.state = static_cast<uint8_t>(state);
+	memset(record.reserved, 0, sizeof(record.reserved));
+	record.price = static_cast<int32_t>(ToTicks(price));
+	record.quantity = quantity;
+	SetJournalId(record.inquiryId, inquiryId);
+	return PutJournalRecord(record, _buffer);
+}
+
+template<typename T>
+Inquiry<T> Inquiry<T>::Decode(const char* _buffer)
+{
+	InquiryRecord record = GetJournalRecord<InquiryRecord>(_buffer);
+	const T& product = ProductRegistry<T>::GetInstance().Get(static_cast<size_t>(record.header.productIndex));
+	return Inquiry<T>(GetJournalId(record.inquiryId), product, static_cast<Side>(record.side),
+		static_cast<long>(record.quantity), ToPrice(record.price), static_cast<InquiryState>(record.state));
+}
+
+// Number of RECEIVED inquiries quoted at once by the inquiry service
+const size_t INQUIRY_BATCH_SIZE = 64;
+
+/**
+ * Quoting function of the inquiry service, pricing the RECEIVED inquiries in batches.
+ * Type T is the product type.
+ */
+template<typename T>
+class InquiryQuoter
+{
+
+public:
+
+	// Dtor
+	virtual ~InquiryQuoter() = default;
+
+	// Price a batch of inquiries into _prices, a price that is not a number rejects its inquiry
+	virtual void Quote(const Inquiry<T>* const* _inquiries, size_t _count, double* _prices) = 0;
+
+};
+
+/**
+ * Quoter quoting every inquiry the same price.
+ * Type T is the product type.
+ */
+template<typename T>
+class FixedPriceQuoter : public InquiryQuoter<T>
+{
+
+public:
+
+	// Ctor, quoting 100 by default
+	FixedPriceQuoter(double _price = 100.0);
+
+	// Price a batch of inquiries into _prices
+	void Quote(const Inquiry<T>* const* _inquiries, size_t _count, double* _prices);
+
+private:
+
+	double price;
+
+};
+
+template<typename T>
+FixedPriceQuoter<T>::FixedPriceQuoter(double _price)
+{
+	price = _price;
+}
+
+template<typename T>
+void FixedPriceQuoter<T>::Quote(const Inquiry<T>* const* _inquiries, size_t _count, double* _prices)
+{
+	fill(_prices, _prices + _count, price);
+}
+
+/**
+ * Quoter quoting the live mid of the product of each inquiry, listening to the Pricing service.
+ * The prices come on another thread than the inquiries, so the mids are kept in a
+ * snapshot store, written by the prices and read by the quotes without locking.
+ * A product not priced yet is quoted a fallback price.
+ * Type T is the product type.
+ */
+template<typename T>
+class MidPriceQuoter : public InquiryQuoter<T>, public ServiceListener<Price<T>>
+{
+
+public:
+
+	// Ctor, quoting 100 by default until a product is priced
+	MidPriceQuoter(double _fallbackPrice = 100.0);
+
+	// Price a batch of inquiries into _prices
+	void Quote(const Inquiry<T>* const* _inquiries, size_t _count, double* _prices);
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(const Price<T>& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(const Price<T>& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(const Price<T>& _data);
+
+private:
+
+	SnapshotStore<double> mids; // by product index
+	double fallbackPrice;
+
+};
+
+template<typename T>
+MidPriceQuoter<T>::MidPriceQuoter(double _fallbackPrice)
+{
+	fallbackPrice = _fallbackPrice;
+}
+
+template<typename T>
+void MidPriceQuoter<T>::Quote(const Inquiry<T>* const* _inquiries, size_t _count, double* _prices)
+{
+	for (size_t i = 0; i < _count; i++)
+	{
+		if (!mids.GetSnapshot(_inquiries[i]->GetProduct().GetProductIndex(), _prices[i])) _prices[i] = fallbackPrice;
+	}
+}
+
+template<typename T>
+void MidPriceQuoter<T>::ProcessAdd(const Price<T>& _data)
+{
+	mids.Publish(_data.GetProduct().GetProductIndex(), _data.GetMid());
+}
+
+template<typename T>
+void MidPriceQuoter<T>::ProcessRemove(const Price<T>& _data) {}
+
+template<typename T>
+void MidPriceQuoter<T>::ProcessUpdate(const Price<T>& _data)
+{
+	mids.Publish(_data.GetProduct().GetProductIndex(), _data.GetMid());
+}
+
 template<typename T>
 class InquiryConnector;
 
 /**
  * Service for customer inquirry objects.
  * Keyed on inquiry identifier 
+ * The inquiries go through their states in a work queue instead of calls back into
+ * OnMessage(): a RECEIVED inquiry is queued, and the queue is run in batches of up to
+ * INQUIRY_BATCH_SIZE inquiries, each batch priced by one call to the quoter, then each
+ * inquiry is QUOTED, published to the connector, and DONE, or REJECTED by the quoter.
+ * The queue is a vector read from a head index and emptied once it is run through, so it
+ * keeps its capacity and queues without allocating once it has grown to the largest burst.
+ * The listeners are sent the inquiry on each change of state, with the state it is in,
+ * so a quoted inquiry is persisted as RECEIVED, QUOTED and DONE.
+ * Each inquiry is stored once and changed in place.
+ * The latency from receiving an inquiry to each later state is kept in a histogram per state.
  * Type T is the product type.
  */
 template<typename T>
-class InquiryService : public Service<string,Inquiry <T> >
+class InquiryService : public Service<string_view, Inquiry <T> >
 {
 
 public:
@@ -171,10 +357,13 @@ public:
 	~InquiryService();
 
 	// Get data on our service given a key
-	Inquiry<T>& GetData(string _key);
+	Inquiry<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(Inquiry<T>& _data);
+	void OnMessage(Inquiry<T>&& _data);
+
+	// The callback that a Connector should invoke for a burst of new or updated data, moved from
+	void OnMessages(Inquiry<T>* _data, size_t _count);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<Inquiry<T>>* _listener);
@@ -185,55 +374,95 @@ public:
 	// Get the connector of the service
 	InquiryConnector<T>* GetConnector();
 
+	// Set the quoter pricing the inquiries, not owned, the service quotes 100 until it is set
+	void SetQuoter(InquiryQuoter<T>* _quoter);
+
 	// Send a quote back to the client
 	void SendQuote(const string& _inquiryId, double _price);
 
 	// Reject an inquiry from the client
 	void RejectInquiry(const string& _inquiryId);
 
+	// Get the histogram of the latency from receiving an inquiry to a state
+	const LatencyHistogram& GetStateLatency(InquiryState _state) const;
+
+	// Print the latency histograms of the states reached
+	void PrintReport(ostream& _output) const;
+
 private:
 
-	unordered_map<string, Inquiry<T>> inquiries;
+	// Inquiry waiting in the work queue, with the time it was received
+	struct PendingInquiry
+	{
+		Inquiry<T>* inquiry;
+		Timestamp received;
+	};
+
+	// Store an inquiry coming from a connector and queue it if it is RECEIVED
+	void Accept(Inquiry<T>&& _data, Timestamp _received);
+
+	// Quote the queued inquiries a batch at a time until the queue is empty
+	void ProcessQueue();
+
+	// Move an inquiry to a state and send it to the listeners, a negative _received time is not recorded
+	void Transition(Inquiry<T>& _inquiry, InquiryState _state, Timestamp _received);
+
+	map<string, Inquiry<T>, less<>> inquiries; // looked up by string_view
 	vector<ServiceListener<Inquiry<T>>*> listeners;
 	InquiryConnector<T>* connector;
+	FixedPriceQuoter<T>* defaultQuoter;
+	InquiryQuoter<T>* quoter;
+	vector<PendingInquiry> workQueue;
+	size_t workHead; // of the next inquiry of the work queue to run
+	bool isProcessing; // the queue is being run, further inquiries are only queued
+	vector<const Inquiry<T>*> batch;
+	vector<Timestamp> batchReceived;
+	vector<double> batchPrices;
+	LatencyHistogram stateLatencies[CUSTOMER_REJECTED + 1];
 };
 
 template<typename T>
 InquiryService<T>::InquiryService()
 {
-	inquiries = unordered_map<string, Inquiry<T>>();
+	inquiries = map<string, Inquiry<T>, less<>>();
 	listeners = vector<ServiceListener<Inquiry<T>>*>();
 	connector = new InquiryConnector<T>(this);
+	defaultQuoter = new FixedPriceQuoter<T>();
+	quoter = defaultQuoter;
+	workQueue.reserve(INQUIRY_BATCH_SIZE);
+	workHead = 0;
+	isProcessing = false;
 }
 
 template<typename T>
 InquiryService<T>::~InquiryService() {
 	delete connector;
+	delete defaultQuoter;
 }
 
 template<typename T>
-Inquiry<T>& InquiryService<T>::GetData(string _key)
+Inquiry<T>& InquiryService<T>::GetData(string_view _key)
 {
-	return inquiries[_key];
+	auto found = inquiries.find(_key);
+	if (found == inquiries.end()) found = inquiries.emplace(string(_key), Inquiry<T>()).first;
+	return found->second;
 }
 
 template<typename T>
-void InquiryService<T>::OnMessage(Inquiry<T>& _data)
+void InquiryService<T>::OnMessage(Inquiry<T>&& _data)
 {
-	InquiryState state = _data.GetState();
-	if (state == RECEIVED) {
-		// send back the quote
-		inquiries[_data.GetInquiryId()] = _data;
-		connector->Publish(_data);
+	INSTRUMENT_HOP("InquiryService::OnMessage");
+	Accept(move(_data), GetTimestamp());
+	ProcessQueue();
+}
 
-		// invoke all the listeners
-		for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
-	}
-	if (state == QUOTED) {
-		// When quoted, set state as DONE
-		_data.SetState(DONE);
-		inquiries[_data.GetInquiryId()] = _data;
-	}
+template<typename T>
+void InquiryService<T>::OnMessages(Inquiry<T>* _data, size_t _count)
+{
+	INSTRUMENT_HOP("InquiryService::OnMessages");
+	Timestamp received = GetTimestamp();
+	for (size_t i = 0; i < _count; i++) Accept(move(_data[i]), received);
+	ProcessQueue();
 }
 
 template<typename T>
@@ -254,27 +483,126 @@ InquiryConnector<T>* InquiryService<T>::GetConnector()
 	return connector;
 }
 
+template<typename T>
+void InquiryService<T>::SetQuoter(InquiryQuoter<T>* _quoter)
+{
+	quoter = _quoter;
+}
+
 template<typename T>
 void InquiryService<T>::SendQuote(const string& _inquiryId, double _price)
 {
 	Inquiry<T>& inquiry = inquiries[_inquiryId];
-	InquiryState state = inquiry.GetState();
-	if (state == RECEIVED) {
-		inquiry.SetPrice(_price);
-		this->OnMessage(inquiry);
-	}
+	if (inquiry.GetState() != RECEIVED) return;
+
+	// a queued inquiry quoted here is skipped by the queue, which only quotes RECEIVED ones
+	inquiry.SetPrice(_price);
+	Transition(inquiry, QUOTED, -1);
+	connector->Publish(inquiry);
+	Transition(inquiry, DONE, -1);
 }
 
 template<typename T>
 void InquiryService<T>::RejectInquiry(const string& _inquiryId)
 {
 	Inquiry<T>& inquiry = inquiries[_inquiryId];
-	inquiry.SetState(REJECTED);
+	if (inquiry.GetState() == RECEIVED || inquiry.GetState() == QUOTED) Transition(inquiry, REJECTED, -1);
+}
+
+template<typename T>
+const LatencyHistogram& InquiryService<T>::GetStateLatency(InquiryState _state) const
+{
+	return stateLatencies[_state];
+}
+
+template<typename T>
+void InquiryService<T>::PrintReport(ostream& _output) const
+{
+	for (int state = QUOTED; state <= CUSTOMER_REJECTED; state++)
+	{
+		const LatencyHistogram& latency = stateLatencies[state];
+		if (latency.GetCount() > 0)
+			latency.PrintReport(_output, string("inquiries RECEIVED to ") + GetInquiryStateName(static_cast<InquiryState>(state)));
+	}
+}
+
+template<typename T>
+void InquiryService<T>::Accept(Inquiry<T>&& _data, Timestamp _received)
+{
+	Inquiry<T>& inquiry = inquiries[_data.GetInquiryId()];
+	inquiry = move(_data);
+
+	// invoke all the listeners
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(inquiry); });
+
+	InquiryState state = inquiry.GetState();
+	if (state == RECEIVED) workQueue.push_back(PendingInquiry{ &inquiry, _received });
+	if (state == QUOTED) Transition(inquiry, DONE, _received);
+}
+
+template<typename T>
+void InquiryService<T>::ProcessQueue()
+{
+	// a listener or the connector adding an inquiry while the queue runs only queues it
+	if (isProcessing) return;
+	isProcessing = true;
+
+	while (workHead < workQueue.size())
+	{
+		// the inquiries quoted or rejected since they were queued are skipped
+		batch.clear();
+		batchReceived.clear();
+		while (workHead < workQueue.size() && batch.size() < INQUIRY_BATCH_SIZE)
+		{
+			PendingInquiry pending = workQueue[workHead++];
+			if (pending.inquiry->GetState() != RECEIVED) continue;
+			batch.push_back(pending.inquiry);
+			batchReceived.push_back(pending.received);
+		}
+		if (batch.empty()) continue;
+
+		batchPrices.resize(batch.size());
+		quoter->Quote(batch.data(), batch.size(), batchPrices.data());
+
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			// the batch holds the stored inquiries, only const to the quoter
+			Inquiry<T>& inquiry = const_cast<Inquiry<T>&>(*batch[i]);
+			if (inquiry.GetState() != RECEIVED) continue;
+			if (isnan(batchPrices[i]))
+			{
+				Transition(inquiry, REJECTED, batchReceived[i]);
+				continue;
+			}
+
+			inquiry.SetPrice(batchPrices[i]);
+			Transition(inquiry, QUOTED, batchReceived[i]);
+			connector->Publish(inquiry);
+			Transition(inquiry, DONE, batchReceived[i]);
+		}
+	}
+
+	// the queue is run through, so it is refilled from the start of its storage
+	workQueue.clear();
+	workHead = 0;
+	isProcessing = false;
+}
+
+template<typename T>
+void InquiryService<T>::Transition(Inquiry<T>& _inquiry, InquiryState _state, Timestamp _received)
+{
+	_inquiry.SetState(_state);
+	if (_received >= 0) stateLatencies[_state].Record(GetTimestamp() - _received);
+
+	// invoke all the listeners
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_inquiry); });
 }
 
 
 /**
 * Inquiry Connector (Subscribe and publish)
+* The inquiries read are handed to the service in bursts of up to INQUIRY_BATCH_SIZE,
+* a burst ending early when the next inquiry is not read yet, so none waits for the input.
 * Type T is the product type.
 */
 template<typename T>
@@ -283,7 +611,11 @@ class InquiryConnector : public Connector<Inquiry<T>>
 
 private:
 
+	// Hand the inquiries gathered to the service
+	void FlushBurst();
+
 	InquiryService<T>* service;
+	vector<Inquiry<T>> burst;
 
 public:
 
@@ -291,10 +623,13 @@ public:
 	InquiryConnector(InquiryService<T>* _service);
 
 	// Publish data to the Connector
-	void Publish(Inquiry<T>& _data);
+	void Publish(const Inquiry<T>& _data);
 
 	// Subscribe data from the Connector
-	void Subscribe(ifstream& _data);
+	void Subscribe(istream& _data);
+
+	// Subscribe the messages of the binary frames of a socket
+	void SubscribeWire(WireReader& _reader);
 };
 
 template<typename T>
@@ -305,47 +640,66 @@ InquiryConnector<T>::InquiryConnector(InquiryService<T>* _service)
 
 
 template<typename T>
-void InquiryConnector<T>::Publish(Inquiry<T>& _data)
+void InquiryConnector<T>::Publish(const Inquiry<T>& _data)
 {
-	_data.SetState(QUOTED); // set the new state
-	service->OnMessage(_data); // send back to service
+	// the quote would go back to the client here, the inquiries are read from a feed with no way back
 }
 
 template<typename T>
-void InquiryConnector<T>::Subscribe(ifstream& _data)
+void InquiryConnector<T>::FlushBurst()
 {
-	string line;
-	while (getline(_data, line))
-	{
-		stringstream inquiryInfo(line);
-		string p;
-		vector<string> inquiryData;
-		while (getline(inquiryInfo, p, ','))
-		{
-			inquiryData.push_back(p);
-		}
-
-		string inquiryId = inquiryData[0];
-		string productId = inquiryData[1];
-		long quantity = stol(inquiryData[3]);
-		double price = GetNormalPrice(inquiryData[4]);
+	if (burst.empty()) return;
+	service->OnMessages(burst.data(), burst.size());
+	burst.clear();
+}
 
-		InquiryState state;
-		if (inquiryData[5] == "RECEIVED") state = RECEIVED;
-		else if (inquiryData[5] == "QUOTED") state = QUOTED;
-		else if (inquiryData[5] == "DONE") state = DONE;
-		else if (inquiryData[5] == "REJECTED") state = REJECTED;
-		else if (inquiryData[5] == "CUSTOMER_REJECTED") state = CUSTOMER_REJECTED;
+template<typename T>
+void InquiryConnector<T>::Subscribe(istream& _data)
+{
+	// tokenize each line in place, reusing the id string from one inquiry to the next
+	LineReader reader(_data);
+	string_view line;
+	string inquiryId;
+	while (reader.Next(line))
+	{
+		INSTRUMENT_ORIGIN();
+		inquiryId.assign(NextField(line));
+		const T& product = GetProductType(NextField(line));
+		Side side = (NextField(line) == "SELL") ? SELL : BUY;
+		long quantity = ParseQuantity(NextField(line));
+		double price = GetNormalPrice(NextField(line));
+
+		string_view stateName = NextField(line);
+		InquiryState state = RECEIVED;
+		if (stateName == "QUOTED") state = QUOTED;
+		else if (stateName == "DONE") state = DONE;
+		else if (stateName == "REJECTED") state = REJECTED;
+		else if (stateName == "CUSTOMER_REJECTED") state = CUSTOMER_REJECTED;
+
+		burst.emplace_back(inquiryId, product, side, quantity, price, state);
+
+		if (burst.size() == INQUIRY_BATCH_SIZE || !reader.HasLine()) FlushBurst();
+	}
+	FlushBurst();
+}
 
-		T product = GetProductType(productId);
+template<typename T>
+void InquiryConnector<T>::SubscribeWire(WireReader& _reader)
+{
+	const WireHeader* message;
+	while (_reader.Next(message))
+	{
+		INSTRUMENT_ORIGIN();
+		const T* product = GetWireProduct<T>(*message);
+		if (message->type != WIRE_INQUIRY || !product) continue;
 
-		Side side;
-		if (inquiryData[2] == "BUY") side = BUY;
-		if (inquiryData[2] == "SELL") side = SELL;
-		Inquiry<T> inquiry(inquiryId, product, side, quantity, price, state);
+		const WireInquiry& inquiry = GetWireMessage<WireInquiry>(*message);
+		burst.emplace_back(string(GetWireId(inquiry.inquiryId)), *product, static_cast<Side>(inquiry.side),
+			static_cast<long>(inquiry.quantity), ToPrice(inquiry.price), static_cast<InquiryState>(inquiry.state));
 
-		service->OnMessage(inquiry);
+		if (burst.size() == INQUIRY_BATCH_SIZE || !_reader.HasMessage()) FlushBurst();
 	}
+	FlushBurst();
 }
 
 #endif
@@ -0,0 +1,360 @@
+/**
+ * instrumentation.hpp
+ * Defines the latency instrumentation of the hops of the pipelines, compiled in
+ * with -DINSTRUMENT_PIPELINE and compiled out otherwise.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "timestamp.hpp"
+#include "latencyhistogram.hpp"
+
+using namespace std;
+
+/*
+	The connectors mark the origin of the data of a thread when they read a line or
+	a message, and each hop (a service taking the data through OnMessage() or one of
+	its pipeline entry points) takes one timestamp and records the latency from that
+	origin. The latency of a hop is thus the time from the wire to the hop, and the
+	latency of a sink (the historical data services writing the files) the end-to-end
+	latency. The origin is carried to the thread of an AsyncListener with each event.
+
+	With INSTRUMENT_PIPELINE undefined, the macros and the origin carried by the
+	events are compiled out.
+*/
+#ifdef INSTRUMENT_PIPELINE
+
+// Mark the origin of the data handled next by this thread
+#define INSTRUMENT_ORIGIN() PipelineInstrumentation::SetOrigin(GetTimestamp())
+
+// Record a hop of the data through a stage, named once by a string expression
+#define INSTRUMENT_HOP(_name) do { \
+	static const int instrumentedStage = PipelineInstrumentation::GetInstance().Register(_name, false); \
+	PipelineInstrumentation::Record(instrumentedStage); } while (0)
+
+// Record the data leaving the system through a sink, its latency being the end-to-end latency
+#define INSTRUMENT_SINK(_name) do { \
+	static const int instrumentedStage = PipelineInstrumentation::GetInstance().Register(_name, true); \
+	PipelineInstrumentation::Record(instrumentedStage); } while (0)
+
+// Save the origin of this thread into a variable, to be carried to another thread
+#define INSTRUMENT_SAVE_ORIGIN(_origin) ((_origin) = PipelineInstrumentation::GetOrigin())
+
+// Make the origin carried from another thread the origin of this thread
+#define INSTRUMENT_RESTORE_ORIGIN(_origin) PipelineInstrumentation::SetOrigin(_origin)
+
+#else
+
+#define INSTRUMENT_ORIGIN() do {} while (0)
+#define INSTRUMENT_HOP(_name) do {} while (0)
+#define INSTRUMENT_SINK(_name) do {} while (0)
+#define INSTRUMENT_SAVE_ORIGIN(_origin) do {} while (0)
+#define INSTRUMENT_RESTORE_ORIGIN(_origin) do {} while (0)
+
+#endif
+
+/**
+ * Counts and latencies of a stage, merged from the threads going through it.
+ */
+struct StageStatistics
+{
+	string name;
+	bool isSink = false;
+	unsigned long long count = 0;
+	Timestamp first = 0; // time of the first hop
+	Timestamp last = 0; // time of the last hop
+	LatencyHistogram latency; // from the origin, of the hops with an origin
+
+	// Get the number of hops per second between the first and the last one
+	double GetThroughput() const;
+};
+
+/**
+ * Registry of the instrumented stages and of their statistics.
+ * Each thread records into tables of its own, so that the threads do not share
+ * cache lines; a table is locked by its thread on each hop, which costs little as
+ * the lock is only contended while a report is merging the tables.
+ * The tables of the threads which have ended are kept for the report of the run.
+ */
+class PipelineInstrumentation
+{
+
+public:
+
+	// Get the instrumentation
+	static PipelineInstrumentation& GetInstance();
+
+	// Get the id of a stage, adding the stage if it is new
+	int Register(const string& _name, bool _isSink);
+
+	// Record a hop through a stage by this thread, at the current time
+	static void Record(int _stage);
+
+	// Set the origin of the data handled next by this thread, 0 for none
+	static void SetOrigin(Timestamp _origin);
+
+	// Get the origin of the data handled by this thread
+	static Timestamp GetOrigin();
+
+	// Get the statistics of every stage, merged from all the threads
+	vector<StageStatistics> GetStatistics() const;
+
+	// Print the count, throughput and latency from the origin of each stage, in the order of their median latency
+	void PrintReport(ostream& _output) const;
+
+	// Print the same statistics as a JSON document, in nanoseconds
+	void PrintJson(ostream& _output) const;
+
+	// Forget every hop recorded so far
+	void Reset();
+
+private:
+
+	PipelineInstrumentation() = default;
+	PipelineInstrumentation(const PipelineInstrumentation&) = delete;
+	PipelineInstrumentation& operator=(const PipelineInstrumentation&) = delete;
+
+	// Counts and latencies of a stage on one thread
+	struct StageRecord
+	{
+		unsigned long long count = 0;
+		Timestamp first = 0;
+		Timestamp last = 0;
+		LatencyHistogram latency;
+	};
+
+	// Records of the stages on one thread, by stage id
+	struct ThreadTable
+	{
+		mutex lock;
+		vector<unique_ptr<StageRecord>> stages;
+	};
+
+	// Get the table of this thread, adding it on first use
+	ThreadTable& GetThreadTable();
+
+	mutable mutex lock; // guards the stages and the list of tables
+	vector<string> names;
+	vector<bool> isSinks;
+	vector<unique_ptr<ThreadTable>> tables;
+
+	static thread_local ThreadTable* threadTable;
+	static thread_local Timestamp origin;
+
+};
+
+/**
+ * Reporter printing the instrumentation report at a fixed interval on a thread of its own until it is destroyed.
+ */
+class PeriodicReporter
+{
+
+public:
+
+	// ctor starting the reporter thread
+	PeriodicReporter(ostream& _output, chrono::milliseconds _interval);
+
+	// dtor stopping the reporter thread
+	~PeriodicReporter();
+
+private:
+
+	PeriodicReporter(const PeriodicReporter&) = delete;
+	PeriodicReporter& operator=(const PeriodicReporter&) = delete;
+
+	// Loop of the reporter thread
+	void Run();
+
+	ostream& output;
+	chrono::milliseconds interval;
+	mutex lock;
+	condition_variable wakeUp;
+	bool stopping;
+	thread worker;
+
+};
+
+thread_local PipelineInstrumentation::ThreadTable* PipelineInstrumentation::threadTable = nullptr;
+thread_local Timestamp PipelineInstrumentation::origin = 0;
+
+double StageStatistics::GetThroughput() const
+{
+	if (count < 2 || last <= first) return 0;
+	return (count - 1) * double(NANOSECONDS_PER_SECOND) / double(last - first);
+}
+
+PipelineInstrumentation& PipelineInstrumentation::GetInstance()
+{
+	static PipelineInstrumentation instrumentation;
+	return instrumentation;
+}
+
+int PipelineInstrumentation::Register(const string& _name, bool _isSink)
+{
+	lock_guard<mutex> guard(lock);
+	auto found = find(names.begin(), names.end(), _name);
+	if (found != names.end()) return static_cast<int>(found - names.begin());
+
+	names.push_back(_name);
+	isSinks.push_back(_isSink);
+	return static_cast<int>(names.size() - 1);
+}
+
+void PipelineInstrumentation::Record(int _stage)
+{
+	Timestamp now = GetTimestamp();
+	ThreadTable& table = GetInstance().GetThreadTable();
+
+	lock_guard<mutex> guard(table.lock);
+	if (static_cast<size_t>(_stage) >= table.stages.size()) table.stages.resize(_stage + 1);
+	unique_ptr<StageRecord>& record = table.stages[_stage];
+	if (!record) record.reset(new StageRecord());
+
+	if (record->count == 0) record->first = now;
+	record->last = now;
+	record->count++;
+	if (origin > 0) record->latency.Record(now - origin);
+}
+
+void PipelineInstrumentation::SetOrigin(Timestamp _origin)
+{
+	origin = _origin;
+}
+
+Timestamp PipelineInstrumentation::GetOrigin()
+{
+	return origin;
+}
+
+PipelineInstrumentation::ThreadTable& PipelineInstrumentation::GetThreadTable()
+{
+	if (threadTable == nullptr)
+	{
+		lock_guard<mutex> guard(lock);
+		tables.emplace_back(new ThreadTable());
+		threadTable = tables.back().get();
+	}
+	return *threadTable;
+}
+
+vector<StageStatistics> PipelineInstrumentation::GetStatistics() const
+{
+	lock_guard<mutex> guard(lock);
+	vector<StageStatistics> statistics(names.size());
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		statistics[i].name = names[i];
+		statistics[i].isSink = isSinks[i];
+	}
+
+	for (const auto& table : tables)
+	{
+		lock_guard<mutex> tableGuard(table->lock);
+		for (size_t i = 0; i < table->stages.size() && i < statistics.size(); i++)
+		{
+			const StageRecord* record = table->stages[i].get();
+			if (record == nullptr || record->count == 0) continue;
+
+			StageStatistics& stage = statistics[i];
+			if (stage.count == 0 || record->first < stage.first) stage.first = record->first;
+			if (record->last > stage.last) stage.last = record->last;
+			stage.count += record->count;
+			stage.latency.Merge(record->latency);
+		}
+	}
+
+	// along a path the latency from the origin grows from one hop to the next,
+	// the stages on threads with no origin, such as the GUI throttle, go last
+	stable_sort(statistics.begin(), statistics.end(), [](const StageStatistics& _a, const StageStatistics& _b) {
+		if ((_a.latency.GetCount() == 0) != (_b.latency.GetCount() == 0)) return _b.latency.GetCount() == 0;
+		return _a.latency.GetPercentile(50) < _b.latency.GetPercentile(50); });
+	return statistics;
+}
+
+void PipelineInstrumentation::PrintReport(ostream& _output) const
+{
+	vector<StageStatistics> statistics = GetStatistics();
+	_output << "Pipeline latency from the wire, by stage:" << endl;
+	for (const StageStatistics& stage : statistics)
+	{
+		if (stage.count == 0) continue;
+		_output << (stage.isSink ? "  end to end " : "  ") << stage.name << ": " << stage.count << " hops, "
+			<< static_cast<long>(stage.GetThroughput()) << "/s";
+		if (stage.latency.GetCount() > 0)
+		{
+			_output << ", p50 " << stage.latency.GetPercentile(50) / 1000.0 << " us, p99 "
+				<< stage.latency.GetPercentile(99) / 1000.0 << " us, p99.9 " << stage.latency.GetPercentile(99.9) / 1000.0
+				<< " us, max " << stage.latency.GetMax() / 1000.0 << " us";
+		}
+		_output << endl;
+	}
+}
+
+void PipelineInstrumentation::PrintJson(ostream& _output) const
+{
+	vector<StageStatistics> statistics = GetStatistics();
+	_output << "{\"stages\":[";
+	bool isFirst = true;
+	for (const StageStatistics& stage : statistics)
+	{
+		if (stage.count == 0) continue;
+		if (!isFirst) _output << ",";
+		isFirst = false;
+
+		// the stage names are the names of services and files, which need no escaping
+		const LatencyHistogram& latency = stage.latency;
+		_output << "\n{\"name\":\"" << stage.name << "\",\"sink\":" << (stage.isSink ? "true" : "false")
+			<< ",\"count\":" << stage.count << ",\"perSecond\":" << static_cast<long>(stage.GetThroughput())
+			<< ",\"samples\":" << latency.GetCount() << ",\"meanNs\":" << static_cast<long long>(latency.GetMean())
+			<< ",\"p50Ns\":" << latency.GetPercentile(50) << ",\"p99Ns\":" << latency.GetPercentile(99)
+			<< ",\"p999Ns\":" << latency.GetPercentile(99.9) << ",\"maxNs\":" << latency.GetMax() << "}";
+	}
+	_output << "\n]}" << endl;
+}
+
+void PipelineInstrumentation::Reset()
+{
+	lock_guard<mutex> guard(lock);
+	for (const auto& table : tables)
+	{
+		lock_guard<mutex> tableGuard(table->lock);
+		table->stages.clear();
+	}
+}
+
+PeriodicReporter::PeriodicReporter(ostream& _output, chrono::milliseconds _interval) :
+	output(_output), interval(_interval)
+{
+	stopping = false;
+	worker = thread(&PeriodicReporter::Run, this);
+}
+
+PeriodicReporter::~PeriodicReporter()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wakeUp.notify_one();
+	worker.join();
+}
+
+void PeriodicReporter::Run()
+{
+	unique_lock<mutex> guard(lock);
+	while (!wakeUp.wait_for(guard, interval, [this]() { return stopping; }))
+		PipelineInstrumentation::GetInstance().PrintReport(output);
+}
+
+#endif
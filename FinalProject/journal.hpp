@@ -0,0 +1,182 @@
+/**
+ * journal.hpp
+ * Defines the fixed-layout binary journal records persisted by the
+ * HistoricalDataService as a compact alternative to the .txt files.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <algorithm>
+#include "pricecodec.hpp"
+
+using namespace std;
+
+/*
+	Every record starts with a JournalHeader followed by the payload of its type.
+	All the fields are little-endian and the structures are packed, so a record is
+	written and read back with a single memcpy on the platforms we run on.
+	Prices are stored as 1/256th ticks, the same precision as the text files.
+*/
+
+// Type of a journal record, one per persisted data type
+enum JournalRecordType { POSITION_RECORD = 1, RISK_RECORD, EXECUTION_RECORD, STREAMING_RECORD, INQUIRY_RECORD, SECTOR_RISK_RECORD };
+
+// Length of the identifier fields, longer identifiers are truncated
+const int JOURNAL_ID_LENGTH = 16;
+
+// Length of a book name in a position record
+const int JOURNAL_BOOK_LENGTH = 8;
+
+// Largest number of books in a position record
+const int JOURNAL_MAX_BOOKS = 32;
+
+#pragma pack(push, 1)
+
+// Header of every record
+struct JournalHeader
+{
+	uint16_t length; // length of the record including this header
+	uint8_t type; // a JournalRecordType
+	uint8_t reserved;
+	uint32_t productIndex; // dense index of the product in the product registry
+	int64_t timestamp; // nanoseconds since the epoch
+};
+
+// Position of a product in one book
+struct JournalBookPosition
+{
+	char book[JOURNAL_BOOK_LENGTH];
+	int64_t quantity;
+};
+
+// Position across books, variable number of books
+struct PositionRecord
+{
+	JournalHeader header;
+	uint8_t bookCount;
+	uint8_t reserved[3];
+	JournalBookPosition books[JOURNAL_MAX_BOOKS];
+};
+
+// PV01 risk, of a product in the product registry or of a sector in the sector registry
+struct RiskRecord
+{
+	JournalHeader header;
+	double pv01;
+	int64_t quantity;
+};
+
+// Execution order
+struct ExecutionRecord
+{
+	JournalHeader header;
+	uint8_t side;
+	uint8_t orderType;
+	uint8_t isChildOrder;
+	uint8_t reserved;
+	int32_t price; // ticks
+	int64_t visibleQuantity;
+	int64_t hiddenQuantity;
+	char orderId[JOURNAL_ID_LENGTH];
+	char parentOrderId[JOURNAL_ID_LENGTH];
+};
+
+// Two-way price stream, streamed quantities are 32-bit
+struct StreamingRecord
+{
+	JournalHeader header;
+	int32_t bidPrice; // ticks
+	int32_t bidVisibleQuantity;
+	int32_t bidHiddenQuantity;
+	int32_t offerPrice; // ticks
+	int32_t offerVisibleQuantity;
+	int32_t offerHiddenQuantity;
+};
+
+// Customer inquiry
+struct InquiryRecord
+{
+	JournalHeader header;
+	uint8_t side;
+	uint8_t state;
+	uint8_t reserved[2];
+	int32_t price; // ticks
+	int64_t quantity;
+	char inquiryId[JOURNAL_ID_LENGTH];
+};
+
+#pragma pack(pop)
+
+// Largest record in the journal
+const size_t JOURNAL_MAX_RECORD = sizeof(PositionRecord);
+
+
+/*
+	Helpers for the Encode() and Decode() of the persisted data types
+*/
+
+// Fill in a record header
+void SetJournalHeader(JournalHeader& _header, JournalRecordType _type, size_t _length, int _productIndex, long long _timestamp)
+{
+	_header.length = static_cast<uint16_t>(_length);
+	_header.type = static_cast<uint8_t>(_type);
+	_header.reserved = 0;
+	_header.productIndex = static_cast<uint32_t>(_productIndex);
+	_header.timestamp = _timestamp;
+}
+
+// Copy an identifier into a fixed-length field, padding with zeros
+template<size_t N>
+void SetJournalId(char (&_field)[N], string_view _id)
+{
+	memset(_field, 0, N);
+	memcpy(_field, _id.data(), min(_id.size(), N));
+}
+
+// Read an identifier back from a fixed-length field
+template<size_t N>
+string GetJournalId(const char (&_field)[N])
+{
+	return string(_field, strnlen(_field, N));
+}
+
+// Copy a record of type R out of a journal buffer, zero-filling what the record does not carry
+template<typename R>
+R GetJournalRecord(const char* _buffer)
+{
+	R record;
+	memset(&record, 0, sizeof(record));
+	JournalHeader header;
+	memcpy(&header, _buffer, sizeof(header));
+	memcpy(&record, _buffer, min(static_cast<size_t>(header.length), sizeof(record)));
+	return record;
+}
+
+// Copy the first bytes of a record given by its header length into a journal buffer, return the length
+template<typename R>
+size_t PutJournalRecord(const R& _record, char* _buffer)
+{
+	memcpy(_buffer, &_record, _record.header.length);
+	return _record.header.length;
+}
+
+// Read the next record of a journal into a buffer of JOURNAL_MAX_RECORD bytes,
+// return false at the end of the journal
+bool ReadJournalRecord(istream& _journal, char* _buffer)
+{
+	if (!_journal.read(_buffer, sizeof(JournalHeader))) return false;
+
+	JournalHeader header;
+	memcpy(&header, _buffer, sizeof(header));
+	if (header.length < sizeof(JournalHeader) || header.length > JOURNAL_MAX_RECORD) return false;
+	return static_cast<bool>(_journal.read(_buffer + sizeof(JournalHeader), header.length - sizeof(JournalHeader)));
+}
+
+#endif
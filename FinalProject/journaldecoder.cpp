@@ -0,0 +1,120 @@
+/*
+*Turning the binary journals of the HistoricalDataService back into the .txt layouts
+*usage: journaldecoder <journal.bin> [output.txt] [--sorted], prints to the console without an output file;
+*with --sorted, the end of day layout, the records are sorted by product and then by time
+*@author: Chaofan Shen
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "soa.hpp"
+#include "sorting.hpp"
+#include "products.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "algoexecutionservice.hpp"
+#include "algostreamingservice.hpp"
+#include "inquiryservice.hpp"
+
+using namespace std;
+
+// Decode one record into its text line, empty for an unknown record type
+string DecodeRecord(const char* _record)
+{
+	JournalHeader header;
+	memcpy(&header, _record, sizeof(header));
+
+	string line;
+	switch (header.type) {
+	case POSITION_RECORD: line = Position<Bond>::Decode(_record).print(); break;
+	case RISK_RECORD: line = PV01<Bond>::Decode(_record).print(); break;
+	case SECTOR_RISK_RECORD: line = PV01<BucketedSector<Bond>>::Decode(_record).print(); break;
+	case EXECUTION_RECORD: line = ExecutionOrder<Bond>::Decode(_record).print(); break;
+	case STREAMING_RECORD: line = PriceStream<Bond>::Decode(_record).print(); break;
+	case INQUIRY_RECORD: line = Inquiry<Bond>::Decode(_record).print(); break;
+	default: return "";
+	}
+	char stamp[MAX_TIMESTAMP_LENGTH];
+	return string(stamp, FormatEpochTime(header.timestamp, stamp)) + ", " + line + "\n";
+}
+
+// Key a record is sorted on, and where it is in the journal
+struct RecordKey
+{
+	uint32_t productIndex;
+	int64_t timestamp;
+	size_t offset;
+};
+
+// Decode every record of a journal sorted by product and then by time, return their number
+long DecodeSorted(istream& _journal, ostream& _output)
+{
+	// the records are read whole, then sorted by their keys on every core
+	vector<char> records;
+	vector<RecordKey> keys;
+	char record[JOURNAL_MAX_RECORD];
+	while (ReadJournalRecord(_journal, record))
+	{
+		JournalHeader header;
+		memcpy(&header, record, sizeof(header));
+		keys.push_back(RecordKey{ header.productIndex, header.timestamp, records.size() });
+		records.insert(records.end(), record, record + header.length);
+	}
+
+	// the offset keeps the records of the same product and time in the order they were written
+	ParallelSort(keys.begin(), keys.end(), [](const RecordKey& _a, const RecordKey& _b) {
+		if (_a.productIndex != _b.productIndex) return _a.productIndex < _b.productIndex;
+		if (_a.timestamp != _b.timestamp) return _a.timestamp < _b.timestamp;
+		return _a.offset < _b.offset;
+	});
+	for (const RecordKey& key : keys) _output << DecodeRecord(records.data() + key.offset);
+	return static_cast<long>(keys.size());
+}
+
+int main(int argc, char* argv[])
+{
+	vector<string> arguments;
+	bool sorted = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (string(argv[i]) == "--sorted") sorted = true;
+		else arguments.push_back(argv[i]);
+	}
+	if (arguments.empty())
+	{
+		cerr << "usage: " << argv[0] << " <journal.bin> [output.txt] [--sorted]" << endl;
+		return 1;
+	}
+
+	ifstream journal(arguments[0], ios::binary);
+	if (!journal)
+	{
+		cerr << "Cannot open " << arguments[0] << endl;
+		return 1;
+	}
+
+	ofstream file;
+	if (arguments.size() > 1) file.open(arguments[1], ios::app);
+	ostream& output = arguments.size() > 1 ? static_cast<ostream&>(file) : cout;
+
+	// the records refer to products and sectors by their index in the registries
+	GetBondRegistry();
+	GetSectorRegistry<Bond>();
+
+	long count = 0;
+	if (sorted) count = DecodeSorted(journal, output);
+	else
+	{
+		char record[JOURNAL_MAX_RECORD];
+		while (ReadJournalRecord(journal, record))
+		{
+			output << DecodeRecord(record);
+			count++;
+		}
+	}
+	cerr << count << " records decoded." << endl;
+
+	return 0;
+}
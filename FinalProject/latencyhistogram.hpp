@@ -0,0 +1,186 @@
+/**
+ * latencyhistogram.hpp
+ * Defines the histogram of latencies recorded on the hot path and read as percentiles.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// Each power of two of latency is split in 2^LATENCY_SUB_BUCKET_BITS buckets
+const int LATENCY_SUB_BUCKET_BITS = 4;
+const int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+
+// Latencies from 2^LATENCY_MAX_MAGNITUDE nanoseconds (about 18 minutes) on share the last bucket
+const int LATENCY_MAX_MAGNITUDE = 40;
+
+/**
+ * Histogram of latencies in nanoseconds with buckets of fixed relative width, in the manner
+ * of an HDR histogram: each power of two is split in 16 buckets of equal width, so a
+ * percentile is read to within 1/16 of its value whatever the scale, from nanoseconds
+ * to minutes, in a fixed array of counts.
+ * Recording is an index computation and an increment, from one thread at a time.
+ */
+class LatencyHistogram
+{
+
+public:
+
+	// ctor for an empty histogram
+	LatencyHistogram();
+
+	// Record a latency in nanoseconds, a negative latency is recorded as 0
+	void Record(long long _nanoseconds);
+
+	// Add the counts of another histogram
+	void Merge(const LatencyHistogram& _histogram);
+
+	// Empty the histogram
+	void Reset();
+
+	// Get the number of latencies recorded
+	unsigned long long GetCount() const;
+
+	// Get the smallest latency recorded, 0 if none
+	long long GetMin() const;
+
+	// Get the largest latency recorded, 0 if none
+	long long GetMax() const;
+
+	// Get the mean of the latencies recorded, 0 if none
+	double GetMean() const;
+
+	// Get the latency under which a percentage of the latencies fall, to the upper edge of its bucket
+	long long GetPercentile(double _percentile) const;
+
+	// Print the count, mean, median, 99th and 99.9th percentiles and maximum, in microseconds
+	void PrintReport(ostream& _output, const string& _name) const;
+
+private:
+
+	static const int BUCKETS = (LATENCY_MAX_MAGNITUDE - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKETS;
+
+	// Get the bucket of a latency
+	static int GetBucket(long long _nanoseconds);
+
+	// Get the largest latency of a bucket
+	static long long GetBucketTop(int _bucket);
+
+	array<unsigned long long, BUCKETS> counts;
+	unsigned long long count;
+	long long minimum;
+	long long maximum;
+	long double total;
+
+};
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Record(long long _nanoseconds)
+{
+	if (_nanoseconds < 0) _nanoseconds = 0;
+	counts[GetBucket(_nanoseconds)]++;
+	if (count == 0 || _nanoseconds < minimum) minimum = _nanoseconds;
+	if (_nanoseconds > maximum) maximum = _nanoseconds;
+	total += _nanoseconds;
+	count++;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& _histogram)
+{
+	if (_histogram.count == 0) return;
+
+	for (int i = 0; i < BUCKETS; i++) counts[i] += _histogram.counts[i];
+	if (count == 0 || _histogram.minimum < minimum) minimum = _histogram.minimum;
+	if (_histogram.maximum > maximum) maximum = _histogram.maximum;
+	total += _histogram.total;
+	count += _histogram.count;
+}
+
+void LatencyHistogram::Reset()
+{
+	counts.fill(0);
+	count = 0;
+	minimum = 0;
+	maximum = 0;
+	total = 0;
+}
+
+unsigned long long LatencyHistogram::GetCount() const
+{
+	return count;
+}
+
+long long LatencyHistogram::GetMin() const
+{
+	return minimum;
+}
+
+long long LatencyHistogram::GetMax() const
+{
+	return maximum;
+}
+
+double LatencyHistogram::GetMean() const
+{
+	return count > 0 ? static_cast<double>(total / count) : 0;
+}
+
+long long LatencyHistogram::GetPercentile(double _percentile) const
+{
+	if (count == 0) return 0;
+
+	// the rank of the latency, counted from 1
+	unsigned long long rank = static_cast<unsigned long long>(_percentile / 100 * count + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > count) rank = count;
+
+	unsigned long long seen = 0;
+	for (int i = 0; i < BUCKETS; i++)
+	{
+		seen += counts[i];
+		if (seen >= rank) return min(GetBucketTop(i), maximum);
+	}
+	return maximum;
+}
+
+void LatencyHistogram::PrintReport(ostream& _output, const string& _name) const
+{
+	_output << _name << ": " << count << " samples, mean " << GetMean() / 1000.0 << " us, p50 "
+		<< GetPercentile(50) / 1000.0 << " us, p99 " << GetPercentile(99) / 1000.0 << " us, p99.9 "
+		<< GetPercentile(99.9) / 1000.0 << " us, max " << maximum / 1000.0 << " us" << endl;
+}
+
+int LatencyHistogram::GetBucket(long long _nanoseconds)
+{
+	// the first power of two with sub buckets of width 1 takes the small latencies as is
+	if (_nanoseconds < LATENCY_SUB_BUCKETS) return static_cast<int>(_nanoseconds);
+
+	int magnitude = 63 - __builtin_clzll(static_cast<unsigned long long>(_nanoseconds));
+	if (magnitude > LATENCY_MAX_MAGNITUDE) return BUCKETS - 1;
+
+	int shift = magnitude - LATENCY_SUB_BUCKET_BITS;
+	int subBucket = static_cast<int>(_nanoseconds >> shift) - LATENCY_SUB_BUCKETS;
+	return (shift + 1) * LATENCY_SUB_BUCKETS + subBucket;
+}
+
+long long LatencyHistogram::GetBucketTop(int _bucket)
+{
+	if (_bucket < LATENCY_SUB_BUCKETS) return _bucket;
+
+	int shift = _bucket / LATENCY_SUB_BUCKETS - 1;
+	long long subBucket = _bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+	return ((subBucket + 1) << shift) - 1;
+}
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * linereader.hpp
+ * Defines a block-buffered line reader and in-place field tokenizer for the
+ * file connectors.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef LINE_READER_HPP
+#define LINE_READER_HPP
+
+#include <istream>
+#include <vector>
+#include <cstring>
+#include <string_view>
+#include <charconv>
+
+using namespace std;
+
+/**
+ * Line reader pulling the input in large blocks.
+ * Lines are handed out as views into the block buffer, so no string is built per line.
+ * A view is only valid until the next call to Next().
+ */
+class LineReader
+{
+
+public:
+
+	// ctor for a line reader on an input stream
+	LineReader(istream& _input, size_t _blockSize = 1 << 20);
+
+	// Get the next line without its line terminator, return false at the end of the input
+	bool Next(string_view& _line);
+
+	// Check whether the next line is in the buffer, so that Next() does not wait for the input
+	bool HasLine() const;
+
+private:
+
+	// Move the unread bytes to the front of the buffer and refill the rest
+	bool Refill();
+
+	istream& input;
+	vector<char> buffer;
+	size_t begin; // first unread byte
+	size_t end; // last valid byte
+	bool eof;
+
+};
+
+LineReader::LineReader(istream& _input, size_t _blockSize) :
+	input(_input), buffer(_blockSize)
+{
+	begin = 0;
+	end = 0;
+	eof = false;
+}
+
+bool LineReader::Next(string_view& _line)
+{
+	while (true)
+	{
+		const char* first = buffer.data() + begin;
+		const char* newLine = static_cast<const char*>(memchr(first, '\n', end - begin));
+
+		if (newLine != nullptr)
+		{
+			size_t length = newLine - first;
+			begin += length + 1;
+
+			// the input files are written with CRLF line endings
+			if (length > 0 && first[length - 1] == '\r') length--;
+			_line = string_view(first, length);
+			return true;
+		}
+
+		if (!Refill())
+		{
+			// last line without a terminator
+			if (begin == end) return false;
+
+			first = buffer.data() + begin;
+			size_t length = end - begin;
+			if (first[length - 1] == '\r') length--;
+			_line = string_view(first, length);
+			begin = end;
+			return true;
+		}
+	}
+}
+
+bool LineReader::HasLine() const
+{
+	if (eof) return begin != end;
+	return memchr(buffer.data() + begin, '\n', end - begin) != nullptr;
+}
+
+bool LineReader::Refill()
+{
+	if (eof) return false;
+
+	size_t remain = end - begin;
+	memmove(buffer.data(), buffer.data() + begin, remain);
+	begin = 0;
+	end = remain;
+
+	// a single line longer than the block, grow the buffer
+	if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+
+	streamsize count = input.rdbuf()->sgetn(buffer.data() + end, buffer.size() - end);
+	if (count <= 0)
+	{
+		eof = true;
+		return false;
+	}
+	end += count;
+	return true;
+}
+
+
+/*
+	In-place tokenizing of a line
+*/
+
+// Split the next comma separated field off the front of a line
+string_view NextField(string_view& _line)
+{
+	size_t pos = _line.find(',');
+	string_view field = _line.substr(0, pos);
+	_line.remove_prefix(pos == string_view::npos ? _line.size() : pos + 1);
+	return field;
+}
+
+// Convert a field to an integer quantity
+long ParseQuantity(string_view _field)
+{
+	long quantity = 0;
+	from_chars(_field.data(), _field.data() + _field.size(), quantity);
+	return quantity;
+}
+
+#endif
@@ -4,88 +4,184 @@
 */
 
 #include <iostream>
+#include <fstream>
 #include <string>
-#include "soa.hpp"
-#include "products.hpp"
-#include "algoexecutionservice.hpp"
-#include "algostreamingservice.hpp"
-#include "bondexecutionservice.hpp"
-#include "guiservice.hpp"
-#include "historicaldataservice.hpp"
-#include "inquiryservice.hpp"
-#include "marketdataservice.hpp"
-#include "positionservice.hpp"
-#include "pricingservice.hpp"
-#include "riskservice.hpp"
-#include "bondstreamingservice.hpp"
-#include "tradebookingservice.hpp"
+#include <memory>
+#include "tradingsystem.hpp"
+#include "shardedtradingsystem.hpp"
+#include "replayengine.hpp"
+#include "instrumentation.hpp"
+#include "feeddriver.hpp"
 
 using namespace std;
 
-int main()
+// Run the trading system sharded by product over a number of worker threads, on the input files
+int RunSharded(int _shards)
 {
+	cout << "Start testing trading system with " << _shards << " shards." << endl;
+	ShardedTradingSystem tradingSystem(_shards);
+	tradingSystem.AddListeners();
+	tradingSystem.AddFeed("prices", "prices.txt", &TradingSystem::pricingservice);
+	tradingSystem.AddFeed("trades", "trades.txt", &TradingSystem::tradeBookingService);
+	tradingSystem.AddFeed("inquiries", "inquiries.txt", &TradingSystem::inquiryService, 1);
+	tradingSystem.AddFeed("market data", "marketdata.txt", &TradingSystem::marketdataservice, 0, 10);
+
+	cout << "Start routing prices, trades, inquiries and market data." << endl;
+	tradingSystem.Run();
+	tradingSystem.Flush();
+	tradingSystem.PrintReport(cout);
+	return 0;
+}
+
+// Replay the input files at a speed, the timestamped ones when they are there, taking a checkpoint
+// every interval of recorded time in microseconds and resuming from the last one if asked
+int RunReplay(double _speed, long long _checkpointInterval, bool _resume)
+{
+	cout << "Start replaying trading system." << endl;
+	TradingSystem tradingSystem;
+	ReplayEngine replayEngine(tradingSystem, _speed);
+
+	// the timestamped files are written by feedgenerator, the others are replayed a message a microsecond
+	auto addFeed = [&](const string& _name, const string& _stem, auto* _connector, int _linesPerMessage) {
+		bool timestamped = ifstream(_stem + ".timed.txt").good();
+		replayEngine.AddFeed(_name, _stem + (timestamped ? ".timed.txt" : ".txt"), _connector, timestamped, _linesPerMessage);
+	};
+	addFeed("prices", "prices", tradingSystem.pricingservice.GetConnector(), 1);
+	addFeed("trades", "trades", tradingSystem.tradeBookingService.GetConnector(), 1);
+	addFeed("inquiries", "inquiries", tradingSystem.inquiryService.GetConnector(), 1);
+	addFeed("market data", "marketdata", tradingSystem.marketdataservice.GetConnector(), 10);
+	replayEngine.SetCheckpoints("checkpoint.bin", _checkpointInterval);
+	tradingSystem.AddListeners();
+
+	if (_resume)
+	{
+		if (replayEngine.Restore("checkpoint.bin")) cout << "Resuming from checkpoint.bin." << endl;
+		else cout << "No checkpoint to resume from, replaying from the start." << endl;
+	}
+
+	cout << "Start replaying prices, trades, inquiries and market data." << endl;
+	replayEngine.Run();
+	tradingSystem.Flush();
+	replayEngine.PrintReport(cout);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	// "socket [host] [binary]" reads the feeds from the feedpublisher process and
+	// publishes executions and streams to the feedlistener process, as wire messages if binary
+	bool socketMode = argc > 1 && string(argv[1]) == "socket";
+	string host = argc > 2 ? argv[2] : "127.0.0.1";
+	FrameFormat format = (argc > 3 && string(argv[3]) == "binary") ? BINARY_FRAME : TEXT_FRAME;
+
+	// wire messages refer to the products by their index, so register them up front
+	GetBondRegistry();
+
+	// "sharded [shards]" runs a trading system per core, each owning a share of the products
+	if (argc > 1 && string(argv[1]) == "sharded")
+		return RunSharded(argc > 2 ? stoi(argv[2]) : max(1, static_cast<int>(thread::hardware_concurrency())));
+
+	// "replay [max|speed] [checkpoint interval] [resume]" plays the files back on their recorded clock
+	if (argc > 1 && string(argv[1]) == "replay")
+	{
+		double speed = (argc > 2 && string(argv[2]) != "max") ? stod(argv[2]) : REPLAY_MAX_SPEED;
+		long long checkpointInterval = argc > 3 ? stoll(argv[3]) : 0;
+		bool resume = argc > 4 && string(argv[4]) == "resume";
+		return RunReplay(speed, checkpointInterval, resume);
+	}
+
 	cout << "Start testing trading system." << endl;
 
 	// First, register all the service
-	// using Bond productType
+	// using Bond productType, with the historical services recording the infomation
 	cout << "Start creating Services." << endl;
-	pricingService<Bond> pricingservice;
-	TradeBookingService<Bond> tradeBookingService;
-	PositionService<Bond> positionService;
-	RiskService<Bond> riskService;
-	marketDataService<Bond> marketdataservice;
-	AlgoExecutionService<Bond> algoExecutionService;
-	AlgoStreamingService<Bond> algoStreamingService;
-	GUIService<Bond> guiService;
-	ExecutionService<Bond> executionService;
-	StreamingService<Bond> streamingService;
-	InquiryService<Bond> inquiryService;
+	TradingSystem tradingSystem;
 	cout << "Services have been created." << endl;
 
-	// Second, create listeners from HistoricalDataService to record the infomation
-	HistoricalDataService<Position<Bond>> historicalPositionService(POSITION);
-	HistoricalDataService<PV01<Bond>> historicalRiskService(RISK);
-	HistoricalDataService<ExecutionOrder<Bond>> historicalExecutionService(EXECUTION);
-	HistoricalDataService<PriceStream<Bond>> historicalStreamingService(STREAMING);
-	HistoricalDataService<Inquiry<Bond>> historicalInquiryService(INQUIRY);
+	// The connectors load the data from the files, or from sockets in socket mode,
+	// where the latency from the wire to each service is measured first thing
+	FeedDriver feedDriver;
+	unique_ptr<WireLatencyListener<Price<Bond>>> pricesLatency;
+	unique_ptr<WireLatencyListener<Trade<Bond>>> tradesLatency;
+	unique_ptr<WireLatencyListener<Inquiry<Bond>>> inquiriesLatency;
+	unique_ptr<WireLatencyListener<OrderStacks<Bond>>> marketDataLatency;
+	if (socketMode)
+	{
+		pricesLatency.reset(new WireLatencyListener<Price<Bond>>(
+			feedDriver.AddSocketFeed("prices", host, PRICES_PORT, tradingSystem.pricingservice.GetConnector(), format)));
+		tradesLatency.reset(new WireLatencyListener<Trade<Bond>>(
+			feedDriver.AddSocketFeed("trades", host, TRADES_PORT, tradingSystem.tradeBookingService.GetConnector(), format)));
+		inquiriesLatency.reset(new WireLatencyListener<Inquiry<Bond>>(
+			feedDriver.AddSocketFeed("inquiries", host, INQUIRIES_PORT, tradingSystem.inquiryService.GetConnector(), format)));
+		marketDataLatency.reset(new WireLatencyListener<OrderStacks<Bond>>(
+			feedDriver.AddSocketFeed("market data", host, MARKET_DATA_PORT, tradingSystem.marketdataservice.GetConnector(), format)));
+		tradingSystem.pricingservice.AddListener(pricesLatency.get());
+		tradingSystem.tradeBookingService.AddListener(tradesLatency.get());
+		tradingSystem.inquiryService.AddListener(inquiriesLatency.get());
+		tradingSystem.marketdataservice.AddListener(marketDataLatency.get());
+
+		if (!tradingSystem.executionService.GetConnector()->Connect(host, EXECUTIONS_PORT, format))
+			cout << "No listener for executions on " << host << ":" << EXECUTIONS_PORT << endl;
+		if (!tradingSystem.streamingService.GetConnector()->Connect(host, STREAMING_PORT, format))
+			cout << "No listener for streams on " << host << ":" << STREAMING_PORT << endl;
+	}
+	else
+	{
+		feedDriver.AddFeed("prices", "prices.txt", tradingSystem.pricingservice.GetConnector());
+		feedDriver.AddFeed("trades", "trades.txt", tradingSystem.tradeBookingService.GetConnector());
+		feedDriver.AddFeed("inquiries", "inquiries.txt", tradingSystem.inquiryService.GetConnector());
+		feedDriver.AddFeed("market data", "marketdata.txt", tradingSystem.marketdataservice.GetConnector());
+	}
 
 
 	// Then, we add the listeners to the related service
 	cout << "Start sending listeners." << endl;
-	pricingservice.AddListener(algoStreamingService.GetListener());
-	pricingservice.AddListener(guiService.GetListener());
-	algoStreamingService.AddListener(streamingService.GetListener());
-	streamingService.AddListener(historicalStreamingService.GetListener());
-	marketdataservice.AddListener(algoExecutionService.GetListener());
-	algoExecutionService.AddListener(executionService.GetListener());
-	executionService.AddListener(tradeBookingService.GetListener());
-	executionService.AddListener(historicalExecutionService.GetListener());
-	tradeBookingService.AddListener(positionService.GetListener());
-	positionService.AddListener(riskService.GetListener());
-	positionService.AddListener(historicalPositionService.GetListener());
-	riskService.AddListener(historicalRiskService.GetListener());
-	inquiryService.AddListener(historicalInquiryService.GetListener());
+	tradingSystem.AddListeners(socketMode);
 	cout << "Listeners have been sent." << endl;
 
 
 	// Finally, we use connectors from different services to 
-	// load the data
-	ifstream prices("prices.txt");
-	cout << "Start subcribing prices." << endl;
-	pricingservice.GetConnector()->Subscribe(prices);
-
+	// load the data, each feed on a thread of its own
+	cout << "Start subcribing prices, trades, inquiries and market data." << endl;
+#ifdef INSTRUMENT_PIPELINE
+	{
+		// report the latency of the pipelines every second while the feeds run
+		PeriodicReporter reporter(cout, chrono::seconds(1));
+		feedDriver.Run();
+	}
+#else
+	feedDriver.Run();
+#endif
+	feedDriver.PrintReport(cout);
+	tradingSystem.inquiryService.PrintReport(cout);
 
-	ifstream trades("trades.txt");
-	cout << "Start subcribing trades." << endl;
-	tradeBookingService.GetConnector()->Subscribe(trades);
+	// the top of the day, as the desk looks at it
+	cout << "largest positions:";
+	for (auto& position : tradingSystem.positionService.GetLargestPositions(3))
+		cout << " " << position.GetProduct().GetProductId() << " " << position.GetAggregatePosition();
+	cout << endl << "widest spreads:";
+	for (auto& spread : tradingSystem.marketdataservice.GetWidestSpreads(3))
+		cout << " " << spread.first->GetProductId() << " " << GetQuotePrice(spread.second);
+	cout << endl;
 
-	ifstream inquiries("inquiries.txt");
-	cout << "Start subcribing inquires." << endl;
-	inquiryService.GetConnector()->Subscribe(inquiries);	
+	if (socketMode)
+	{
+		tradingSystem.conflatingStreamingListener.Flush();
+		cout << "streams: " << tradingSystem.conflatingStreamingListener.GetDeliveredCount() << " published, "
+			<< tradingSystem.conflatingStreamingListener.GetConflatedCount() << " conflated" << endl;
+		pricesLatency->PrintReport(cout, "prices");
+		tradesLatency->PrintReport(cout, "trades");
+		inquiriesLatency->PrintReport(cout, "inquiries");
+		marketDataLatency->PrintReport(cout, "market data");
+	}
 
-	ifstream marketdata("marketdata.txt");
-	cout << "Start subcribing market data." << endl;
-	marketdataservice.GetConnector()->Subscribe(marketdata);
+#ifdef INSTRUMENT_PIPELINE
+	// the feeds have ended, so the files are written once the historical listeners are flushed
+	tradingSystem.Flush();
+	PipelineInstrumentation::GetInstance().PrintReport(cout);
+	ofstream instrumentationFile("instrumentation.json");
+	PipelineInstrumentation::GetInstance().PrintJson(instrumentationFile);
+#endif
 
 	return 0;
 }
\ No newline at end of file
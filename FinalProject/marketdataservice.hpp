@@ -10,8 +10,16 @@
 
 #include <string>
 #include <vector>
+#include <memory_resource>
+#include <cstddef>
 #include <algorithm>
 #include "soa.hpp"
+#include "instrumentation.hpp"
+#include "snapshotstore.hpp"
+#include "checkpoint.hpp"
+#include "daryheap.hpp"
+#include "linereader.hpp"
+#include "wireprotocol.hpp"
 
 using namespace std;
 
@@ -45,6 +53,7 @@ private:
   long quantity;
   PricingSide side;
 
+  COPY_COUNTED(Order)
 };
 
 Order::Order(double _price, long _quantity, PricingSide _side)
@@ -92,6 +101,7 @@ private:
   Order bidOrder;
   Order offerOrder;
 
+  COPY_COUNTED(BidOffer)
 };
 
 BidOffer::BidOffer(const Order& _bidOrder, const Order& _offerOrder) :
@@ -109,8 +119,21 @@ const Order& BidOffer::GetOfferOrder() const
 }
 
 
+// Type of a level-by-level order book update
+enum BookUpdateType { ADD_LEVEL, MODIFY_LEVEL, DELETE_LEVEL };
+
+// Orders of one side of a book, allocator-aware so that a book can live in an arena
+typedef pmr::vector<Order> OrderStack;
+
 /**
  * Order Stack with bid and offer stacks.
+ * The bid stack is kept sorted from the highest price down and the offer stack
+ * from the lowest price up, and the best bid/offer is cached as the stacks change,
+ * so reading the top of the book is O(1).
+ * A book can take its storage from a memory resource, copies of it take theirs from
+ * the default resource, so they never refer to the arena of the book they copy.
+ * Moving a book assigns its orders into the storage of the book it is moved to, a
+ * book of an arena is moved by assignment only, never into a new book.
  * Type T is the product type.
  */
 template<typename T>
@@ -123,64 +146,400 @@ public:
   OrderStacks(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack);
   OrderStacks() = default;
 
+  // ctor for the empty book of a product
+  explicit OrderStacks(const T &_product);
+
+  // ctor for an empty book allocating its stacks from a memory resource
+  explicit OrderStacks(pmr::memory_resource *_resource);
+
   // Get the product
   const T& GetProduct() const;
 
   // Get the bid stack
-  const vector<Order>& GetBidStack() const;
+  const OrderStack& GetBidStack() const;
 
   // Get the offer stack
-  const vector<Order>& GetOfferStack() const;
+  const OrderStack& GetOfferStack() const;
 
   // Get best bid and offer price
-  BidOffer& GetBestBidOffer() const;
+  const BidOffer& GetBestBidOffer() const;
+
+  // Get the spread between the best offer and the best bid
+  double GetSpread() const;
+
+  // Set the product
+  void SetProduct(const T &_product);
+
+  // Add an order at its sorted place in the stack of its side
+  void AddOrder(const Order &_order);
+
+  // Change the quantity of the level at a price, adding the level if there is none
+  void ModifyLevel(PricingSide _side, double _price, long _quantity);
+
+  // Remove the level at a price
+  void DeleteLevel(PricingSide _side, double _price);
+
+  // Apply a level-by-level update
+  void UpdateLevel(BookUpdateType _type, const Order &_order);
+
+  // Remove all the orders, keeping the storage for the next update
+  void Clear();
 
 private:
-  T product;
-  vector<Order> bidStack;
-  vector<Order> offerStack;
 
+  // Find the level at a price, end of the stack if there is none
+  OrderStack::iterator FindLevel(OrderStack &_stack, double _price);
+
+  // Refresh the cached best bid/offer from the top of both stacks
+  void UpdateBestBidOffer();
+
+  const T* product = nullptr; // owned by the product registry
+  OrderStack bidStack;
+  OrderStack offerStack;
+  BidOffer bestBidOffer = BidOffer(Order(0, 0, BID), Order(1000, 0, OFFER));
+
+  COPY_COUNTED(OrderStacks<T>)
 };
 
+// Order of the levels in a stack, best price first
+bool IsBetterPrice(PricingSide _side, double _price, double _other)
+{
+	return (_side == BID) ? _price > _other : _price < _other;
+}
+
 template<typename T>
 OrderStacks<T>::OrderStacks(const T& _product, const vector<Order>& _bidStack, const vector<Order>& _offerStack) :
-	product(_product), bidStack(_bidStack), offerStack(_offerStack)
+	product(&_product), bidStack(_bidStack.begin(), _bidStack.end()), offerStack(_offerStack.begin(), _offerStack.end())
 {
+	// a stable sort keeps the orders at the same price in the order they came in, at any depth
+	auto better = [](const Order& a, const Order& b) { return IsBetterPrice(a.GetSide(), a.GetPrice(), b.GetPrice()); };
+	stable_sort(bidStack.begin(), bidStack.end(), better);
+	stable_sort(offerStack.begin(), offerStack.end(), better);
+	UpdateBestBidOffer();
 }
 
+template<typename T>
+OrderStacks<T>::OrderStacks(const T& _product) :
+	product(&_product)
+{}
+
+template<typename T>
+OrderStacks<T>::OrderStacks(pmr::memory_resource* _resource) :
+	bidStack(_resource), offerStack(_resource)
+{}
+
 template<typename T>
 const T& OrderStacks<T>::GetProduct() const
 {
-	return product;
+	return *product;
 }
 
 template<typename T>
-const vector<Order>& OrderStacks<T>::GetBidStack() const
+const OrderStack& OrderStacks<T>::GetBidStack() const
 {
 	return bidStack;
 }
 
 template<typename T>
-const vector<Order>& OrderStacks<T>::GetOfferStack() const
+const OrderStack& OrderStacks<T>::GetOfferStack() const
 {
 	return offerStack;
 }
 
 template<typename T>
-BidOffer& OrderStacks<T>::GetBestBidOffer() const
+const BidOffer& OrderStacks<T>::GetBestBidOffer() const
 {
-	
-	Order bestBid(0, 0, BID);
-	for (auto p : bidStack) {
-		if (p.GetPrice() > bestBid.GetPrice()) bestBid = p;
+	return bestBidOffer;
+}
+
+template<typename T>
+double OrderStacks<T>::GetSpread() const
+{
+	return bestBidOffer.GetOfferOrder().GetPrice() - bestBidOffer.GetBidOrder().GetPrice();
+}
+
+template<typename T>
+void OrderStacks<T>::SetProduct(const T& _product)
+{
+	product = &_product;
+}
+
+template<typename T>
+void OrderStacks<T>::AddOrder(const Order& _order)
+{
+	PricingSide side = _order.GetSide();
+	OrderStack& stack = (side == BID) ? bidStack : offerStack;
+
+	// the feeds send the levels best first, so this is normally an append
+	auto it = stack.end();
+	while (it != stack.begin() && IsBetterPrice(side, _order.GetPrice(), (it - 1)->GetPrice())) --it;
+	bool isTop = (it == stack.begin());
+	stack.insert(it, _order);
+
+	if (isTop) UpdateBestBidOffer();
+}
+
+template<typename T>
+void OrderStacks<T>::ModifyLevel(PricingSide _side, double _price, long _quantity)
+{
+	OrderStack& stack = (_side == BID) ? bidStack : offerStack;
+	auto it = FindLevel(stack, _price);
+	if (it == stack.end())
+	{
+		AddOrder(Order(_price, _quantity, _side));
+		return;
 	}
-	Order bestOffer(1000, 0, BID);
-	for (auto p : offerStack) {
-		if (p.GetPrice() < bestOffer.GetPrice()) bestOffer = p;
+
+	*it = Order(_price, _quantity, _side);
+	if (it == stack.begin()) UpdateBestBidOffer();
+}
+
+template<typename T>
+void OrderStacks<T>::DeleteLevel(PricingSide _side, double _price)
+{
+	OrderStack& stack = (_side == BID) ? bidStack : offerStack;
+	auto it = FindLevel(stack, _price);
+	if (it == stack.end()) return;
+
+	bool isTop = (it == stack.begin());
+	stack.erase(it);
+	if (isTop) UpdateBestBidOffer();
+}
+
+template<typename T>
+void OrderStacks<T>::UpdateLevel(BookUpdateType _type, const Order& _order)
+{
+	if (_type == ADD_LEVEL) AddOrder(_order);
+	if (_type == MODIFY_LEVEL) ModifyLevel(_order.GetSide(), _order.GetPrice(), _order.GetQuantity());
+	if (_type == DELETE_LEVEL) DeleteLevel(_order.GetSide(), _order.GetPrice());
+}
+
+template<typename T>
+void OrderStacks<T>::Clear()
+{
+	bidStack.clear();
+	offerStack.clear();
+	UpdateBestBidOffer();
+}
+
+template<typename T>
+OrderStack::iterator OrderStacks<T>::FindLevel(OrderStack& _stack, double _price)
+{
+	return find_if(_stack.begin(), _stack.end(), [&](const Order& o) { return o.GetPrice() == _price; });
+}
+
+template<typename T>
+void OrderStacks<T>::UpdateBestBidOffer()
+{
+	// an empty side keeps the same bounds as an empty book
+	Order bestBid = bidStack.empty() ? Order(0, 0, BID) : bidStack.front();
+	Order bestOffer = offerStack.empty() ? Order(1000, 0, OFFER) : offerStack.front();
+	bestBidOffer = BidOffer(bestBid, bestOffer);
+}
+
+
+// Number of levels per side in the order books of our feed
+const int BOOK_DEPTH = 5;
+
+/**
+ * Aggregated order book of a fixed depth, held as a structure of arrays.
+ * Levels at the same price are merged, prices are integer ticks and quantities are
+ * kept in contiguous arrays, so the aggregation, spread and depth computations are
+ * fixed-length loops that the compiler vectorizes and that never allocate.
+ * Only the first Depth levels of each side of the source book are aggregated.
+ */
+template<int Depth>
+class AggregatedBook
+{
+
+public:
+
+	// ctor for an empty book
+	AggregatedBook();
+
+	// Aggregate the levels of an order book
+	template<typename T>
+	void Aggregate(const OrderStacks<T>& _orderBook);
+
+	// Get the number of distinct price levels on a side
+	int GetDepth(PricingSide _side) const;
+
+	// Get the price in ticks of a level
+	PriceTicks GetPrice(PricingSide _side, int _level) const;
+
+	// Get the aggregated quantity of a level
+	long GetQuantity(PricingSide _side, int _level) const;
+
+	// Get the spread in ticks between the best offer and the best bid
+	PriceTicks GetSpread() const;
+
+	// Get the total quantity over all the levels of a side
+	long GetTotalQuantity(PricingSide _side) const;
+
+private:
+
+	// Aggregate one side of the book into the arrays of that side
+	static int AggregateSide(const OrderStack& _stack, PriceTicks* _prices, long* _quantities);
+
+	PriceTicks bidPrices[Depth];
+	long bidQuantities[Depth];
+	int bidDepth;
+	PriceTicks offerPrices[Depth];
+	long offerQuantities[Depth];
+	int offerDepth;
+
+};
+
+template<int Depth>
+AggregatedBook<Depth>::AggregatedBook()
+{
+	fill(bidPrices, bidPrices + Depth, 0);
+	fill(bidQuantities, bidQuantities + Depth, 0);
+	fill(offerPrices, offerPrices + Depth, 0);
+	fill(offerQuantities, offerQuantities + Depth, 0);
+	bidDepth = 0;
+	offerDepth = 0;
+}
+
+template<int Depth>
+template<typename T>
+void AggregatedBook<Depth>::Aggregate(const OrderStacks<T>& _orderBook)
+{
+	bidDepth = AggregateSide(_orderBook.GetBidStack(), bidPrices, bidQuantities);
+	offerDepth = AggregateSide(_orderBook.GetOfferStack(), offerPrices, offerQuantities);
+}
+
+template<int Depth>
+int AggregatedBook<Depth>::AggregateSide(const OrderStack& _stack, PriceTicks* _prices, long* _quantities)
+{
+	// load the levels, padding the missing ones with zero quantity
+	int count = min(static_cast<int>(_stack.size()), Depth);
+	PriceTicks ticks[Depth];
+	long quantities[Depth];
+	for (int i = 0; i < Depth; i++)
+	{
+		ticks[i] = (i < count) ? ToTicks(_stack[i].GetPrice()) : -1 - i;
+		quantities[i] = (i < count) ? _stack[i].GetQuantity() : 0;
+	}
+
+	// total quantity at the price of each level, as a branch-free Depth x Depth pass
+	long totals[Depth];
+	for (int i = 0; i < Depth; i++)
+	{
+		long total = 0;
+		for (int j = 0; j < Depth; j++) total += (ticks[j] == ticks[i]) ? quantities[j] : 0;
+		totals[i] = total;
+	}
+
+	// the stack is sorted, so a level starts a new price when it differs from the one before
+	int isNew[Depth];
+	isNew[0] = (count > 0);
+	for (int i = 1; i < Depth; i++) isNew[i] = (i < count) & (ticks[i] != ticks[i - 1]);
+
+	// branch-free compaction, a repeated price rewrites the next free slot
+	int depth = 0;
+	for (int i = 0; i < Depth; i++)
+	{
+		_prices[depth] = ticks[i];
+		_quantities[depth] = totals[i];
+		depth += isNew[i];
 	}
-	BidOffer newBidOffer(bestBid, bestOffer);
+	for (int i = depth; i < Depth; i++)
+	{
+		_prices[i] = 0;
+		_quantities[i] = 0;
+	}
+	return depth;
+}
+
+template<int Depth>
+int AggregatedBook<Depth>::GetDepth(PricingSide _side) const
+{
+	return (_side == BID) ? bidDepth : offerDepth;
+}
 
-	return newBidOffer;
+template<int Depth>
+PriceTicks AggregatedBook<Depth>::GetPrice(PricingSide _side, int _level) const
+{
+	return (_side == BID) ? bidPrices[_level] : offerPrices[_level];
+}
+
+template<int Depth>
+long AggregatedBook<Depth>::GetQuantity(PricingSide _side, int _level) const
+{
+	return (_side == BID) ? bidQuantities[_level] : offerQuantities[_level];
+}
+
+template<int Depth>
+PriceTicks AggregatedBook<Depth>::GetSpread() const
+{
+	return offerPrices[0] - bidPrices[0];
+}
+
+template<int Depth>
+long AggregatedBook<Depth>::GetTotalQuantity(PricingSide _side) const
+{
+	// unused levels hold zero quantity, so the sum runs over the full depth
+	const long* quantities = (_side == BID) ? bidQuantities : offerQuantities;
+	long total = 0;
+	for (int i = 0; i < Depth; i++) total += quantities[i];
+	return total;
+}
+
+
+/**
+ * A level-by-level update of an order book.
+ * Type T is the product type.
+ */
+template<typename T>
+class OrderBookDelta
+{
+
+public:
+
+  // ctor for an order book update
+  OrderBookDelta(const T &_product, BookUpdateType _type, const Order &_order);
+  OrderBookDelta() = default;
+
+  // Get the product
+  const T& GetProduct() const;
+
+  // Get the type of update
+  BookUpdateType GetType() const;
+
+  // Get the level with its side, price and new quantity
+  const Order& GetOrder() const;
+
+private:
+  const T* product = nullptr; // owned by the product registry
+  BookUpdateType type;
+  Order order;
+
+};
+
+template<typename T>
+OrderBookDelta<T>::OrderBookDelta(const T& _product, BookUpdateType _type, const Order& _order) :
+	product(&_product), order(_order)
+{
+	type = _type;
+}
+
+template<typename T>
+const T& OrderBookDelta<T>::GetProduct() const
+{
+	return *product;
+}
+
+template<typename T>
+BookUpdateType OrderBookDelta<T>::GetType() const
+{
+	return type;
+}
+
+template<typename T>
+const Order& OrderBookDelta<T>::GetOrder() const
+{
+	return order;
 }
 
 
@@ -190,10 +549,13 @@ class marketDataConnector;
 /**
  * Market Data Service which provides market data to interested subscribers
  * Keyed on product identifier.
+ * The best bid/offer of each book is published as a snapshot on each update, which
+ * other threads read a copy of with GetBestBidOfferSnapshot() while the books change,
+ * at a cost to the writer of about 3 ns per update.
  * Type T is the product type.
  */
 template<typename T>
-class marketDataService : public Service<string,OrderStacks <T> >
+class marketDataService : public Service<string_view, OrderStacks <T> >
 {
 
 public:
@@ -202,10 +564,10 @@ public:
 	marketDataService();
 
 	// Get data on our service given a key
-	OrderStacks<T>& GetData(string key);
+	OrderStacks<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(OrderStacks<T>& data);
+	void OnMessage(OrderStacks<T>&& data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<OrderStacks<T>>* listener);
@@ -216,18 +578,39 @@ public:
 	// Get the connector of the service
 	marketDataConnector<T>* GetConnector();
 
+	// Apply a level-by-level update to the book of a product and notify the listeners
+	void OnDelta(const OrderBookDelta<T>& delta);
+
 	// Get the best bid/offer order
-	BidOffer& GetBestBidOffer(const string &productId);
+	const BidOffer& GetBestBidOffer(string_view productId);
+
+	// Get a copy of the best bid/offer of a product from any thread without locking, false if it has no book
+	bool GetBestBidOfferSnapshot(string_view productId, BidOffer& snapshot) const;
 
 	// Aggregate the market data at all price points to create a new bid/offer stack
-	OrderStacks<T>& AggregateMarketData(const string &productId);
+	OrderStacks<T> AggregateMarketData(string_view productId);
+
+	// Aggregate the market data of a product into a fixed-depth book, without allocating
+	template<int Depth>
+	void GetAggregatedBook(string_view productId, AggregatedBook<Depth> &aggregatedBook);
+
+	// Get the products of the widest spreads between the best bid and offer and those spreads,
+	// the widest first, from any thread without locking
+	vector<pair<const T*, double>> GetWidestSpreads(size_t _n) const;
+
+	// Save the order books to a checkpoint
+	void SaveCheckpoint(ostream& _checkpoint) const;
+
+	// Restore the order books of a checkpoint, without notifying the listeners
+	void RestoreCheckpoint(istream& _checkpoint);
 
 	// dtor
 	~marketDataService();
 
 private:
 
-	unordered_map<string, OrderStacks<T>> orderBooks;
+	ProductStore<OrderStacks<T>> orderBooks;
+	SnapshotStore<BidOffer> bestBidOffers;
 	marketDataConnector<T>* connector;
 	vector<ServiceListener<OrderStacks<T>>*> listeners;
 
@@ -237,25 +620,27 @@ private:
 template<typename T>
 marketDataService<T>::marketDataService()
 {
-	orderBooks = unordered_map<string, OrderStacks<T>>();
+	orderBooks = ProductStore<OrderStacks<T>>();
 	connector = new marketDataConnector<T>(this);
 	listeners = vector<ServiceListener<OrderStacks<T>>*>();
 }
 
 template<typename T>
-OrderStacks<T>& marketDataService<T>::GetData(string key)
+OrderStacks<T>& marketDataService<T>::GetData(string_view _key)
 {
-	return orderBooks[key];
+	return orderBooks.Get(_key);
 }
 
 template<typename T>
-void marketDataService<T>::OnMessage(OrderStacks<T>& data)
+void marketDataService<T>::OnMessage(OrderStacks<T>&& data)
 {
-	// add or update a new event
-	orderBooks[data.GetProduct().GetProductId()] = data;
+	INSTRUMENT_HOP("marketDataService::OnMessage");
+	// add or update a new event, moving the orders into the stored book
+	const OrderStacks<T>& orderBook = orderBooks.Put(move(data));
+	bestBidOffers.Publish(orderBook.GetProduct().GetProductIndex(), orderBook.GetBestBidOffer());
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(orderBook); });
 }
 
 template<typename T>
@@ -277,34 +662,132 @@ marketDataConnector<T>* marketDataService<T>::GetConnector()
 }
 
 template<typename T>
-BidOffer& marketDataService<T>::GetBestBidOffer(const string& productId)
+void marketDataService<T>::OnDelta(const OrderBookDelta<T>& delta)
+{
+	INSTRUMENT_HOP("marketDataService::OnDelta");
+	// update the stored book in place
+	size_t index = delta.GetProduct().GetProductIndex();
+	if (!orderBooks.Contains(index))
+	{
+		OrderStacks<T> orderBook;
+		orderBook.SetProduct(delta.GetProduct());
+		orderBooks.Put(move(orderBook));
+	}
+	OrderStacks<T>& orderBook = orderBooks[index];
+	orderBook.UpdateLevel(delta.GetType(), delta.GetOrder());
+	bestBidOffers.Publish(index, orderBook.GetBestBidOffer());
+
+	// invoke all the listeners
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessUpdate(orderBook); });
+}
+
+template<typename T>
+const BidOffer& marketDataService<T>::GetBestBidOffer(string_view productId)
+{
+	return orderBooks.Get(productId).GetBestBidOffer();
+}
+
+template<typename T>
+bool marketDataService<T>::GetBestBidOfferSnapshot(string_view productId, BidOffer& snapshot) const
 {
-	return orderBooks[productId].GetBestBidOffer();
+	const T* product = ProductRegistry<T>::GetInstance().Find(productId);
+	return product != nullptr && bestBidOffers.GetSnapshot(product->GetProductIndex(), snapshot);
 }
 
 template<typename T>
-OrderStacks<T>& marketDataService<T>::AggregateMarketData(const string& productId)
+OrderStacks<T> marketDataService<T>::AggregateMarketData(string_view productId)
 {
-	T product = orderBooks[productId].GetProduct();
-	vector<Order> bidStack = orderBooks[productId].GetBidStack();
-	vector<Order> offerStack = orderBooks[productId].GetOfferStack();
+	const OrderStacks<T>& orderBook = orderBooks.Get(productId);
+
+	// the stacks are sorted, so orders at the same price are next to each other
+	auto aggregate = [](const OrderStack& stack) {
+		vector<Order> newStack;
+		for (auto& o : stack) {
+			if (!newStack.empty() && newStack.back().GetPrice() == o.GetPrice())
+				newStack.back() = Order(o.GetPrice(), newStack.back().GetQuantity() + o.GetQuantity(), o.GetSide());
+			else
+				newStack.push_back(o);
+		}
+		return newStack;
+	};
+
+	return OrderStacks<T>(orderBook.GetProduct(), aggregate(orderBook.GetBidStack()), aggregate(orderBook.GetOfferStack()));
+}
+
+template<typename T>
+template<int Depth>
+void marketDataService<T>::GetAggregatedBook(string_view productId, AggregatedBook<Depth>& aggregatedBook)
+{
+	aggregatedBook.Aggregate(orderBooks.Get(productId));
+}
+
+template<typename T>
+vector<pair<const T*, double>> marketDataService<T>::GetWidestSpreads(size_t _n) const
+{
+	const ProductRegistry<T>& registry = ProductRegistry<T>::GetInstance();
+	vector<pair<const T*, double>> spreads;
+	BidOffer bidOffer;
+	for (size_t i = 0; i < registry.Size(); i++)
+	{
+		if (!bestBidOffers.GetSnapshot(i, bidOffer)) continue;
+		spreads.push_back(make_pair(&registry.Get(i), bidOffer.GetOfferOrder().GetPrice() - bidOffer.GetBidOrder().GetPrice()));
+	}
+	return GetTopN(spreads.begin(), spreads.end(), _n, [](const pair<const T*, double>& _a, const pair<const T*, double>& _b) {
+		return _a.second < _b.second; });
+}
 
-	// aggregate the same price
-	unordered_map<double, long> tmpBidTable, tmpOfferTable;
-	auto aggBid = [&](auto o) {tmpBidTable[o->GetPrice()] += o->GetQuantity(); };
-	auto aggOffer = [&](auto o) {tmpOfferTable[o->GetPrice()] += o->GetQuantity(); };
-	for_each(bidStack.begin(), bidStack.end(), aggBid);
-	for_each(offerStack.begin(), offerStack.end(), aggOffer);
+template<typename T>
+void marketDataService<T>::SaveCheckpoint(ostream& _checkpoint) const
+{
+	uint32_t count = 0;
+	for (size_t i = 0; i < orderBooks.Size(); i++) count += orderBooks.Contains(i);
+	WriteCheckpointValue(_checkpoint, count);
+
+	// the product index and the size of both stacks, then their orders
+	for (size_t i = 0; i < orderBooks.Size(); i++)
+	{
+		if (!orderBooks.Contains(i)) continue;
+		const OrderStacks<T>& orderBook = orderBooks[i];
+		WriteCheckpointValue(_checkpoint, static_cast<uint32_t>(i));
+		WriteCheckpointValue(_checkpoint, static_cast<uint32_t>(orderBook.GetBidStack().size()));
+		WriteCheckpointValue(_checkpoint, static_cast<uint32_t>(orderBook.GetOfferStack().size()));
+		for (const OrderStack* stack : { &orderBook.GetBidStack(), &orderBook.GetOfferStack() })
+		{
+			for (const Order& order : *stack)
+			{
+				WriteCheckpointValue(_checkpoint, order.GetPrice());
+				WriteCheckpointValue(_checkpoint, static_cast<int64_t>(order.GetQuantity()));
+			}
+		}
+	}
+}
 
-	// convert to new stacks
-	vector<Order> newbidStack, newofferStack;
-	auto converBid = [&](auto p) {newbidStack.push_back(Order(p->first, p->second, BID)); };
-	auto converOffer = [&](auto p) {newofferStack.push_back(Order(p->first, p->second, OFFER)); };
-	for_each(tmpBidTable.begin(), tmpBidTable.end(), converBid);
-	for_each(tmpOfferTable.begin(), tmpOfferTable.end(), converOffer);
-	OrderStacks<T> newOrderStack(product, newbidStack, newofferStack);
+template<typename T>
+void marketDataService<T>::RestoreCheckpoint(istream& _checkpoint)
+{
+	uint32_t count = 0;
+	ReadCheckpointValue(_checkpoint, count);
+	for (uint32_t b = 0; b < count; b++)
+	{
+		uint32_t index = 0, bidCount = 0, offerCount = 0;
+		ReadCheckpointValue(_checkpoint, index);
+		ReadCheckpointValue(_checkpoint, bidCount);
+		ReadCheckpointValue(_checkpoint, offerCount);
+
+		vector<Order> bids, offers;
+		for (uint32_t i = 0; i < bidCount + offerCount; i++)
+		{
+			double price = 0;
+			int64_t quantity = 0;
+			ReadCheckpointValue(_checkpoint, price);
+			ReadCheckpointValue(_checkpoint, quantity);
+			if (i < bidCount) bids.push_back(Order(price, static_cast<long>(quantity), BID));
+			else offers.push_back(Order(price, static_cast<long>(quantity), OFFER));
+		}
 
-	return newOrderStack;
+		const OrderStacks<T>& orderBook = orderBooks.Put(OrderStacks<T>(ProductRegistry<T>::GetInstance().Get(index), bids, offers));
+		bestBidOffers.Publish(index, orderBook.GetBestBidOffer());
+	}
 }
 
 template<typename T>
@@ -314,8 +797,14 @@ marketDataService<T>::~marketDataService()
 }
 
 
+// Bytes of the arena a market data connector keeps its scratch book in
+const size_t MARKET_DATA_ARENA_SIZE = 4096;
+
 /**
 * Market Data Connector (subscribe-only)
+* The updates are gathered in a scratch book whose stacks live in an arena of the
+* connector and keep their storage from one update to the next, so that the steady
+* state allocates nothing per update. A book outgrowing the arena falls back to the heap.
 * Type T is the product type.
 */
 template<typename T>
@@ -326,69 +815,99 @@ public:
 	marketDataConnector(marketDataService<T>* _service);
 
 	// Publish data to the Connector
-	void Publish(OrderStacks<T>& data);
+	void Publish(const OrderStacks<T>& data);
 
 	// Subscribe data from the Connector
-	void Subscribe(ifstream& data);
+	void Subscribe(istream& data);
 
+	// Subscribe the book snapshots and deltas of the binary frames of a socket
+	void SubscribeWire(WireReader& _reader);
 
 private:
 
 	marketDataService<T>* service;
+	alignas(max_align_t) char arena[MARKET_DATA_ARENA_SIZE];
+	pmr::monotonic_buffer_resource arenaResource;
 };
 
 
 template<typename T>
-marketDataConnector<T>::marketDataConnector(marketDataService<T>* _service)
+marketDataConnector<T>::marketDataConnector(marketDataService<T>* _service) :
+	arenaResource(arena, sizeof(arena))
 {
 	service = _service;
 }
 
 template<typename T>
-void marketDataConnector<T>::Publish(OrderStacks<T>& data) {}
+void marketDataConnector<T>::Publish(const OrderStacks<T>& data) {}
 
 template<typename T>
-void marketDataConnector<T>::Subscribe(ifstream& data)
+void marketDataConnector<T>::Subscribe(istream& data)
 {
-	// subcribe the data from files
-	string line;
+	// subcribe the data from files, reading in large blocks
+	// and tokenizing each line in place
+	LineReader reader(data);
+	string_view line;
 	int num_line = 0; // count the lines already read
-	vector<Order> bidStacks, offerStacks;
+	string productId;
+	OrderStacks<T> orderBook(&arenaResource);
 
 	// read orders from files
-	while (getline(data, line)) {
-		stringstream orderInfo(line);
-		vector<string> orderData;
-		string p;
-
-		while (getline(orderInfo, p, ','))
+	while (reader.Next(line)) {
+		// the latency of a book is measured from its first line
+		if (num_line == 0) INSTRUMENT_ORIGIN();
+		string_view CUSIP = NextField(line);
+		double price = GetNormalPrice(NextField(line));
+		long quantity = ParseQuantity(NextField(line));
+		string_view side = NextField(line);
+
+		if (side == "BID")
 		{
-			orderData.push_back(p);
+			orderBook.AddOrder(Order(price, quantity, BID));
 		}
-
-		// convert string to desired type
-		string CUSIP = orderData[0];
-		double price = GetNormalPrice(orderData[1]);
-		long quantity = stol(orderData[2]);
-
-		if (orderData[3] == "BID")
-		{
-			bidStacks.push_back(Order(price, quantity, BID));
-		}
-		else if (orderData[3] == "OFFER")
+		else if (side == "OFFER")
 		{
-			offerStacks.push_back(Order(price, quantity, OFFER));
+			orderBook.AddOrder(Order(price, quantity, OFFER));
 		}
 
 		// decide whether it is an separate update
 		num_line++;
 		if (num_line == 10) {
 			num_line = 0;
-			T product = GetProductType(CUSIP);
-			OrderStacks<T>  orderBook(product, bidStacks, offerStacks);
-			bidStacks = vector<Order>();
-			offerStacks = vector<Order>();
-			service->OnMessage(orderBook);
+
+			// only look up the product when the CUSIP changes
+			if (productId != CUSIP) {
+				productId = string(CUSIP);
+				orderBook.SetProduct(GetProductType(productId));
+			}
+			service->OnMessage(move(orderBook));
+			orderBook.Clear();
+		}
+	}
+}
+
+template<typename T>
+void marketDataConnector<T>::SubscribeWire(WireReader& _reader)
+{
+	OrderStacks<T> orderBook(&arenaResource);
+	const WireHeader* message;
+	while (_reader.Next(message))
+	{
+		INSTRUMENT_ORIGIN();
+		const T* product = GetWireProduct<T>(*message);
+		if (!product) continue;
+
+		if (message->type == WIRE_BOOK_SNAPSHOT)
+		{
+			const WireBookSnapshot& snapshot = GetWireMessage<WireBookSnapshot>(*message);
+			orderBook.Clear();
+			orderBook.SetProduct(*product);
+			for (int i = 0; i < snapshot.bidCount + snapshot.offerCount; i++)
+			{
+				const WireLevel& level = snapshot.levels[i];
+				orderBook.AddOrder(Order(ToPrice(level.price), static_cast<long>(level.quantity), i < snapshot.bidCount ? BID : OFFER));
+			}
+			service->OnMessage(move(orderBook));
 		}
 	}
 }
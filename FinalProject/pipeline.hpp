@@ -0,0 +1,139 @@
+/**
+ * pipeline.hpp
+ * Defines the pipeline of stages wired at compile time, the static counterpart
+ * of the listeners added to a Service at run time.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <tuple>
+#include <utility>
+#include "soa.hpp"
+
+using namespace std;
+
+/**
+ * Pipeline calling its stages one after the other, in the order they are given.
+ * A stage gives the data type it takes as InputType and takes the data through
+ *   template<typename Next> void Process(const InputType& _data, Next& _next);
+ * calling _next() on each piece of data it passes on to the next stage.
+ * The next stage is known to the compiler, so passing the data on is a direct call
+ * which can be inlined, instead of a virtual call through a vector of listeners.
+ * The pipeline listens to the Service feeding its first stage like any listener,
+ * adds and updates both pushing the data, or is pushed the data with Push().
+ * The services of the stages keep notifying the listeners added at run time.
+ * Types Stages are the stage types, the stages are held by value.
+ */
+template<typename... Stages>
+class Pipeline : public ServiceListener<typename tuple_element<0, tuple<Stages...>>::type::InputType>
+{
+
+public:
+
+	typedef typename tuple_element<0, tuple<Stages...>>::type::InputType InputType;
+
+	// ctor
+	Pipeline(Stages... _stages);
+
+	// Push data through the stages
+	void Push(const InputType& _data);
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(const InputType& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(const InputType& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(const InputType& _data);
+
+private:
+
+	// Pass the data to the stage of an index, the data leaving the last stage goes nowhere
+	template<size_t Index, typename D>
+	void Forward(const D& _data);
+
+	tuple<Stages...> stages;
+
+};
+
+template<typename... Stages>
+Pipeline<Stages...>::Pipeline(Stages... _stages) :
+	stages(move(_stages)...)
+{}
+
+template<typename... Stages>
+void Pipeline<Stages...>::Push(const InputType& _data)
+{
+	Forward<0>(_data);
+}
+
+template<typename... Stages>
+void Pipeline<Stages...>::ProcessAdd(const InputType& _data)
+{
+	Forward<0>(_data);
+}
+
+template<typename... Stages>
+void Pipeline<Stages...>::ProcessRemove(const InputType& _data) {}
+
+template<typename... Stages>
+void Pipeline<Stages...>::ProcessUpdate(const InputType& _data)
+{
+	Forward<0>(_data);
+}
+
+template<typename... Stages>
+template<size_t Index, typename D>
+void Pipeline<Stages...>::Forward(const D& _data)
+{
+	if constexpr (Index < sizeof...(Stages))
+	{
+		auto next = [this](const auto& _output) { this->template Forward<Index + 1>(_output); };
+		get<Index>(stages).Process(_data, next);
+	}
+}
+
+/**
+ * Stage handing the data to a listener, last in a pipeline, such as an AsyncListener
+ * taking the rest of the path to a thread of its own.
+ * The listener is not owned.
+ * Type V is the data type of the listener.
+ */
+template<typename V>
+class ListenerStage
+{
+
+private:
+
+	ServiceListener<V>* listener;
+
+public:
+
+	typedef V InputType;
+
+	// Ctor
+	ListenerStage(ServiceListener<V>* _listener);
+
+	// Hand the data to the listener as an add event
+	template<typename Next>
+	void Process(const V& _data, Next& _next);
+
+};
+
+template<typename V>
+ListenerStage<V>::ListenerStage(ServiceListener<V>* _listener)
+{
+	listener = _listener;
+}
+
+template<typename V>
+template<typename Next>
+void ListenerStage<V>::Process(const V& _data, Next& _next)
+{
+	listener->ProcessAdd(_data);
+}
+
+#endif
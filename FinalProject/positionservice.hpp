@@ -9,14 +9,25 @@
 #define POSITION_SERVICE_HPP
 
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
 #include "soa.hpp"
+#include "instrumentation.hpp"
+#include "bookregistry.hpp"
+#include "snapshotstore.hpp"
+#include "checkpoint.hpp"
+#include "daryheap.hpp"
 #include "tradebookingservice.hpp"
 
 using namespace std;
 
 /**
  * Position class in a particular book.
+ * The books are kept in an array indexed by their id in the book registry, and the
+ * aggregate position is kept up to date as the books change.
  * Type T is the product type.
  */
 template<typename T>
@@ -25,7 +36,7 @@ class Position
 
 public:
 
-  // ctor for a position
+  // ctor for a position, empty until its books are traded
   Position(const T &_product);
   Position() = default;
 
@@ -33,82 +44,145 @@ public:
   const T& GetProduct() const;
 
   // Get the position quantity
-  long GetPosition(string &book);
+  long GetPosition(const string &book) const;
 
   // Set the position quantity
-  void AddPosition(string& _book, long _position);
+  void AddPosition(string_view _book, long _position);
+
+  // Set the position quantity of a book id of the book registry, throw out_of_range for an id out of 0 to MAX_BOOKS - 1
+  void AddPosition(int _bookId, long _position);
 
   // Get the aggregate position
-  long GetAggregatePosition();
+  long GetAggregatePosition() const;
 
   // Print the position
-  string print();
+  string print() const;
 
-private:
-  T product;
-  unordered_map<string, long> positions;
+  // Write the position as a binary journal record, return the record length
+  size_t Encode(long long _timestamp, char* _buffer) const;
+
+  // Read a position back from a binary journal record
+  static Position<T> Decode(const char* _buffer);
 
+private:
+  const T* product = nullptr; // owned by the product registry
+  array<long, MAX_BOOKS> positions{}; // by book id
+  array<uint8_t, MAX_BOOKS> books{}; // ids of the books traded, in the order they were first traded
+  int bookCount = 0;
+  uint32_t tradedBooks = 0; // bit of each book id traded
+  long aggregatePosition = 0;
+
+  COPY_COUNTED(Position<T>)
 };
 
 template<typename T>
-Position<T>::Position(const T& _product): product(_product) {
+Position<T>::Position(const T& _product): product(&_product) {
 }
 
 template<typename T>
 const T& Position<T>::GetProduct() const
 {
-	return product;
+	return *product;
 }
 
 template<typename T>
-long Position<T>::GetPosition(string& book)
+long Position<T>::GetPosition(const string& book) const
 {
-	return positions[book];
+	int bookId = BookRegistry::GetInstance().Find(book);
+	return bookId < 0 ? 0 : positions[bookId];
 }
 
 template<typename T>
-void Position<T>::AddPosition(string& _book, long _position)
+void Position<T>::AddPosition(string_view _book, long _position)
 {
-	positions[_book] += _position;
+	AddPosition(BookRegistry::GetInstance().Intern(_book), _position);
 }
 
 template<typename T>
-long Position<T>::GetAggregatePosition()
+void Position<T>::AddPosition(int _bookId, long _position)
 {
-	long aggPosition = 0;
-	for (auto& p : positions)
+	static_assert(MAX_BOOKS <= 32, "the traded books are kept as the bits of a 32-bit word");
+	if (_bookId < 0 || _bookId >= MAX_BOOKS) throw out_of_range("No such book id: " + to_string(_bookId));
+	if (!(tradedBooks & (1u << _bookId)))
 	{
-		aggPosition += p.second;
+		tradedBooks |= 1u << _bookId;
+		books[bookCount++] = static_cast<uint8_t>(_bookId);
 	}
-	return aggPosition;
+	positions[_bookId] += _position;
+	aggregatePosition += _position;
+}
+
+template<typename T>
+long Position<T>::GetAggregatePosition() const
+{
+	return aggregatePosition;
 }
 
 template<typename T>
-string Position<T>::print()
+string Position<T>::print() const
 {
 	stringstream output;
-	output << "CUSIP: " << product.GetProductId() << ", ";
+	output << "CUSIP: " << product->GetProductId() << ", ";
 
-	for (auto p : positions) {
-		output << p.first << ": " << p.second << ", ";
+	// the last book traded first
+	const BookRegistry& registry = BookRegistry::GetInstance();
+	for (int i = bookCount - 1; i >= 0; i--) {
+		output << registry.GetName(books[i]) << ": " << positions[books[i]] << ", ";
 	}
 
 	// Also print aggregate position
-	output << "Aggregate: " << to_string(this->GetAggregatePosition());
+	output << "Aggregate: " << to_string(aggregatePosition);
 
 	return output.str();
 }
 
+template<typename T>
+size_t Position<T>::Encode(long long _timestamp, char* _buffer) const
+{
+	PositionRecord record;
+	const BookRegistry& registry = BookRegistry::GetInstance();
+	int count = 0;
+	for (int i = bookCount - 1; i >= 0 && count < JOURNAL_MAX_BOOKS; i--)
+	{
+		SetJournalId(record.books[count].book, registry.GetName(books[i]));
+		record.books[count].quantity = positions[books[i]];
+		count++;
+	}
+	record.bookCount = static_cast<uint8_t>(count);
+	memset(record.reserved, 0, sizeof(record.reserved));
+
+	size_t length = sizeof(PositionRecord) - (JOURNAL_MAX_BOOKS - count) * sizeof(JournalBookPosition);
+	SetJournalHeader(record.header, POSITION_RECORD, length, product->GetProductIndex(), _timestamp);
+	return PutJournalRecord(record, _buffer);
+}
+
+template<typename T>
+Position<T> Position<T>::Decode(const char* _buffer)
+{
+	PositionRecord record = GetJournalRecord<PositionRecord>(_buffer);
+	Position<T> position(ProductRegistry<T>::GetInstance().Get(static_cast<size_t>(record.header.productIndex)));
+	// insert the books in reverse, so that print() lists them in the order they were written
+	for (int i = min(static_cast<int>(record.bookCount), JOURNAL_MAX_BOOKS) - 1; i >= 0; i--)
+	{
+		position.AddPosition(GetJournalId(record.books[i].book), record.books[i].quantity);
+	}
+	return position;
+}
+
 template<typename T>
 class TradeBookingListener;
 
 /**
  * Position Service to manage positions across multiple books and bonds.
  * Keyed on product identifier.
+ * Each change of a position is published as a snapshot, which other threads read a
+ * copy of with GetSnapshot() while the service writes, instead of GetData(). It costs
+ * the writer one store per 8 bytes of the position, 39 stores or about 15 ns for a
+ * Position of Bond, and the cache lines a reader takes when it copies them.
  * Type T is the product type.
  */
 template<typename T>
-class PositionService : public Service<string,Position <T> >
+class PositionService : public Service<string_view, Position <T> >
 {
 
 public:
@@ -117,10 +191,17 @@ public:
 	PositionService();
 
 	// Get data on our service given a key
-	Position<T>& GetData(string _key);
+	Position<T>& GetData(string_view _key);
+
+	// Get a copy of the position of a product from any thread without locking, false if it has none
+	bool GetSnapshot(string_view _key, Position<T>& _snapshot) const;
+
+	// Get copies of the positions of the largest aggregate size, long or short, the largest first,
+	// from any thread without locking
+	vector<Position<T>> GetLargestPositions(size_t _n) const;
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(Position<T>& _data);
+	void OnMessage(Position<T>&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<Position<T>>* _listener);
@@ -131,8 +212,17 @@ public:
 	// Get the listener of the service
 	TradeBookingListener<T>* GetListener();
 
-	// Add a trade to the service
-	virtual void AddTrade(const Trade<T>& _trade);
+	// Add a trade to the service, return the updated position
+	virtual const Position<T>& AddTrade(const Trade<T>& _trade);
+
+	// Add trades to the service, notifying the listeners once for each product traded
+	void AddTrades(const Trade<T>* _trades, size_t _count);
+
+	// Save the positions to a checkpoint
+	void SaveCheckpoint(ostream& _checkpoint) const;
+
+	// Restore the positions of a checkpoint, without notifying the listeners
+	void RestoreCheckpoint(istream& _checkpoint);
 
 	// Dtor
 	~PositionService();
@@ -140,15 +230,21 @@ public:
 
 private:
 
-	unordered_map<string, Position<T>> positions;
+	// Update the position of a trade in place, without notifying the listeners
+	Position<T>& ApplyTrade(const Trade<T>& _trade);
+
+	ProductStore<Position<T>> positions;
+	SnapshotStore<Position<T>> snapshots;
 	vector<ServiceListener<Position<T>>*> listeners;
 	TradeBookingListener<T>* listener;
+	vector<size_t> tradedProducts; // product indices of a batch of trades, in the order first traded
+	vector<char> isTraded;
 };
 
 template<typename T>
 PositionService<T>::PositionService()
 {
-	positions = unordered_map<string, Position<T>>();
+	positions = ProductStore<Position<T>>();
 	listeners = vector<ServiceListener<Position<T>>*>();
 	listener = new TradeBookingListener<T>(this);
 }
@@ -159,16 +255,27 @@ PositionService<T>::~PositionService() {
 }
 
 template<typename T>
-Position<T>& PositionService<T>::GetData(string _key)
+Position<T>& PositionService<T>::GetData(string_view _key)
 {
-	return positions[_key];
+	return positions.Get(_key);
 }
 
 template<typename T>
-void PositionService<T>::OnMessage(Position<T>& _data)
+bool PositionService<T>::GetSnapshot(string_view _key, Position<T>& _snapshot) const
 {
+	const T* product = ProductRegistry<T>::GetInstance().Find(_key);
+	return product != nullptr && snapshots.GetSnapshot(product->GetProductIndex(), _snapshot);
+}
+
+template<typename T>
+void PositionService<T>::OnMessage(Position<T>&& _data)
+{
+	INSTRUMENT_HOP("PositionService::OnMessage");
+	const Position<T>& position = positions.Put(move(_data));
+	snapshots.Publish(position.GetProduct().GetProductIndex(), position);
+
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(position); });
 }
 
 template<typename T>
@@ -190,27 +297,94 @@ const vector<ServiceListener<Position<T>>*>& PositionService<T>::GetListeners()
 }
 
 template<typename T>
-void PositionService<T>::AddTrade(const Trade<T>& trade)
+const Position<T>& PositionService<T>::AddTrade(const Trade<T>& trade)
+{
+	INSTRUMENT_HOP("PositionService::AddTrade");
+	Position<T>& position = ApplyTrade(trade);
+	snapshots.Publish(position.GetProduct().GetProductIndex(), position);
+
+	// the position is updated in place, so the listeners get the stored one rather than a copy through OnMessage()
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(position); });
+	return position;
+}
+
+template<typename T>
+void PositionService<T>::AddTrades(const Trade<T>* _trades, size_t _count)
 {
-	string productId = trade.GetProduct().GetProductId();
-	double price = trade.GetPrice();
-	string book = trade.GetBook();
+	for (size_t i = 0; i < _count; i++)
+	{
+		size_t index = ApplyTrade(_trades[i]).GetProduct().GetProductIndex();
+		if (index >= isTraded.size()) isTraded.resize(index + 1, false);
+		if (isTraded[index]) continue;
+		isTraded[index] = true;
+		tradedProducts.push_back(index);
+	}
+
+	for (size_t index : tradedProducts)
+	{
+		const Position<T>& position = positions[index];
+		snapshots.Publish(index, position);
+		for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(position); });
+		isTraded[index] = false;
+	}
+	tradedProducts.clear();
+}
+
+template<typename T>
+Position<T>& PositionService<T>::ApplyTrade(const Trade<T>& trade)
+{
+	const T& product = trade.GetProduct();
+	size_t index = product.GetProductIndex();
 	long quantity = trade.GetQuantity();
 	Side side = trade.GetSide();
 	if (side == SELL) quantity = -quantity;
 	
-	// See if already record the trade
-	if (positions.find(productId) == positions.end())
+	// See if already record the trade, then update the position in place
+	if (!positions.Contains(index))
 	{
-		positions[productId] = Position<T>(trade.GetProduct());
-		positions[productId].AddPosition(book, quantity);
+		positions.Put(Position<T>(product));
 	}
-	else
+	Position<T>& position = positions[index];
+	position.AddPosition(trade.GetBookId(), quantity);
+	return position;
+}
+
+template<typename T>
+vector<Position<T>> PositionService<T>::GetLargestPositions(size_t _n) const
+{
+	vector<Position<T>> all;
+	Position<T> snapshot;
+	for (size_t i = 0; i < ProductRegistry<T>::GetInstance().Size(); i++)
+	{
+		if (snapshots.GetSnapshot(i, snapshot)) all.push_back(snapshot);
+	}
+	return GetTopN(all.begin(), all.end(), _n, [](const Position<T>& _a, const Position<T>& _b) {
+		return labs(_a.GetAggregatePosition()) < labs(_b.GetAggregatePosition()); });
+}
+
+template<typename T>
+void PositionService<T>::SaveCheckpoint(ostream& _checkpoint) const
+{
+	uint32_t count = 0;
+	for (size_t i = 0; i < positions.Size(); i++) count += positions.Contains(i);
+	WriteCheckpointValue(_checkpoint, count);
+	for (size_t i = 0; i < positions.Size(); i++)
 	{
-		positions[productId].AddPosition(book, quantity);
+		if (positions.Contains(i)) WriteCheckpointRecord(_checkpoint, positions[i]);
 	}
+}
 
-	this->OnMessage(positions[productId]);
+template<typename T>
+void PositionService<T>::RestoreCheckpoint(istream& _checkpoint)
+{
+	uint32_t count = 0;
+	ReadCheckpointValue(_checkpoint, count);
+	char record[JOURNAL_MAX_RECORD];
+	for (uint32_t i = 0; i < count && ReadJournalRecord(_checkpoint, record); i++)
+	{
+		const Position<T>& position = positions.Put(Position<T>::Decode(record));
+		snapshots.Publish(position.GetProduct().GetProductIndex(), position);
+	}
 }
 
 
@@ -232,13 +406,13 @@ public:
 	TradeBookingListener(PositionService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(Trade<T>& _data);
+	void ProcessAdd(const Trade<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(Trade<T>& _data);
+	void ProcessRemove(const Trade<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(Trade<T>& _data);
+	void ProcessUpdate(const Trade<T>& _data);
 
 };
 
@@ -249,16 +423,55 @@ TradeBookingListener<T>::TradeBookingListener(PositionService<T>* _service)
 }
 
 template<typename T>
-void TradeBookingListener<T>::ProcessAdd(Trade<T>& _data)
+void TradeBookingListener<T>::ProcessAdd(const Trade<T>& _data)
 {
 	service->AddTrade(_data);
 }
 
 template<typename T>
-void TradeBookingListener<T>::ProcessRemove(Trade<T>& _data) {}
+void TradeBookingListener<T>::ProcessRemove(const Trade<T>& _data) {}
+
+template<typename T>
+void TradeBookingListener<T>::ProcessUpdate(const Trade<T>& _data) {}
+
+
+/**
+* Stage of a Pipeline keeping the positions, wired at compile time in place of TradeBookingListener.
+* Type T is the product type.
+*/
+template<typename T>
+class PositionStage
+{
+
+private:
+
+	PositionService<T>* service;
+
+public:
+
+	typedef Trade<T> InputType;
+
+	// Ctor
+	PositionStage(PositionService<T>* _service);
+
+	// Add a trade, passing on the updated position
+	template<typename Next>
+	void Process(const Trade<T>& _data, Next& _next);
+
+};
+
+template<typename T>
+PositionStage<T>::PositionStage(PositionService<T>* _service)
+{
+	service = _service;
+}
 
 template<typename T>
-void TradeBookingListener<T>::ProcessUpdate(Trade<T>& _data) {}
+template<typename Next>
+void PositionStage<T>::Process(const Trade<T>& _data, Next& _next)
+{
+	_next(service->AddTrade(_data));
+}
 
 
 #endif
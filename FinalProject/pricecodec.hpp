@@ -0,0 +1,176 @@
+/**
+ * pricecodec.hpp
+ * Defines the fixed-point tick price and the codec between fractional
+ * notation (e.g. 100-25+) and ticks, shared by the connectors and the
+ * output writers.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef PRICE_CODEC_HPP
+#define PRICE_CODEC_HPP
+
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+// Price as an integer number of ticks, US Treasuries tick in 1/256th
+typedef long PriceTicks;
+
+const int TICKS_PER_POINT = 256;
+
+/**
+ * Lookup table from the fraction of a point in ticks (0 to 255) to the "xyz"
+ * suffix of the fractional notation, xy being the 32nds and z the 256ths
+ * (z = 4 is written as +).
+ */
+class FractionalSuffixTable
+{
+
+public:
+
+	// ctor building the table at compile time
+	constexpr FractionalSuffixTable();
+
+	// Get the 3 characters of the suffix for a fraction in ticks
+	constexpr const char* GetSuffix(int _fraction) const;
+
+private:
+	char suffixes[TICKS_PER_POINT][3];
+
+};
+
+constexpr FractionalSuffixTable::FractionalSuffixTable() : suffixes{}
+{
+	for (int i = 0; i < TICKS_PER_POINT; i++)
+	{
+		int sp = i / 8;
+		int tp = i % 8;
+		suffixes[i][0] = static_cast<char>('0' + sp / 10);
+		suffixes[i][1] = static_cast<char>('0' + sp % 10);
+		suffixes[i][2] = (tp == 4) ? '+' : static_cast<char>('0' + tp);
+	}
+}
+
+constexpr const char* FractionalSuffixTable::GetSuffix(int _fraction) const
+{
+	return suffixes[_fraction];
+}
+
+constexpr FractionalSuffixTable FRACTIONAL_SUFFIXES;
+
+// Longest fractional price written by FormatTicks, e.g. -9223372036854775807-31+
+const int MAX_FRACTIONAL_LENGTH = 24;
+
+
+/*
+	Conversions between ticks and numerical prices
+*/
+
+// Convert a numerical price to ticks, rounding down to the tick below
+PriceTicks ToTicks(double _price)
+{
+	return static_cast<PriceTicks>(floor(_price * TICKS_PER_POINT));
+}
+
+// Convert ticks to a numerical price
+constexpr double ToPrice(PriceTicks _ticks)
+{
+	return _ticks / static_cast<double>(TICKS_PER_POINT);
+}
+
+
+/*
+	Fractional notation codec
+*/
+
+// Parse a fractional price such as 99-317 or 100-25+ into ticks; the sign is only the one
+// of the points, the fraction being added to them, so -1-317 is 1 tick below 0 as FormatTicks writes it
+PriceTicks ParseTicks(string_view _price)
+{
+	const char* p = _price.data();
+	const char* last = p + _price.size();
+
+	bool negative = (p != last && *p == '-');
+	p += negative;
+
+	PriceTicks points = 0;
+	while (p != last && *p != '-')
+	{
+		points = points * 10 + (*p - '0');
+		p++;
+	}
+
+	if (negative) points = -points;
+
+	// no fraction given, e.g. a plain "100"
+	if (last - p < 4) return points * TICKS_PER_POINT;
+
+	int sp = (p[1] - '0') * 10 + (p[2] - '0');
+	int tp = (p[3] == '+') ? 4 : p[3] - '0';
+	return points * TICKS_PER_POINT + sp * 8 + tp;
+}
+
+// Check that a price is in the fractional notation ParseTicks reads: optional minus, points,
+// and an optional fraction of a dash, 32nds from 00 to 31 and 256ths from 0 to 7 or +
+bool IsFractionalPrice(string_view _price)
+{
+	const char* p = _price.data();
+	const char* last = p + _price.size();
+	bool negative = (p != last && *p == '-');
+	p += negative;
+
+	// the points times TICKS_PER_POINT must fit in ticks, the negative ones going one point further
+	const char* digits = p;
+	PriceTicks points = 0;
+	while (p != last && *p >= '0' && *p <= '9')
+	{
+		points = points * 10 + (*p - '0');
+		if (points > (numeric_limits<PriceTicks>::max() >> 8) + negative) return false;
+		p++;
+	}
+	if (p == digits) return false;
+	if (p == last) return true;
+
+	if (last - p != 4 || p[0] != '-') return false;
+	if (p[1] < '0' || p[1] > '3' || p[2] < '0' || p[2] > '9' || (p[1] == '3' && p[2] > '1')) return false;
+	return (p[3] >= '0' && p[3] <= '7') || p[3] == '+';
+}
+
+// Parse a fractional price as ParseTicks does, throw invalid_argument if it is not in fractional notation,
+// as the stod of the baseline did; the connectors read their input with it
+PriceTicks ParseTicksChecked(string_view _price)
+{
+	if (!IsFractionalPrice(_price)) throw invalid_argument("Not a fractional price: " + string(_price));
+	return ParseTicks(_price);
+}
+
+// Write ticks in fractional notation to a buffer of at least MAX_FRACTIONAL_LENGTH
+// characters, return the end of the written characters
+char* FormatTicks(PriceTicks _ticks, char* _output)
+{
+	// the arithmetic shift rounds towards the tick below, as ToTicks does
+	PriceTicks points = _ticks >> 8;
+	int fraction = static_cast<int>(_ticks & (TICKS_PER_POINT - 1));
+
+	char* p = to_chars(_output, _output + MAX_FRACTIONAL_LENGTH - 4, points).ptr;
+	const char* suffix = FRACTIONAL_SUFFIXES.GetSuffix(fraction);
+	p[0] = '-';
+	p[1] = suffix[0];
+	p[2] = suffix[1];
+	p[3] = suffix[2];
+	return p + 4;
+}
+
+// Format ticks in fractional notation
+string FormatTicks(PriceTicks _ticks)
+{
+	char buffer[MAX_FRACTIONAL_LENGTH];
+	return string(buffer, FormatTicks(_ticks, buffer));
+}
+
+#endif
@@ -11,6 +11,9 @@
 #include <string>
 #include <algorithm>
 #include "soa.hpp"
+#include "instrumentation.hpp"
+#include "linereader.hpp"
+#include "wireprotocol.hpp"
 
 /**
  * A price object consisting of mid and bid/offer spread.
@@ -25,7 +28,10 @@ public:
 
   // ctor for a price
 	Price() = default;
-	Price(T _product, double _mid, double _bidOfferSpread);
+	Price(const T& _product, double _mid, double _bidOfferSpread);
+
+  // ctor for a product not priced yet
+	explicit Price(const T& _product);
 
   
 
@@ -40,7 +46,7 @@ public:
   double GetBidOfferSpread() const;
 
 private:
-  T product;
+  const T* product = nullptr; // owned by the product registry
   double mid;
   double bidOfferSpread;
 
@@ -48,17 +54,23 @@ private:
 
 
 template<typename T>
-Price<T>::Price(T _product, double _mid, double _bidOfferSpread) :
-  product(_product)
+Price<T>::Price(const T& _product, double _mid, double _bidOfferSpread) :
+  product(&_product)
 {
   mid = _mid;
   bidOfferSpread = _bidOfferSpread;
 }
 
+template<typename T>
+Price<T>::Price(const T& _product) :
+  Price(_product, 0, 0)
+{
+}
+
 template<typename T>
 const T& Price<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
@@ -83,7 +95,7 @@ class pricingConnector;
  * Type T is the product type.
  */
 template<typename T>
-class pricingService : public Service<string, Price <T> >
+class pricingService : public Service<string_view, Price <T> >
 {
 public:
 
@@ -91,10 +103,10 @@ public:
 	pricingService();
 
 	// Get data on our service given a key
-	Price<T>& GetData(string key);
+	Price<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(Price<T>& data);
+	void OnMessage(Price<T>&& data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events
 	// for data to the Service.
@@ -110,7 +122,7 @@ public:
 	~pricingService();
 
 private:
-	unordered_map<string, Price<T>> prices;
+	ProductStore<Price<T>> prices;
 	vector<ServiceListener<Price<T>>*> listeners;
 	pricingConnector<T>* connector;
 };
@@ -118,7 +130,7 @@ private:
 template<typename T>
 pricingService<T>::pricingService()
 {
-	prices = unordered_map<string, Price<T>>();
+	prices = ProductStore<Price<T>>();
 	listeners = vector<ServiceListener<Price<T>>*>();
 	connector = new pricingConnector<T>(this);
 }
@@ -129,18 +141,19 @@ pricingService<T>::~pricingService() {
 }
 
 template<typename T>
-Price<T>& pricingService<T>::GetData(string _key)
+Price<T>& pricingService<T>::GetData(string_view _key)
 {
-	return prices[_key];
+	return prices.Get(_key);
 }
 
 template<typename T>
-void pricingService<T>::OnMessage(Price<T>& data)
+void pricingService<T>::OnMessage(Price<T>&& data)
 {
-	prices[data.GetProduct().GetProductId()] = data;
+	INSTRUMENT_HOP("pricingService::OnMessage");
+	const Price<T>& price = prices.Put(move(data));
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(price); });
 }
 
 template<typename T>
@@ -180,10 +193,13 @@ public:
 	pricingConnector(pricingService<T>* _service);
 
 	// Publish data to the Connector
-	void Publish(Price<T>& _data);
+	void Publish(const Price<T>& _data);
 
 	// Subscribe data from the Connector
-	void Subscribe(ifstream& _data);
+	void Subscribe(istream& _data);
+
+	// Subscribe the messages of the binary frames of a socket
+	void SubscribeWire(WireReader& _reader);
 
 };
 
@@ -194,30 +210,39 @@ pricingConnector<T>::pricingConnector(pricingService<T>* _service)
 }
 
 template<typename T>
-void pricingConnector<T>::Publish(Price<T>& _data) {}
+void pricingConnector<T>::Publish(const Price<T>& _data) {}
 
 template<typename T>
-void pricingConnector<T>::Subscribe(ifstream& data)
+void pricingConnector<T>::Subscribe(istream& data)
 {
-	string line;
-	while (getline(data, line))
+	// tokenize each line in place, so that nothing is allocated per price
+	LineReader reader(data);
+	string_view line;
+	while (reader.Next(line))
 	{
-		stringstream priceInfo(line);
-		vector<string> priceData;
-		string p;
-
-		while (getline(priceInfo, p, ','))
-		{
-			priceData.push_back(p);
-		}
-
-		string productId = priceData[0];
-		double mid = GetNormalPrice(priceData[1]);
-		double spread = GetNormalPrice(priceData[2]);
-		T product = GetProductType(productId);
+		INSTRUMENT_ORIGIN();
+		const T& product = GetProductType(NextField(line));
+		double mid = GetNormalPrice(NextField(line));
+		double spread = GetNormalPrice(NextField(line));
 		Price<T> newPrice(product, mid, spread);
-		
-		service->OnMessage(newPrice);
+
+		service->OnMessage(move(newPrice));
+	}
+}
+
+template<typename T>
+void pricingConnector<T>::SubscribeWire(WireReader& _reader)
+{
+	const WireHeader* message;
+	while (_reader.Next(message))
+	{
+		INSTRUMENT_ORIGIN();
+		const T* product = GetWireProduct<T>(*message);
+		if (message->type != WIRE_PRICE || !product) continue;
+
+		const WirePrice& price = GetWireMessage<WirePrice>(*message);
+		Price<T> newPrice(*product, ToPrice(price.mid), ToPrice(price.spread));
+		service->OnMessage(move(newPrice));
 	}
 }
 #endif
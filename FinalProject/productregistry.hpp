@@ -0,0 +1,119 @@
+/**
+ * productregistry.hpp
+ * Defines the registry interning every product once at startup.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef PRODUCT_REGISTRY_HPP
+#define PRODUCT_REGISTRY_HPP
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <stdexcept>
+#include "products.hpp"
+
+using namespace std;
+
+/**
+ * Registry owning one instance of each product.
+ * Every product gets a dense index (0, 1, 2, ...) in the order it is added, and
+ * keeps its address for the lifetime of the program, so data types can refer to
+ * it instead of holding a copy.
+ * Products should all be added at startup, before any service runs.
+ * Type T is the product type.
+ */
+template<typename T>
+class ProductRegistry
+{
+
+public:
+
+	// Get the registry of product type T
+	static ProductRegistry<T>& GetInstance();
+
+	// Add a product, return the registered instance
+	const T& Add(const T& _product);
+
+	// Find a product by identifier, nullptr if it is not registered
+	const T* Find(string_view _productId) const;
+
+	// Get a product by identifier, throw out_of_range if it is not registered
+	const T& Get(string_view _productId) const;
+
+	// Get a product by its dense index
+	const T& Get(size_t _index) const;
+
+	// Get the dense index of a product identifier, throw out_of_range if it is not registered
+	size_t GetIndex(string_view _productId) const;
+
+	// Get the number of registered products
+	size_t Size() const;
+
+private:
+
+	ProductRegistry() = default;
+	ProductRegistry(const ProductRegistry&) = delete;
+	ProductRegistry& operator=(const ProductRegistry&) = delete;
+
+	deque<T> products; // deque keeps the addresses stable when growing
+	unordered_map<string_view, size_t> indices; // views on the product identifiers above
+
+};
+
+template<typename T>
+ProductRegistry<T>& ProductRegistry<T>::GetInstance()
+{
+	static ProductRegistry<T> registry;
+	return registry;
+}
+
+template<typename T>
+const T& ProductRegistry<T>::Add(const T& _product)
+{
+	const T* existing = Find(_product.GetProductId());
+	if (existing != nullptr) return *existing;
+
+	products.push_back(_product);
+	T& product = products.back();
+	product.SetProductIndex(static_cast<int>(products.size() - 1));
+	indices[product.GetProductId()] = products.size() - 1;
+	return product;
+}
+
+template<typename T>
+const T* ProductRegistry<T>::Find(string_view _productId) const
+{
+	auto it = indices.find(_productId);
+	if (it == indices.end()) return nullptr;
+	return &products[it->second];
+}
+
+template<typename T>
+const T& ProductRegistry<T>::Get(string_view _productId) const
+{
+	return products[GetIndex(_productId)];
+}
+
+template<typename T>
+const T& ProductRegistry<T>::Get(size_t _index) const
+{
+	return products[_index];
+}
+
+template<typename T>
+size_t ProductRegistry<T>::GetIndex(string_view _productId) const
+{
+	auto it = indices.find(_productId);
+	if (it == indices.end()) throw out_of_range("Unknown product " + string(_productId));
+	return it->second;
+}
+
+template<typename T>
+size_t ProductRegistry<T>::Size() const
+{
+	return products.size();
+}
+
+#endif
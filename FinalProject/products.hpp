@@ -12,6 +12,7 @@
 #include <string>
 
 #include "boost/date_time/gregorian/gregorian.hpp"
+#include "copycounter.hpp"
 
 using namespace std;
 using namespace boost::gregorian;
@@ -36,9 +37,16 @@ public:
   // Ge the product type
   ProductType GetProductType() const;
 
+  // Get the dense index given by the product registry, -1 if not registered
+  int GetProductIndex() const;
+
+  // Set the dense index of the product
+  void SetProductIndex(int _productIndex);
+
 private:
   string productId;
   ProductType productType;
+  int productIndex = -1;
 
 };
 
@@ -78,6 +86,7 @@ private:
   float coupon;
   date maturityDate;
 
+  COPY_COUNTED(Bond)
 };
 
 /**
@@ -177,6 +186,16 @@ ProductType Product::GetProductType() const
   return productType;
 }
 
+int Product::GetProductIndex() const
+{
+  return productIndex;
+}
+
+void Product::SetProductIndex(int _productIndex)
+{
+  productIndex = _productIndex;
+}
+
 Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, 
 	float _coupon, date _maturityDate) : Product(_productId, BOND)
 {
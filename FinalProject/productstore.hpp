@@ -0,0 +1,124 @@
+/**
+ * productstore.hpp
+ * Defines the dense per-product store used by the services keyed on product identifier.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef PRODUCT_STORE_HPP
+#define PRODUCT_STORE_HPP
+
+#include <vector>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include "productregistry.hpp"
+
+using namespace std;
+
+/**
+ * Store of one value per product, held in an array indexed by the dense product
+ * index of the product registry instead of a hash map keyed on product identifier.
+ * Slots are created on first use, holding the empty value of their product until a
+ * value is stored. References to values stay valid until a product with a higher
+ * index than any seen before is stored.
+ * Type V is the value type, which gives its product through GetProduct() and is
+ * constructed empty from its product alone.
+ */
+template<typename V>
+class ProductStore
+{
+
+public:
+
+	// The product type of the values
+	typedef typename decay<decltype(declval<V>().GetProduct())>::type ProductType;
+
+	// Get the value of a product index, creating the empty slots up to it if needed
+	V& operator[](size_t _index);
+
+	// Get the value of a product index, which must have a slot
+	const V& operator[](size_t _index) const;
+
+	// Get the value of a product identifier, creating the empty slots up to it if needed
+	V& Get(string_view _productId);
+
+	// Check whether a value has been stored for a product index
+	bool Contains(size_t _index) const;
+
+	// Store a value in the slot of its product, return the stored value
+	V& Put(const V& _value);
+
+	// Move a value into the slot of its product, return the stored value
+	V& Put(V&& _value);
+
+	// Get the number of slots
+	size_t Size() const;
+
+private:
+
+	vector<V> values;
+	vector<char> present;
+
+};
+
+template<typename V>
+V& ProductStore<V>::operator[](size_t _index)
+{
+	static_assert(is_constructible<V, const ProductType&>::value, "the empty slots hold the value of their product");
+	if (_index >= values.size())
+	{
+		// an empty slot holds its product, as GetData() of a product with no data gives the product
+		const ProductRegistry<ProductType>& registry = ProductRegistry<ProductType>::GetInstance();
+		size_t first = values.size();
+		values.resize(_index + 1);
+		present.resize(_index + 1, false);
+		for (size_t i = first; i < values.size() && i < registry.Size(); i++) values[i] = V(registry.Get(i));
+	}
+	return values[_index];
+}
+
+template<typename V>
+const V& ProductStore<V>::operator[](size_t _index) const
+{
+	return values[_index];
+}
+
+template<typename V>
+V& ProductStore<V>::Get(string_view _productId)
+{
+	return (*this)[ProductRegistry<ProductType>::GetInstance().GetIndex(_productId)];
+}
+
+template<typename V>
+bool ProductStore<V>::Contains(size_t _index) const
+{
+	return _index < present.size() && present[_index];
+}
+
+template<typename V>
+V& ProductStore<V>::Put(const V& _value)
+{
+	size_t index = _value.GetProduct().GetProductIndex();
+	V& slot = (*this)[index];
+	slot = _value;
+	present[index] = true;
+	return slot;
+}
+
+template<typename V>
+V& ProductStore<V>::Put(V&& _value)
+{
+	size_t index = _value.GetProduct().GetProductIndex();
+	V& slot = (*this)[index];
+	slot = move(_value);
+	present[index] = true;
+	return slot;
+}
+
+template<typename V>
+size_t ProductStore<V>::Size() const
+{
+	return values.size();
+}
+
+#endif
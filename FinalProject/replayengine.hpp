@@ -0,0 +1,440 @@
+/**
+ * replayengine.hpp
+ * Defines the replay engine playing the input files back to the trading system
+ * on the clock they were recorded on, at full speed or any multiple of real time,
+ * and taking checkpoints of the state of the services it can be restarted from.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef REPLAY_ENGINE_HPP
+#define REPLAY_ENGINE_HPP
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <streambuf>
+#include "soa.hpp"
+#include "checkpoint.hpp"
+#include "tradingsystem.hpp"
+
+using namespace std;
+
+// Speed of a replay going as fast as the services take the messages
+const double REPLAY_MAX_SPEED = 0;
+
+// Recorded time in microseconds between the messages of a file without timestamps
+const long long REPLAY_MESSAGE_INTERVAL = 1;
+
+// Most bytes handed to a connector at once
+const size_t REPLAY_BATCH_SIZE = 1 << 16;
+
+class ReplayEngine;
+
+/**
+ * Input file of a replay and the connector subscribing it.
+ * A timestamped file starts each line with the time it was recorded at, in microseconds,
+ * the rest of the line being in the format of the connector; the messages of the other
+ * files are spaced REPLAY_MESSAGE_INTERVAL apart.
+ */
+struct ReplayFeed
+{
+	string name;
+	string fileName;
+	bool timestamped = false;
+	int linesPerMessage = 1; // lines of a message, a checkpoint is only taken between messages
+	function<void(istream&)> subscribe;
+	uint64_t offset = 0; // of the next message to replay
+	long long lines = 0; // replayed, from the start of the file
+	long long time = 0; // recorded time of the next message to replay
+	double seconds = 0;
+};
+
+/**
+ * Stream buffer a connector reads one feed of a replay through.
+ * The messages are handed over in batches of whole lines, holding back the ones that are
+ * not due yet on the clock of the replay, and each message from the next checkpoint on
+ * until the engine has taken that checkpoint, so that a checkpoint is always taken
+ * with every message before it processed by the connector and none after it.
+ */
+class ReplayStreamBuffer : public streambuf
+{
+
+public:
+
+	// ctor for a feed of an engine, reading the file from the offset of the feed
+	ReplayStreamBuffer(ReplayEngine& _engine, size_t _feed);
+
+protected:
+
+	// Hand over the next batch of messages, waiting for them to be due
+	int_type underflow() override;
+
+	// Read the messages handed over, rather than waiting for the whole count
+	streamsize xsgetn(char* _buffer, streamsize _count) override;
+
+private:
+
+	// Read the next message of the file into the look ahead, return false at the end of the file
+	bool ReadMessage();
+
+	ReplayEngine& engine;
+	size_t index;
+	ReplayFeed& feed;
+	ifstream input;
+	string batch; // handed over
+	string message; // look ahead, not handed over yet
+	uint64_t messageBytes = 0; // of the look ahead in the file
+	long long messageTime = 0;
+	bool hasMessage = false;
+
+};
+
+/**
+ * Replay engine subscribing each input file on a thread of its own, as the feed driver does,
+ * with the messages released on the recorded clock: the recorded time elapsed since the start
+ * of the replay is played back divided by the speed, REPLAY_MAX_SPEED not waiting at all.
+ * Every checkpoint interval of recorded time, the feeds stop at the first message past it,
+ * and the last one to get there flushes the historical services and saves the offsets of the
+ * files and the state of the positions, risk, order books and algo execution to the checkpoint
+ * file, which Restore() reads back to resume the replay from those offsets.
+ */
+class ReplayEngine
+{
+
+public:
+
+	// ctor for a trading system and a speed, such as 1 for real time
+	ReplayEngine(TradingSystem& _tradingSystem, double _speed = REPLAY_MAX_SPEED);
+
+	// Add an input file read by a connector, of messages over a number of lines
+	template<typename V>
+	void AddFeed(const string& _name, const string& _fileName, Connector<V>* _connector, bool _timestamped,
+		int _linesPerMessage = 1);
+
+	// Take a checkpoint into a file every interval of recorded time in microseconds
+	void SetCheckpoints(const string& _fileName, long long _interval);
+
+	// Restore the trading system and the offsets of the feeds from a checkpoint file,
+	// added in the same order, return false when there is no such checkpoint
+	bool Restore(const string& _fileName);
+
+	// Replay every feed, each on its own thread, and wait for them
+	void Run();
+
+	// Print the throughput of each feed, the checkpoints taken and the wall time of the last run
+	void PrintReport(ostream& _output) const;
+
+	// Get the number of checkpoints taken by the last run
+	int GetCheckpointCount() const;
+
+	// Get the wall time of the last run in seconds
+	double GetWallSeconds() const;
+
+	// Get a feed
+	ReplayFeed& GetFeed(size_t _feed);
+
+	// Wait until a recorded time is due on the clock of the replay, return false
+	// without waiting when the feed has messages to hand over in the meantime
+	bool WaitUntilDue(long long _time, bool _handOver) const;
+
+	// Check whether a message of a recorded time must wait for a checkpoint
+	bool IsPastCheckpoint(long long _time) const;
+
+	// Stop a feed at a message past the next checkpoint until it has been taken
+	void ReachCheckpoint(size_t _feed, long long _time);
+
+	// Release the other feeds from a checkpoint once a feed has ended
+	void FinishFeed(size_t _feed);
+
+private:
+
+	// Replay one feed and time it
+	void RunFeed(size_t _feed);
+
+	// Save the offsets of the feeds and the state of the trading system, the feeds being stopped
+	void WriteCheckpoint(long long _time);
+
+	TradingSystem& tradingSystem;
+	double speed;
+	vector<ReplayFeed> feeds;
+	string checkpointFileName;
+	long long checkpointInterval = 0; // 0 for no checkpoints
+	long long origin = 0; // recorded time the replay starts from
+	chrono::steady_clock::time_point start;
+
+	// the checkpoint barrier
+	mutex lock;
+	condition_variable reachedCheckpoint;
+	vector<long long> reached; // recorded time each feed has stopped at
+	atomic<long long> checkpointed{ 0 }; // recorded time of the last checkpoint
+	int checkpointCount = 0;
+	double wallSeconds = 0;
+
+};
+
+ReplayStreamBuffer::ReplayStreamBuffer(ReplayEngine& _engine, size_t _feed) :
+	engine(_engine), index(_feed), feed(_engine.GetFeed(_feed)), input(feed.fileName, ios::binary)
+{
+	input.seekg(feed.offset);
+	setg(nullptr, nullptr, nullptr);
+}
+
+bool ReplayStreamBuffer::ReadMessage()
+{
+	message.clear();
+	messageBytes = 0;
+	string line;
+	for (int i = 0; i < feed.linesPerMessage && getline(input, line); i++)
+	{
+		messageBytes += line.size() + 1;
+		if (feed.timestamped)
+		{
+			// the recorded time of a message is the one of its first line
+			size_t comma = line.find(',');
+			if (i == 0) messageTime = stoll(line.substr(0, comma));
+			line.erase(0, comma == string::npos ? line.size() : comma + 1);
+		}
+		message += line;
+		message += '\n';
+	}
+	if (!feed.timestamped) messageTime = feed.lines / feed.linesPerMessage * REPLAY_MESSAGE_INTERVAL;
+	hasMessage = !message.empty();
+	return hasMessage;
+}
+
+ReplayStreamBuffer::int_type ReplayStreamBuffer::underflow()
+{
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+	batch.clear();
+	while (batch.size() < REPLAY_BATCH_SIZE)
+	{
+		if (!hasMessage && !ReadMessage())
+		{
+			if (!batch.empty()) break;
+			engine.FinishFeed(index);
+			return traits_type::eof();
+		}
+		feed.time = messageTime;
+
+		// the messages handed over are processed before the connector asks for more,
+		// so they are handed over before waiting for a checkpoint or for the clock
+		if (engine.IsPastCheckpoint(messageTime))
+		{
+			if (!batch.empty()) break;
+			engine.ReachCheckpoint(index, messageTime);
+		}
+		if (!engine.WaitUntilDue(messageTime, !batch.empty())) break;
+
+		batch += message;
+		feed.offset += messageBytes;
+		feed.lines += feed.linesPerMessage;
+		hasMessage = false;
+	}
+
+	char* begin = &batch[0];
+	setg(begin, begin, begin + batch.size());
+	return traits_type::to_int_type(*gptr());
+}
+
+streamsize ReplayStreamBuffer::xsgetn(char* _buffer, streamsize _count)
+{
+	if (gptr() == egptr() && underflow() == traits_type::eof()) return 0;
+	streamsize count = min(_count, static_cast<streamsize>(egptr() - gptr()));
+	memcpy(_buffer, gptr(), count);
+	gbump(static_cast<int>(count));
+	return count;
+}
+
+ReplayEngine::ReplayEngine(TradingSystem& _tradingSystem, double _speed) :
+	tradingSystem(_tradingSystem)
+{
+	speed = _speed;
+}
+
+template<typename V>
+void ReplayEngine::AddFeed(const string& _name, const string& _fileName, Connector<V>* _connector, bool _timestamped,
+	int _linesPerMessage)
+{
+	if (feeds.size() == CHECKPOINT_MAX_FEEDS)
+		throw out_of_range("A replay has at most " + to_string(CHECKPOINT_MAX_FEEDS) + " feeds");
+	ReplayFeed feed;
+	feed.name = _name;
+	feed.fileName = _fileName;
+	feed.timestamped = _timestamped;
+	feed.linesPerMessage = _linesPerMessage;
+	feed.subscribe = [_connector](istream& _data) { _connector->Subscribe(_data); };
+	feeds.push_back(feed);
+}
+
+void ReplayEngine::SetCheckpoints(const string& _fileName, long long _interval)
+{
+	checkpointFileName = _fileName;
+	checkpointInterval = _interval;
+}
+
+bool ReplayEngine::Restore(const string& _fileName)
+{
+	ifstream checkpoint(_fileName, ios::binary);
+	CheckpointHeader header;
+	if (!ReadCheckpointValue(checkpoint, header) || !equal(header.magic, header.magic + 8, CHECKPOINT_MAGIC)) return false;
+	if (header.feedCount != feeds.size())
+		throw logic_error("The checkpoint " + _fileName + " is of " + to_string(header.feedCount) + " feeds, not " + to_string(feeds.size()));
+
+	tradingSystem.positionService.RestoreCheckpoint(checkpoint);
+	tradingSystem.riskService.RestoreCheckpoint(checkpoint);
+	tradingSystem.marketdataservice.RestoreCheckpoint(checkpoint);
+	tradingSystem.algoExecutionService.RestoreCheckpoint(checkpoint);
+	if (!checkpoint) throw runtime_error("The checkpoint " + _fileName + " is truncated");
+
+	for (size_t f = 0; f < feeds.size(); f++)
+	{
+		feeds[f].offset = header.offsets[f];
+		feeds[f].lines = static_cast<long long>(header.lines[f]);
+	}
+	origin = header.recordedTime;
+	checkpointed = header.recordedTime;
+	return true;
+}
+
+void ReplayEngine::Run()
+{
+	reached.assign(feeds.size(), origin);
+	checkpointCount = 0;
+	start = chrono::steady_clock::now();
+
+	vector<thread> threads;
+	for (size_t f = 0; f < feeds.size(); f++) threads.push_back(thread(&ReplayEngine::RunFeed, this, f));
+	for (auto& t : threads) t.join();
+
+	auto stop = chrono::steady_clock::now();
+	wallSeconds = chrono::duration<double>(stop - start).count();
+}
+
+void ReplayEngine::RunFeed(size_t _feed)
+{
+	auto feedStart = chrono::steady_clock::now();
+	ReplayStreamBuffer buffer(*this, _feed);
+	istream data(&buffer);
+	feeds[_feed].subscribe(data);
+	auto stop = chrono::steady_clock::now();
+	feeds[_feed].seconds = chrono::duration<double>(stop - feedStart).count();
+}
+
+ReplayFeed& ReplayEngine::GetFeed(size_t _feed)
+{
+	return feeds[_feed];
+}
+
+bool ReplayEngine::WaitUntilDue(long long _time, bool _handOver) const
+{
+	if (speed == REPLAY_MAX_SPEED || _time <= origin) return true;
+	auto due = start + chrono::duration_cast<chrono::steady_clock::duration>(
+		chrono::duration<double, micro>((_time - origin) / speed));
+	if (chrono::steady_clock::now() >= due) return true;
+	if (_handOver) return false;
+	this_thread::sleep_until(due);
+	return true;
+}
+
+bool ReplayEngine::IsPastCheckpoint(long long _time) const
+{
+	return checkpointInterval > 0 && _time >= checkpointed + checkpointInterval;
+}
+
+void ReplayEngine::ReachCheckpoint(size_t _feed, long long _time)
+{
+	unique_lock<mutex> guard(lock);
+	reached[_feed] = _time;
+
+	// the last feed to stop takes the checkpoint, at the last boundary before every feed,
+	// so that the intervals without any message are skipped
+	long long slowest = *min_element(reached.begin(), reached.end());
+	if (slowest != LLONG_MAX && slowest >= checkpointed + checkpointInterval)
+	{
+		WriteCheckpoint(slowest / checkpointInterval * checkpointInterval);
+		reachedCheckpoint.notify_all();
+	}
+	while (_time >= checkpointed + checkpointInterval) reachedCheckpoint.wait(guard);
+}
+
+void ReplayEngine::FinishFeed(size_t _feed)
+{
+	if (checkpointInterval == 0) return;
+	lock_guard<mutex> guard(lock);
+	reached[_feed] = LLONG_MAX;
+
+	long long slowest = *min_element(reached.begin(), reached.end());
+	if (slowest != LLONG_MAX && slowest >= checkpointed + checkpointInterval)
+	{
+		WriteCheckpoint(slowest / checkpointInterval * checkpointInterval);
+		reachedCheckpoint.notify_all();
+	}
+}
+
+void ReplayEngine::WriteCheckpoint(long long _time)
+{
+	// the files hold every event before the checkpoint
+	tradingSystem.Flush();
+
+	CheckpointHeader header = {};
+	copy(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + 8, header.magic);
+	header.feedCount = static_cast<uint32_t>(feeds.size());
+	header.recordedTime = _time;
+	for (size_t f = 0; f < feeds.size(); f++)
+	{
+		header.offsets[f] = feeds[f].offset;
+		header.lines[f] = static_cast<uint64_t>(feeds[f].lines);
+	}
+
+	// written aside and renamed, so that a crash leaves the previous checkpoint whole
+	string tempFileName = checkpointFileName + ".tmp";
+	{
+		ofstream checkpoint(tempFileName, ios::binary | ios::trunc);
+		WriteCheckpointValue(checkpoint, header);
+		tradingSystem.positionService.SaveCheckpoint(checkpoint);
+		tradingSystem.riskService.SaveCheckpoint(checkpoint);
+		tradingSystem.marketdataservice.SaveCheckpoint(checkpoint);
+		tradingSystem.algoExecutionService.SaveCheckpoint(checkpoint);
+	}
+	rename(tempFileName.c_str(), checkpointFileName.c_str());
+
+	checkpointed = _time;
+	checkpointCount++;
+}
+
+void ReplayEngine::PrintReport(ostream& _output) const
+{
+	for (auto& feed : feeds)
+	{
+		_output << feed.name << ": " << feed.lines << " lines in " << feed.seconds << " s, "
+			<< static_cast<long>(feed.seconds > 0 ? feed.lines / feed.seconds : 0) << " lines/s" << endl;
+	}
+	_output << "Replay at ";
+	if (speed == REPLAY_MAX_SPEED) _output << "max";
+	else _output << speed << "x";
+	_output << " speed from " << origin << " us: " << checkpointCount << " checkpoints, " << wallSeconds << " s wall time" << endl;
+}
+
+int ReplayEngine::GetCheckpointCount() const
+{
+	return checkpointCount;
+}
+
+double ReplayEngine::GetWallSeconds() const
+{
+	return wallSeconds;
+}
+
+#endif
@@ -8,9 +8,27 @@
 #ifndef RISK_SERVICE_HPP
 #define RISK_SERVICE_HPP
 
+#include <vector>
+#include <mutex>
 #include "soa.hpp"
+#include "instrumentation.hpp"
+#include "bondanalytics.hpp"
+#include "productregistry.hpp"
+#include "productstore.hpp"
+#include "snapshotstore.hpp"
+#include "checkpoint.hpp"
 #include "positionservice.hpp"
+#include "pricingservice.hpp"
 
+template<typename T>
+class BucketedSector;
+
+// Journal record type of the risk of a product type, the sectors have a record type of their own
+template<typename T>
+struct RiskRecordType { static const JournalRecordType value = RISK_RECORD; };
+
+template<typename T>
+struct RiskRecordType<BucketedSector<T>> { static const JournalRecordType value = SECTOR_RISK_RECORD; };
 
 /**
  * PV01 risk.
@@ -26,12 +44,18 @@ public:
   PV01(const T &_product, double _pv01, long _quantity);
   PV01() = default;
 
+  // ctor for a product not risked yet
+  explicit PV01(const T &_product);
+
   // Get the product on this PV01 value
   const T& GetProduct() const;
 
   // Get the PV01 value
   double GetPV01() const;
 
+  // Set the PV01 value
+  void SetPV01(double _pv01);
+
   // Get the quantity that this risk value is associated with
   long GetQuantity() const;
 
@@ -39,28 +63,41 @@ public:
   void SetQuantity(long _quantity);
 
   // Print risk
-  string print();
+  string print() const;
+
+  // Write the risk as a binary journal record, return the record length
+  size_t Encode(long long _timestamp, char* _buffer) const;
+
+  // Read a risk back from a binary journal record
+  static PV01<T> Decode(const char* _buffer);
 
 private:
-  T product;
+  const T* product = nullptr; // owned by the product registry
   double pv01;
   long quantity;
 
+  COPY_COUNTED(PV01<T>)
 };
 
 
 template<typename T>
 PV01<T>::PV01(const T& _product, double _pv01, long _quantity) :
-	product(_product)
+	product(&_product)
 {
 	pv01 = _pv01;
 	quantity = _quantity;
 }
 
+template<typename T>
+PV01<T>::PV01(const T& _product) :
+	PV01(_product, 0, 0)
+{
+}
+
 template<typename T>
 const T& PV01<T>::GetProduct() const
 {
-	return product;
+	return *product;
 }
 
 template<typename T>
@@ -69,6 +106,12 @@ double PV01<T>::GetPV01() const
 	return pv01;
 }
 
+template<typename T>
+void PV01<T>::SetPV01(double _pv01)
+{
+	pv01 = _pv01;
+}
+
 template<typename T>
 long PV01<T>::GetQuantity() const
 {
@@ -82,19 +125,40 @@ void PV01<T>::SetQuantity(long _quantity)
 }
 
 template<typename T>
-string PV01<T>::print()
+string PV01<T>::print() const
 {
 	stringstream output;
-	output << "CUSIP: " << product.GetProductId() << ", ";
+	output << "CUSIP: " << product->GetProductId() << ", ";
 	output << "PV01: " << to_string(pv01) << ", ";
 	output << "Quantity: " << to_string(quantity);
 
 	return output.str();
 }
 
+template<typename T>
+size_t PV01<T>::Encode(long long _timestamp, char* _buffer) const
+{
+	RiskRecord record;
+	SetJournalHeader(record.header, RiskRecordType<T>::value, sizeof(record), product->GetProductIndex(), _timestamp);
+	record.pv01 = pv01;
+	record.quantity = quantity;
+	return PutJournalRecord(record, _buffer);
+}
+
+template<typename T>
+PV01<T> PV01<T>::Decode(const char* _buffer)
+{
+	RiskRecord record = GetJournalRecord<RiskRecord>(_buffer);
+	const T& product = ProductRegistry<T>::GetInstance().Get(static_cast<size_t>(record.header.productIndex));
+	return PV01<T>(product, record.pv01, static_cast<long>(record.quantity));
+}
+
 /**
  * A bucket sector to bucket a group of securities.
  * We can then aggregate bucketed risk to this bucket.
+ * The sectors are registered in a product registry of their own, where the name
+ * of a sector is its identifier, so that the risk of a sector is stored and
+ * persisted like the risk of a product.
  * Type T is the product type.
  */
 template<typename T>
@@ -105,6 +169,7 @@ public:
 
   // ctor for a bucket sector
   BucketedSector(const vector<T> &_products, string _name);
+  BucketedSector() = default;
 
   // Get the products associated with this bucket
   const vector<T>& GetProducts() const;
@@ -112,9 +177,19 @@ public:
   // Get the name of the bucket
   const string& GetName() const;
 
+  // Get the identifier of the bucket in the sector registry, its name
+  const string& GetProductId() const;
+
+  // Get the dense index of the bucket in the sector registry
+  int GetProductIndex() const;
+
+  // Set the dense index of the bucket, done by the sector registry
+  void SetProductIndex(int _productIndex);
+
 private:
   vector<T> products;
   string name;
+  int productIndex = -1;
 
 };
 
@@ -137,18 +212,97 @@ const string& BucketedSector<T>::GetName() const
 	return name;
 }
 
+template<typename T>
+const string& BucketedSector<T>::GetProductId() const
+{
+	return name;
+}
+
+template<typename T>
+int BucketedSector<T>::GetProductIndex() const
+{
+	return productIndex;
+}
+
+template<typename T>
+void BucketedSector<T>::SetProductIndex(int _productIndex)
+{
+	productIndex = _productIndex;
+}
+
+// Get the registry of the bucket sectors of a product type, built once at first use
+template<typename T>
+ProductRegistry<BucketedSector<T>>& GetSectorRegistry();
+
+// Register the sectors of the bond reference data, in the order they first appear, which for
+// the Treasuries are FrontEnd (2Y, 3Y), Belly (5Y, 7Y, 10Y) and LongEnd (20Y, 30Y)
+ProductRegistry<BucketedSector<Bond>>& RegisterBondSectors(ProductRegistry<BucketedSector<Bond>>& registry)
+{
+	const ProductRegistry<Bond>& bonds = GetBondRegistry();
+	const vector<string>& sectors = GetBondSectors();
+	vector<string> names;
+	vector<vector<Bond>> products;
+	for (size_t i = 0; i < bonds.Size() && i < sectors.size(); i++)
+	{
+		if (sectors[i].empty()) continue;
+		size_t sector = find(names.begin(), names.end(), sectors[i]) - names.begin();
+		if (sector == names.size())
+		{
+			names.push_back(sectors[i]);
+			products.emplace_back();
+		}
+		products[sector].push_back(bonds.Get(i));
+	}
+
+	for (size_t sector = 0; sector < names.size(); sector++)
+		registry.Add(BucketedSector<Bond>(products[sector], names[sector]));
+	return registry;
+}
+
+template<>
+ProductRegistry<BucketedSector<Bond>>& GetSectorRegistry<Bond>()
+{
+	static ProductRegistry<BucketedSector<Bond>>& registry = RegisterBondSectors(ProductRegistry<BucketedSector<Bond>>::GetInstance());
+	return registry;
+}
+
+// Get the registry of the products of a type, registering them with their sectors first,
+// so that whatever is built over it sees every product
+template<typename T>
+const ProductRegistry<T>& GetRiskRegistry()
+{
+	GetSectorRegistry<T>();
+	return ProductRegistry<T>::GetInstance();
+}
+
 
 // Listener obtaining updates from Position service
 template<typename T>
 class PositionListener;
 
+// Listener obtaining updates from Pricing service
+template<typename T>
+class RiskPricingListener;
+
 /**
  * Risk Service to vend out risk for a particular security and across a risk bucketed sector.
  * Keyed on product identifier.
+ * The PV01 of each product is computed by the bond analytics from its coupon and
+ * maturity, at par until the product is priced, and the sectors each product is in are
+ * looked up once, when the service is made. The risk of a sector, the sum of PV01 times
+ * quantity of its products, is kept up to date by the change of risk of each position
+ * added, so reading the risk of a product or of a sector does not go through the products.
+ * Each change of the risk of a sector is sent to the sector listeners.
+ * A new price reprices the PV01 of its product from the mid, and moves the stored risk
+ * of the product and of its sectors in place; the listeners are sent the risk on the
+ * next position of the product, so that the risk is not persisted on every tick.
+ * Positions and prices come from different feeds, so both take the lock of the service.
+ * Each change of the risk of a product is published as a snapshot, which other threads
+ * read a copy of with GetSnapshot() without the lock, at a cost to the writer of about 2 ns.
  * Type T is the product type.
  */
 template<typename T>
-class RiskService : public Service<string,PV01 <T> >
+class RiskService : public Service<string_view, PV01 <T> >
 {
 
 public:
@@ -160,10 +314,13 @@ public:
 	~RiskService();
 
 	// Get data on our service given a key
-	PV01<T>& GetData(string _key);
+	PV01<T>& GetData(string_view _key);
+
+	// Get a copy of the risk of a product from any thread without locking, false if it has none
+	bool GetSnapshot(string_view _key, PV01<T>& _snapshot) const;
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(PV01<T>& _data);
+	void OnMessage(PV01<T>&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<PV01<T>>* _listener);
@@ -174,45 +331,102 @@ public:
 	// Get the listener of the service
 	PositionListener<T>* GetListener();
 
-	// Add a position that the service will risk
-	void AddPosition(Position<T>& _position);
+	// Get the listener of the service to the prices
+	RiskPricingListener<T>* GetPricingListener();
+
+	// Add a position that the service will risk, return a copy of its risk taken under the lock
+	PV01<T> AddPosition(const Position<T>& _position);
+
+	// Reprice the PV01 of a product from its mid price
+	void UpdatePrice(const Price<T>& _price);
 
 	// Get the bucketed risk for the bucket sector
 	const PV01<BucketedSector<T>>& GetBucketedRisk(const BucketedSector<T>& _sector) const;
 
+	// Add a listener for the updates of the bucketed risk of the sectors
+	void AddSectorListener(ServiceListener<PV01<BucketedSector<T>>>* _listener);
+
+	// Get all the sector listeners
+	const vector<ServiceListener<PV01<BucketedSector<T>>>*>& GetSectorListeners() const;
+
+	// Save the prices the PV01 are computed from and the risk of the products to a checkpoint
+	void SaveCheckpoint(ostream& _checkpoint);
+
+	// Restore the prices and the risk of a checkpoint, and the risk of the sectors from them,
+	// without notifying the listeners
+	void RestoreCheckpoint(istream& _checkpoint);
+
 private:
 
-	unordered_map<string, PV01<T>> pvs;
+	ProductStore<PV01<T>> pvs;
+	SnapshotStore<PV01<T>> snapshots;
 	vector<ServiceListener<PV01<T>>*> listeners;
 	PositionListener<T>* listener;
+	RiskPricingListener<T>* pricingListener;
+	BondAnalytics analytics;
+	mutex lock; // between the positions and the prices
+	vector<double> productPV01; // by product index
+	vector<vector<int>> productSectors; // indices of the sectors of each product index
+	ProductStore<PV01<BucketedSector<T>>> sectorPVs; // one for each sector, of quantity 1
+	vector<ServiceListener<PV01<BucketedSector<T>>>*> sectorListeners;
 };
 
 template<typename T>
-RiskService<T>::RiskService()
+RiskService<T>::RiskService() :
+	analytics(GetRiskRegistry<T>())
 {
-	pvs = unordered_map<string, PV01<T>>();
+	pvs = ProductStore<PV01<T>>();
 	listeners = vector<ServiceListener<PV01<T>>*>();
 	listener = new PositionListener<T>(this);
+	pricingListener = new RiskPricingListener<T>(this);
+
+	// resolve the PV01 and the sectors of every product up front
+	const ProductRegistry<BucketedSector<T>>& sectors = GetSectorRegistry<T>();
+	const ProductRegistry<T>& products = GetRiskRegistry<T>();
+	for (size_t i = 0; i < products.Size(); i++)
+	{
+		productPV01.push_back(analytics.GetPV01(i));
+	}
+	productSectors.resize(products.Size());
+	for (size_t s = 0; s < sectors.Size(); s++)
+	{
+		const BucketedSector<T>& sector = sectors.Get(s);
+		for (const T& product : sector.GetProducts())
+		{
+			productSectors[product.GetProductIndex()].push_back(static_cast<int>(s));
+		}
+		sectorPVs.Put(PV01<BucketedSector<T>>(sector, 0, 1));
+	}
 }
 
 template<typename T>
 RiskService<T>::~RiskService() {
 	delete listener;
+	delete pricingListener;
 }
 
 template<typename T>
-PV01<T>& RiskService<T>::GetData(string _key)
+PV01<T>& RiskService<T>::GetData(string_view _key)
 {
-	return pvs[_key];
+	return pvs.Get(_key);
 }
 
 template<typename T>
-void RiskService<T>::OnMessage(PV01<T>& _data)
+bool RiskService<T>::GetSnapshot(string_view _key, PV01<T>& _snapshot) const
 {
-	pvs[_data.GetProduct().GetProductId()] = _data;
+	const T* product = ProductRegistry<T>::GetInstance().Find(_key);
+	return product != nullptr && snapshots.GetSnapshot(product->GetProductIndex(), _snapshot);
+}
+
+template<typename T>
+void RiskService<T>::OnMessage(PV01<T>&& _data)
+{
+	INSTRUMENT_HOP("RiskService::OnMessage");
+	const PV01<T>& pv01 = pvs.Put(move(_data));
+	snapshots.Publish(pv01.GetProduct().GetProductIndex(), pv01);
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(pv01); });
 }
 
 template<typename T>
@@ -234,31 +448,129 @@ PositionListener<T>* RiskService<T>::GetListener()
 }
 
 template<typename T>
-void RiskService<T>::AddPosition(Position<T>& position)
+RiskPricingListener<T>* RiskService<T>::GetPricingListener()
 {
-	T product = position.GetProduct();
-	string productId = product.GetProductId();
-	double pv01value = GetPV01(productId);
+	return pricingListener;
+}
+
+template<typename T>
+PV01<T> RiskService<T>::AddPosition(const Position<T>& position)
+{
+	INSTRUMENT_HOP("RiskService::AddPosition");
+	lock_guard<mutex> guard(lock);
+	const T& product = position.GetProduct();
+	size_t index = product.GetProductIndex();
+	double pv01value = productPV01[index];
 	long quantity = position.GetAggregatePosition();
+	long previousQuantity = pvs.Contains(index) ? pvs[index].GetQuantity() : 0;
 	PV01<T> pv01(product, pv01value, quantity);
-	this->OnMessage(pv01);
+	this->OnMessage(move(pv01));
+
+	// move the risk of the sectors of the product by the change of its risk
+	double change = pv01value * (quantity - previousQuantity);
+	for (int s : productSectors[index])
+	{
+		PV01<BucketedSector<T>>& sectorPV01 = sectorPVs[s];
+		sectorPV01.SetPV01(sectorPV01.GetPV01() + change);
+		for_each(sectorListeners.begin(), sectorListeners.end(), [&](auto& l) {l->ProcessAdd(sectorPV01); });
+	}
+	return pvs[index];
+}
+
+template<typename T>
+void RiskService<T>::UpdatePrice(const Price<T>& _price)
+{
+	INSTRUMENT_HOP("RiskService::UpdatePrice");
+	lock_guard<mutex> guard(lock);
+	size_t index = _price.GetProduct().GetProductIndex();
+	double mid = _price.GetMid();
+	if (mid == analytics.GetPrice(index)) return;
+
+	analytics.SetPrice(index, mid);
+	analytics.Compute(index, index + 1);
+	double pv01value = analytics.GetPV01(index);
+	double previousPV01 = productPV01[index];
+	productPV01[index] = pv01value;
+	if (!pvs.Contains(index)) return;
+
+	// move the stored risk of the product and of its sectors by the change of PV01
+	PV01<T>& pv01 = pvs[index];
+	pv01.SetPV01(pv01value);
+	snapshots.Publish(index, pv01);
+	double change = (pv01value - previousPV01) * pv01.GetQuantity();
+	for (int s : productSectors[index])
+	{
+		PV01<BucketedSector<T>>& sectorPV01 = sectorPVs[s];
+		sectorPV01.SetPV01(sectorPV01.GetPV01() + change);
+	}
 }
 
 template<typename T>
 const PV01<BucketedSector<T>>& RiskService<T>::GetBucketedRisk(const BucketedSector<T>& _sector) const
 {
-	BucketedSector<T> sector = _sector;
-	double pv01 = 0;
-	long quantity = 1;
+	return sectorPVs[_sector.GetProductIndex()];
+}
+
+template<typename T>
+void RiskService<T>::AddSectorListener(ServiceListener<PV01<BucketedSector<T>>>* _listener)
+{
+	sectorListeners.push_back(_listener);
+}
+
+template<typename T>
+const vector<ServiceListener<PV01<BucketedSector<T>>>*>& RiskService<T>::GetSectorListeners() const
+{
+	return sectorListeners;
+}
+
+template<typename T>
+void RiskService<T>::SaveCheckpoint(ostream& _checkpoint)
+{
+	lock_guard<mutex> guard(lock);
+	uint32_t products = static_cast<uint32_t>(analytics.Size());
+	WriteCheckpointValue(_checkpoint, products);
+	for (size_t i = 0; i < products; i++) WriteCheckpointValue(_checkpoint, analytics.GetPrice(i));
+
+	uint32_t count = 0;
+	for (size_t i = 0; i < pvs.Size(); i++) count += pvs.Contains(i);
+	WriteCheckpointValue(_checkpoint, count);
+	for (size_t i = 0; i < pvs.Size(); i++)
+	{
+		if (pvs.Contains(i)) WriteCheckpointRecord(_checkpoint, pvs[i]);
+	}
+}
 
-	vector<T>& products = _sector.GetProducts();
-	for (auto& p : products)
+template<typename T>
+void RiskService<T>::RestoreCheckpoint(istream& _checkpoint)
+{
+	lock_guard<mutex> guard(lock);
+	uint32_t products = 0;
+	ReadCheckpointValue(_checkpoint, products);
+	for (size_t i = 0; i < products; i++)
 	{
-		string pId = p.GetProductId();
-		pv01 += pvs[pId].GetPV01() * pvs[pId].GetQuantity();
+		double price = 0;
+		ReadCheckpointValue(_checkpoint, price);
+		if (i < analytics.Size()) analytics.SetPrice(i, price);
 	}
+	analytics.Compute();
+	for (size_t i = 0; i < productPV01.size(); i++) productPV01[i] = analytics.GetPV01(i);
 
-	return PV01<BucketedSector<T>>(products, pv01, quantity);
+	uint32_t count = 0;
+	ReadCheckpointValue(_checkpoint, count);
+	char record[JOURNAL_MAX_RECORD];
+	for (uint32_t i = 0; i < count && ReadJournalRecord(_checkpoint, record); i++)
+	{
+		const PV01<T>& pv01 = pvs.Put(PV01<T>::Decode(record));
+		snapshots.Publish(pv01.GetProduct().GetProductIndex(), pv01);
+	}
+
+	// the risk of a sector is the sum of the risk of its products
+	for (size_t s = 0; s < sectorPVs.Size(); s++) sectorPVs[s].SetPV01(0);
+	for (size_t i = 0; i < pvs.Size(); i++)
+	{
+		if (!pvs.Contains(i)) continue;
+		for (int s : productSectors[i]) sectorPVs[s].SetPV01(sectorPVs[s].GetPV01() + productPV01[i] * pvs[i].GetQuantity());
+	}
 }
 
 
@@ -280,13 +592,13 @@ public:
 	PositionListener(RiskService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(Position<T>& _data);
+	void ProcessAdd(const Position<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(Position<T>& _data);
+	void ProcessRemove(const Position<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(Position<T>& _data);
+	void ProcessUpdate(const Position<T>& _data);
 
 };
 
@@ -298,15 +610,101 @@ PositionListener<T>::PositionListener(RiskService<T>* _service)
 
 
 template<typename T>
-void PositionListener<T>::ProcessAdd(Position<T>& _data)
+void PositionListener<T>::ProcessAdd(const Position<T>& _data)
 {
 	service->AddPosition(_data);
 }
 
 template<typename T>
-void PositionListener<T>::ProcessRemove(Position<T>& _data) {}
+void PositionListener<T>::ProcessRemove(const Position<T>& _data) {}
 
 template<typename T>
-void PositionListener<T>::ProcessUpdate(Position<T>& _data) {}
+void PositionListener<T>::ProcessUpdate(const Position<T>& _data) {}
+
+
+/**
+* Risk Service Listener subscribing prices from Pricing Service, to reprice the risk
+* Type T is the product type.
+*/
+template<typename T>
+class RiskPricingListener : public ServiceListener<Price<T>>
+{
+
+private:
+
+	RiskService<T>* service;
+
+public:
+
+	// Ctor
+	RiskPricingListener(RiskService<T>* _service);
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(const Price<T>& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(const Price<T>& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(const Price<T>& _data);
+
+};
+
+template<typename T>
+RiskPricingListener<T>::RiskPricingListener(RiskService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+void RiskPricingListener<T>::ProcessAdd(const Price<T>& _data)
+{
+	service->UpdatePrice(_data);
+}
+
+template<typename T>
+void RiskPricingListener<T>::ProcessRemove(const Price<T>& _data) {}
+
+template<typename T>
+void RiskPricingListener<T>::ProcessUpdate(const Price<T>& _data) {}
+
+
+/**
+* Stage of a Pipeline risking the positions, wired at compile time in place of PositionListener.
+* Type T is the product type.
+*/
+template<typename T>
+class RiskStage
+{
+
+private:
+
+	RiskService<T>* service;
+
+public:
+
+	typedef Position<T> InputType;
+
+	// Ctor
+	RiskStage(RiskService<T>* _service);
+
+	// Risk a position, passing on its risk
+	template<typename Next>
+	void Process(const Position<T>& _data, Next& _next);
+
+};
+
+template<typename T>
+RiskStage<T>::RiskStage(RiskService<T>* _service)
+{
+	service = _service;
+}
+
+template<typename T>
+template<typename Next>
+void RiskStage<T>::Process(const Position<T>& _data, Next& _next)
+{
+	_next(service->AddPosition(_data));
+}
 
 #endif
@@ -0,0 +1,639 @@
+/*
+*Self checks of the trading system components
+*build with "g++ -std=c++17 selftest.cpp -o selftest -pthread" like the other tools, the library
+*bounds checks being turned on below, and run as "selftest [filter]" from the folder of the input files:
+*the groups whose name contains the filter are run, each failed check is printed, and the
+*exit code is the number of failed checks
+*@author: Chaofan Shen
+*/
+
+#ifndef _GLIBCXX_ASSERTIONS
+#define _GLIBCXX_ASSERTIONS
+#endif
+
+#include <iostream>
+#include <string>
+#include <functional>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include "pricecodec.hpp"
+#include "soa.hpp"
+#include "products.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "bondanalytics.hpp"
+#include "tradebookingservice.hpp"
+#include "asynclistener.hpp"
+#include "snapshotstore.hpp"
+#include "sorting.hpp"
+#include "daryheap.hpp"
+#include "sequenceid.hpp"
+#include "tradingsystem.hpp"
+#include "shardedtradingsystem.hpp"
+
+using namespace std;
+
+// Number of checks that failed
+int failureCount = 0;
+
+// Record a check, printing it if it failed
+void Check(bool _passed, const string& _description)
+{
+	if (_passed) return;
+	failureCount++;
+	cout << "FAILED: " << _description << endl;
+}
+
+// Fractional prices of either sign are read back as the ticks they were written from,
+// the fraction being added to the signed points as the string parser of the baseline did
+void CheckPriceCodec()
+{
+	for (PriceTicks ticks = -3 * TICKS_PER_POINT; ticks <= 3 * TICKS_PER_POINT; ticks++)
+	{
+		string price = FormatTicks(ticks);
+		Check(ParseTicks(price) == ticks, price + " is read back as " + to_string(ticks) + " ticks");
+		Check(GetNormalPrice(GetQuotePrice(ToPrice(ticks))) == ToPrice(ticks), price + " goes back and forth through the quote price");
+	}
+	for (PriceTicks ticks : { 99L * TICKS_PER_POINT + 255, 100L * TICKS_PER_POINT + 204, -100L * TICKS_PER_POINT - 1 })
+	{
+		Check(ParseTicks(FormatTicks(ticks)) == ticks, FormatTicks(ticks) + " is read back as " + to_string(ticks) + " ticks");
+	}
+
+	Check(FormatTicks(-1) == "-1-317", "1 tick below 0 is -1-317");
+	Check(ParseTicks("-1-317") == -1, "-1-317 is 1 tick below 0");
+	Check(ParseTicks("-2-16+") == -2 * TICKS_PER_POINT + 16 * 8 + 4, "-2-16+ is -2 points plus 16 32nds and a half");
+	Check(ParseTicks("-3") == -3 * TICKS_PER_POINT, "-3 is -3 points");
+	Check(ParseTicks("99-317") == 99 * TICKS_PER_POINT + 255, "99-317 is 1 tick below 100");
+}
+
+// Connector input in fractional notation is read as ParseTicks reads it, anything else is refused
+void CheckPriceCodecChecked()
+{
+	for (PriceTicks ticks = -3 * TICKS_PER_POINT; ticks <= 3 * TICKS_PER_POINT; ticks++)
+	{
+		string price = FormatTicks(ticks);
+		Check(IsFractionalPrice(price) && ParseTicksChecked(price) == ticks, price + " is a fractional price");
+	}
+	for (PriceTicks ticks : { numeric_limits<PriceTicks>::max(), numeric_limits<PriceTicks>::min() })
+	{
+		Check(ParseTicksChecked(FormatTicks(ticks)) == ticks, FormatTicks(ticks) + " is read back as " + to_string(ticks) + " ticks");
+	}
+	for (const char* price : { "100", "-3", "100-25+", "0-000", "99-317" })
+	{
+		Check(IsFractionalPrice(price), string(price) + " is a fractional price");
+	}
+
+	for (const char* price : { "", "-", "99-", "99-3", "99-31", "99-3177", "99.5", "99-32+", "99-318", "99-31x",
+		"99-x1+", "-99-", "--1-000", "99 ", " 99", "+99", "99-00+ ", "36028797018963968", "99999999999999999999-000" })
+	{
+		bool thrown = false;
+		try { ParseTicksChecked(price); }
+		catch (const invalid_argument&) { thrown = true; }
+		Check(thrown, "\"" + string(price) + "\" throws invalid_argument");
+	}
+}
+
+// The risk service built before anything else uses the registries
+void CheckRiskServiceCold()
+{
+	RiskService<Bond> risk;
+	const ProductRegistry<Bond>& bonds = GetBondRegistry();
+	Check(bonds.Size() > 0, "the bonds are registered by the risk service");
+
+	BondAnalytics analytics(bonds);
+	for (size_t i = 0; i < bonds.Size(); i++)
+	{
+		Position<Bond> position(bonds.Get(i));
+		position.AddPosition("TRSY1", 1000000);
+		PV01<Bond> pv01 = risk.AddPosition(position);
+		Check(pv01.GetQuantity() == 1000000, "the risk of " + bonds.Get(i).GetProductId() + " has the quantity of its position");
+		Check(pv01.GetPV01() == analytics.GetPV01(i), "the PV01 of " + bonds.Get(i).GetProductId() + " is the one of the analytics");
+	}
+}
+
+// A book id out of the book registry is refused before the position is touched
+void CheckPositionBooks()
+{
+	Position<Bond> position(GetProductType("91282CFX4"));
+	position.AddPosition("TRSY1", 1000000);
+	for (int bookId : { -1, MAX_BOOKS, MAX_BOOKS + 1 })
+	{
+		bool thrown = false;
+		try { position.AddPosition(bookId, 1000000); }
+		catch (const out_of_range&) { thrown = true; }
+		Check(thrown, "book id " + to_string(bookId) + " throws out_of_range");
+	}
+	Check(position.GetAggregatePosition() == 1000000, "the refused book ids leave the aggregate position");
+	Check(position.GetPosition("TRSY1") == 1000000, "the refused book ids leave the position of TRSY1");
+}
+
+// The data of a registered product with nothing stored yet is empty and of that product
+void CheckEmptySlots()
+{
+	const ProductRegistry<Bond>& bonds = GetBondRegistry();
+	const Bond& last = bonds.Get(bonds.Size() - 1);
+	PositionService<Bond> positionService;
+	const Position<Bond>& position = positionService.GetData(last.GetProductId());
+	Check(&position.GetProduct() == &last, "the empty position of " + last.GetProductId() + " is of its product");
+	Check(position.GetAggregatePosition() == 0, "the empty position of " + last.GetProductId() + " is flat");
+	Check(position.print().find(last.GetProductId()) != string::npos, "the empty position of " + last.GetProductId() + " prints");
+
+	pricingService<Bond> prices;
+	const Price<Bond>& price = prices.GetData(bonds.Get(0).GetProductId());
+	Check(&price.GetProduct() == &bonds.Get(0), "the empty price of " + bonds.Get(0).GetProductId() + " is of its product");
+
+	marketDataService<Bond> books;
+	const OrderStacks<Bond>& book = books.GetData(last.GetProductId());
+	Check(&book.GetProduct() == &last && book.GetBidStack().empty(), "the empty book of " + last.GetProductId() + " is of its product");
+
+	ProductStore<PV01<Bond>> risks;
+	risks[bonds.Size() - 1];
+	for (size_t i = 0; i < bonds.Size(); i++)
+		Check(&risks[i].GetProduct() == &bonds.Get(i) && !risks.Contains(i), "the slot " + to_string(i) + " is created empty with its product");
+}
+
+// Every trade of an execution is found by its trade ID, not only the last one of its product
+void CheckExecutionTrades()
+{
+	TradeBookingService<Bond> tradeBookingService;
+	const Bond& bond = GetProductType("91282CFX4");
+	const int executions = 5;
+	for (int i = 0; i < executions; i++)
+	{
+		ExecutionOrder<Bond> order(bond, i % 2 == 0 ? BID : OFFER, SequenceId(i), MARKET, 99.0 + i / 256.0, 1000000 * (i + 1), 0, SequenceId(), false);
+		const Trade<Bond>& trade = tradeBookingService.BookExecution(order);
+		Check(trade.GetTradeId() == "TRADE-EXECUTE-" + to_string(i), "the trade of execution " + to_string(i) + " is the one booked");
+	}
+
+	for (int i = 0; i < executions; i++)
+	{
+		string tradeId = "TRADE-EXECUTE-" + to_string(i);
+		const Trade<Bond>& trade = tradeBookingService.GetData(tradeId);
+		Check(trade.GetExecutionId() == SequenceId(i), tradeId + " is found by its trade ID");
+		if (trade.GetExecutionId() != SequenceId(i)) continue;
+		Check(&trade.GetProduct() == &bond, tradeId + " is of its product");
+		Check(trade.GetQuantity() == 1000000 * (i + 1), tradeId + " has the quantity of its execution");
+		Check(trade.GetSide() == (i % 2 == 0 ? BUY : SELL), tradeId + " has the side of its execution");
+	}
+}
+
+// The orders of a book at the same price stay in the order they came in, however deep the book
+void CheckBookTies()
+{
+	const Bond& bond = GetProductType("91282CFX4");
+	const int depth = 100;
+	vector<Order> bids, offers;
+	for (int i = 0; i < depth; i++)
+	{
+		// the quantity is the arrival index, over four prices coming in shuffled
+		bids.push_back(Order(99.0 + (i * 7 % 4) / 256.0, i, BID));
+		offers.push_back(Order(100.0 + (i * 7 % 4) / 256.0, i, OFFER));
+	}
+	OrderStacks<Bond> book(bond, bids, offers);
+
+	for (const OrderStack* stack : { &book.GetBidStack(), &book.GetOfferStack() })
+	{
+		string side = stack == &book.GetBidStack() ? "bid" : "offer";
+		Check(stack->size() == depth, "the " + side + " stack keeps its " + to_string(depth) + " orders");
+		for (size_t i = 1; i < stack->size(); i++)
+		{
+			const Order& previous = (*stack)[i - 1];
+			const Order& order = (*stack)[i];
+			Check(!IsBetterPrice(order.GetSide(), order.GetPrice(), previous.GetPrice()), "the " + side + " stack is sorted best first at " + to_string(i));
+			if (order.GetPrice() == previous.GetPrice())
+				Check(previous.GetQuantity() < order.GetQuantity(), "the " + side + " orders at the same price keep their arrival order at " + to_string(i));
+		}
+	}
+	Check(book.GetBestBidOffer().GetBidOrder().GetQuantity() == 1, "the best bid is the first one at its price");
+	Check(book.GetBestBidOffer().GetOfferOrder().GetQuantity() == 0, "the best offer is the first one at its price");
+}
+
+// A registry message matches the products it was encoded from and no others, and is out of sequence
+void CheckWireRegistry()
+{
+	WireEncoder encoder;
+	char message[WIRE_MAX_MESSAGE];
+	size_t length = encoder.EncodeRegistry(message);
+	WireRegistry registry;
+	memcpy(&registry, message, sizeof(registry));
+	Check(length == sizeof(WireRegistry) && registry.header.length == length, "the registry message has its length");
+	Check(registry.header.sequence == 0 && encoder.GetSequence() == 0, "the registry message takes no sequence number");
+	Check(MatchesWireRegistry(registry.header), "the registry message matches the bond registry");
+
+	WireRegistry other = registry;
+	other.productHash++;
+	Check(!MatchesWireRegistry(other.header), "a registry message of other CUSIPs does not match");
+	other = registry;
+	other.productCount++;
+	Check(!MatchesWireRegistry(other.header), "a registry message of more products does not match");
+	other = registry;
+	other.header.type = WIRE_PRICE;
+	Check(!MatchesWireRegistry(other.header), "a price message is not a registry message");
+}
+
+/**
+ * Listener recording the price events it is given, holding them back while it is closed.
+ * Only the listener thread of an AsyncListener records, the events are read after its Flush().
+ */
+class RecordingPriceListener : public ServiceListener<Price<Bond>>
+{
+
+public:
+
+	// Product index and mid of each event, in the order they came
+	vector<pair<size_t, double>> events;
+	atomic<bool> open{ true };
+
+	void ProcessAdd(const Price<Bond>& _data) { Record(_data); }
+	void ProcessRemove(const Price<Bond>& _data) { Record(_data); }
+	void ProcessUpdate(const Price<Bond>& _data) { Record(_data); }
+
+private:
+
+	void Record(const Price<Bond>& _data)
+	{
+		while (!open.load(memory_order_acquire)) this_thread::yield();
+		events.push_back({ _data.GetProduct().GetProductIndex(), _data.GetMid() });
+	}
+
+};
+
+// With the BLOCK policy every event is delivered in order, however small the ring
+void CheckAsyncListenerOrder()
+{
+	const ProductRegistry<Bond>& bonds = GetBondRegistry();
+	RecordingPriceListener recorder;
+	AsyncListener<Price<Bond>> listener(&recorder, BLOCK, 4);
+	const int count = 10000;
+	for (int i = 0; i < count; i++) listener.ProcessAdd(Price<Bond>(bonds.Get(i % bonds.Size()), i, 0));
+	listener.Flush();
+
+	Check(listener.GetDeliveredCount() == count, "the BLOCK listener delivers the " + to_string(count) + " events");
+	Check(recorder.events.size() == count, "the listener receives the " + to_string(count) + " events");
+	bool inOrder = true;
+	for (size_t i = 0; i < recorder.events.size(); i++)
+		inOrder = inOrder && recorder.events[i].first == i % bonds.Size() && recorder.events[i].second == i;
+	Check(inOrder, "the events are received in the order they were sent");
+	Check(listener.GetDroppedCount() == 0 && listener.GetConflatedCount() == 0, "the BLOCK listener drops and conflates nothing");
+}
+
+// With the DROP policy the events finding the ring full are counted and lost, the others delivered in order
+void CheckAsyncListenerDrop()
+{
+	const Bond& bond = GetBondRegistry().Get(0);
+	RecordingPriceListener recorder;
+	recorder.open = false;
+	AsyncListener<Price<Bond>> listener(&recorder, DROP, 4);
+
+	// the first event holds its slot while the closed listener is given it, so the ring takes 4 events
+	for (int i = 0; i < 10; i++) listener.ProcessAdd(Price<Bond>(bond, i, 0));
+	Check(listener.GetDroppedCount() == 6, "a full ring of 4 drops the last 6 of 10 events");
+
+	recorder.open = true;
+	listener.Flush();
+	Check(listener.GetDeliveredCount() == 4, "the 4 events of the ring are delivered");
+	bool delivered = recorder.events.size() == 4;
+	for (size_t i = 0; delivered && i < recorder.events.size(); i++) delivered = recorder.events[i].second == i;
+	Check(delivered, "the events delivered are the first 4, in order");
+}
+
+// With the CONFLATE policy the events finding the ring full keep the latest of each product
+void CheckAsyncListenerConflate()
+{
+	const ProductRegistry<Bond>& bonds = GetBondRegistry();
+	RecordingPriceListener recorder;
+	recorder.open = false;
+	AsyncListener<Price<Bond>> listener(&recorder, CONFLATE, 4);
+
+	// 4 events fill the ring, the next 6 go to products 0 and 1 in turn and are parked
+	for (int i = 0; i < 10; i++) listener.ProcessAdd(Price<Bond>(bonds.Get(i % 2), i, 0));
+	Check(listener.GetConflatedCount() == 4, "each product replaces 2 of its 3 parked events");
+	Check(listener.GetDroppedCount() == 0, "the CONFLATE listener drops nothing");
+
+	recorder.open = true;
+	listener.Flush();
+	vector<pair<size_t, double>> expected = { { 0, 0 }, { 1, 1 }, { 0, 2 }, { 1, 3 }, { 0, 8 }, { 1, 9 } };
+	Check(recorder.events == expected, "the ring is delivered, then the latest event of each product");
+	Check(listener.GetDeliveredCount() == expected.size(), "the flushed listener delivers 6 events");
+}
+
+// Flush() returns once the listener has been given every event, parked ones included
+void CheckAsyncListenerFlush()
+{
+	const ProductRegistry<Bond>& bonds = GetBondRegistry();
+	for (BackPressurePolicy policy : { BLOCK, DROP, CONFLATE })
+	{
+		RecordingPriceListener recorder;
+		AsyncListener<Price<Bond>> listener(&recorder, policy, 8);
+		unsigned long long sent = 0;
+		for (int round = 0; round < 100; round++)
+		{
+			for (int i = 0; i < 50; i++, sent++) listener.ProcessAdd(Price<Bond>(bonds.Get(i % bonds.Size()), i, 0));
+			listener.Flush();
+			unsigned long long accounted = listener.GetDeliveredCount() + listener.GetDroppedCount() + listener.GetConflatedCount();
+			Check(accounted == sent, "policy " + to_string(policy) + " accounts for every event sent after Flush() " + to_string(round));
+			Check(recorder.events.size() == listener.GetDeliveredCount(), "policy " + to_string(policy) + " has given the listener every delivered event after Flush() " + to_string(round));
+		}
+	}
+}
+
+// Value of several words of which a reader must never see a mix of two writes, its size not a multiple of a word
+struct SnapshotCheckValue
+{
+	uint64_t words[63];
+	uint32_t last;
+};
+
+// A reader racing the writer of a snapshot store sees whole values only, each no older than the one before
+void CheckSnapshotStore()
+{
+	const uint64_t writes = 5000000;
+	const size_t products = 3;
+	SnapshotStore<SnapshotCheckValue> store;
+	atomic<bool> writing{ true };
+	thread writer([&]() {
+		for (uint64_t n = 1; n <= writes; n++)
+		{
+			SnapshotCheckValue value;
+			for (uint64_t& word : value.words) word = n;
+			value.last = static_cast<uint32_t>(n);
+			store.Publish(n % products, value);
+		}
+		writing = false;
+	});
+
+	long torn = 0;
+	long backwards = 0;
+	long reads = 0;
+	uint64_t latest[products] = {};
+	SnapshotCheckValue value;
+	while (writing.load() || reads == 0)
+	{
+		for (size_t p = 0; p < products; p++)
+		{
+			if (!store.GetSnapshot(p, value)) continue;
+			reads++;
+			bool whole = value.last == static_cast<uint32_t>(value.words[0]);
+			for (uint64_t word : value.words) whole = whole && word == value.words[0];
+			torn += !whole;
+			backwards += value.words[0] < latest[p];
+			latest[p] = value.words[0];
+		}
+	}
+	writer.join();
+
+	Check(reads > 0, "the reader reads snapshots while they are written");
+	Check(torn == 0, to_string(torn) + " of " + to_string(reads) + " snapshots read are a mix of two writes");
+	Check(backwards == 0, to_string(backwards) + " of " + to_string(reads) + " snapshots read are older than the one before");
+	for (size_t p = 0; p < products; p++)
+	{
+		Check(store.GetSnapshot(p, value) && value.words[0] == writes - (writes - p) % products,
+			"product " + to_string(p) + " ends with its last write");
+	}
+	Check(!store.GetSnapshot(products, value), "a product never published has no snapshot");
+}
+
+// Updates and erases of random handles keep the order of a heap of D children and its handles
+template<int D>
+void CheckDaryHeap()
+{
+	mt19937 random(D);
+	DaryHeap<int, D> heap;
+	map<size_t, int> values; // by handle, what the heap must hold
+	string name = to_string(D) + "-ary heap";
+	for (int step = 0; step < 10000; step++)
+	{
+		int value = static_cast<int>(random() % 1000);
+		// pushes are as likely as the rest together, so that the heap grows to thousands of values
+		static const int operations[] = { 0, 0, 0, 0, 1, 1, 2, 3 };
+		int operation = values.empty() ? 0 : operations[random() % 8];
+		auto handle = values.begin();
+		advance(handle, values.empty() ? 0 : random() % values.size());
+		string what;
+		switch (operation) {
+		case 0:
+			values[heap.Push(value)] = value;
+			what = "push";
+			break;
+		case 1:
+			heap.Update(handle->first, value);
+			handle->second = value;
+			what = "update";
+			break;
+		case 2:
+			heap.Erase(handle->first);
+			values.erase(handle);
+			what = "erase";
+			break;
+		case 3:
+			values.erase(heap.TopHandle());
+			heap.Pop();
+			what = "pop";
+			break;
+		}
+
+		if (!heap.IsValid() || heap.Size() != values.size())
+		{
+			Check(false, "the " + name + " keeps its order and handles after the " + what + " of step " + to_string(step));
+			return;
+		}
+		int largest = -1;
+		bool found = true;
+		for (auto& v : values)
+		{
+			largest = max(largest, v.second);
+			found = found && heap.Contains(v.first) && heap.Get(v.first) == v.second;
+		}
+		if (!found || (!values.empty() && heap.Top() != largest))
+		{
+			Check(false, "the " + name + " gives the values of its handles and the largest on top after the " + what + " of step " + to_string(step));
+			return;
+		}
+	}
+
+	vector<int> popped;
+	for (; !heap.Empty(); heap.Pop()) popped.push_back(heap.Top());
+	Check(is_sorted(popped.rbegin(), popped.rend()), "the " + name + " pops its values largest first");
+}
+
+// ParallelSort and IntroSort sort as std::sort, whatever the input order and however many threads
+void CheckParallelSort()
+{
+	mt19937 random(29);
+	for (size_t size : { 0, 1, 2, 17, 1000, 100000, 300000 })
+	{
+		vector<vector<long>> inputs(4, vector<long>(size));
+		for (size_t i = 0; i < size; i++)
+		{
+			inputs[0][i] = static_cast<long>(random());
+			inputs[1][i] = static_cast<long>(random() % 16); // many equal values
+			inputs[2][i] = static_cast<long>(i); // sorted
+			inputs[3][i] = static_cast<long>(size - i); // reversed
+		}
+		for (size_t k = 0; k < inputs.size(); k++)
+		{
+			vector<long> expected = inputs[k];
+			sort(expected.begin(), expected.end(), greater<long>());
+			string input = "input " + to_string(k) + " of " + to_string(size) + " values";
+			for (int threads : { 1, 2, 3, 8 })
+			{
+				vector<long> sorted = inputs[k];
+				ParallelSort(sorted.begin(), sorted.end(), greater<long>(), threads);
+				Check(sorted == expected, "ParallelSort on " + to_string(threads) + " threads sorts " + input);
+			}
+			vector<long> sorted = inputs[k];
+			IntroSort(sorted.begin(), sorted.end(), greater<long>());
+			Check(sorted == expected, "IntroSort sorts " + input);
+		}
+	}
+}
+
+// The text of an ID reads back as the same ID, up to the largest shard and sequence number,
+// and any other text reads as no ID
+void CheckSequenceIdText()
+{
+	for (uint32_t shard : { 0u, 1u, 9u, 10u, 65533u, SEQUENCE_ID_MAX_SHARD })
+	{
+		for (uint64_t sequence : initializer_list<uint64_t>{ 0, 1, 9, 10, 999999, SEQUENCE_ID_MAX_SEQUENCE - 1, SEQUENCE_ID_MAX_SEQUENCE })
+		{
+			SequenceId id(shard, sequence);
+			char text[SEQUENCE_ID_MAX_LENGTH];
+			size_t length = id.Format(text);
+			string description = to_string(shard) + "-" + to_string(sequence);
+			Check(length <= SEQUENCE_ID_MAX_LENGTH, description + " fits in SEQUENCE_ID_MAX_LENGTH");
+			Check(string(text, length) == id.ToString(), description + " is formatted as its string");
+			SequenceId parsed = SequenceId::Parse(string_view(text, length));
+			Check(parsed == id && parsed.GetShard() == shard && parsed.GetSequence() == sequence, description + " reads back from " + id.ToString());
+		}
+	}
+
+	Check(SequenceId(0, 17).ToString() == "17", "an ID of shard 0 is its sequence number");
+	Check(SequenceId(2, 17).ToString() == "2-17", "an ID of shard 2 is 2-17");
+	Check(SequenceId(SEQUENCE_ID_MAX_SHARD, SEQUENCE_ID_MAX_SEQUENCE).ToString().size() == SEQUENCE_ID_MAX_LENGTH, "the largest ID is SEQUENCE_ID_MAX_LENGTH long");
+	Check(SequenceId().ToString() == "NA" && !SequenceId::Parse("NA").IsValid(), "no ID is NA both ways");
+	for (const char* text : { "", "-", "-5", "5-", "x", "12x", "1-2-3", " 1", "65535-1", "281474976710656", "1-281474976710656", "18446744073709551616" })
+		Check(!SequenceId::Parse(text).IsValid(), string("\"") + text + "\" reads as no ID");
+}
+
+// Add the position of each product and book of a trading system to a total
+void AddPositions(TradingSystem& _tradingSystem, map<pair<string, string>, long>& _positions)
+{
+	const ProductRegistry<Bond>& bonds = GetBondRegistry();
+	for (size_t i = 0; i < bonds.Size(); i++)
+	{
+		const Position<Bond>& position = _tradingSystem.positionService.GetData(bonds.Get(i).GetProductId());
+		for (const char* book : { "TRSY1", "TRSY2", "TRSY3" })
+			_positions[{ bonds.Get(i).GetProductId(), book }] += position.GetPosition(book);
+	}
+}
+
+// Read a whole file, empty if it does not exist
+string ReadFile(const string& _fileName)
+{
+	ifstream file(_fileName, ios::binary);
+	return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+// A writer opened while redirected follows later redirections, with everything written
+// before a redirection going to the file of before
+void CheckWriterRedirection()
+{
+	const string fileName = "selftest_redirection.txt";
+	remove(fileName.c_str());
+	BufferedFileWriter::SetRedirection(NULL_DEVICE);
+	BufferedFileWriter& writer = BufferedFileWriter::GetWriter(fileName);
+	writer.Write("discarded\n");
+	BufferedFileWriter::SetRedirection("");
+	writer.Write("kept\n");
+	writer.Flush();
+	Check(ReadFile(fileName) == "kept\n", "a cached writer goes back to its own file when the redirection is removed");
+	BufferedFileWriter::SetRedirection(NULL_DEVICE);
+	writer.Write("discarded\n");
+	writer.Flush();
+	Check(ReadFile(fileName) == "kept\n", "a cached writer is redirected again");
+	BufferedFileWriter::SetRedirection("");
+	remove(fileName.c_str());
+}
+
+// The trades and market data of the input files give the same positions to the trading
+// system of main and to the sharded one, whatever the number of shards
+void CheckShardedPositions()
+{
+	BufferedFileWriter::SetRedirection(NULL_DEVICE);
+	map<pair<string, string>, long> expected;
+	{
+		TradingSystem tradingSystem;
+		tradingSystem.AddListeners();
+		ifstream trades("trades.txt");
+		tradingSystem.tradeBookingService.GetConnector()->Subscribe(trades);
+		ifstream marketData("marketdata.txt");
+		tradingSystem.marketdataservice.GetConnector()->Subscribe(marketData);
+		tradingSystem.Flush();
+		AddPositions(tradingSystem, expected);
+	}
+	long executed = 0;
+	for (auto& position : expected) executed += position.second != 0;
+	Check(executed > 0, "trades.txt and marketdata.txt make positions");
+
+	for (int shards : { 1, 2, 3, 4 })
+	{
+		ShardedTradingSystem tradingSystem(shards);
+		tradingSystem.AddListeners();
+		tradingSystem.AddFeed("trades", "trades.txt", &TradingSystem::tradeBookingService);
+		tradingSystem.AddFeed("market data", "marketdata.txt", &TradingSystem::marketdataservice, 0, 10);
+		tradingSystem.Run();
+		tradingSystem.Flush();
+
+		map<pair<string, string>, long> positions;
+		for (int s = 0; s < shards; s++) AddPositions(tradingSystem.GetShard(s), positions);
+		for (auto& position : expected)
+		{
+			Check(positions[position.first] == position.second, to_string(shards) + " shards give the position of " +
+				position.first.first + " in " + position.first.second + " of " + to_string(position.second));
+		}
+	}
+	BufferedFileWriter::SetRedirection("");
+}
+
+int main(int argc, char* argv[])
+{
+	string filter = argc > 1 ? argv[1] : "";
+
+	// the groups of checks, in the order they are run; RiskServiceCold is first, as it is
+	// only cold while nothing has used the registries of the process yet
+	vector<pair<string, function<void()>>> groups = {
+		{ "RiskServiceCold", []() { CheckRiskServiceCold(); } },
+		{ "PriceCodec", []() { CheckPriceCodec(); } },
+		{ "PriceCodecChecked", []() { CheckPriceCodecChecked(); } },
+		{ "PositionBooks", []() { CheckPositionBooks(); } },
+		{ "EmptySlots", []() { CheckEmptySlots(); } },
+		{ "ExecutionTrades", []() { CheckExecutionTrades(); } },
+		{ "AsyncListenerOrder", []() { CheckAsyncListenerOrder(); } },
+		{ "AsyncListenerDrop", []() { CheckAsyncListenerDrop(); } },
+		{ "AsyncListenerConflate", []() { CheckAsyncListenerConflate(); } },
+		{ "AsyncListenerFlush", []() { CheckAsyncListenerFlush(); } },
+		{ "SnapshotStore", []() { CheckSnapshotStore(); } },
+		{ "DaryHeap", []() { CheckDaryHeap<2>(); CheckDaryHeap<4>(); CheckDaryHeap<5>(); } },
+		{ "ParallelSort", []() { CheckParallelSort(); } },
+		{ "SequenceIdText", []() { CheckSequenceIdText(); } },
+		{ "BookTies", []() { CheckBookTies(); } },
+		{ "WireRegistry", []() { CheckWireRegistry(); } },
+		{ "WriterRedirection", []() { CheckWriterRedirection(); } },
+		{ "ShardedPositions", []() { CheckShardedPositions(); } },
+	};
+
+	for (auto& group : groups)
+	{
+		if (group.first.find(filter) == string::npos) continue;
+		int failures = failureCount;
+		group.second();
+		cout << group.first << ": " << (failureCount == failures ? "passed" : "failed") << endl;
+	}
+	return failureCount;
+}
@@ -0,0 +1,241 @@
+/**
+ * sequenceid.hpp
+ * Defines the compact IDs of the orders and trades the trading system makes itself,
+ * and the lock-free generator numbering them.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef SEQUENCE_ID_HPP
+#define SEQUENCE_ID_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <ostream>
+
+using namespace std;
+
+// Bits of an ID holding its sequence number, the ones above holding its shard
+const int SEQUENCE_ID_SHARD_SHIFT = 48;
+
+// Largest shard of an ID
+const uint32_t SEQUENCE_ID_MAX_SHARD = (1u << (64 - SEQUENCE_ID_SHARD_SHIFT)) - 2;
+
+// Largest sequence number of an ID
+const uint64_t SEQUENCE_ID_MAX_SEQUENCE = (1ull << SEQUENCE_ID_SHARD_SHIFT) - 1;
+
+// Longest text of an ID: a shard, a dash and a sequence number
+const size_t SEQUENCE_ID_MAX_LENGTH = 5 + 1 + 15;
+
+/**
+ * ID of an order or a trade made by the trading system, 64 bits holding the number of
+ * the shard that made it above its sequence number within that shard.
+ * It is only turned into text when it is persisted or published: the sequence number alone
+ * for shard 0, the one of an unsharded system, so that the IDs read as they always have,
+ * and shard-sequence otherwise, or NA for no ID, such as the parent of an order that has none.
+ */
+class SequenceId
+{
+
+public:
+
+	// ctor for no ID
+	SequenceId() = default;
+
+	// ctor for a sequence number within a shard
+	SequenceId(uint32_t _shard, uint64_t _sequence);
+
+	// ctor for a sequence number of shard 0
+	explicit SequenceId(uint64_t _sequence);
+
+	// Check whether there is an ID
+	bool IsValid() const;
+
+	// Get the shard that made the ID
+	uint32_t GetShard() const;
+
+	// Get the sequence number within the shard
+	uint64_t GetSequence() const;
+
+	// Get the 64 bits of the ID, the shard stored one higher so that 0 is no ID
+	uint64_t GetValue() const;
+
+	// Write the text of the ID into a buffer of SEQUENCE_ID_MAX_LENGTH characters, return its length
+	size_t Format(char* _buffer) const;
+
+	// Get the text of the ID
+	string ToString() const;
+
+	// Read an ID back from its text, no ID for NA or any other text, such as a shard or a sequence number too large
+	static SequenceId Parse(string_view _text);
+
+	// Make an ID from its 64 bits
+	static SequenceId FromValue(uint64_t _value);
+
+	bool operator==(const SequenceId& _other) const;
+	bool operator!=(const SequenceId& _other) const;
+
+private:
+
+	uint64_t value = 0;
+
+};
+
+// Write the text of an ID
+ostream& operator<<(ostream& _output, const SequenceId& _id);
+
+/**
+ * Generator of the IDs of a shard, each call to Next() giving the next sequence number.
+ * The sequence is a single atomic counter, so the IDs stay unique when several threads
+ * make orders at once, without a lock.
+ */
+class SequenceIdGenerator
+{
+
+public:
+
+	// ctor for the IDs of a shard, numbered from 0
+	SequenceIdGenerator(uint32_t _shard = 0);
+
+	// Get the next ID
+	SequenceId Next();
+
+	// Get the next ID without taking it
+	SequenceId Peek() const;
+
+	// Number the next IDs of a shard from a sequence number, the state a checkpoint keeps
+	void Reset(uint32_t _shard, uint64_t _sequence);
+
+	// Get the shard of the IDs
+	uint32_t GetShard() const;
+
+private:
+
+	atomic<uint64_t> next; // the value of the next ID, shard included
+
+};
+
+SequenceId::SequenceId(uint32_t _shard, uint64_t _sequence)
+{
+	value = (static_cast<uint64_t>(_shard + 1) << SEQUENCE_ID_SHARD_SHIFT) | (_sequence & ((1ull << SEQUENCE_ID_SHARD_SHIFT) - 1));
+}
+
+SequenceId::SequenceId(uint64_t _sequence) :
+	SequenceId(0, _sequence)
+{
+}
+
+bool SequenceId::IsValid() const
+{
+	return value != 0;
+}
+
+uint32_t SequenceId::GetShard() const
+{
+	return static_cast<uint32_t>(value >> SEQUENCE_ID_SHARD_SHIFT) - 1;
+}
+
+uint64_t SequenceId::GetSequence() const
+{
+	return value & ((1ull << SEQUENCE_ID_SHARD_SHIFT) - 1);
+}
+
+uint64_t SequenceId::GetValue() const
+{
+	return value;
+}
+
+size_t SequenceId::Format(char* _buffer) const
+{
+	if (!IsValid())
+	{
+		_buffer[0] = 'N';
+		_buffer[1] = 'A';
+		return 2;
+	}
+
+	char* end = _buffer;
+	if (GetShard() > 0)
+	{
+		end = to_chars(end, _buffer + SEQUENCE_ID_MAX_LENGTH, GetShard()).ptr;
+		*end++ = '-';
+	}
+	end = to_chars(end, _buffer + SEQUENCE_ID_MAX_LENGTH, GetSequence()).ptr;
+	return end - _buffer;
+}
+
+string SequenceId::ToString() const
+{
+	char text[SEQUENCE_ID_MAX_LENGTH];
+	return string(text, Format(text));
+}
+
+SequenceId SequenceId::Parse(string_view _text)
+{
+	uint32_t shard = 0;
+	size_t dash = _text.find('-');
+	if (dash != string_view::npos)
+	{
+		if (from_chars(_text.data(), _text.data() + dash, shard).ec != errc()) return SequenceId();
+		_text.remove_prefix(dash + 1);
+	}
+
+	uint64_t sequence = 0;
+	auto result = from_chars(_text.data(), _text.data() + _text.size(), sequence);
+	if (_text.empty() || result.ec != errc() || result.ptr != _text.data() + _text.size() || shard > SEQUENCE_ID_MAX_SHARD
+		|| sequence > SEQUENCE_ID_MAX_SEQUENCE)
+		return SequenceId();
+	return SequenceId(shard, sequence);
+}
+
+SequenceId SequenceId::FromValue(uint64_t _value)
+{
+	SequenceId id;
+	id.value = _value;
+	return id;
+}
+
+bool SequenceId::operator==(const SequenceId& _other) const
+{
+	return value == _other.value;
+}
+
+bool SequenceId::operator!=(const SequenceId& _other) const
+{
+	return value != _other.value;
+}
+
+ostream& operator<<(ostream& _output, const SequenceId& _id)
+{
+	char text[SEQUENCE_ID_MAX_LENGTH];
+	return _output.write(text, _id.Format(text));
+}
+
+SequenceIdGenerator::SequenceIdGenerator(uint32_t _shard) :
+	next(SequenceId(_shard, 0).GetValue())
+{
+}
+
+SequenceId SequenceIdGenerator::Next()
+{
+	return SequenceId::FromValue(next.fetch_add(1, memory_order_relaxed));
+}
+
+SequenceId SequenceIdGenerator::Peek() const
+{
+	return SequenceId::FromValue(next.load(memory_order_relaxed));
+}
+
+void SequenceIdGenerator::Reset(uint32_t _shard, uint64_t _sequence)
+{
+	next.store(SequenceId(_shard, _sequence).GetValue(), memory_order_relaxed);
+}
+
+uint32_t SequenceIdGenerator::GetShard() const
+{
+	return Peek().GetShard();
+}
+
+#endif
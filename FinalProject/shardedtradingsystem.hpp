@@ -0,0 +1,540 @@
+/**
+ * shardedtradingsystem.hpp
+ * Defines the sharded deployment of the trading system: one trading system per
+ * worker thread, each owning the products of its shard, behind routers splitting
+ * the input files by product.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef SHARDED_TRADING_SYSTEM_HPP
+#define SHARDED_TRADING_SYSTEM_HPP
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <streambuf>
+#include "soa.hpp"
+#include "linereader.hpp"
+#include "tradingsystem.hpp"
+
+using namespace std;
+
+// Size from which the lines routed to a shard are handed to it
+const size_t SHARD_BLOCK_SIZE = 1 << 18;
+
+// Most blocks waiting for the worker of a shard before the routers wait for it
+const size_t SHARD_QUEUE_CAPACITY = 64;
+
+template<typename T>
+class ShardSectorRiskListener;
+
+/**
+ * Lines of one input file for the products of one shard.
+ */
+struct ShardBlock
+{
+	int feed = 0;
+	string lines;
+	long lineCount = 0;
+};
+
+/**
+ * Bounded queue of the blocks routed to a shard, filled by the router of each
+ * feed and drained by the worker of the shard.
+ */
+class ShardQueue
+{
+
+public:
+
+	// ctor for the blocks of a number of routers
+	ShardQueue(int _producers, size_t _capacity = SHARD_QUEUE_CAPACITY);
+
+	// Add a block, waiting while the queue is full
+	void Push(ShardBlock&& _block);
+
+	// Take the next block, waiting for one, return false once every router has closed and the queue is empty
+	bool Pop(ShardBlock& _block);
+
+	// Close the queue for one router, which has no more blocks
+	void Close();
+
+private:
+
+	mutex lock;
+	condition_variable notEmpty;
+	condition_variable notFull;
+	deque<ShardBlock> blocks;
+	size_t capacity;
+	int producers;
+
+};
+
+/**
+ * Stream buffer reading the lines of a block in place, for the connectors of a shard.
+ */
+class ShardBlockBuffer : public streambuf
+{
+
+public:
+
+	// ctor for a block, which must outlive the buffer
+	ShardBlockBuffer(const string& _lines);
+
+};
+
+/**
+ * Input file of the sharded system, routed by the product of each message.
+ */
+struct ShardFeed
+{
+	string name;
+	string fileName;
+	int productField = 0; // comma separated field holding the CUSIP
+	int linesPerMessage = 1; // lines of a message, which all go to the same shard
+	vector<function<void(istream&)>> subscribes; // by shard
+	long lines = 0;
+	double seconds = 0;
+};
+
+/**
+ * Merger of the sector risk of the shards.
+ * Each shard sends the risk of the sectors over its own products, and the sum over
+ * the shards of the latest risk each one sent is the risk of the sector, which is
+ * sent to the listeners on every change, in the order the shards sent their part.
+ * Type T is the product type.
+ */
+template<typename T>
+class SectorRiskMerger
+{
+
+public:
+
+	// ctor for a number of shards
+	SectorRiskMerger(int _shards);
+
+	// dtor
+	~SectorRiskMerger();
+
+	// Get the listener of the sector risk of a shard
+	ShardSectorRiskListener<T>* GetListener(int _shard);
+
+	// Add a listener for the merged risk of the sectors
+	void AddListener(ServiceListener<PV01<BucketedSector<T>>>* _listener);
+
+	// Get the merged risk of a sector
+	PV01<BucketedSector<T>> GetBucketedRisk(const BucketedSector<T>& _sector) const;
+
+	// Merge the risk of a sector sent by a shard
+	void OnShardRisk(int _shard, const PV01<BucketedSector<T>>& _risk);
+
+private:
+
+	vector<ShardSectorRiskListener<T>*> shardListeners;
+	vector<ServiceListener<PV01<BucketedSector<T>>>*> listeners;
+	mutable mutex lock; // the shards send their risk from their own threads
+	vector<vector<double>> shardRisks; // by shard and sector index
+	ProductStore<PV01<BucketedSector<T>>> mergedRisks;
+
+};
+
+template<typename T>
+SectorRiskMerger<T>::SectorRiskMerger(int _shards)
+{
+	const ProductRegistry<BucketedSector<T>>& sectors = GetSectorRegistry<T>();
+	for (int s = 0; s < _shards; s++) shardListeners.push_back(new ShardSectorRiskListener<T>(this, s));
+	shardRisks.assign(_shards, vector<double>(sectors.Size(), 0));
+	for (size_t i = 0; i < sectors.Size(); i++) mergedRisks.Put(PV01<BucketedSector<T>>(sectors.Get(i), 0, 1));
+}
+
+template<typename T>
+SectorRiskMerger<T>::~SectorRiskMerger()
+{
+	for (auto l : shardListeners) delete l;
+}
+
+template<typename T>
+ShardSectorRiskListener<T>* SectorRiskMerger<T>::GetListener(int _shard)
+{
+	return shardListeners[_shard];
+}
+
+template<typename T>
+void SectorRiskMerger<T>::AddListener(ServiceListener<PV01<BucketedSector<T>>>* _listener)
+{
+	listeners.push_back(_listener);
+}
+
+template<typename T>
+PV01<BucketedSector<T>> SectorRiskMerger<T>::GetBucketedRisk(const BucketedSector<T>& _sector) const
+{
+	lock_guard<mutex> guard(lock);
+	return mergedRisks[_sector.GetProductIndex()];
+}
+
+template<typename T>
+void SectorRiskMerger<T>::OnShardRisk(int _shard, const PV01<BucketedSector<T>>& _risk)
+{
+	lock_guard<mutex> guard(lock);
+	size_t index = _risk.GetProduct().GetProductIndex();
+	shardRisks[_shard][index] = _risk.GetPV01();
+
+	double total = 0;
+	for (const auto& risks : shardRisks) total += risks[index];
+	PV01<BucketedSector<T>>& merged = mergedRisks[index];
+	merged.SetPV01(total);
+
+	// sent under the lock, so that the listeners see a single producer
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(merged); });
+}
+
+
+/**
+* Listener sending the sector risk of a shard to the merger.
+* Type T is the product type.
+*/
+template<typename T>
+class ShardSectorRiskListener final : public ServiceListener<PV01<BucketedSector<T>>>
+{
+
+private:
+
+	SectorRiskMerger<T>* merger;
+	int shard;
+
+public:
+
+	// Ctor
+	ShardSectorRiskListener(SectorRiskMerger<T>* _merger, int _shard);
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(const PV01<BucketedSector<T>>& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(const PV01<BucketedSector<T>>& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(const PV01<BucketedSector<T>>& _data);
+
+};
+
+template<typename T>
+ShardSectorRiskListener<T>::ShardSectorRiskListener(SectorRiskMerger<T>* _merger, int _shard)
+{
+	merger = _merger;
+	shard = _shard;
+}
+
+template<typename T>
+void ShardSectorRiskListener<T>::ProcessAdd(const PV01<BucketedSector<T>>& _data)
+{
+	merger->OnShardRisk(shard, _data);
+}
+
+template<typename T>
+void ShardSectorRiskListener<T>::ProcessRemove(const PV01<BucketedSector<T>>& _data) {}
+
+template<typename T>
+void ShardSectorRiskListener<T>::ProcessUpdate(const PV01<BucketedSector<T>>& _data) {}
+
+
+/**
+ * Trading system sharded by product.
+ * Each shard is a whole TradingSystem run by a worker thread of its own, and owns the
+ * products whose index is the shard number modulo the number of shards, so that the
+ * order books, algos, positions and risk of a product are only touched by its worker.
+ * The router of each input file reads it once and hands the lines of each shard to its
+ * worker in blocks, the lines of a message, such as the ten lines of an order book,
+ * going to the same block. The workers subscribe the blocks through the connectors of
+ * their shard, so that the services are the same as in the unsharded system.
+ * The sector risk of the shards is merged before it is persisted, the other data
+ * goes to the same files as in the unsharded system. The order IDs of each shard carry
+ * the shard number plus one as their prefix, such as 3-17, so the order and trade IDs
+ * stay unique, and the algo alternates between buying and selling within each product,
+ * so the positions are those of the unsharded system whatever the number of shards.
+ * Each shard has a GUI of its own, throttling the prices of its products.
+ */
+class ShardedTradingSystem
+{
+
+public:
+
+	// ctor creating the trading system of every shard
+	ShardedTradingSystem(int _shards);
+
+	// Get the number of shards
+	int GetShardCount() const;
+
+	// Get the shard owning a product index
+	int GetProductShard(size_t _productIndex) const;
+
+	// Get the trading system of a shard
+	TradingSystem& GetShard(int _shard);
+
+	// Get the merged sector risk
+	SectorRiskMerger<Bond>& GetSectorRisk();
+
+	// Add the listeners and pipelines of every shard and the merged sector risk
+	void AddListeners();
+
+	// Add an input file subscribed by the connector of a service of each shard, the CUSIP of each
+	// message being in a comma separated field of its first line
+	template<typename S>
+	void AddFeed(const string& _name, const string& _fileName, S TradingSystem::* _service, int _productField = 0,
+		int _linesPerMessage = 1);
+
+	// Route every feed to the shards and wait for the workers to process them
+	void Run();
+
+	// Wait until the data of every shard has been persisted, called once the feeds have ended
+	void Flush();
+
+	// Print the throughput of each router and of each shard and the wall time of the last run
+	void PrintReport(ostream& _output) const;
+
+	// Get the wall time of the last run in seconds
+	double GetWallSeconds() const;
+
+private:
+
+	ShardedTradingSystem(const ShardedTradingSystem&) = delete;
+	ShardedTradingSystem& operator=(const ShardedTradingSystem&) = delete;
+
+	// Split a feed into blocks by shard
+	void Route(ShardFeed& _feed, int _feedIndex);
+
+	// Subscribe the blocks of a shard through its connectors
+	void Work(int _shard);
+
+	vector<unique_ptr<TradingSystem>> shards;
+	SectorRiskMerger<Bond> sectorRisk;
+	HistoricalDataService<PV01<BucketedSector<Bond>>> historicalSectorRiskService;
+	AsyncListener<PV01<BucketedSector<Bond>>> historicalSectorRiskListener;
+	vector<ShardFeed> feeds;
+	vector<unique_ptr<ShardQueue>> queues;
+	vector<long> shardLines;
+	vector<double> shardSeconds;
+	double wallSeconds = 0;
+
+};
+
+ShardQueue::ShardQueue(int _producers, size_t _capacity)
+{
+	producers = _producers;
+	capacity = _capacity;
+}
+
+void ShardQueue::Push(ShardBlock&& _block)
+{
+	unique_lock<mutex> guard(lock);
+	notFull.wait(guard, [this]() { return blocks.size() < capacity; });
+	blocks.push_back(move(_block));
+	notEmpty.notify_one();
+}
+
+bool ShardQueue::Pop(ShardBlock& _block)
+{
+	unique_lock<mutex> guard(lock);
+	notEmpty.wait(guard, [this]() { return !blocks.empty() || producers == 0; });
+	if (blocks.empty()) return false;
+
+	_block = move(blocks.front());
+	blocks.pop_front();
+	notFull.notify_one();
+	return true;
+}
+
+void ShardQueue::Close()
+{
+	lock_guard<mutex> guard(lock);
+	producers--;
+	notEmpty.notify_one();
+}
+
+ShardBlockBuffer::ShardBlockBuffer(const string& _lines)
+{
+	char* begin = const_cast<char*>(_lines.data());
+	setg(begin, begin, begin + _lines.size());
+}
+
+ShardedTradingSystem::ShardedTradingSystem(int _shards) :
+	sectorRisk(_shards),
+	historicalSectorRiskService(RISK),
+	historicalSectorRiskListener(historicalSectorRiskService.GetListener())
+{
+	for (int s = 0; s < _shards; s++)
+	{
+		shards.emplace_back(new TradingSystem());
+		shards.back()->algoExecutionService.SetOrderIdShard(static_cast<uint32_t>(s + 1));
+	}
+	shardLines.assign(_shards, 0);
+	shardSeconds.assign(_shards, 0);
+}
+
+int ShardedTradingSystem::GetShardCount() const
+{
+	return static_cast<int>(shards.size());
+}
+
+int ShardedTradingSystem::GetProductShard(size_t _productIndex) const
+{
+	return static_cast<int>(_productIndex % shards.size());
+}
+
+TradingSystem& ShardedTradingSystem::GetShard(int _shard)
+{
+	return *shards[_shard];
+}
+
+SectorRiskMerger<Bond>& ShardedTradingSystem::GetSectorRisk()
+{
+	return sectorRisk;
+}
+
+void ShardedTradingSystem::AddListeners()
+{
+	for (size_t s = 0; s < shards.size(); s++)
+	{
+		shards[s]->AddListeners(false, false);
+		shards[s]->riskService.AddSectorListener(sectorRisk.GetListener(static_cast<int>(s)));
+	}
+	sectorRisk.AddListener(&historicalSectorRiskListener);
+}
+
+template<typename S>
+void ShardedTradingSystem::AddFeed(const string& _name, const string& _fileName, S TradingSystem::* _service,
+	int _productField, int _linesPerMessage)
+{
+	ShardFeed feed;
+	feed.name = _name;
+	feed.fileName = _fileName;
+	feed.productField = _productField;
+	feed.linesPerMessage = _linesPerMessage;
+	for (auto& shard : shards)
+	{
+		auto connector = ((*shard).*_service).GetConnector();
+		feed.subscribes.push_back([connector](istream& _data) { connector->Subscribe(_data); });
+	}
+	feeds.push_back(feed);
+}
+
+void ShardedTradingSystem::Run()
+{
+	queues.clear();
+	for (size_t s = 0; s < shards.size(); s++) queues.emplace_back(new ShardQueue(static_cast<int>(feeds.size())));
+
+	auto start = chrono::steady_clock::now();
+	vector<thread> workers;
+	for (size_t s = 0; s < shards.size(); s++) workers.push_back(thread(&ShardedTradingSystem::Work, this, static_cast<int>(s)));
+	vector<thread> routers;
+	for (size_t f = 0; f < feeds.size(); f++)
+		routers.push_back(thread(&ShardedTradingSystem::Route, this, ref(feeds[f]), static_cast<int>(f)));
+	for (auto& t : routers) t.join();
+	for (auto& t : workers) t.join();
+	auto stop = chrono::steady_clock::now();
+	wallSeconds = chrono::duration<double>(stop - start).count();
+}
+
+void ShardedTradingSystem::Route(ShardFeed& _feed, int _feedIndex)
+{
+	auto start = chrono::steady_clock::now();
+	const ProductRegistry<Bond>& registry = GetBondRegistry();
+	vector<ShardBlock> blocks(shards.size());
+	ifstream data(_feed.fileName);
+	LineReader reader(data);
+	string_view line;
+	long lines = 0;
+	int messageLine = 0; // of the message being routed
+	size_t shard = 0;
+	while (reader.Next(line))
+	{
+		lines++;
+		if (messageLine == 0)
+		{
+			// the CUSIP of a message is on its first line
+			string_view fields = line;
+			string_view cusip;
+			for (int i = 0; i <= _feed.productField; i++) cusip = NextField(fields);
+			const Bond* product = registry.Find(cusip);
+			shard = product ? GetProductShard(product->GetProductIndex()) : 0;
+		}
+
+		ShardBlock& block = blocks[shard];
+		block.lines.append(line.data(), line.size());
+		block.lines += '\n';
+		block.lineCount++;
+
+		messageLine = (messageLine + 1) % _feed.linesPerMessage;
+		if (messageLine == 0 && block.lines.size() >= SHARD_BLOCK_SIZE)
+		{
+			block.feed = _feedIndex;
+			queues[shard]->Push(move(block));
+			block = ShardBlock();
+		}
+	}
+
+	for (size_t s = 0; s < shards.size(); s++)
+	{
+		if (blocks[s].lineCount > 0)
+		{
+			blocks[s].feed = _feedIndex;
+			queues[s]->Push(move(blocks[s]));
+		}
+		queues[s]->Close();
+	}
+	auto stop = chrono::steady_clock::now();
+	_feed.lines = lines;
+	_feed.seconds = chrono::duration<double>(stop - start).count();
+}
+
+void ShardedTradingSystem::Work(int _shard)
+{
+	auto start = chrono::steady_clock::now();
+	ShardBlock block;
+	long lines = 0;
+	while (queues[_shard]->Pop(block))
+	{
+		ShardBlockBuffer buffer(block.lines);
+		istream data(&buffer);
+		feeds[block.feed].subscribes[_shard](data);
+		lines += block.lineCount;
+	}
+	auto stop = chrono::steady_clock::now();
+	shardLines[_shard] = lines;
+	shardSeconds[_shard] = chrono::duration<double>(stop - start).count();
+}
+
+void ShardedTradingSystem::Flush()
+{
+	for (auto& shard : shards) shard->Flush();
+	historicalSectorRiskListener.Flush();
+}
+
+void ShardedTradingSystem::PrintReport(ostream& _output) const
+{
+	for (auto& feed : feeds)
+	{
+		_output << feed.name << ": " << feed.lines << " lines routed in " << feed.seconds << " s, "
+			<< static_cast<long>(feed.seconds > 0 ? feed.lines / feed.seconds : 0) << " lines/s" << endl;
+	}
+	for (size_t s = 0; s < shards.size(); s++)
+	{
+		_output << "shard " << s << ": " << shardLines[s] << " lines in " << shardSeconds[s] << " s, "
+			<< static_cast<long>(shardSeconds[s] > 0 ? shardLines[s] / shardSeconds[s] : 0) << " lines/s" << endl;
+	}
+	_output << "All shards: " << wallSeconds << " s wall time" << endl;
+}
+
+double ShardedTradingSystem::GetWallSeconds() const
+{
+	return wallSeconds;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/**
+ * snapshotstore.hpp
+ * Defines the per-product snapshots a service publishes as it writes its data,
+ * read by other threads without taking a lock.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef SNAPSHOT_STORE_HPP
+#define SNAPSHOT_STORE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+using namespace std;
+
+// Number of slots allocated at once by a snapshot store
+const size_t SNAPSHOT_CHUNK_SIZE = 16;
+
+// Number of chunks of a snapshot store, which can hold the snapshots of this many times SNAPSHOT_CHUNK_SIZE products
+const size_t SNAPSHOT_MAX_CHUNKS = 256;
+
+/**
+ * Slot under a sequence lock holding the latest copy of a value.
+ * The writer makes the sequence odd, writes the value and makes the sequence even again;
+ * a reader copies the value and retries if the sequence was odd or has moved meanwhile.
+ * The value is kept as atomic words, so a read racing a write is defined, only retried.
+ * Writing costs two stores of the sequence and one store per 8 bytes of the value,
+ * and never waits for the readers.
+ * Type V is the value type, copied as bytes, which must be trivially copyable.
+ */
+template<typename V>
+class SeqLockSlot
+{
+
+public:
+
+	// Write a value, writers of a slot must not write at the same time
+	void Write(const V& _value);
+
+	// Read a consistent copy of the value, false if no value has been written yet
+	bool Read(V& _value) const;
+
+private:
+
+#ifndef COUNT_COPIES
+	static_assert(is_trivially_copyable<V>::value, "a snapshot is copied as bytes");
+#else
+	// the copy counters of the data types give them a copy ctor, which only counts and holds
+	// no state, so they are still copied as bytes, leaving the snapshots out of the count;
+	// a value whose destructor must run could not be
+	static_assert(is_trivially_destructible<V>::value, "a snapshot is copied as bytes");
+#endif
+
+	static const size_t WORDS = (sizeof(V) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	static const size_t FULL_WORDS = sizeof(V) / sizeof(uint64_t);
+
+	alignas(64) atomic<uint64_t> sequence{ 0 }; // odd while a write is under way, 0 until the first write
+	atomic<uint64_t> words[WORDS];
+
+};
+
+template<typename V>
+void SeqLockSlot<V>::Write(const V& _value)
+{
+	const char* bytes = reinterpret_cast<const char*>(&_value);
+
+	uint64_t position = sequence.load(memory_order_relaxed);
+	sequence.store(position + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (size_t i = 0; i < FULL_WORDS; i++)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+		words[i].store(word, memory_order_relaxed);
+	}
+	if constexpr (FULL_WORDS < WORDS)
+	{
+		uint64_t word = 0;
+		memcpy(&word, bytes + FULL_WORDS * sizeof(uint64_t), sizeof(V) - FULL_WORDS * sizeof(uint64_t));
+		words[FULL_WORDS].store(word, memory_order_relaxed);
+	}
+	sequence.store(position + 2, memory_order_release);
+}
+
+template<typename V>
+bool SeqLockSlot<V>::Read(V& _value) const
+{
+	uint64_t buffer[WORDS];
+	while (true)
+	{
+		uint64_t before = sequence.load(memory_order_acquire);
+		if (before == 0) return false;
+		if (before & 1) continue;
+
+		for (size_t i = 0; i < WORDS; i++) buffer[i] = words[i].load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		if (sequence.load(memory_order_relaxed) == before) break;
+	}
+	memcpy(static_cast<void*>(&_value), static_cast<const void*>(buffer), sizeof(V));
+	return true;
+}
+
+/**
+ * Store of the latest snapshot of each product, by product index, which a service
+ * publishes to after each change of its data and any thread reads a copy from.
+ * The slots are allocated in chunks as the products are first published and never
+ * move, so a reader never sees the store being resized; it takes no lock and the
+ * writer never waits for it.
+ * Only one thread at a time may publish, as the services already ensure.
+ * Type V is the value type, which must be trivially copyable.
+ */
+template<typename V>
+class SnapshotStore
+{
+
+public:
+
+	// ctor
+	SnapshotStore() = default;
+
+	// dtor
+	~SnapshotStore();
+
+	// Publish the snapshot of a product index, throw out_of_range past the capacity of the store
+	void Publish(size_t _index, const V& _value);
+
+	// Get a copy of the snapshot of a product index, false if none has been published
+	bool GetSnapshot(size_t _index, V& _snapshot) const;
+
+private:
+
+	SnapshotStore(const SnapshotStore&) = delete;
+	SnapshotStore& operator=(const SnapshotStore&) = delete;
+
+	struct Chunk
+	{
+		SeqLockSlot<V> slots[SNAPSHOT_CHUNK_SIZE];
+	};
+
+	array<atomic<Chunk*>, SNAPSHOT_MAX_CHUNKS> chunks{};
+
+};
+
+template<typename V>
+SnapshotStore<V>::~SnapshotStore()
+{
+	for (auto& chunk : chunks) delete chunk.load(memory_order_relaxed);
+}
+
+template<typename V>
+void SnapshotStore<V>::Publish(size_t _index, const V& _value)
+{
+	size_t index = _index / SNAPSHOT_CHUNK_SIZE;
+	if (index >= SNAPSHOT_MAX_CHUNKS) throw out_of_range("Too many products for a snapshot store: " + to_string(_index));
+
+	Chunk* chunk = chunks[index].load(memory_order_relaxed);
+	if (chunk == nullptr)
+	{
+		chunk = new Chunk();
+		chunks[index].store(chunk, memory_order_release);
+	}
+	chunk->slots[_index % SNAPSHOT_CHUNK_SIZE].Write(_value);
+}
+
+template<typename V>
+bool SnapshotStore<V>::GetSnapshot(size_t _index, V& _snapshot) const
+{
+	size_t index = _index / SNAPSHOT_CHUNK_SIZE;
+	if (index >= SNAPSHOT_MAX_CHUNKS) return false;
+
+	const Chunk* chunk = chunks[index].load(memory_order_acquire);
+	if (chunk == nullptr) return false;
+	return chunk->slots[_index % SNAPSHOT_CHUNK_SIZE].Read(_snapshot);
+}
+
+#endif
@@ -11,12 +11,20 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <map>
 #include <unordered_map>
 #include <algorithm>
 #include <string>
+#include <string_view>
 #include "products.hpp"
+#include "pricecodec.hpp"
+#include "productregistry.hpp"
+#include "productstore.hpp"
+#include "journal.hpp"
+#include "timestamp.hpp"
+#include "linereader.hpp"
 
 using namespace std;
 
@@ -24,6 +32,8 @@ using namespace std;
  * Definition of a generic base class ServiceListener to listen to add, update, and remve
  * events on a Service. This listener should be registered on a Service for the Service
  * to notify all listeners for these events.
+ * The data is passed by const reference, usually to the copy held by the Service,
+ * and a listener copies only what it keeps.
  */
 template<typename V>
 class ServiceListener
@@ -32,13 +42,13 @@ class ServiceListener
 public:
 
   // Listener callback to process an add event to the Service
-  virtual void ProcessAdd(V &data) = 0;
+  virtual void ProcessAdd(const V &data) = 0;
 
   // Listener callback to process a remove event to the Service
-  virtual void ProcessRemove(V &data) = 0;
+  virtual void ProcessRemove(const V &data) = 0;
 
   // Listener callback to process an update event to the Service
-  virtual void ProcessUpdate(V &data) = 0;
+  virtual void ProcessUpdate(const V &data) = 0;
 
 };
 
@@ -46,6 +56,9 @@ public:
 /**
  * Definition of a generic base class Service.
  * Uses key generic type K and value generic type V.
+ * Keys are passed by value, so the services keyed on identifiers use string_view.
+ * New data is handed over as an rvalue and moved into the storage of the Service,
+ * a caller keeping its data passes a copy.
  */
 template<typename K, typename V>
 class Service
@@ -57,7 +70,7 @@ public:
   virtual V& GetData(K key) = 0;
 
   // The callback that a Connector should invoke for any new or updated data
-  virtual void OnMessage(V &data) = 0;
+  virtual void OnMessage(V &&data) = 0;
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
@@ -84,10 +97,10 @@ class Connector
 public:
 
   // Publish data to the Connector
-  virtual void Publish(V &data) = 0;
+  virtual void Publish(const V &data) = 0;
 
   // Subscribe data from Connector
-  virtual void Subscribe(ifstream& data) = 0;
+  virtual void Subscribe(istream& data) = 0;
 
 };
 
@@ -96,58 +109,104 @@ public:
 	Some useful functions
 */
 
-// Return Bond product type given CUSIP
-Bond GetProductType(string cusip) {
-	if (cusip == "91282CFX4") return Bond("91282CFX4", CUSIP, "T", 0.04500, from_string("2024/11/30"));
-	if (cusip == "91282CGA3") return Bond("91282CGA3", CUSIP, "T", 0.04000, from_string("2025/12/15"));
-	if (cusip == "91282CFZ9") return Bond("91282CFZ9", CUSIP, "T", 0.03875, from_string("2027/11/30"));
-	if (cusip == "91282CFY2") return Bond("91282CFY2", CUSIP, "T", 0.03875, from_string("2029/11/30"));
-	if (cusip == "91282CFV8") return Bond("91282CFV8", CUSIP, "T", 0.04125, from_string("2032/11/15"));
-	if (cusip == "912810TM0") return Bond("912810TM0", CUSIP, "T", 0.04000, from_string("2042/11/15"));
-	if (cusip == "912810TL2") return Bond("912810TL2", CUSIP, "T", 0.04000, from_string("2052/11/15"));
+// Reference data of the seven Treasuries, used when there is no reference file.
+// One bond per line: CUSIP,ticker,coupon,maturity,risk sector,PV01 at par on 100 face value
+const char* DEFAULT_BOND_REFERENCE =
+	"91282CFX4,T,0.04500,2024/11/30,FrontEnd,0.01836\n"
+	"91282CGA3,T,0.04000,2025/12/15,FrontEnd,0.02782\n"
+	"91282CFZ9,T,0.03875,2027/11/30,Belly,0.04455\n"
+	"91282CFY2,T,0.03875,2029/11/30,Belly,0.06033\n"
+	"91282CFV8,T,0.04125,2032/11/15,Belly,0.08059\n"
+	"912810TM0,T,0.04000,2042/11/15,LongEnd,0.13632\n"
+	"912810TL2,T,0.04000,2052/11/15,LongEnd,0.17350\n";
+
+// Get the path of the reference file the bonds are loaded from, products.txt by default
+string& GetBondReferenceFile()
+{
+	static string fileName = "products.txt";
+	return fileName;
+}
 
+// Get the risk sector of each registered bond, by product index
+vector<string>& GetBondSectors()
+{
+	static vector<string> sectors;
+	return sectors;
 }
 
-// Convert fractional price to numerical price.
-double GetNormalPrice(string price)
+// Parse a line of bond reference data into a bond and its risk sector.
+// The PV01 column is for reference, the risk service computes the PV01 from the coupon and maturity.
+Bond ParseBondReference(string_view line, string& sector)
 {
-	string fp, sp, tp;
-	auto pos_dot = price.find("-");
-	fp = price.substr(0, pos_dot);
-	sp = price.substr(pos_dot + 1, 2);
-	tp = price.substr(pos_dot + 3, 1);
-	if (tp == "+") tp = "4";
-
-	return stod(fp) + stod(sp) / 32.0 + stod(tp) / 256.0;
+	string cusip(NextField(line));
+	string ticker(NextField(line));
+	float coupon = stof(string(NextField(line)));
+	date maturity = from_string(string(NextField(line)));
+	sector = string(NextField(line));
+	return Bond(cusip, CUSIP, ticker, coupon, maturity);
 }
 
+// Register the bonds of reference data lines, and record their risk sectors
+ProductRegistry<Bond>& LoadBondReference(ProductRegistry<Bond>& registry, istream& data)
+{
+	LineReader reader(data);
+	string_view line;
+	string sector;
+	while (reader.Next(line))
+	{
+		if (line.empty()) continue;
+		const Bond& bond = registry.Add(ParseBondReference(line, sector));
+
+		vector<string>& sectors = GetBondSectors();
+		if (sectors.size() <= static_cast<size_t>(bond.GetProductIndex())) sectors.resize(bond.GetProductIndex() + 1);
+		sectors[bond.GetProductIndex()] = sector;
+	}
+	return registry;
+}
 
-// Convert numerical price to fractional price.
-string GetQuotePrice(double price)
+// Register the bonds of the reference file, or the seven Treasuries if there is none
+ProductRegistry<Bond>& RegisterBonds(ProductRegistry<Bond>& registry)
+{
+	ifstream file(GetBondReferenceFile());
+	if (file) return LoadBondReference(registry, file);
+
+	istringstream defaults(DEFAULT_BOND_REFERENCE);
+	return LoadBondReference(registry, defaults);
+}
+
+// Get the registry of bonds, built once at first use
+ProductRegistry<Bond>& GetBondRegistry()
 {
-	int fp = floor(price);
-	int tp = floor((price - fp) * 256.0);
-	int sp = floor(tp / 8.0);
-	tp = tp % 8;
-
-	string tmp_sp = to_string(sp), tmp_tp = to_string(tp);
-	if (sp < 10) tmp_sp = "0" + tmp_sp;
-	if (tp == 4) tmp_tp = "+";
-	return to_string(fp) + "-" + tmp_sp + tmp_tp;
+	static ProductRegistry<Bond>& registry = RegisterBonds(ProductRegistry<Bond>::GetInstance());
+	return registry;
 }
 
-// Get PV01 for different bonds
-double GetPV01(string cusip)
+// Load the bonds from another reference file, to be called before the registry is first used
+void SetBondReferenceFile(const string& fileName)
+{
+	if (ProductRegistry<Bond>::GetInstance().Size() > 0)
+		throw logic_error("The bonds are registered already, cannot load " + fileName);
+	GetBondReferenceFile() = fileName;
+}
+
+// Return Bond product type given CUSIP.
+// The bond is owned by the registry, data types keep a reference to it.
+const Bond& GetProductType(string_view cusip)
+{
+	return GetBondRegistry().Get(cusip);
+}
+
+// Convert fractional price to numerical price, throw invalid_argument if it is malformed.
+double GetNormalPrice(string_view price)
+{
+	return ToPrice(ParseTicksChecked(price));
+}
+
+
+// Convert numerical price to fractional price.
+string GetQuotePrice(double price)
 {
-	double pv01;
-	if (cusip == "91282CFX4") pv01 = 0.0188;
-	if (cusip == "91282CGA3") pv01 = 0.0276;
-	if (cusip == "91282CFZ9") pv01 = 0.0452;
-	if (cusip == "91282CFY2") pv01 = 0.0617;
-	if (cusip == "91282CFV8") pv01 = 0.0862;
-	if (cusip == "912810TM0") pv01 = 0.1442;
-	if (cusip == "912810TL2") pv01 = 0.1992;
-	return pv01;
+	return FormatTicks(ToTicks(price));
 }
 
 #endif
@@ -0,0 +1,836 @@
+/**
+ * socketconnector.hpp
+ * Defines the TCP transport between the feed publisher process, the trading
+ * system and the listener process: framing, the inbound stream read by the
+ * connectors, the outbound publisher and the wire latency measurement.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef SOCKET_CONNECTOR_HPP
+#define SOCKET_CONNECTOR_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <istream>
+#include <streambuf>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "soa.hpp"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#endif
+
+using namespace std;
+
+// Ports of the feeds published into the trading system
+const int PRICES_PORT = 9001;
+const int TRADES_PORT = 9002;
+const int INQUIRIES_PORT = 9003;
+const int MARKET_DATA_PORT = 9004;
+
+// Ports of the listener process the trading system publishes to
+const int EXECUTIONS_PORT = 9011;
+const int STREAMING_PORT = 9012;
+
+// Payload of a frame
+// TEXT_FRAME: '\n' terminated lines
+// BINARY_FRAME: wire messages, see wireprotocol.hpp
+enum FrameFormat { TEXT_FRAME, BINARY_FRAME };
+
+#pragma pack(push, 1)
+
+// Header of a frame on the wire, followed by length bytes of payload
+struct FrameHeader
+{
+	uint32_t length; // bytes after the header
+	uint16_t format; // FrameFormat
+	uint16_t reserved;
+	uint32_t lineCount; // lines, or messages of a binary frame
+	int64_t sendTime; // Timestamp of the sender, comparable between processes on the same machine
+};
+
+#pragma pack(pop)
+
+
+/*
+	Socket calls, only available on POSIX systems.
+	On Windows they fail, and the socket mode reports that it cannot connect.
+*/
+
+#ifndef _WIN32
+
+// Set TCP_NODELAY so that small frames go out at once
+void SetNoDelay(int _socket)
+{
+	int on = 1;
+	setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+// Connect to a host and port, retrying every 100 ms, return the socket or -1
+int ConnectSocket(const string& _host, int _port, int _retries = 50)
+{
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	for (int attempt = 0; attempt <= _retries; attempt++)
+	{
+		if (attempt > 0) this_thread::sleep_for(chrono::milliseconds(100));
+
+		addrinfo* addresses = nullptr;
+		if (getaddrinfo(_host.c_str(), to_string(_port).c_str(), &hints, &addresses) != 0) continue;
+		for (addrinfo* a = addresses; a != nullptr; a = a->ai_next)
+		{
+			int s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (s < 0) continue;
+			if (connect(s, a->ai_addr, a->ai_addrlen) == 0)
+			{
+				freeaddrinfo(addresses);
+				SetNoDelay(s);
+				return s;
+			}
+			close(s);
+		}
+		freeaddrinfo(addresses);
+	}
+	return -1;
+}
+
+// Listen on a port of every interface, return the socket or -1
+int ListenSocket(int _port)
+{
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0) return -1;
+
+	int on = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(static_cast<uint16_t>(_port));
+	if (bind(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(s, 4) != 0)
+	{
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+// Accept a connection, return the socket or -1
+int AcceptSocket(int _listener)
+{
+	int s = accept(_listener, nullptr, nullptr);
+	if (s >= 0) SetNoDelay(s);
+	return s;
+}
+
+// Make the reads of a socket return at once when there is nothing to read
+void SetNonBlocking(int _socket)
+{
+	fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Send all the bytes, false if the connection is lost
+bool SendAll(int _socket, const char* _data, size_t _length)
+{
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL;
+#else
+	const int flags = 0;
+#endif
+	while (_length > 0)
+	{
+		ssize_t sent = send(_socket, _data, _length, flags);
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent <= 0) return false;
+		_data += sent;
+		_length -= sent;
+	}
+	return true;
+}
+
+// Read what is available without waiting, bytes read, 0 at the end of the stream, -1 if nothing is available
+long ReceiveSome(int _socket, char* _buffer, size_t _length)
+{
+	while (true)
+	{
+		ssize_t received = recv(_socket, _buffer, _length, 0);
+		if (received >= 0) return static_cast<long>(received);
+		if (errno == EINTR) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;
+		return 0;
+	}
+}
+
+// Close a socket
+void CloseSocket(int _socket)
+{
+	if (_socket >= 0) close(_socket);
+}
+
+#else
+
+int ConnectSocket(const string& _host, int _port, int _retries = 50) { return -1; }
+int ListenSocket(int _port) { return -1; }
+int AcceptSocket(int _listener) { return -1; }
+void SetNonBlocking(int _socket) {}
+bool SendAll(int _socket, const char* _data, size_t _length) { return false; }
+long ReceiveSome(int _socket, char* _buffer, size_t _length) { return 0; }
+void CloseSocket(int _socket) {}
+
+#endif
+
+
+/**
+ * Wait for a socket to become readable, through epoll on Linux and poll elsewhere.
+ */
+class SocketPoller
+{
+
+public:
+
+	// ctor
+	SocketPoller();
+
+	// dtor
+	~SocketPoller();
+
+	// Watch a socket
+	void Watch(int _socket);
+
+	// Wait until the socket is readable or closed
+	void Wait();
+
+private:
+
+	SocketPoller(const SocketPoller&) = delete;
+	SocketPoller& operator=(const SocketPoller&) = delete;
+
+	int socket;
+	int poller;
+
+};
+
+SocketPoller::SocketPoller()
+{
+	socket = -1;
+	poller = -1;
+}
+
+SocketPoller::~SocketPoller()
+{
+#ifdef __linux__
+	if (poller >= 0) close(poller);
+#endif
+}
+
+void SocketPoller::Watch(int _socket)
+{
+	socket = _socket;
+#ifdef __linux__
+	if (poller >= 0) close(poller);
+	poller = epoll_create1(0);
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.fd = socket;
+	epoll_ctl(poller, EPOLL_CTL_ADD, socket, &event);
+#endif
+}
+
+void SocketPoller::Wait()
+{
+#if defined(__linux__)
+	epoll_event event;
+	while (epoll_wait(poller, &event, 1, -1) < 0 && errno == EINTR) {}
+#elif !defined(_WIN32)
+	pollfd descriptor;
+	descriptor.fd = socket;
+	descriptor.events = POLLIN;
+	while (poll(&descriptor, 1, -1) < 0 && errno == EINTR) {}
+#endif
+}
+
+
+/**
+ * Stream buffer reading the frames of a socket.
+ * The socket is non-blocking: each refill waits for it to become readable, then reads
+ * everything available in one batch. The lines of one frame at a time are handed to
+ * the reader, which can be any connector reading an istream. Binary frames are read
+ * whole with NextFrame() and decoded in place.
+ */
+class SocketStreamBuf : public streambuf
+{
+
+public:
+
+	// ctor
+	SocketStreamBuf(size_t _bufferSize = 1 << 18);
+
+	// dtor closing the socket
+	~SocketStreamBuf();
+
+	// Connect to a publisher, false if it cannot be reached
+	bool Connect(const string& _host, int _port, int _retries = 50);
+
+	// Read from an accepted socket
+	void Attach(int _socket);
+
+	// Close the socket, ending the stream
+	void Close();
+
+	// Get the send time of the frame being read
+	Timestamp GetFrameSendTime() const;
+
+	// Get the time the frame being read was handed to the reader
+	Timestamp GetFrameReceiveTime() const;
+
+	// Get the thread reading the stream
+	thread::id GetReaderThread() const;
+
+	// Get the number of frames read
+	unsigned long long GetFrameCount() const;
+
+	// Get the number of lines, or messages of binary frames, read
+	unsigned long long GetLineCount() const;
+
+	// Get the number of bytes received
+	unsigned long long GetByteCount() const;
+
+	// Get the next frame of any format, its payload stays in the receive buffer and is
+	// only valid until the next call, return false at the end of the stream
+	bool NextFrame(FrameHeader& _header, const char*& _payload);
+
+protected:
+
+	// Hand the next text frame to the reader, binary frames are skipped
+	int_type underflow() override;
+
+	// Read what the current frame has left, waiting for a frame only when nothing is left,
+	// so that block readers get each frame as soon as it arrives
+	streamsize xsgetn(char* _data, streamsize _count) override;
+
+private:
+
+	// Wait for the next complete frame, false at the end of the stream
+	bool ReadFrame(FrameHeader& _header, char*& _payload);
+
+	// Receive one batch of bytes, false at the end of the stream
+	bool Receive();
+
+	int socket;
+	SocketPoller poller;
+	vector<char> buffer;
+	size_t begin; // first byte not handed to the reader
+	size_t end; // end of the received bytes
+	bool closed;
+
+	Timestamp frameSendTime;
+	Timestamp frameReceiveTime;
+	atomic<thread::id> readerThread;
+	unsigned long long frames;
+	unsigned long long lines;
+	unsigned long long bytes;
+
+};
+
+SocketStreamBuf::SocketStreamBuf(size_t _bufferSize) : buffer(_bufferSize)
+{
+	socket = -1;
+	begin = 0;
+	end = 0;
+	closed = true;
+	frameSendTime = 0;
+	frameReceiveTime = 0;
+	frames = 0;
+	lines = 0;
+	bytes = 0;
+}
+
+SocketStreamBuf::~SocketStreamBuf()
+{
+	CloseSocket(socket);
+}
+
+bool SocketStreamBuf::Connect(const string& _host, int _port, int _retries)
+{
+	int s = ConnectSocket(_host, _port, _retries);
+	if (s < 0) return false;
+	Attach(s);
+	return true;
+}
+
+void SocketStreamBuf::Attach(int _socket)
+{
+	CloseSocket(socket);
+	socket = _socket;
+	SetNonBlocking(socket);
+	poller.Watch(socket);
+	begin = 0;
+	end = 0;
+	closed = false;
+	setg(nullptr, nullptr, nullptr);
+}
+
+void SocketStreamBuf::Close()
+{
+	CloseSocket(socket);
+	socket = -1;
+	closed = true;
+}
+
+Timestamp SocketStreamBuf::GetFrameSendTime() const
+{
+	return frameSendTime;
+}
+
+Timestamp SocketStreamBuf::GetFrameReceiveTime() const
+{
+	return frameReceiveTime;
+}
+
+thread::id SocketStreamBuf::GetReaderThread() const
+{
+	return readerThread.load(memory_order_relaxed);
+}
+
+unsigned long long SocketStreamBuf::GetFrameCount() const
+{
+	return frames;
+}
+
+unsigned long long SocketStreamBuf::GetLineCount() const
+{
+	return lines;
+}
+
+unsigned long long SocketStreamBuf::GetByteCount() const
+{
+	return bytes;
+}
+
+bool SocketStreamBuf::NextFrame(FrameHeader& _header, const char*& _payload)
+{
+	// drop whatever a stream reader has left of its frame
+	setg(nullptr, nullptr, nullptr);
+
+	char* payload;
+	if (!ReadFrame(_header, payload)) return false;
+	_payload = payload;
+	return true;
+}
+
+SocketStreamBuf::int_type SocketStreamBuf::underflow()
+{
+	if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+	// the frame handed out before has been read
+	setg(nullptr, nullptr, nullptr);
+
+	FrameHeader header;
+	char* payload;
+	while (ReadFrame(header, payload))
+	{
+		if (header.format != TEXT_FRAME || header.length == 0) continue;
+		setg(payload, payload, payload + header.length);
+		return traits_type::to_int_type(*gptr());
+	}
+	return traits_type::eof();
+}
+
+bool SocketStreamBuf::ReadFrame(FrameHeader& _header, char*& _payload)
+{
+	while (true)
+	{
+		if (end - begin >= sizeof(FrameHeader))
+		{
+			FrameHeader header;
+			memcpy(&header, buffer.data() + begin, sizeof(header));
+			size_t frameEnd = begin + sizeof(header) + header.length;
+			if (frameEnd <= end)
+			{
+				frameSendTime = header.sendTime;
+				frameReceiveTime = GetTimestamp();
+				readerThread.store(this_thread::get_id(), memory_order_relaxed);
+				frames++;
+				lines += header.lineCount;
+
+				_header = header;
+				_payload = buffer.data() + begin + sizeof(header);
+				begin = frameEnd;
+				return true;
+			}
+
+			// make room for a frame larger than the buffer
+			if (sizeof(header) + header.length > buffer.size()) buffer.resize(sizeof(header) + header.length);
+		}
+
+		// keep the partial frame at the front of the buffer
+		if (begin > 0)
+		{
+			memmove(buffer.data(), buffer.data() + begin, end - begin);
+			end -= begin;
+			begin = 0;
+		}
+		if (!Receive()) return false;
+	}
+}
+
+streamsize SocketStreamBuf::xsgetn(char* _data, streamsize _count)
+{
+	if (_count <= 0) return 0;
+	if (gptr() == egptr() && traits_type::eq_int_type(underflow(), traits_type::eof())) return 0;
+
+	streamsize count = min(_count, static_cast<streamsize>(egptr() - gptr()));
+	memcpy(_data, gptr(), count);
+	gbump(static_cast<int>(count));
+	return count;
+}
+
+bool SocketStreamBuf::Receive()
+{
+	if (closed) return false;
+
+	bool received = false;
+	while (end < buffer.size())
+	{
+		long count = ReceiveSome(socket, buffer.data() + end, buffer.size() - end);
+		if (count > 0)
+		{
+			end += count;
+			bytes += count;
+			received = true;
+			continue;
+		}
+		if (count == 0)
+		{
+			closed = true;
+			return received;
+		}
+
+		// nothing more for now, hand over what this batch has, or wait for the next one
+		if (received) return true;
+		poller.Wait();
+	}
+	return true;
+}
+
+
+/**
+ * Input stream over a socket, read by the Subscribe() of the connectors.
+ */
+class SocketStream : public istream
+{
+
+public:
+
+	// ctor
+	SocketStream();
+
+	// Connect to a publisher, false if it cannot be reached
+	bool Connect(const string& _host, int _port, int _retries = 50);
+
+	// Read from an accepted socket
+	void Attach(int _socket);
+
+	// Get the stream buffer and its statistics
+	const SocketStreamBuf& GetBuffer() const;
+
+	// Get the stream buffer to read frames from
+	SocketStreamBuf& GetBuffer();
+
+private:
+
+	SocketStreamBuf socketBuffer;
+
+};
+
+SocketStream::SocketStream() : istream(nullptr)
+{
+	rdbuf(&socketBuffer);
+}
+
+bool SocketStream::Connect(const string& _host, int _port, int _retries)
+{
+	return socketBuffer.Connect(_host, _port, _retries);
+}
+
+void SocketStream::Attach(int _socket)
+{
+	socketBuffer.Attach(_socket);
+}
+
+const SocketStreamBuf& SocketStream::GetBuffer() const
+{
+	return socketBuffer;
+}
+
+SocketStreamBuf& SocketStream::GetBuffer()
+{
+	return socketBuffer;
+}
+
+
+/**
+ * Publisher sending lines, or wire messages, in frames over a socket.
+ * Used by a single thread.
+ */
+class SocketPublisher
+{
+
+public:
+
+	// ctor sending a frame every number of lines or messages
+	SocketPublisher(int _linesPerFrame = 1, FrameFormat _format = TEXT_FRAME);
+
+	// dtor sending the last frame and closing the socket
+	~SocketPublisher();
+
+	// Connect to a listener, false if it cannot be reached
+	bool Connect(const string& _host, int _port, int _retries = 50);
+
+	// Send to an accepted socket
+	void Attach(int _socket);
+
+	// Check whether the publisher has somewhere to send to
+	bool IsConnected() const;
+
+	// Add a line, without its '\n', to the current frame of a text publisher
+	void PublishLine(string_view _line);
+
+	// Add an encoded wire message to the current frame of a binary publisher
+	void PublishMessage(const char* _message, size_t _length);
+
+	// Send the current frame and change the format of the next ones
+	void SetFormat(FrameFormat _format);
+
+	// Get the format of the frames sent
+	FrameFormat GetFormat() const;
+
+	// Send the current frame
+	void Flush();
+
+	// Close the connection after sending the current frame
+	void Close();
+
+	// Get the number of frames sent
+	unsigned long long GetFrameCount() const;
+
+private:
+
+	SocketPublisher(const SocketPublisher&) = delete;
+	SocketPublisher& operator=(const SocketPublisher&) = delete;
+
+	int socket;
+	int linesPerFrame;
+	FrameFormat format;
+	vector<char> frame;
+	uint32_t lineCount;
+	unsigned long long frames;
+
+};
+
+SocketPublisher::SocketPublisher(int _linesPerFrame, FrameFormat _format)
+{
+	socket = -1;
+	linesPerFrame = _linesPerFrame;
+	format = _format;
+	frame.resize(sizeof(FrameHeader));
+	lineCount = 0;
+	frames = 0;
+}
+
+SocketPublisher::~SocketPublisher()
+{
+	Close();
+}
+
+bool SocketPublisher::Connect(const string& _host, int _port, int _retries)
+{
+	int s = ConnectSocket(_host, _port, _retries);
+	if (s < 0) return false;
+	Attach(s);
+	return true;
+}
+
+void SocketPublisher::Attach(int _socket)
+{
+	Close();
+	socket = _socket;
+}
+
+bool SocketPublisher::IsConnected() const
+{
+	return socket >= 0;
+}
+
+void SocketPublisher::PublishLine(string_view _line)
+{
+	if (socket < 0) return;
+
+	frame.insert(frame.end(), _line.begin(), _line.end());
+	frame.push_back('\n');
+	if (++lineCount >= static_cast<uint32_t>(linesPerFrame)) Flush();
+}
+
+void SocketPublisher::PublishMessage(const char* _message, size_t _length)
+{
+	if (socket < 0) return;
+
+	frame.insert(frame.end(), _message, _message + _length);
+	if (++lineCount >= static_cast<uint32_t>(linesPerFrame)) Flush();
+}
+
+void SocketPublisher::SetFormat(FrameFormat _format)
+{
+	Flush();
+	format = _format;
+}
+
+FrameFormat SocketPublisher::GetFormat() const
+{
+	return format;
+}
+
+void SocketPublisher::Flush()
+{
+	if (socket < 0 || lineCount == 0) return;
+
+	FrameHeader header;
+	header.length = static_cast<uint32_t>(frame.size() - sizeof(FrameHeader));
+	header.format = static_cast<uint16_t>(format);
+	header.reserved = 0;
+	header.lineCount = lineCount;
+	header.sendTime = GetTimestamp();
+	memcpy(frame.data(), &header, sizeof(header));
+
+	if (!SendAll(socket, frame.data(), frame.size()))
+	{
+		// the other side has gone, stop publishing
+		CloseSocket(socket);
+		socket = -1;
+	}
+	frames++;
+	frame.resize(sizeof(FrameHeader));
+	lineCount = 0;
+}
+
+void SocketPublisher::Close()
+{
+	Flush();
+	CloseSocket(socket);
+	socket = -1;
+}
+
+unsigned long long SocketPublisher::GetFrameCount() const
+{
+	return frames;
+}
+
+
+/**
+ * Listener measuring the latency from the send time of the frame being read off a
+ * socket to the callback, that is to the OnMessage() of the service it listens to.
+ * Register it first on the service so that it runs before the other listeners.
+ * Callbacks from other threads than the one reading the socket are not counted.
+ * Type V is the data type of the service.
+ */
+template<typename V>
+class WireLatencyListener : public ServiceListener<V>
+{
+
+public:
+
+	// ctor
+	WireLatencyListener(const SocketStream& _source);
+
+	// Listener callback to process an add event to the Service
+	void ProcessAdd(const V& _data);
+
+	// Listener callback to process a remove event to the Service
+	void ProcessRemove(const V& _data);
+
+	// Listener callback to process an update event to the Service
+	void ProcessUpdate(const V& _data);
+
+	// Print the number of samples and the latency
+	void PrintReport(ostream& _output, const string& _name) const;
+
+private:
+
+	// Record the latency of the current frame
+	void Record();
+
+	const SocketStreamBuf& source;
+	unsigned long long count;
+	long long total;
+	long long maximum;
+
+};
+
+template<typename V>
+WireLatencyListener<V>::WireLatencyListener(const SocketStream& _source) : source(_source.GetBuffer())
+{
+	count = 0;
+	total = 0;
+	maximum = 0;
+}
+
+template<typename V>
+void WireLatencyListener<V>::ProcessAdd(const V& _data)
+{
+	Record();
+}
+
+template<typename V>
+void WireLatencyListener<V>::ProcessRemove(const V& _data)
+{
+	Record();
+}
+
+template<typename V>
+void WireLatencyListener<V>::ProcessUpdate(const V& _data)
+{
+	Record();
+}
+
+template<typename V>
+void WireLatencyListener<V>::Record()
+{
+	if (this_thread::get_id() != source.GetReaderThread()) return;
+
+	long long latency = GetTimestamp() - source.GetFrameSendTime();
+	count++;
+	total += latency;
+	if (latency > maximum) maximum = latency;
+}
+
+template<typename V>
+void WireLatencyListener<V>::PrintReport(ostream& _output, const string& _name) const
+{
+	_output << _name << " wire to OnMessage: " << count << " messages, average "
+		<< (count > 0 ? total / static_cast<long long>(count) / 1000.0 : 0) << " us, max "
+		<< maximum / 1000.0 << " us" << endl;
+}
+
+#endif
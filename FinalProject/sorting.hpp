@@ -0,0 +1,159 @@
+/**
+ * sorting.hpp
+ * Defines the introsort the order books and the historical records are sorted with,
+ * and its fork-join parallel mode for large ranges.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef SORTING_HPP
+#define SORTING_HPP
+
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <thread>
+
+using namespace std;
+
+// Largest range sorted by insertion, which is also stable, so the order books of the feeds
+// keep their orders at the same price in the order they came in
+const ptrdiff_t SORT_INSERTION_THRESHOLD = 16;
+
+// Smallest range split between two threads by the parallel sort
+const ptrdiff_t SORT_PARALLEL_THRESHOLD = 1 << 15;
+
+/*
+	Introsort: a quicksort on the median of three, sorting the smaller side first so that
+	the stack stays logarithmic, falling back to a heapsort past a depth of 2 log2(n) so that
+	it stays in n log(n) on any input, and leaving the small ranges to an insertion sort.
+	Unlike the class of Quicksort.cpp, the pivot is compared in place whatever the type,
+	and any random access range and comparison are sorted.
+*/
+
+// Sort a small range by insertion
+template<typename RandomIt, typename Compare>
+void InsertionSort(RandomIt _first, RandomIt _last, Compare _comp)
+{
+	if (_first == _last) return;
+	for (RandomIt i = _first + 1; i != _last; ++i)
+	{
+		auto value = move(*i);
+		RandomIt j = i;
+		for (; j != _first && _comp(value, *(j - 1)); --j) *j = move(*(j - 1));
+		*j = move(value);
+	}
+}
+
+// Move the median of three elements to the front of a range, as the pivot
+template<typename RandomIt, typename Compare>
+void MoveMedianToFirst(RandomIt _result, RandomIt _a, RandomIt _b, RandomIt _c, Compare _comp)
+{
+	if (_comp(*_a, *_b))
+	{
+		if (_comp(*_b, *_c)) iter_swap(_result, _b);
+		else if (_comp(*_a, *_c)) iter_swap(_result, _c);
+		else iter_swap(_result, _a);
+	}
+	else if (_comp(*_a, *_c)) iter_swap(_result, _a);
+	else if (_comp(*_b, *_c)) iter_swap(_result, _c);
+	else iter_swap(_result, _b);
+}
+
+// Partition a range of more than three elements around the median of three, return the start
+// of the upper side; the pivot and the largest of the three bound the scans, so they are unchecked
+template<typename RandomIt, typename Compare>
+RandomIt PartitionOnMedian(RandomIt _first, RandomIt _last, Compare _comp)
+{
+	MoveMedianToFirst(_first, _first + 1, _first + (_last - _first) / 2, _last - 1, _comp);
+	RandomIt i = _first + 1;
+	RandomIt j = _last;
+	while (true)
+	{
+		while (_comp(*i, *_first)) ++i;
+		--j;
+		while (_comp(*_first, *j)) --j;
+		if (!(i < j)) return i;
+		iter_swap(i, j);
+		++i;
+	}
+}
+
+// Sort a range within a depth of partitions
+template<typename RandomIt, typename Compare>
+void IntroSortLoop(RandomIt _first, RandomIt _last, int _depth, Compare _comp)
+{
+	while (_last - _first > SORT_INSERTION_THRESHOLD)
+	{
+		if (_depth == 0)
+		{
+			make_heap(_first, _last, _comp);
+			sort_heap(_first, _last, _comp);
+			return;
+		}
+		_depth--;
+
+		RandomIt cut = PartitionOnMedian(_first, _last, _comp);
+		if (cut - _first < _last - cut)
+		{
+			IntroSortLoop(_first, cut, _depth, _comp);
+			_first = cut;
+		}
+		else
+		{
+			IntroSortLoop(cut, _last, _depth, _comp);
+			_last = cut;
+		}
+	}
+	InsertionSort(_first, _last, _comp);
+}
+
+// Get the depth of partitions after which the introsort of a range falls back to a heapsort
+int GetIntroSortDepth(ptrdiff_t _size)
+{
+	int depth = 0;
+	for (; _size > 1; _size >>= 1) depth += 2;
+	return depth;
+}
+
+// Sort a range
+template<typename RandomIt, typename Compare>
+void IntroSort(RandomIt _first, RandomIt _last, Compare _comp)
+{
+	IntroSortLoop(_first, _last, GetIntroSortDepth(_last - _first), _comp);
+}
+
+// Sort a range in increasing order
+template<typename RandomIt>
+void IntroSort(RandomIt _first, RandomIt _last)
+{
+	IntroSort(_first, _last, less<>());
+}
+
+// Sort a range within a depth of partitions on a number of threads
+template<typename RandomIt, typename Compare>
+void ParallelSortLoop(RandomIt _first, RandomIt _last, int _depth, int _threads, Compare _comp)
+{
+	if (_threads <= 1 || _depth == 0 || _last - _first < SORT_PARALLEL_THRESHOLD)
+	{
+		IntroSortLoop(_first, _last, _depth, _comp);
+		return;
+	}
+
+	// fork the lower side on a thread of its own with half the threads, and join it
+	RandomIt cut = PartitionOnMedian(_first, _last, _comp);
+	thread lower(ParallelSortLoop<RandomIt, Compare>, _first, cut, _depth - 1, _threads / 2, _comp);
+	ParallelSortLoop(cut, _last, _depth - 1, _threads - _threads / 2, _comp);
+	lower.join();
+}
+
+// Sort a range on a number of threads, by default one per core, the ranges too small
+// to be split being sorted on the calling thread
+template<typename RandomIt, typename Compare>
+void ParallelSort(RandomIt _first, RandomIt _last, Compare _comp, int _threads = 0)
+{
+	if (_threads <= 0) _threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+	ParallelSortLoop(_first, _last, GetIntroSortDepth(_last - _first), _threads, _comp);
+}
+
+#endif
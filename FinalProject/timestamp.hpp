@@ -0,0 +1,178 @@
+/**
+ * timestamp.hpp
+ * Defines the timestamps stamped on the output of the services: a cheap
+ * monotonic capture on the hot path and a lazy conversion to wall-clock text.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef TIMESTAMP_HPP
+#define TIMESTAMP_HPP
+
+#include <chrono>
+#include <string>
+#include <cstring>
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/date_time/c_local_time_adjustor.hpp"
+
+using namespace std;
+
+// Monotonic time captured on the hot path, nanoseconds of steady_clock
+typedef long long Timestamp;
+
+// Length of a formatted timestamp such as "2022-Dec-23 17:23:04.789"
+const int MAX_TIMESTAMP_LENGTH = 32;
+
+const long long NANOSECONDS_PER_SECOND = 1000000000LL;
+const long long NANOSECONDS_PER_DAY = 86400LL * NANOSECONDS_PER_SECOND;
+
+/**
+ * Calibration of the steady clock against the wall clock, read once at first use.
+ * The offset to the epoch and the local time zone offset are fixed for the run,
+ * so a daylight saving change during a run is not followed.
+ */
+class TimestampCalibration
+{
+
+public:
+
+	// Get the calibration, made on first use
+	static const TimestampCalibration& GetInstance();
+
+	// Nanoseconds to add to a steady clock reading to get nanoseconds since the epoch
+	long long GetEpochOffset() const;
+
+	// Nanoseconds to add to a UTC time to get the local time
+	long long GetLocalOffset() const;
+
+private:
+
+	TimestampCalibration();
+
+	long long epochOffset;
+	long long localOffset;
+
+};
+
+TimestampCalibration::TimestampCalibration()
+{
+	// keep the tightest of a few steady/system clock pairs
+	long long bestGap = -1;
+	for (int i = 0; i < 5; i++)
+	{
+		auto before = chrono::steady_clock::now();
+		auto wall = chrono::system_clock::now();
+		auto after = chrono::steady_clock::now();
+
+		long long gap = chrono::duration_cast<chrono::nanoseconds>(after - before).count();
+		if (bestGap < 0 || gap < bestGap)
+		{
+			bestGap = gap;
+			long long steady = chrono::duration_cast<chrono::nanoseconds>(before.time_since_epoch()).count() + gap / 2;
+			epochOffset = chrono::duration_cast<chrono::nanoseconds>(wall.time_since_epoch()).count() - steady;
+		}
+	}
+
+	boost::posix_time::ptime utcTime = boost::posix_time::second_clock::universal_time();
+	boost::posix_time::ptime localTime = boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(utcTime);
+	localOffset = (localTime - utcTime).total_seconds() * NANOSECONDS_PER_SECOND;
+}
+
+const TimestampCalibration& TimestampCalibration::GetInstance()
+{
+	static TimestampCalibration calibration;
+	return calibration;
+}
+
+long long TimestampCalibration::GetEpochOffset() const
+{
+	return epochOffset;
+}
+
+long long TimestampCalibration::GetLocalOffset() const
+{
+	return localOffset;
+}
+
+
+/*
+	Capture and formatting
+*/
+
+// Capture the current time, cheap enough for every event
+Timestamp GetTimestamp()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Convert a captured time to nanoseconds since the epoch
+long long ToEpochNanoseconds(Timestamp _timestamp)
+{
+	return _timestamp + TimestampCalibration::GetInstance().GetEpochOffset();
+}
+
+// Write two digits
+char* FormatTwoDigits(int _value, char* _out)
+{
+	_out[0] = static_cast<char>('0' + _value / 10);
+	_out[1] = static_cast<char>('0' + _value % 10);
+	return _out + 2;
+}
+
+// Format nanoseconds since the epoch as local time with milliseconds, "2022-Dec-23 17:23:04.789",
+// into a buffer of MAX_TIMESTAMP_LENGTH characters, return the end of the text.
+// The date part is cached per thread and only rebuilt when the day changes.
+char* FormatEpochTime(long long _epochNanoseconds, char* _out)
+{
+	thread_local long long cachedDay = -1;
+	thread_local char datePrefix[MAX_TIMESTAMP_LENGTH];
+	thread_local size_t prefixLength = 0;
+
+	long long local = _epochNanoseconds + TimestampCalibration::GetInstance().GetLocalOffset();
+	long long day = local / NANOSECONDS_PER_DAY;
+	long long timeOfDay = local % NANOSECONDS_PER_DAY;
+	if (timeOfDay < 0)
+	{
+		day--;
+		timeOfDay += NANOSECONDS_PER_DAY;
+	}
+
+	if (day != cachedDay)
+	{
+		boost::gregorian::date date = boost::gregorian::date(1970, 1, 1) + boost::gregorian::days(static_cast<long>(day));
+		string text = boost::gregorian::to_simple_string(date) + " ";
+		prefixLength = min(text.size(), static_cast<size_t>(MAX_TIMESTAMP_LENGTH - 13));
+		memcpy(datePrefix, text.data(), prefixLength);
+		cachedDay = day;
+	}
+
+	memcpy(_out, datePrefix, prefixLength);
+	char* out = _out + prefixLength;
+
+	long long milliseconds = timeOfDay / 1000000;
+	int seconds = static_cast<int>(milliseconds / 1000);
+	out = FormatTwoDigits(seconds / 3600, out);
+	*out++ = ':';
+	out = FormatTwoDigits(seconds / 60 % 60, out);
+	*out++ = ':';
+	out = FormatTwoDigits(seconds % 60, out);
+	*out++ = '.';
+	int millis = static_cast<int>(milliseconds % 1000);
+	*out++ = static_cast<char>('0' + millis / 100);
+	out = FormatTwoDigits(millis % 100, out);
+	return out;
+}
+
+// Format a captured time as local time with milliseconds, return the end of the text
+char* FormatTimestamp(Timestamp _timestamp, char* _out)
+{
+	return FormatEpochTime(ToEpochNanoseconds(_timestamp), _out);
+}
+
+// Format a captured time as local time with milliseconds
+string FormatTimestamp(Timestamp _timestamp)
+{
+	char buffer[MAX_TIMESTAMP_LENGTH];
+	return string(buffer, FormatTimestamp(_timestamp, buffer));
+}
+
+#endif
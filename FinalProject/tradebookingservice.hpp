@@ -11,7 +11,13 @@
 
 #include <string>
 #include <vector>
+#include <mutex>
+#include <map>
 #include "soa.hpp"
+#include "instrumentation.hpp"
+#include "linereader.hpp"
+#include "bookregistry.hpp"
+#include "wireprotocol.hpp"
 #include "algoexecutionservice.hpp"
 
 // Trade sides
@@ -19,6 +25,9 @@ enum Side { BUY, SELL };
 
 /**
  * Trade object with a price, side, and quantity on a particular book.
+ * The trade of an execution keeps the compact ID of the order instead of a trade ID,
+ * which is only turned into text when it is asked for, and its book as its id in the
+ * book registry, so that booking an execution builds no string.
  * Type T is the product type.
  */
 template<typename T>
@@ -29,13 +38,19 @@ public:
 
   // ctor for a trade
   Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side);
+
+  // ctor for the trade of an execution, in a book of the book registry
+  Trade(const T &_product, SequenceId _executionId, double _price, int _bookId, long _quantity, Side _side);
   Trade() = default;
 
   // Get the product
   const T& GetProduct() const;
 
-  // Get the trade ID
-  const string& GetTradeId() const;
+  // Get the trade ID, TRADE-EXECUTE- and the order ID for the trade of an execution
+  string GetTradeId() const;
+
+  // Get the ID of the order of an execution, no ID for a trade of the feed
+  SequenceId GetExecutionId() const;
 
   // Get the mid price
   double GetPrice() const;
@@ -43,6 +58,9 @@ public:
   // Get the book
   const string& GetBook() const;
 
+  // Get the id of the book in the book registry
+  int GetBookId() const;
+
   // Get the quantity
   long GetQuantity() const;
 
@@ -50,22 +68,33 @@ public:
   Side GetSide() const;
 
 private:
-  T product;
+  const T* product = nullptr; // owned by the product registry
   string tradeId;
+  SequenceId executionId;
   double price;
-  string book;
+  int bookId = -1; // interned when the trade is made
   long quantity;
   Side side;
 
+  COPY_COUNTED(Trade<T>)
 };
 
 template<typename T>
 Trade<T>::Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side) :
-  product(_product)
+  product(&_product), tradeId(move(_tradeId))
 {
-  tradeId = _tradeId;
   price = _price;
-  book = _book;
+  bookId = BookRegistry::GetInstance().Intern(_book);
+  quantity = _quantity;
+  side = _side;
+}
+
+template<typename T>
+Trade<T>::Trade(const T &_product, SequenceId _executionId, double _price, int _bookId, long _quantity, Side _side) :
+  product(&_product), executionId(_executionId)
+{
+  price = _price;
+  bookId = _bookId;
   quantity = _quantity;
   side = _side;
 }
@@ -73,13 +102,20 @@ Trade<T>::Trade(const T &_product, string _tradeId, double _price, string _book,
 template<typename T>
 const T& Trade<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
-const string& Trade<T>::GetTradeId() const
+string Trade<T>::GetTradeId() const
 {
-  return tradeId;
+  if (!executionId.IsValid()) return tradeId;
+  return "TRADE-EXECUTE-" + executionId.ToString();
+}
+
+template<typename T>
+SequenceId Trade<T>::GetExecutionId() const
+{
+  return executionId;
 }
 
 template<typename T>
@@ -91,7 +127,14 @@ double Trade<T>::GetPrice() const
 template<typename T>
 const string& Trade<T>::GetBook() const
 {
-  return book;
+  static const string noBook;
+  return bookId < 0 ? noBook : BookRegistry::GetInstance().GetName(bookId);
+}
+
+template<typename T>
+int Trade<T>::GetBookId() const
+{
+  return bookId;
 }
 
 template<typename T>
@@ -115,11 +158,14 @@ class ExecutionListener;
 
 /**
  * Trade Booking Service to book trades to a particular book.
- * Keyed on trade id.
+ * Trades come from the trade feed and from executions, possibly on different threads,
+ * so they are booked one at a time, listeners included.
+ * Keyed on trade id. The trades of the feed are kept by trade ID, and the trades of the
+ * executions by the 64 bits of their order ID, so that booking one builds no key string.
  * Type T is the product type.
  */
 template<typename T>
-class TradeBookingService : public Service<string, Trade <T> >
+class TradeBookingService : public Service<string_view, Trade <T> >
 {
 
 public:
@@ -128,10 +174,10 @@ public:
 	TradeBookingService();
 
 	// Get data on our service given a key
-	Trade<T>& GetData(string _key);
+	Trade<T>& GetData(string_view _key);
 
 	// The callback that a Connector should invoke for any new or updated data
-	void OnMessage(Trade<T>& _data);
+	void OnMessage(Trade<T>&& _data);
 
 	// Add a listener to the Service for callbacks on add, remove, and update events for data to the Service
 	void AddListener(ServiceListener<Trade<T>>* _listener);
@@ -146,7 +192,10 @@ public:
 	TradeBookingConnector<T>* GetConnector();
 
 	// add the trade
-	void AddTrade(Trade<T>& trade);
+	void AddTrade(const Trade<T>& trade);
+
+	// Book the trade of an execution, return the stored trade
+	const Trade<T>& BookExecution(const ExecutionOrder<T>& _executionOrder);
 
 	// Dtor
 	~TradeBookingService();
@@ -154,21 +203,25 @@ public:
 
 private:
 
-	unordered_map<string, Trade<T>> trades;
+	map<string, Trade<T>, less<>> trades; // looked up by string_view
+	map<uint64_t, Trade<T>> executionTrades; // by the value of the order ID
 	vector<ServiceListener<Trade<T>>*> listeners;
 	TradeBookingConnector<T>* connector;
 	ExecutionListener<T>* listener;
-
+	mutex sequencer; // books one trade at a time, whichever feed it comes from
+	long num; // decide the book traded
+	int executionBookIds[3] = { -1, -1, -1 }; // of TRSY1, TRSY2 and TRSY3, interned when first booked
 
 };
 
 template<typename T>
 TradeBookingService<T>::TradeBookingService()
 {
-	trades = unordered_map<string, Trade<T>>();
+	trades = map<string, Trade<T>, less<>>();
 	listeners = vector<ServiceListener<Trade<T>>*>();
 	connector = new TradeBookingConnector<T>(this);
 	listener = new ExecutionListener<T>(this);
+	num = 0;
 }
 
 template<typename T>
@@ -178,18 +231,41 @@ TradeBookingService<T>::~TradeBookingService() {
 }
 
 template<typename T>
-Trade<T>& TradeBookingService<T>::GetData(string _key)
+Trade<T>& TradeBookingService<T>::GetData(string_view _key)
 {
-	return trades[_key];
+	// the trade of an execution is found by its order ID
+	const string_view executionPrefix = "TRADE-EXECUTE-";
+	if (_key.substr(0, executionPrefix.size()) == executionPrefix)
+	{
+		SequenceId executionId = SequenceId::Parse(_key.substr(executionPrefix.size()));
+		auto execution = executionTrades.find(executionId.GetValue());
+		if (executionId.IsValid() && execution != executionTrades.end()) return execution->second;
+	}
+
+	auto found = trades.find(_key);
+	if (found == trades.end()) found = trades.emplace(string(_key), Trade<T>()).first;
+	return found->second;
 }
 
 template<typename T>
-void TradeBookingService<T>::OnMessage(Trade<T>& _data)
+void TradeBookingService<T>::OnMessage(Trade<T>&& _data)
 {
-	trades[_data.GetTradeId()] = _data;
+	INSTRUMENT_HOP("TradeBookingService::OnMessage");
+	lock_guard<mutex> guard(sequencer);
+	Trade<T>* trade;
+	if (_data.GetExecutionId().IsValid())
+	{
+		trade = &executionTrades[_data.GetExecutionId().GetValue()];
+		*trade = move(_data);
+	}
+	else
+	{
+		trade = &trades[_data.GetTradeId()];
+		*trade = move(_data);
+	}
 
 	// invoke all the listeners
-	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(_data); });
+	for_each(listeners.begin(), listeners.end(), [&](auto& l) {l->ProcessAdd(*trade); });
 }
 
 template<typename T>
@@ -217,9 +293,38 @@ TradeBookingConnector<T>* TradeBookingService<T>::GetConnector()
 }
 
 template<typename T>
-void TradeBookingService<T>::AddTrade(Trade<T> &trade)
+void TradeBookingService<T>::AddTrade(const Trade<T>& trade)
 {
-	this->OnMessage(trade);
+	this->OnMessage(Trade<T>(trade));
+}
+
+template<typename T>
+const Trade<T>& TradeBookingService<T>::BookExecution(const ExecutionOrder<T>& _executionOrder)
+{
+	INSTRUMENT_HOP("TradeBookingService::BookExecution");
+	const T& product = _executionOrder.GetProduct();
+	PricingSide pricingSide = _executionOrder.GetPricingSide();
+	double price = _executionOrder.GetPrice();
+	long visibleQuantity = _executionOrder.GetVisibleQuantity();
+	long hiddenQuantity = _executionOrder.GetHiddenQuantity();
+	long quantity = visibleQuantity + hiddenQuantity; // Market orders
+
+	Side side;
+	if (pricingSide == BID) side = BUY;
+	if (pricingSide == OFFER) side = SELL;
+
+	// the books are interned as they are first booked, so that they keep the order they are seen in
+	const char* books[] = { "TRSY1", "TRSY2", "TRSY3" };
+	int& bookId = executionBookIds[num % 3];
+	if (bookId < 0) bookId = BookRegistry::GetInstance().Intern(books[num % 3]);
+
+	Trade<T> trade(product, _executionOrder.GetOrderId(), price, bookId, quantity, side);
+	this->AddTrade(trade);
+	this->OnMessage(move(trade));
+
+	// the trades feed may be booking on another thread
+	lock_guard<mutex> guard(sequencer);
+	return executionTrades.find(_executionOrder.GetOrderId().GetValue())->second;
 }
 
 
@@ -240,10 +345,13 @@ public:
 	TradeBookingConnector(TradeBookingService<T>* _service);
 
 	// Publish data to the Connector
-	void Publish(Trade<T>& _data);
+	void Publish(const Trade<T>& _data);
 
 	// Subscribe data from the Connector
-	void Subscribe(ifstream& _data);
+	void Subscribe(istream& _data);
+
+	// Subscribe the messages of the binary frames of a socket
+	void SubscribeWire(WireReader& _reader);
 
 };
 
@@ -254,37 +362,45 @@ TradeBookingConnector<T>::TradeBookingConnector(TradeBookingService<T>* _service
 }
 
 template<typename T>
-void TradeBookingConnector<T>::Publish(Trade<T>& _data) {}
+void TradeBookingConnector<T>::Publish(const Trade<T>& _data) {}
 
 template<typename T>
-void TradeBookingConnector<T>::Subscribe(ifstream& _data)
+void TradeBookingConnector<T>::Subscribe(istream& _data)
 {
-	string line;
-	while (getline(_data, line))
+	// tokenize each line in place, reusing the id strings from one trade to the next
+	LineReader reader(_data);
+	string_view line;
+	string tradeId;
+	string book;
+	while (reader.Next(line))
 	{
-		stringstream tradeInfo(line);
-		vector<string> tradeData;
-		string p;
-		
-		while (getline(tradeInfo, p, ','))
-		{
-			tradeData.push_back(p);
-		}
-
-		string productId = tradeData[0];
-		T product = GetProductType(productId);
-		string tradeId = tradeData[1];
-		double price = GetNormalPrice(tradeData[2]);
-		string book = tradeData[3];
-		long quantity = stol(tradeData[4]);
-		
-		
-		Side side;
-		if (tradeData[5] == "BUY") side = BUY;
-		if (tradeData[5] == "SELL") side = SELL;
+		INSTRUMENT_ORIGIN();
+		const T& product = GetProductType(NextField(line));
+		tradeId.assign(NextField(line));
+		double price = GetNormalPrice(NextField(line));
+		book.assign(NextField(line));
+		long quantity = ParseQuantity(NextField(line));
+		Side side = (NextField(line) == "SELL") ? SELL : BUY;
 		Trade<T> trade(product, tradeId, price, book, quantity, side);
 
-		service->OnMessage(trade);
+		service->OnMessage(move(trade));
+	}
+}
+
+template<typename T>
+void TradeBookingConnector<T>::SubscribeWire(WireReader& _reader)
+{
+	const WireHeader* message;
+	while (_reader.Next(message))
+	{
+		INSTRUMENT_ORIGIN();
+		const T* product = GetWireProduct<T>(*message);
+		if (message->type != WIRE_TRADE || !product) continue;
+
+		const WireTrade& trade = GetWireMessage<WireTrade>(*message);
+		Trade<T> newTrade(*product, string(GetWireId(trade.tradeId)), ToPrice(trade.price), string(GetWireId(trade.book)),
+			static_cast<long>(trade.quantity), static_cast<Side>(trade.side));
+		service->OnMessage(move(newTrade));
 	}
 }
 
@@ -299,7 +415,6 @@ class ExecutionListener : public ServiceListener<ExecutionOrder<T>>
 private:
 
 	TradeBookingService<T>* service;
-	long num; // decide the book traded
 
 public:
 
@@ -307,13 +422,13 @@ public:
 	ExecutionListener(TradeBookingService<T>* _service);
 
 	// Listener callback to process an add event to the Service
-	void ProcessAdd(ExecutionOrder<T>& _data);
+	void ProcessAdd(const ExecutionOrder<T>& _data);
 
 	// Listener callback to process a remove event to the Service
-	void ProcessRemove(ExecutionOrder<T>& _data);
+	void ProcessRemove(const ExecutionOrder<T>& _data);
 
 	// Listener callback to process an update event to the Service
-	void ProcessUpdate(ExecutionOrder<T>& _data);
+	void ProcessUpdate(const ExecutionOrder<T>& _data);
 
 };
 
@@ -321,40 +436,57 @@ template<typename T>
 ExecutionListener<T>::ExecutionListener(TradeBookingService<T>* _service)
 {
 	service = _service;
-	num = 0;
 }
 
 template<typename T>
-void ExecutionListener<T>::ProcessAdd(ExecutionOrder<T>& _data)
+void ExecutionListener<T>::ProcessAdd(const ExecutionOrder<T>& _data)
 {
-	T product = _data.GetProduct();
-	PricingSide pricingSide = _data.GetPricingSide();
-	string tradeId = "TRADE-EXECUTE-" + _data.GetOrderId();
-	double price = _data.GetPrice();
-	long visibleQuantity = _data.GetVisibleQuantity();
-	long hiddenQuantity = _data.GetHiddenQuantity();
-	long quantity = visibleQuantity + hiddenQuantity; // Market orders
+	service->BookExecution(_data);
+}
 
-	Side side;
-	if (pricingSide == BID) side = BUY;
-	if (pricingSide == OFFER) side = SELL;
+template<typename T>
+void ExecutionListener<T>::ProcessRemove(const ExecutionOrder<T>& _data) {}
 
-	
-	string book;
-	if (num % 3 == 0) book = "TRSY1";
-	if (num % 3 == 1) book = "TRSY2";
-	if (num % 3 == 2) book = "TRSY3";
+template<typename T>
+void ExecutionListener<T>::ProcessUpdate(const ExecutionOrder<T>& _data) {}
 
 
-	Trade<T> trade(product, tradeId, price, book, quantity, side);
-	service->OnMessage(trade);
-	service->AddTrade(trade);
-}
+/**
+* Stage of a Pipeline booking the executions, wired at compile time in place of ExecutionListener.
+* Type T is the product type.
+*/
+template<typename T>
+class TradeBookingStage
+{
+
+private:
+
+	TradeBookingService<T>* service;
+
+public:
+
+	typedef ExecutionOrder<T> InputType;
+
+	// Ctor
+	TradeBookingStage(TradeBookingService<T>* _service);
+
+	// Book the trade of an execution, passing on the trade
+	template<typename Next>
+	void Process(const ExecutionOrder<T>& _data, Next& _next);
+
+};
 
 template<typename T>
-void ExecutionListener<T>::ProcessRemove(ExecutionOrder<T>& _data) {}
+TradeBookingStage<T>::TradeBookingStage(TradeBookingService<T>* _service)
+{
+	service = _service;
+}
 
 template<typename T>
-void ExecutionListener<T>::ProcessUpdate(ExecutionOrder<T>& _data) {}
+template<typename Next>
+void TradeBookingStage<T>::Process(const ExecutionOrder<T>& _data, Next& _next)
+{
+	_next(service->BookExecution(_data));
+}
 
 #endif
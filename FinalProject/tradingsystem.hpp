@@ -0,0 +1,159 @@
+/**
+ * tradingsystem.hpp
+ * Defines the trading system run by main: the services, the historical data
+ * services persisting them and the listeners and pipelines wiring them together.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef TRADING_SYSTEM_HPP
+#define TRADING_SYSTEM_HPP
+
+#include "soa.hpp"
+#include "products.hpp"
+#include "algoexecutionservice.hpp"
+#include "algostreamingservice.hpp"
+#include "bondexecutionservice.hpp"
+#include "guiservice.hpp"
+#include "historicaldataservice.hpp"
+#include "asynclistener.hpp"
+#include "pipeline.hpp"
+#include "inquiryservice.hpp"
+#include "marketdataservice.hpp"
+#include "positionservice.hpp"
+#include "pricingservice.hpp"
+#include "riskservice.hpp"
+#include "bondstreamingservice.hpp"
+#include "tradebookingservice.hpp"
+
+using namespace std;
+
+/**
+ * Trading system on bonds, the graph of services fed by the connectors of the
+ * pricing, trade booking, inquiry and market data services.
+ * The services are created first and wired by AddListeners(), so that listeners
+ * which must see the data first, such as the wire latency listeners, can be added
+ * to the services in between.
+ * The members are public, as the feeds and the reports reach into the services.
+ */
+class TradingSystem
+{
+
+public:
+
+	// ctor creating the services, not wired yet
+	TradingSystem();
+
+	// Add the listeners and pipelines to the services, conflating the published streams if asked,
+	// the sector risk is persisted unless it is merged with the risk of other systems
+	void AddListeners(bool _conflateStreams = false, bool _persistSectorRisk = true);
+
+	// Wait until the historical data services have been handed every event, called once the feeds have ended
+	void Flush();
+
+	// the services
+	pricingService<Bond> pricingservice;
+	TradeBookingService<Bond> tradeBookingService;
+	PositionService<Bond> positionService;
+	RiskService<Bond> riskService;
+	marketDataService<Bond> marketdataservice;
+	AlgoExecutionService<Bond> algoExecutionService;
+	AlgoStreamingService<Bond> algoStreamingService;
+	GUIService<Bond> guiService;
+	ExecutionService<Bond> executionService;
+	StreamingService<Bond> streamingService;
+	InquiryService<Bond> inquiryService;
+
+	// The inquiries are quoted on the live mid of their product
+	MidPriceQuoter<Bond> inquiryQuoter;
+
+	// the historical services recording the infomation
+	HistoricalDataService<Position<Bond>> historicalPositionService;
+	HistoricalDataService<PV01<Bond>> historicalRiskService;
+	HistoricalDataService<PV01<BucketedSector<Bond>>> historicalSectorRiskService;
+	HistoricalDataService<ExecutionOrder<Bond>> historicalExecutionService;
+	HistoricalDataService<PriceStream<Bond>> historicalStreamingService;
+	HistoricalDataService<Inquiry<Bond>> historicalInquiryService;
+
+	// The historical services persist on threads of their own, so that writing
+	// the files does not hold up the services feeding them
+	AsyncListener<Position<Bond>> historicalPositionListener;
+	AsyncListener<PV01<Bond>> historicalRiskListener;
+	AsyncListener<PV01<BucketedSector<Bond>>> historicalSectorRiskListener;
+	AsyncListener<ExecutionOrder<Bond>> historicalExecutionListener;
+	AsyncListener<PriceStream<Bond>> historicalStreamingListener;
+	AsyncListener<Inquiry<Bond>> historicalInquiryListener;
+
+	// The fixed paths are wired at compile time, each stage calling the next one directly,
+	// the services along the way still notify the listeners added to them.
+	// Trades are booked from the trades feed as well as from the executions,
+	// so the positions are kept by a pipeline of their own listening to the trade booking
+	Pipeline<AlgoStreamingStage<Bond>, StreamingStage<Bond>> streamingPipeline;
+
+	// When conflating, the streams are published on a thread of their own, so that a slow
+	// listener does not hold up the prices: when the publisher falls behind, only the latest
+	// stream of each product is kept for it, while the algo still updates on every price
+	AsyncListener<PriceStream<Bond>> conflatingStreamingListener;
+	Pipeline<AlgoStreamingStage<Bond>, ListenerStage<PriceStream<Bond>>> conflatingStreamingPipeline;
+	Pipeline<AlgoExecutionStage<Bond>, ExecutionStage<Bond>, TradeBookingStage<Bond>> executionPipeline;
+	Pipeline<PositionStage<Bond>, RiskStage<Bond>> positionPipeline;
+
+private:
+
+	TradingSystem(const TradingSystem&) = delete;
+	TradingSystem& operator=(const TradingSystem&) = delete;
+
+};
+
+TradingSystem::TradingSystem() :
+	historicalPositionService(POSITION),
+	historicalRiskService(RISK),
+	historicalSectorRiskService(RISK),
+	historicalExecutionService(EXECUTION),
+	historicalStreamingService(STREAMING),
+	historicalInquiryService(INQUIRY),
+	historicalPositionListener(historicalPositionService.GetListener()),
+	historicalRiskListener(historicalRiskService.GetListener()),
+	historicalSectorRiskListener(historicalSectorRiskService.GetListener()),
+	historicalExecutionListener(historicalExecutionService.GetListener()),
+	historicalStreamingListener(historicalStreamingService.GetListener()),
+	historicalInquiryListener(historicalInquiryService.GetListener()),
+	streamingPipeline(AlgoStreamingStage<Bond>(&algoStreamingService), StreamingStage<Bond>(&streamingService)),
+	conflatingStreamingListener(streamingService.GetListener(), CONFLATE),
+	conflatingStreamingPipeline(AlgoStreamingStage<Bond>(&algoStreamingService),
+		ListenerStage<PriceStream<Bond>>(&conflatingStreamingListener)),
+	executionPipeline(AlgoExecutionStage<Bond>(&algoExecutionService), ExecutionStage<Bond>(&executionService),
+		TradeBookingStage<Bond>(&tradeBookingService)),
+	positionPipeline(PositionStage<Bond>(&positionService), RiskStage<Bond>(&riskService))
+{
+	inquiryService.SetQuoter(&inquiryQuoter);
+}
+
+void TradingSystem::AddListeners(bool _conflateStreams, bool _persistSectorRisk)
+{
+	if (_conflateStreams) pricingservice.AddListener(&conflatingStreamingPipeline);
+	else pricingservice.AddListener(&streamingPipeline);
+	pricingservice.AddListener(guiService.GetListener());
+	pricingservice.AddListener(riskService.GetPricingListener());
+	pricingservice.AddListener(&inquiryQuoter);
+	streamingService.AddListener(&historicalStreamingListener);
+	marketdataservice.AddListener(&executionPipeline);
+	executionService.AddListener(&historicalExecutionListener);
+	tradeBookingService.AddListener(&positionPipeline);
+	positionService.AddListener(&historicalPositionListener);
+	riskService.AddListener(&historicalRiskListener);
+	if (_persistSectorRisk) riskService.AddSectorListener(&historicalSectorRiskListener);
+	inquiryService.AddListener(&historicalInquiryListener);
+}
+
+void TradingSystem::Flush()
+{
+	conflatingStreamingListener.Flush();
+	historicalPositionListener.Flush();
+	historicalRiskListener.Flush();
+	historicalSectorRiskListener.Flush();
+	historicalExecutionListener.Flush();
+	historicalStreamingListener.Flush();
+	historicalInquiryListener.Flush();
+}
+
+#endif
@@ -0,0 +1,547 @@
+/**
+ * wireprotocol.hpp
+ * Defines the compact binary messages sent in the binary frames of the socket
+ * connectors, their encoder and the reader decoding them in place.
+ *
+ * @author Chaofan Shen
+ */
+#ifndef WIRE_PROTOCOL_HPP
+#define WIRE_PROTOCOL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "soa.hpp"
+#include "linereader.hpp"
+#include "socketconnector.hpp"
+
+using namespace std;
+
+// Type of a wire message, 3 is not used
+enum WireMessageType { WIRE_PRICE = 1, WIRE_BOOK_SNAPSHOT, WIRE_TRADE = 4, WIRE_INQUIRY, WIRE_EXECUTION, WIRE_STREAM, WIRE_REGISTRY };
+
+// Most levels of each side of a book snapshot
+const int WIRE_MAX_LEVELS = 16;
+
+/*
+	Messages, packed and copied in host byte order, which must be little-endian.
+	Products travel as their index in the product registry, prices as ticks and
+	quantities as integers, so that the receiver never parses text.
+	Each connection starts with a registry message, out of sequence, describing the
+	products of the sender, and the receiver drops a connection whose products differ.
+	Sides are 0 for BUY or BID and 1 for SELL or OFFER, states follow InquiryState.
+*/
+
+#if defined(__BYTE_ORDER__)
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the wire messages are little-endian, copied in host byte order");
+#endif
+
+#pragma pack(push, 1)
+
+// Header of every message, sequence numbers start at 1 on each connection
+struct WireHeader
+{
+	uint16_t length; // bytes of the whole message
+	uint8_t type; // WireMessageType
+	uint8_t reserved;
+	uint32_t productIndex;
+	uint64_t sequence;
+};
+
+struct WirePrice
+{
+	WireHeader header;
+	int32_t mid;
+	int32_t spread;
+};
+
+struct WireLevel
+{
+	int32_t price;
+	int64_t quantity;
+};
+
+// Full book, the bid levels come first, the message only carries the levels in use
+struct WireBookSnapshot
+{
+	WireHeader header;
+	uint8_t bidCount;
+	uint8_t offerCount;
+	uint8_t reserved[2];
+	WireLevel levels[2 * WIRE_MAX_LEVELS];
+};
+
+struct WireTrade
+{
+	WireHeader header;
+	uint8_t side;
+	uint8_t reserved[3];
+	int32_t price;
+	int64_t quantity;
+	char tradeId[JOURNAL_ID_LENGTH];
+	char book[JOURNAL_BOOK_LENGTH];
+};
+
+struct WireInquiry
+{
+	WireHeader header;
+	uint8_t side;
+	uint8_t state;
+	uint8_t reserved[2];
+	int32_t price;
+	int64_t quantity;
+	char inquiryId[JOURNAL_ID_LENGTH];
+};
+
+// Products of the sender, its sequence number is 0 and the product index of its header unused
+struct WireRegistry
+{
+	WireHeader header;
+	uint32_t productCount;
+	uint32_t reserved;
+	uint64_t productHash; // of the CUSIPs in the order of the registry
+};
+
+#pragma pack(pop)
+
+// Longest wire message, a full book snapshot
+const size_t WIRE_MAX_MESSAGE = sizeof(WireBookSnapshot);
+
+// The executions and streams published by the trading system carry their journal record
+// after the header, so their Encode() and Decode() serve the wire as well
+static_assert(sizeof(WireHeader) + sizeof(ExecutionRecord) <= WIRE_MAX_MESSAGE, "execution message too long");
+static_assert(sizeof(WireHeader) + sizeof(StreamingRecord) <= WIRE_MAX_MESSAGE, "stream message too long");
+
+
+/*
+	Access to messages in the receive buffer
+*/
+
+// Get a message of a known type in place, the packed layout has no alignment requirement
+template<typename M>
+const M& GetWireMessage(const WireHeader& _message)
+{
+	return *reinterpret_cast<const M*>(&_message);
+}
+
+// Get the payload after the header, for the messages carrying a journal record
+const char* GetWirePayload(const WireHeader& _message)
+{
+	return reinterpret_cast<const char*>(&_message) + sizeof(WireHeader);
+}
+
+// Get a padded id in place
+template<size_t N>
+string_view GetWireId(const char (&_field)[N])
+{
+	const void* terminator = memchr(_field, '\0', N);
+	return string_view(_field, terminator ? static_cast<const char*>(terminator) - _field : N);
+}
+
+// Get the product of a message, nullptr if the index is not registered
+template<typename T>
+const T* GetWireProduct(const WireHeader& _message)
+{
+	const ProductRegistry<T>& registry = ProductRegistry<T>::GetInstance();
+	if (_message.productIndex >= registry.Size()) return nullptr;
+	return &registry.Get(static_cast<size_t>(_message.productIndex));
+}
+
+// Get the hash of the CUSIPs of the bond registry in their order, FNV-1a
+uint64_t GetWireRegistryHash()
+{
+	const ProductRegistry<Bond>& registry = GetBondRegistry();
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < registry.Size(); i++)
+	{
+		for (char c : registry.Get(i).GetProductId()) hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+		hash = (hash ^ static_cast<unsigned char>('\n')) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Check whether a registry message describes the products of the bond registry
+bool MatchesWireRegistry(const WireHeader& _message)
+{
+	if (_message.type != WIRE_REGISTRY || _message.length < sizeof(WireRegistry)) return false;
+	const WireRegistry& registry = GetWireMessage<WireRegistry>(_message);
+	return registry.productCount == GetBondRegistry().Size() && registry.productHash == GetWireRegistryHash();
+}
+
+// Step over the next message of a frame payload, nullptr at its end or on a truncated message
+const WireHeader* NextWireMessage(const char*& _position, const char* _end)
+{
+	if (_end - _position < static_cast<ptrdiff_t>(sizeof(WireHeader))) return nullptr;
+
+	const WireHeader* message = reinterpret_cast<const WireHeader*>(_position);
+	if (message->length < sizeof(WireHeader) || message->length > _end - _position) return nullptr;
+	_position += message->length;
+	return message;
+}
+
+
+/**
+ * Check of the sequence numbers of one connection.
+ * A gap is any break in the sequence, the messages missed are those skipped forward.
+ */
+class WireSequence
+{
+
+public:
+
+	// ctor expecting sequence number 1
+	WireSequence();
+
+	// Check the sequence number of the next message, false on a gap
+	bool Check(uint64_t _sequence);
+
+	// Get the number of gaps
+	unsigned long long GetGapCount() const;
+
+	// Get the number of messages skipped by the gaps
+	unsigned long long GetMissedCount() const;
+
+private:
+
+	uint64_t expected;
+	unsigned long long gaps;
+	unsigned long long missed;
+
+};
+
+WireSequence::WireSequence()
+{
+	expected = 1;
+	gaps = 0;
+	missed = 0;
+}
+
+bool WireSequence::Check(uint64_t _sequence)
+{
+	bool inSequence = (_sequence == expected);
+	if (!inSequence)
+	{
+		gaps++;
+		if (_sequence > expected) missed += _sequence - expected;
+	}
+	expected = _sequence + 1;
+	return inSequence;
+}
+
+unsigned long long WireSequence::GetGapCount() const
+{
+	return gaps;
+}
+
+unsigned long long WireSequence::GetMissedCount() const
+{
+	return missed;
+}
+
+
+/**
+ * Reader handing out the messages of the binary frames of a socket, in place in its
+ * receive buffer. A message is only valid until the next call to Next().
+ * Text frames are skipped. The connection is rejected and closed unless its first
+ * message is a registry message matching the bond registry.
+ */
+class WireReader
+{
+
+public:
+
+	// ctor
+	WireReader(SocketStreamBuf& _socket);
+
+	// Get the next message, return false at the end of the stream or once the connection is rejected
+	bool Next(const WireHeader*& _message);
+
+	// Check whether the connection was rejected for products differing from those of the bond registry
+	bool IsRejected() const;
+
+	// Check whether the frame being read has a message left, so that Next() does not wait for the socket
+	bool HasMessage() const;
+
+	// Get the number of messages read
+	unsigned long long GetMessageCount() const;
+
+	// Get the sequence check of the connection
+	const WireSequence& GetSequence() const;
+
+private:
+
+	SocketStreamBuf& socket;
+	const char* position;
+	const char* end;
+	unsigned long long messages;
+	WireSequence sequence;
+	bool registryChecked;
+	bool rejected;
+
+};
+
+WireReader::WireReader(SocketStreamBuf& _socket) : socket(_socket)
+{
+	position = nullptr;
+	end = nullptr;
+	messages = 0;
+	registryChecked = false;
+	rejected = false;
+}
+
+bool WireReader::Next(const WireHeader*& _message)
+{
+	while (!rejected)
+	{
+		const WireHeader* message = NextWireMessage(position, end);
+		if (message && !registryChecked)
+		{
+			// the index of a product only means the same product with the same registry
+			registryChecked = true;
+			rejected = !MatchesWireRegistry(*message);
+			if (rejected) socket.Close();
+			continue;
+		}
+		if (message)
+		{
+			messages++;
+			sequence.Check(message->sequence);
+			_message = message;
+			return true;
+		}
+
+		FrameHeader header;
+		const char* payload;
+		do
+		{
+			if (!socket.NextFrame(header, payload)) return false;
+		} while (header.format != BINARY_FRAME);
+		position = payload;
+		end = payload + header.length;
+	}
+	return false;
+}
+
+bool WireReader::IsRejected() const
+{
+	return rejected;
+}
+
+bool WireReader::HasMessage() const
+{
+	return end - position >= static_cast<ptrdiff_t>(sizeof(WireHeader));
+}
+
+unsigned long long WireReader::GetMessageCount() const
+{
+	return messages;
+}
+
+const WireSequence& WireReader::GetSequence() const
+{
+	return sequence;
+}
+
+
+/**
+ * Encoder of the messages of one connection, numbering them in sequence.
+ * Lines of the input files are parsed once here, on the publisher side; market data
+ * lines are gathered into a snapshot of every 10 lines, as the market data connector
+ * reads them.
+ */
+class WireEncoder
+{
+
+public:
+
+	// ctor
+	WireEncoder();
+
+	// Encode a line of an input file into a buffer of WIRE_MAX_MESSAGE bytes, return the
+	// length of the message, or 0 if the line does not complete one or is not valid
+	size_t EncodeLine(WireMessageType _type, string_view _line, char* _buffer);
+
+	// Encode a published data type carrying its journal record, return the length of the message
+	template<typename V>
+	size_t EncodeRecord(WireMessageType _type, const V& _data, char* _buffer);
+
+	// Encode the registry message starting a connection, out of sequence, return the length of the message
+	size_t EncodeRegistry(char* _buffer) const;
+
+	// Get the sequence number of the last message
+	uint64_t GetSequence() const;
+
+private:
+
+	// Fill the header of the next message
+	void SetHeader(WireHeader& _header, WireMessageType _type, size_t _length, uint32_t _productIndex);
+
+	size_t EncodePrice(string_view _line, char* _buffer);
+	size_t EncodeTrade(string_view _line, char* _buffer);
+	size_t EncodeInquiry(string_view _line, char* _buffer);
+	size_t EncodeBookLine(string_view _line, char* _buffer);
+
+	uint64_t sequence;
+	WireLevel bids[WIRE_MAX_LEVELS];
+	WireLevel offers[WIRE_MAX_LEVELS];
+	int bidCount;
+	int offerCount;
+	int bookLines;
+
+};
+
+WireEncoder::WireEncoder()
+{
+	sequence = 0;
+	bidCount = 0;
+	offerCount = 0;
+	bookLines = 0;
+}
+
+size_t WireEncoder::EncodeLine(WireMessageType _type, string_view _line, char* _buffer)
+{
+	switch (_type) {
+	case WIRE_PRICE: return EncodePrice(_line, _buffer);
+	case WIRE_TRADE: return EncodeTrade(_line, _buffer);
+	case WIRE_INQUIRY: return EncodeInquiry(_line, _buffer);
+	case WIRE_BOOK_SNAPSHOT: return EncodeBookLine(_line, _buffer);
+	default: return 0;
+	}
+}
+
+template<typename V>
+size_t WireEncoder::EncodeRecord(WireMessageType _type, const V& _data, char* _buffer)
+{
+	size_t length = sizeof(WireHeader) + _data.Encode(ToEpochNanoseconds(GetTimestamp()), _buffer + sizeof(WireHeader));
+	WireHeader header;
+	SetHeader(header, _type, length, static_cast<uint32_t>(_data.GetProduct().GetProductIndex()));
+	memcpy(_buffer, &header, sizeof(header));
+	return length;
+}
+
+size_t WireEncoder::EncodeRegistry(char* _buffer) const
+{
+	WireRegistry message;
+	message.header.length = static_cast<uint16_t>(sizeof(message));
+	message.header.type = static_cast<uint8_t>(WIRE_REGISTRY);
+	message.header.reserved = 0;
+	message.header.productIndex = 0;
+	message.header.sequence = 0;
+	message.productCount = static_cast<uint32_t>(GetBondRegistry().Size());
+	message.reserved = 0;
+	message.productHash = GetWireRegistryHash();
+	memcpy(_buffer, &message, sizeof(message));
+	return sizeof(message);
+}
+
+uint64_t WireEncoder::GetSequence() const
+{
+	return sequence;
+}
+
+void WireEncoder::SetHeader(WireHeader& _header, WireMessageType _type, size_t _length, uint32_t _productIndex)
+{
+	_header.length = static_cast<uint16_t>(_length);
+	_header.type = static_cast<uint8_t>(_type);
+	_header.reserved = 0;
+	_header.productIndex = _productIndex;
+	_header.sequence = ++sequence;
+}
+
+size_t WireEncoder::EncodePrice(string_view _line, char* _buffer)
+{
+	// CUSIP,mid,spread
+	const Bond* product = GetBondRegistry().Find(NextField(_line));
+	if (!product) return 0;
+
+	WirePrice message;
+	SetHeader(message.header, WIRE_PRICE, sizeof(message), static_cast<uint32_t>(product->GetProductIndex()));
+	message.mid = static_cast<int32_t>(ParseTicksChecked(NextField(_line)));
+	message.spread = static_cast<int32_t>(ParseTicksChecked(NextField(_line)));
+	memcpy(_buffer, &message, sizeof(message));
+	return sizeof(message);
+}
+
+size_t WireEncoder::EncodeTrade(string_view _line, char* _buffer)
+{
+	// CUSIP,trade id,price,book,quantity,BUY or SELL
+	const Bond* product = GetBondRegistry().Find(NextField(_line));
+	if (!product) return 0;
+
+	WireTrade message;
+	SetHeader(message.header, WIRE_TRADE, sizeof(message), static_cast<uint32_t>(product->GetProductIndex()));
+	SetJournalId(message.tradeId, NextField(_line));
+	message.price = static_cast<int32_t>(ParseTicksChecked(NextField(_line)));
+	SetJournalId(message.book, NextField(_line));
+	message.quantity = ParseQuantity(NextField(_line));
+	message.side = (NextField(_line) == "SELL") ? 1 : 0;
+	memset(message.reserved, 0, sizeof(message.reserved));
+	memcpy(_buffer, &message, sizeof(message));
+	return sizeof(message);
+}
+
+size_t WireEncoder::EncodeInquiry(string_view _line, char* _buffer)
+{
+	// inquiry id,CUSIP,BUY or SELL,quantity,price,state
+	static const char* const states[] = { "RECEIVED", "QUOTED", "DONE", "REJECTED", "CUSTOMER_REJECTED" };
+
+	string_view inquiryId = NextField(_line);
+	const Bond* product = GetBondRegistry().Find(NextField(_line));
+	if (!product) return 0;
+
+	WireInquiry message;
+	SetHeader(message.header, WIRE_INQUIRY, sizeof(message), static_cast<uint32_t>(product->GetProductIndex()));
+	SetJournalId(message.inquiryId, inquiryId);
+	message.side = (NextField(_line) == "SELL") ? 1 : 0;
+	message.quantity = ParseQuantity(NextField(_line));
+	message.price = static_cast<int32_t>(ParseTicksChecked(NextField(_line)));
+	string_view state = NextField(_line);
+	message.state = 0;
+	for (uint8_t i = 0; i < 5; i++)
+	{
+		if (state == states[i]) message.state = i;
+	}
+	memset(message.reserved, 0, sizeof(message.reserved));
+	memcpy(_buffer, &message, sizeof(message));
+	return sizeof(message);
+}
+
+size_t WireEncoder::EncodeBookLine(string_view _line, char* _buffer)
+{
+	// CUSIP,price,quantity,BID or OFFER
+	string_view cusip = NextField(_line);
+	WireLevel level;
+	level.price = static_cast<int32_t>(ParseTicksChecked(NextField(_line)));
+	level.quantity = ParseQuantity(NextField(_line));
+	string_view side = NextField(_line);
+	if (side == "BID" && bidCount < WIRE_MAX_LEVELS) bids[bidCount++] = level;
+	else if (side == "OFFER" && offerCount < WIRE_MAX_LEVELS) offers[offerCount++] = level;
+
+	if (++bookLines < 10) return 0;
+	bookLines = 0;
+
+	const Bond* product = GetBondRegistry().Find(cusip);
+	if (!product)
+	{
+		bidCount = 0;
+		offerCount = 0;
+		return 0;
+	}
+
+	WireBookSnapshot message;
+	size_t length = sizeof(WireBookSnapshot) - sizeof(message.levels) + (bidCount + offerCount) * sizeof(WireLevel);
+	SetHeader(message.header, WIRE_BOOK_SNAPSHOT, length, static_cast<uint32_t>(product->GetProductIndex()));
+	message.bidCount = static_cast<uint8_t>(bidCount);
+	message.offerCount = static_cast<uint8_t>(offerCount);
+	memset(message.reserved, 0, sizeof(message.reserved));
+	memcpy(message.levels, bids, bidCount * sizeof(WireLevel));
+	memcpy(message.levels + bidCount, offers, offerCount * sizeof(WireLevel));
+	memcpy(_buffer, &message, length);
+
+	bidCount = 0;
+	offerCount = 0;
+	return length;
+}
+
+#endif
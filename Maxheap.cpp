@@ -1,70 +1,32 @@
 // Chaofan Shen 22/11/2022
 #include <iostream>
+#include "FinalProject/daryheap.hpp"
 
+// Max heap, now the binary case of the d-ary heap of the trading system,
+// which stores the values themselves rather than pointers to the arguments of add()
 template <typename T>
 class MaxHeap
 {
 private:
-	T** arr;
-	int n;
+	DaryHeap<T, 2> heap;
 
 public:
 	MaxHeap(int size)
 	{
-		arr = new T * [size];
-		n = 0;
-	}
-
-	void maxheap()
-	{
-		int k;
-		for (k = n / 2; k >= 1; k--) {
-			heapify(k, n);
-		}
-	}
-
-	void heapify(int n, int i)
-	{
-		int left = 2 * i + 1;
-		int right = 2 * i + 2;
-
-		int smallest = i;
-		if (left < n && arr[left] > arr[smallest])
-			smallest = left;
-
-		if (right < n && arr[right] > arr[smallest])
-			smallest = right;
-
-		if (smallest != i)
-		{
-			swap(*arr, i, smallest);
-			heapify(n, smallest);
-		}
+		heap.Reserve(size);
 	}
 
 	void add(T key)
 	{
-		n = n + 1;
-		arr[n - 1] = &key;
-		maxheap();
+		heap.Push(key);
 	}
 
 	T remove()
 	{
-		T* last_value = arr[n - 1];
-		T top_value = *arr[0];
-		arr[0] = last_value;
-		n = n - 1;
-		maxheap();
+		T top_value = heap.Top();
+		heap.Pop();
 		return top_value;
 	}
-
-	void swap(T* arr, int i, int j)
-	{
-		T temp = arr[i];
-		arr[i] = arr[j];
-		arr[j] = temp;
-	}
 };
 
 int main()
@@ -3,9 +3,12 @@
 
 #include <iostream>
 #include <string>
+#include "FinalProject/sorting.hpp"
 
 
-// Class for Quicksort
+// Class for Quicksort, now the introsort of the trading system: the pivot is the median of
+// three compared in place whatever T is, the smaller side is sorted first so that the stack
+// stays logarithmic, and a heapsort takes over from quicksort past a depth of 2 log2(n)
 template <typename T>
 class Quicksort
 {
@@ -14,44 +17,7 @@ public:
 	// overload () to start quick sort
 	void operator() (T* arr, const int& n)
 	{
-		quick_sort(arr, 0, n - 1);
-	}
-
-
-	void quick_sort(T* arr, const int& low, const int& high)
-	{
-		if (low < high)
-		{
-			int pivot_index = partition(arr, low, high);
-			quick_sort(arr, low, pivot_index - 1);
-			quick_sort(arr, pivot_index + 1, high);
-		}
-	}
-
-
-	int partition(T* arr, const int& low, const int& high)
-	{
-		int pivot = arr[high];
-		int i = (low - 1);
-
-		for (int j = low; j < high; j++)
-		{
-			if (arr[j] < pivot)
-			{
-				i++;
-				swap(arr, i, j);
-			}
-		}
-		swap(arr, i + 1, high);
-		return (i + 1);
-	}
-
-
-	void swap(T* arr, const int& i, const int& j)
-	{
-		T temp = arr[i];
-		arr[i] = arr[j];
-		arr[j] = temp;
+		IntroSort(arr, arr + n);
 	}
 };
 
@@ -69,6 +35,17 @@ int main()
 	{
 		std::cout << arr[i] << ", ";
 	}
+	std::cout << std::endl;
+
+	// the pivot used to be kept in an int, which truncated these
+	double prices[] = { 99.5, 99.25, 99.75, 99.125 };
+	Quicksort<double> dsort = Quicksort<double>();
+	dsort(prices, 4);
+
+	for (int i = 0; i < 4; ++i)
+	{
+		std::cout << prices[i] << ", ";
+	}
 	
 	return 0;
 }
\ No newline at end of file